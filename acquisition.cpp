@@ -0,0 +1,331 @@
+#include "acquisition.h"
+
+#include "capture_log.h"
+#include "link_supervisor.h"
+#include "numeric.h"
+#include "scpi_commands.h"
+#include "trigger.h"
+
+// SYST:ERR? queries per message while the error queue is drained, and messages at most
+const int ERRORS_PER_ROUND = 4;
+const int MAX_ERROR_ROUNDS = 4;
+
+// How often the engine looks whether a lost link is back
+const std::chrono::milliseconds LINK_CHECK_PERIOD(5);
+
+bool ParseMeasurement(const std::string& response, double& value) {
+    return ParseScpiNumber(response, value);
+}
+
+std::string FormatDeviceError(const DeviceError& error) {
+    switch (error.kind) {
+    case DeviceError::SCPI_ERROR:
+        return "SCPI error " + std::to_string(error.code) + ": " + error.message;
+    case DeviceError::STATUS_EVENT:
+        return "Status event " + std::to_string(error.code) + ": " + error.message;
+    default:
+        return "Link error: " + error.message;
+    }
+}
+
+// Names of the error bits of the standard event status register
+static std::string describeEvents(int events) {
+    static const struct {
+        int bit;
+        const char* name;
+    } names[] = {{EVENT_COMMAND_ERROR, "command error"}, {EVENT_EXECUTION_ERROR, "execution error"},
+                 {EVENT_DEVICE_ERROR, "device error"}, {EVENT_QUERY_ERROR, "query error"}};
+
+    std::string text;
+    for (const auto& name : names) {
+        if ((events & name.bit) != 0) {
+            if (!text.empty()) {
+                text += ", ";
+            }
+            text += name.name;
+        }
+    }
+    return text;
+}
+
+AcquisitionEngine::AcquisitionEngine(QueryFunction queryFunction, CommandFunction commandFunction)
+    : batch(std::move(commandFunction), std::move(queryFunction)) {
+}
+
+AcquisitionEngine::~AcquisitionEngine() {
+    Stop();
+}
+
+void AcquisitionEngine::Start(std::chrono::milliseconds period) {
+    Start(PollSchedule::Fixed(period));
+}
+
+void AcquisitionEngine::Start(const PollSchedule& schedule) {
+    Stop();
+    scheduler = PollScheduler(schedule);
+    linkFailed = false;
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        report = PollReport();
+    }
+    running = true;
+    worker = std::thread(&AcquisitionEngine::Run, this);
+}
+
+void AcquisitionEngine::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        running = false;
+    }
+    wakeCondition.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+bool AcquisitionEngine::IsRunning() const {
+    return running;
+}
+
+bool AcquisitionEngine::PostCommand(const std::string& command) {
+    if (!commands.Push(command)) {
+        return false;
+    }
+    {
+        // Taking the lock orders the push with the engine's wait, so the wakeup cannot be lost
+        std::lock_guard<std::mutex> lock(wakeMutex);
+    }
+    wakeCondition.notify_one();
+    return true;
+}
+
+void AcquisitionEngine::NotifyTransient() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        transientPending = true;
+    }
+    wakeCondition.notify_one();
+}
+
+bool AcquisitionEngine::PopSample(Sample& sample) {
+    return samples.Pop(sample);
+}
+
+bool AcquisitionEngine::PopError(DeviceError& error) {
+    return errors.Pop(error);
+}
+
+uint64_t AcquisitionEngine::DroppedSamples() const {
+    return droppedSamples;
+}
+
+PollReport AcquisitionEngine::Report() const {
+    std::lock_guard<std::mutex> lock(reportMutex);
+    return report;
+}
+
+void AcquisitionEngine::SetCaptureLog(CaptureLog* log) {
+    captureLog = log;
+}
+
+void AcquisitionEngine::SetTriggerEngine(TriggerEngine* engine) {
+    triggerEngine = engine;
+}
+
+void AcquisitionEngine::SetLinkSupervisor(LinkSupervisor* supervisor) {
+    linkSupervisor = supervisor;
+}
+
+void AcquisitionEngine::SetStatusMonitoring(bool enabled) {
+    statusMonitoring = enabled;
+}
+
+void AcquisitionEngine::SetModel(const ScpiModel& model) {
+    this->model = &model;
+}
+
+void AcquisitionEngine::pushError(DeviceError::Kind kind, int code, const std::string& message) {
+    DeviceError error;
+    error.kind = kind;
+    error.code = code;
+    error.message = message;
+    errors.Push(std::move(error));  // A full queue means the UI is not reading them anyway
+
+    std::lock_guard<std::mutex> lock(reportMutex);
+    report.deviceErrors++;
+}
+
+// The due measurements are queued into the same batch and read back in one round trip
+void AcquisitionEngine::QueuePoll(unsigned quantities, Sample& sample, bool& voltageValid, bool& currentValid) {
+    sample.hasVoltage = (quantities & (1u << POLL_VOLTAGE)) != 0;
+    sample.hasCurrent = (quantities & (1u << POLL_CURRENT)) != 0;
+    const ScpiCommandSpec* commands = model.load()->commands;
+    if (sample.hasVoltage) {
+        batch.Query(commands[SCPI_MEASURE_VOLTAGE].shortForm, [&sample, &voltageValid](bool ok, const std::string& response) {
+            voltageValid = ok && ParseMeasurement(response, sample.voltage);
+        });
+    }
+    if (sample.hasCurrent) {
+        batch.Query(commands[SCPI_MEASURE_CURRENT].shortForm, [&sample, &currentValid](bool ok, const std::string& response) {
+            currentValid = ok && ParseMeasurement(response, sample.current);
+        });
+    }
+}
+
+// The status byte rides along with the message, so checking it costs no extra round trip
+void AcquisitionEngine::QueueStatus(int& statusByte) {
+    batch.Query(model.load()->commands[SCPI_STATUS_BYTE].shortForm, [&statusByte](bool ok, const std::string& response) {
+        double value;
+        if (ok && DecodeResponse<SCPI_STATUS_BYTE>(response, value) && value >= 0.0 && value <= 255.0) {
+            statusByte = static_cast<int>(value);
+        }
+    });
+}
+
+// Reading the error queue (and the event status register, which also clears the summary bit)
+// while the status byte says there is something to read
+void AcquisitionEngine::DrainErrors(int statusByte) {
+    const ScpiCommandSpec* commands = model.load()->commands;
+    for (int round = 0; round < MAX_ERROR_ROUNDS; round++) {
+        if ((statusByte & (STATUS_ERROR_AVAILABLE | STATUS_EVENT_SUMMARY)) == 0) {
+            return;
+        }
+
+        bool queueReported = (statusByte & STATUS_ERROR_AVAILABLE) != 0;
+        if (queueReported) {
+            for (int i = 0; i < ERRORS_PER_ROUND; i++) {
+                batch.Query(commands[SCPI_NEXT_ERROR].shortForm, [this](bool ok, const std::string& response) {
+                    ScpiError error;
+                    if (ok && DecodeResponse<SCPI_NEXT_ERROR>(response, error) && error.code != 0) {
+                        pushError(DeviceError::SCPI_ERROR, error.code, error.message);
+                    }
+                });
+            }
+        }
+        if ((statusByte & STATUS_EVENT_SUMMARY) != 0) {
+            batch.Query(commands[SCPI_EVENT_STATUS].shortForm, [this, queueReported](bool ok, const std::string& response) {
+                double value;
+                if (!ok || !DecodeResponse<SCPI_EVENT_STATUS>(response, value)) {
+                    return;
+                }
+                // Errors of the queue set these bits as well; they are reported only by supplies without one
+                int events = static_cast<int>(value) & EVENT_ERRORS;
+                if (events != 0 && !queueReported) {
+                    pushError(DeviceError::STATUS_EVENT, events, describeEvents(events));
+                }
+            });
+        }
+        statusByte = 0;
+        QueueStatus(statusByte);
+        batch.Flush();
+    }
+}
+
+// Engine thread: pending commands and the due queries go out as one message, the scheduler
+// decides when the next poll is due
+void AcquisitionEngine::Run() {
+    scheduler.Reset(std::chrono::steady_clock::now());
+    bool linkDown = false;
+    while (running) {
+        LinkSupervisor* link = linkSupervisor.load();
+        if (link != nullptr && !link->Connected()) {
+            linkDown = true;
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait_for(lock, LINK_CHECK_PERIOD, [this] { return !running; });
+            continue;
+        }
+        if (linkDown) {
+            // The supply was restored to its setpoints, which is followed at full rate
+            linkDown = false;
+            scheduler.Transient(std::chrono::steady_clock::now());
+        }
+
+        std::string command;
+        while (commands.Pop(command)) {
+            if (IsTransientCommand(command)) {
+                scheduler.Transient(std::chrono::steady_clock::now());
+            }
+            batch.Command(command);
+        }
+        if (transientPending.exchange(false)) {
+            scheduler.Transient(std::chrono::steady_clock::now());
+        }
+
+        Sample sample;
+        bool voltageValid = false;
+        bool currentValid = false;
+        unsigned due = scheduler.Due(std::chrono::steady_clock::now());
+        if (due != 0) {
+            QueuePoll(due, sample, voltageValid, currentValid);
+        }
+
+        int statusByte = -1;
+        bool exchanged = batch.Pending() > 0;
+        bool statusQueued = exchanged && statusMonitoring;
+        if (statusQueued) {
+            QueueStatus(statusByte);
+        }
+
+        auto sent = std::chrono::steady_clock::now();
+        if (exchanged) {
+            bool ok = batch.Flush();
+            if (!ok && !linkFailed) {
+                pushError(DeviceError::LINK_ERROR, 0, "the supply did not accept or answer a message");
+            }
+            linkFailed = !ok;
+            // Only an exchange with queries shows whether the supply answers
+            if (link != nullptr && (due != 0 || statusQueued)) {
+                if (ok) {
+                    link->Answered();
+                } else {
+                    link->DeadlineMissed();
+                }
+            }
+        }
+
+        if (due != 0) {
+            auto received = std::chrono::steady_clock::now();
+            // The instrument took the measurement somewhere between the request and the answer
+            sample.timestamp = sent + (received - sent) / 2;
+            sample.valid = (!sample.hasVoltage || voltageValid) && (!sample.hasCurrent || currentValid);
+
+            scheduler.Completed(due, sent, received);
+            if (sample.hasVoltage) {
+                scheduler.Measured(POLL_VOLTAGE, voltageValid, sample.voltage);
+            }
+            if (sample.hasCurrent) {
+                scheduler.Measured(POLL_CURRENT, currentValid, sample.current);
+            }
+            // A trigger being recorded or about to fire gets the fastest polling
+            if (TriggerEngine* triggers = triggerEngine.load()) {
+                if (triggers->Process(sample)) {
+                    scheduler.Transient(received);
+                }
+            }
+
+            if (!samples.Push(sample)) {
+                droppedSamples++;
+            }
+            if (CaptureLog* log = captureLog.load()) {
+                log->Append(sample);
+            }
+
+            std::lock_guard<std::mutex> lock(reportMutex);
+            report.roundTrip = scheduler.RoundTrip();
+            report.periods[POLL_VOLTAGE] = scheduler.Period(POLL_VOLTAGE);
+            report.periods[POLL_CURRENT] = scheduler.Period(POLL_CURRENT);
+            report.jitter = scheduler.Jitter();
+        }
+
+        if (statusByte >= 0) {
+            {
+                std::lock_guard<std::mutex> lock(reportMutex);
+                report.statusByte = statusByte;
+            }
+            DrainErrors(statusByte);
+        }
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wakeCondition.wait_until(lock, scheduler.NextDeadline(), [this] { return !running || !commands.Empty() || transientPending; });
+    }
+}
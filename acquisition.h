@@ -0,0 +1,143 @@
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "poll_scheduler.h"
+#include "scpi_batch.h"
+#include "scpi_commands.h"
+#include "spsc_queue.h"
+
+class CaptureLog;
+class LinkSupervisor;
+class TriggerEngine;
+
+// One timestamped measurement taken by the acquisition engine
+struct Sample {
+    std::chrono::steady_clock::time_point timestamp;
+    double voltage = 0.0;
+    double current = 0.0;
+    bool hasVoltage = true;  // Quantities polled for this sample, each has its own poll rate
+    bool hasCurrent = true;
+    bool valid = false;  // false if the instrument did not answer or the answer could not be parsed
+};
+
+// Converting the instrument's answer to a number without throwing
+bool ParseMeasurement(const std::string& response, double& value);
+
+// Error found by the engine's status monitoring or by a failed exchange
+struct DeviceError {
+    enum Kind {
+        SCPI_ERROR,    // Entry of the supply's error queue (SYST:ERR?)
+        STATUS_EVENT,  // Error bits of *ESR? not explained by the error queue
+        LINK_ERROR     // A message could not be sent or was not answered
+    };
+
+    Kind kind = SCPI_ERROR;
+    int code = 0;  // SCPI error number, or the *ESR? bits
+    std::string message;
+};
+
+// Text for the panel and the log, e.g. "SCPI error -113: Undefined header"
+std::string FormatDeviceError(const DeviceError& error);
+
+// State of the poll scheduler, for display
+struct PollReport {
+    std::chrono::microseconds roundTrip{0};
+    std::chrono::microseconds periods[POLL_QUANTITY_COUNT] = {};
+    RunningStatistics jitter;  // Lateness of the polls against their deadlines, in microseconds
+    int statusByte = -1;       // Last *STB? answer, -1 if not known
+    uint64_t deviceErrors = 0;
+};
+
+// Acquisition engine: polls the power supply on its own thread and hands samples to the UI.
+// While the engine is running it is the only user of the port; other commands are
+// passed to it with PostCommand and sent between polls.
+// Every message also asks for the status byte (*STB?) in the same round trip; only when it
+// reports errors or events is the error queue drained, and the errors are handed to the UI
+// like the samples.
+class AcquisitionEngine {
+public:
+    typedef ScpiBatch::QueryFunction QueryFunction;
+    typedef ScpiBatch::CommandFunction CommandFunction;
+
+    AcquisitionEngine(QueryFunction queryFunction, CommandFunction commandFunction);
+    ~AcquisitionEngine();
+
+    AcquisitionEngine(const AcquisitionEngine&) = delete;
+    AcquisitionEngine& operator=(const AcquisitionEngine&) = delete;
+
+    // Polling every quantity at a fixed period
+    void Start(std::chrono::milliseconds period);
+    // Adaptive polling: fast during transients and output changes, slower while the readings are stable
+    void Start(const PollSchedule& schedule);
+    void Stop();
+    bool IsRunning() const;
+
+    // Called from the UI thread
+    bool PostCommand(const std::string& command);
+    bool PopSample(Sample& sample);
+    bool PopError(DeviceError& error);
+    // The output was changed behind the engine's back (e.g. by the sequencer): polling at full rate
+    void NotifyTransient();
+
+    uint64_t DroppedSamples() const;
+    PollReport Report() const;
+
+    // Every sample is also appended to the capture log while it is open (nullptr: none)
+    void SetCaptureLog(CaptureLog* log);
+
+    // Every sample is also evaluated by the trigger engine (nullptr: none), which is configured
+    // while this engine is stopped; polling is at full rate while it asks for it
+    void SetTriggerEngine(TriggerEngine* engine);
+
+    // Reporting the outcome of every exchange with queries to the link supervisor (nullptr: none);
+    // while it reopens the port nothing is polled and posted commands wait
+    void SetLinkSupervisor(LinkSupervisor* supervisor);
+
+    // Asking for *STB? with every message (on by default); for supplies without a status byte
+    void SetStatusMonitoring(bool enabled);
+
+    // The connected model, whose command table gives the queries (GENERIC_SUPPLY by default)
+    void SetModel(const ScpiModel& model);
+
+private:
+    void Run();
+    void QueuePoll(unsigned quantities, Sample& sample, bool& voltageValid, bool& currentValid);
+    void QueueStatus(int& statusByte);
+    void DrainErrors(int statusByte);
+    void pushError(DeviceError::Kind kind, int code, const std::string& message);
+
+    ScpiBatch batch;  // used only by the engine thread
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<bool> transientPending{false};
+    std::atomic<bool> statusMonitoring{true};
+    bool linkFailed = false;  // Reported once until an exchange succeeds again
+    PollScheduler scheduler;  // used only by the engine thread
+
+    mutable std::mutex reportMutex;
+    PollReport report;
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+
+    SpscQueue<std::string, 64> commands;  // UI -> engine
+    SpscQueue<Sample, 4096> samples;      // engine -> UI
+    SpscQueue<DeviceError, 64> errors;    // engine -> UI
+    std::atomic<uint64_t> droppedSamples{0};
+    std::atomic<CaptureLog*> captureLog{nullptr};
+    std::atomic<TriggerEngine*> triggerEngine{nullptr};
+    std::atomic<LinkSupervisor*> linkSupervisor{nullptr};
+    std::atomic<const ScpiModel*> model{&GENERIC_SUPPLY};
+};
+
+#endif // ACQUISITION_H
@@ -0,0 +1,205 @@
+#include "baud_negotiation.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "numeric.h"
+#include "scpi.h"
+#include "serial.h"
+
+// Query that reports a lost port as false; a timeout gives an empty response
+static bool tryQuery(Transport& transport, const char* command, int timeoutMs, std::string& response) {
+    try {
+        response = query(transport, command, timeoutMs);
+        return true;
+    } catch (const std::runtime_error&) {
+        response.clear();
+        return false;
+    }
+}
+
+// Ending whatever the instrument received at the wrong rate with a terminator of its own, and
+// dropping what came back at the wrong rate
+static void resynchronize(Transport& transport, int timeoutMs) {
+    transport.WriteMessage("\n", 1);
+    char buffer[256];
+    while (transport.Read(buffer, sizeof(buffer), std::max(timeoutMs / 4, 10)) > 0) {
+    }
+    transport.DiscardInput();
+}
+
+// Reading the error queue until it is empty; false if it does not answer
+static bool clearErrors(const ScpiModel& model, Transport& transport, int timeoutMs) {
+    std::string response;
+    for (int i = 0; i < 20; i++) {
+        ScpiError error;
+        if (!tryQuery(transport, model.commands[SCPI_NEXT_ERROR].shortForm, timeoutMs, response) ||
+            !DecodeResponse<SCPI_NEXT_ERROR>(response, error)) {
+            return false;
+        }
+        if (error.code == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VerifyLink(Transport& transport, const ScpiModel& model, int roundTrips, int timeoutMs, int* goodRoundTrips) {
+    std::string response;
+    int good = 0;
+    for (int i = 0; i < roundTrips; i++) {
+        double value;
+        if (!tryQuery(transport, model.commands[SCPI_MEASURE_VOLTAGE].shortForm, timeoutMs, response) ||
+            !DecodeResponse<SCPI_MEASURE_VOLTAGE>(response, value)) {
+            break;
+        }
+        good++;
+    }
+    if (goodRoundTrips != nullptr) {
+        *goodRoundTrips = good;
+    }
+    if (good < roundTrips) {
+        return false;
+    }
+    // A command the instrument received garbled shows up as an error
+    ScpiError error;
+    return tryQuery(transport, model.commands[SCPI_NEXT_ERROR].shortForm, timeoutMs, response) &&
+           DecodeResponse<SCPI_NEXT_ERROR>(response, error) && error.code == 0;
+}
+
+static bool sendRate(Transport& transport, const ScpiModel& model, unsigned long rate) {
+    ScpiMessage message;
+    if (BuildCommand<SCPI_SERIAL_BAUD>(model, static_cast<double>(rate), message) != SCPI_BUILD_OK) {
+        return false;
+    }
+    try {
+        return sendCommand(transport, message.Text());
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+}
+
+// Bringing the instrument back from the rate it was switched to; the port ends at the old rate
+static bool fallBack(Transport& transport, const ScpiModel& model, const SerialSettings& original,
+                     const SerialSettings& trial, const BaudNegotiationOptions& options) {
+    // The command may itself be lost to line errors, so it is repeated
+    for (int retry = 0; retry < 3; retry++) {
+        if (transport.Configure(trial)) {
+            resynchronize(transport, options.timeoutMs);
+            sendRate(transport, model, original.baudRate);
+            std::this_thread::sleep_for(options.settle);
+        }
+        if (!transport.Configure(original)) {
+            return false;
+        }
+        resynchronize(transport, options.timeoutMs);
+        if (clearErrors(model, transport, options.timeoutMs) &&
+            VerifyLink(transport, model, options.verifyRoundTrips, options.timeoutMs)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+BaudNegotiationResult NegotiateBaudRate(Transport& transport, const ScpiModel& model, SerialSettings& settings,
+                                        const BaudNegotiationOptions& options) {
+    BaudNegotiationResult result;
+    result.baudRate = settings.baudRate;
+    const SerialSettings original = settings;
+    if (model.commands[SCPI_SERIAL_BAUD].shortForm == nullptr) {
+        result.status = BAUD_UNSUPPORTED;
+        return result;
+    }
+    if (!clearErrors(model, transport, options.timeoutMs) ||
+        !VerifyLink(transport, model, options.verifyRoundTrips, options.timeoutMs)) {
+        result.status = BAUD_UNRELIABLE;
+        return result;
+    }
+
+    std::vector<unsigned long> candidates = options.candidates;
+    if (candidates.empty()) {
+        candidates.assign(std::begin(STANDARD_BAUD_RATES), std::end(STANDARD_BAUD_RATES));
+    }
+    std::sort(candidates.begin(), candidates.end(), [](unsigned long a, unsigned long b) { return a > b; });
+
+    std::string response;
+    for (unsigned long rate : candidates) {
+        if (rate <= original.baudRate) {
+            break;
+        }
+        SerialSettings trial = original;
+        trial.baudRate = rate;
+
+        // The port must be able to follow before the instrument is asked to switch
+        bool portCanFollow = transport.Configure(trial);
+        if (!transport.Configure(original)) {
+            result.status = BAUD_LINK_LOST;
+            return result;
+        }
+        if (!portCanFollow) {
+            continue;
+        }
+
+        BaudAttempt attempt;
+        attempt.baudRate = rate;
+        if (!sendRate(transport, model, rate)) {
+            result.attempts.push_back(attempt);
+            continue;
+        }
+        std::this_thread::sleep_for(options.settle);
+
+        // A rate the instrument refuses leaves an error, answered at the old rate; one it takes
+        // leaves the query unanswered. This assumes that an instrument which switched does not
+        // answer at the old rate any more, so any SYST:ERR? answer that decodes counts as a refusal,
+        // 0,"No error" included: an instrument that ignores the command without queuing an error
+        // has not switched either.
+        ScpiError error;
+        if (!tryQuery(transport, model.commands[SCPI_NEXT_ERROR].shortForm, options.timeoutMs, response)) {
+            result.status = BAUD_LINK_LOST;
+            return result;
+        }
+        if (DecodeResponse<SCPI_NEXT_ERROR>(response, error)) {
+            clearErrors(model, transport, options.timeoutMs);
+            result.attempts.push_back(attempt);
+            continue;
+        }
+        attempt.accepted = true;
+
+        if (transport.Configure(trial)) {
+            resynchronize(transport, options.timeoutMs);
+            attempt.stable = clearErrors(model, transport, options.timeoutMs) &&
+                             VerifyLink(transport, model, options.verifyRoundTrips, options.timeoutMs, &attempt.roundTrips);
+        }
+        result.attempts.push_back(attempt);
+        if (attempt.stable) {
+            settings = trial;
+            result.baudRate = rate;
+            result.status = BAUD_RAISED;
+            return result;
+        }
+
+        if (!fallBack(transport, model, original, trial, options)) {
+            result.status = BAUD_LINK_LOST;
+            return result;
+        }
+    }
+    result.status = BAUD_UNCHANGED;
+    return result;
+}
+
+const char* DescribeBaudNegotiation(BaudNegotiationStatus status) {
+    switch (status) {
+    case BAUD_RAISED:
+        return "Baud rate raised";
+    case BAUD_UNCHANGED:
+        return "No higher baud rate is stable";
+    case BAUD_UNSUPPORTED:
+        return "The baud rate of this supply model cannot be changed from the panel";
+    case BAUD_UNRELIABLE:
+        return "The link is not reliable at the current baud rate, no higher one was tried";
+    default:
+        return "The supply was lost while changing the baud rate";
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef BAUD_NEGOTIATION_H
+#define BAUD_NEGOTIATION_H
+
+#include <chrono>
+#include <vector>
+
+#include "scpi_commands.h"
+#include "transport.h"
+
+struct BaudNegotiationOptions {
+    std::vector<unsigned long> candidates;  // Rates to try; empty: the standard rates above the current one
+    int verifyRoundTrips = 20;              // Queries of the burst checking a rate
+    int timeoutMs = 200;                    // For each query of the negotiation
+    std::chrono::milliseconds settle{50};   // Given to the instrument to switch its port
+};
+
+enum BaudNegotiationStatus {
+    BAUD_RAISED,       // Both ends run at a higher rate
+    BAUD_UNCHANGED,    // No higher rate was accepted and stable; the link is back at the old rate
+    BAUD_UNSUPPORTED,  // The model's command table has no SCPI_SERIAL_BAUD (any supply not recognized by FindScpiModel)
+    BAUD_UNRELIABLE,   // The link does not pass VerifyLink at the current rate, so no other rate is tried
+    BAUD_LINK_LOST     // The instrument could not be brought back to a rate the port is at
+};
+
+// One rate tried
+struct BaudAttempt {
+    unsigned long baudRate = 0;
+    bool accepted = false;  // The instrument switched to it
+    int roundTrips = 0;     // Good round trips of the burst at that rate
+    bool stable = false;
+};
+
+struct BaudNegotiationResult {
+    BaudNegotiationStatus status = BAUD_UNCHANGED;
+    unsigned long baudRate = 0;  // Rate of both ends when the negotiation returns
+    std::vector<BaudAttempt> attempts;
+};
+
+// Burst of round trips: every measurement query must be answered with a number within the timeout,
+// and the error queue must be empty afterwards. Returns the good round trips in goodRoundTrips.
+bool VerifyLink(Transport& transport, const ScpiModel& model, int roundTrips, int timeoutMs, int* goodRoundTrips = nullptr);
+
+// Moving the instrument and the transport from a working link at settings.baudRate to the highest
+// candidate rate the instrument accepts (SCPI_SERIAL_BAUD of the model) and the link passes
+// VerifyLink at, trying the highest first. A rate the instrument takes but the link fails at is
+// undone by commanding the old rate back at the new one. settings is updated to the rate the
+// transport is left at. Nothing else may use the transport meanwhile.
+BaudNegotiationResult NegotiateBaudRate(Transport& transport, const ScpiModel& model, SerialSettings& settings,
+                                        const BaudNegotiationOptions& options = BaudNegotiationOptions());
+
+// Message for the user, e.g. "No higher baud rate is stable"
+const char* DescribeBaudNegotiation(BaudNegotiationStatus status);
+
+#endif // BAUD_NEGOTIATION_H
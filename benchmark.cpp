@@ -0,0 +1,1626 @@
+/*****************************************************************************************************************
+ * Benchmarks of the communication core against simulated power supplies (Linux, pseudo-terminals or loopback).
+ *
+ * Usage: benchmark [--json <file>] [--loopback] [baud rate] [instrument latency in ms]
+ * The tables go to the console; --json also writes every result as JSON, so runs of different
+ * versions and machines can be compared by a script. All sizes and counts are fixed.
+ *
+ * Command building: cost of a validated setpoint command from the command table against string concatenation.
+ * Send path: allocations and write calls per command, one write per command against coalesced bursts.
+ * Query latency: queries per second and p50/p99 round trip at each of the panel's baud rates.
+ * State cache: commands sent and time taken by a scripted run that re-sends unchanged settings, with and without the cache.
+ * Batched polling: samples per second polling voltage and current as one message against two queries.
+ * Rack throughput: samples per second polled by one DeviceRegistry event loop against the number of devices.
+ * Coroutine client: the same with a coroutine per device on one loop thread, both queries of a sample in flight
+ * at once (only built as C++20).
+ * Poll path: time and heap allocations per sample of the response parsing and display formatting,
+ * the std::stod/std::to_string path against the std::from_chars/std::to_chars one.
+ * Time-series store: cost of adding a sample and of the sliding-window queries.
+ * Strip chart: cost of adding a sample, and of decimating the whole history or the last minute into the
+ * columns of a chart, the min/max levels against scanning every sample.
+ * Triggers: cost of evaluating level, edge, window and slew conditions per sample, and the samples kept to catch
+ * rare over-current spikes, trigger records against logging every sample.
+ * Capture log: records per second appended by a producer thread and written to the mapped file.
+ * Adaptive polling: samples taken while the output is stable and during a ramp, fixed against adaptive schedule.
+ * Status monitoring: poll rate without and with *STB? in every poll, and the errors of bad commands delivered.
+ * Block decoding: ns per value of decoding a big-endian REAL,32 block, against parsing the same values as ASCII.
+ * Array fetch: samples per second read as MEAS:VOLT? polls, as an ASCII FETC:ARR:VOLT? list and as a REAL,32 block.
+ * Baud negotiation: rate reached, time taken and poll rate before and after, against a supply that garbles
+ * responses above a rate (always over loopback, which garbles bytes read at another rate than written).
+ * Reconnect: a polled supply whose port disappears and comes back (as a supply that lost power) 0 to 500 ms later,
+ * the time until the link supervisor notices, until it has restored the setpoints, and the gap in the samples
+ * (always over loopback, where closing the instrument's end fails the client's reads like an unplugged adapter).
+ * Traffic replay: polls recorded from a simulated supply and played back without it, as fast as possible and at the
+ * recorded timing, with the trace bytes per query.
+ * Sequencer: actual against planned time of the steps of a ramp played to a simulated supply.
+ * Instrumentation: cost of tracing one exchange, and the per-command latencies recorded during the run.
+ ***************************************************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "baud_negotiation.h"
+#include "capture_log.h"
+#include "command_buffer.h"
+#include "device_state.h"
+#include "instrumentation.h"
+#include "link_supervisor.h"
+#include "numeric.h"
+#include "poll_scheduler.h"
+#include "rack.h"
+#include "scpi.h"
+#include "scpi_batch.h"
+#include "scpi_block.h"
+#include "scpi_client.h"
+#include "scpi_commands.h"
+#include "sequencer.h"
+#include "strip_chart.h"
+#include "timeseries.h"
+#include "traffic_trace.h"
+#include "trigger.h"
+#include "serial.h"
+#include "simulator.h"
+
+// Counting the heap allocations of the whole program, for the allocations per sample. All forms of
+// new and delete are replaced together, on malloc and free; new is kept out of line, so the compiler
+// does not see malloc at the call sites and take the matching delete for a mismatched one.
+static std::atomic<uint64_t> allocations{0};
+
+__attribute__((noinline)) static void* countedAllocate(size_t size, size_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) {
+        size = 1;
+    }
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return std::malloc(size);
+    }
+    // aligned_alloc wants a multiple of the alignment
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void* countedNew(size_t size, size_t alignment) {
+    if (void* memory = countedAllocate(size, alignment)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) {
+    return countedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](size_t size) {
+    return countedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return countedNew(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return countedNew(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+// Keeping the optimizer from dropping the benchmarked work
+static volatile double sink;
+static volatile size_t textSink;
+
+// Results for the JSON report: sections of records, each record a list of named numbers and texts
+class JsonReport {
+public:
+    class Record {
+    public:
+        Record& Number(const char* key, double value) {
+            char text[64];
+            snprintf(text, sizeof(text), "%.10g", value);
+            fields.emplace_back(key, text);
+            return *this;
+        }
+
+        Record& Text(const char* key, const std::string& value) {
+            std::string text = "\"";
+            for (char c : value) {
+                if (c == '"' || c == '\\') {
+                    text += '\\';
+                }
+                if (static_cast<unsigned char>(c) >= 0x20) {
+                    text += c;
+                }
+            }
+            fields.emplace_back(key, text + "\"");
+            return *this;
+        }
+
+    private:
+        friend class JsonReport;
+        std::vector<std::pair<std::string, std::string>> fields;  // Values already in JSON
+    };
+
+    Record& Add(const std::string& section) {
+        for (auto& existing : sections) {
+            if (existing.first == section) {
+                existing.second.emplace_back();
+                return existing.second.back();
+            }
+        }
+        sections.emplace_back(section, std::vector<Record>(1));
+        return sections.back().second.back();
+    }
+
+    bool Write(const std::string& path) const {
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        fprintf(file, "{\n");
+        for (size_t i = 0; i < sections.size(); i++) {
+            fprintf(file, "  \"%s\": [\n", sections[i].first.c_str());
+            const std::vector<Record>& records = sections[i].second;
+            for (size_t j = 0; j < records.size(); j++) {
+                fprintf(file, "    {");
+                for (size_t k = 0; k < records[j].fields.size(); k++) {
+                    fprintf(file, "%s\"%s\": %s", k == 0 ? "" : ", ", records[j].fields[k].first.c_str(),
+                            records[j].fields[k].second.c_str());
+                }
+                fprintf(file, "}%s\n", j + 1 < records.size() ? "," : "");
+            }
+            fprintf(file, "  ]%s\n", i + 1 < sections.size() ? "," : "");
+        }
+        fprintf(file, "}\n");
+        return fclose(file) == 0;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::vector<Record>>> sections;
+};
+
+static JsonReport report;
+
+// Simulated supplies are reached through a pseudo-terminal unless --loopback is given
+static bool useLoopback = false;
+
+static std::unique_ptr<Transport> connectSimulator(PowerSupplySimulator& simulator, unsigned long baudRate) {
+    if (useLoopback) {
+        return simulator.StartLoopback();
+    }
+    std::string path = simulator.StartPty();
+    std::unique_ptr<Transport> transport = OpenSerialTransport(path.c_str());
+    SerialSettings settings;
+    settings.baudRate = baudRate;
+    if (!transport || !transport->Configure(settings)) {
+        fprintf(stderr, "Failed to open simulated supply %s\n", path.c_str());
+        return nullptr;
+    }
+    return transport;
+}
+
+// Nearest-rank percentile of the measured values, sorted in ascending order
+static double percentile(const std::vector<double>& values, double share) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(share * values.size() + 0.5);
+    return values[std::min(values.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+struct PollPathResult {
+    double nanosecondsPerSample;
+    double allocationsPerSample;
+};
+
+// Measuring one way of turning the responses of a poll into the four display texts
+template <typename Function>
+static PollPathResult measurePollPath(Function samplePath, int iterations) {
+    samplePath();  // Warming up the reused buffers
+    uint64_t allocationsBefore = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        samplePath();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    PollPathResult result;
+    result.nanosecondsPerSample = elapsed.count() / iterations;
+    result.allocationsPerSample = static_cast<double>(allocations - allocationsBefore) / iterations;
+    return result;
+}
+
+// The previous path: std::stod on each response twice, std::to_string + substr and string concatenation
+static std::string previousFormat(double value) {
+    std::string stringValue = std::to_string(value);
+    size_t pos = stringValue.find_last_not_of('0');
+    if (pos != std::string::npos && stringValue[pos] == '.') {
+        pos--;
+    }
+    return stringValue.substr(0, pos + 1);
+}
+
+static void benchmarkPollPath() {
+    const std::string voltageResponse = "12.3456";
+    const std::string currentResponse = "1.23456";
+    const int iterations = 1000000;
+
+    PollPathResult previous = measurePollPath([&] {
+        double voltage = std::stod(voltageResponse);
+        double current = std::stod(currentResponse);
+        double maxVoltage = std::stod(voltageResponse);
+        double maxCurrent = std::stod(currentResponse);
+        std::string texts[4] = {"Actual Voltage: " + previousFormat(voltage), "Actual Current: " + previousFormat(current),
+                                "Max Voltage: " + previousFormat(maxVoltage), "Max Current: " + previousFormat(maxCurrent)};
+        textSink = texts[0].size() + texts[1].size() + texts[2].size() + texts[3].size();
+    }, iterations);
+
+    PollPathResult charconv = measurePollPath([&] {
+        double voltage = 0.0;
+        double current = 0.0;
+        ParseScpiNumber(voltageResponse, voltage);
+        ParseScpiNumber(currentResponse, current);
+        char texts[4][NUMBER_BUFFER_SIZE];
+        textSink = FormatNumber(voltage, texts[0], sizeof(texts[0])) + FormatNumber(current, texts[1], sizeof(texts[1])) +
+                   FormatNumber(voltage, texts[2], sizeof(texts[2])) + FormatNumber(current, texts[3], sizeof(texts[3]));
+    }, iterations);
+
+    // The engine's poll: both queries batched, the combined response split and parsed
+    const std::string combinedResponse = "12.3456;1.23456";
+    ScpiBatch batch([](const std::string&) { return true; },
+                    [&combinedResponse](const std::string&, std::string& response) {
+                        response = combinedResponse;
+                        return true;
+                    });
+    double voltage = 0.0;
+    double current = 0.0;
+    PollPathResult batched = measurePollPath([&] {
+        batch.Query("MEAS:VOLT?", [&voltage](bool ok, const std::string& response) {
+            if (ok) {
+                ParseScpiNumber(response, voltage);
+            }
+        });
+        batch.Query("MEAS:CURR?", [&current](bool ok, const std::string& response) {
+            if (ok) {
+                ParseScpiNumber(response, current);
+            }
+        });
+        batch.Flush();
+        sink = voltage + current;
+    }, iterations);
+
+    printf("Poll path, %d samples\n", iterations);
+    printf("%-34s %10s %14s\n", "", "ns/sample", "allocs/sample");
+    printf("%-34s %10.1f %14.2f\n", "stod + to_string (previous)", previous.nanosecondsPerSample,
+           previous.allocationsPerSample);
+    printf("%-34s %10.1f %14.2f\n", "from_chars + to_chars", charconv.nanosecondsPerSample, charconv.allocationsPerSample);
+    printf("%-34s %10.1f %14.2f\n", "batched poll, split and parse", batched.nanosecondsPerSample,
+           batched.allocationsPerSample);
+
+    // What the instrumentation adds to every exchange
+    const std::string message = "MEAS:VOLT?;:MEAS:CURR?";
+    PollPathResult traced = measurePollPath([&] {
+        CommandTrace trace(message);
+        trace.Written(message.size() + 1, true);
+        trace.Received(std::chrono::steady_clock::now(), combinedResponse.size() + 1, true);
+    }, iterations);
+    printf("%-34s %10.1f %14.2f\n", "instrumentation of one exchange", traced.nanosecondsPerSample,
+           traced.allocationsPerSample);
+    printf("\n");
+
+    const std::pair<const char*, PollPathResult> results[] = {
+        {"stod_to_string", previous}, {"from_chars_to_chars", charconv}, {"batched_split_parse", batched},
+        {"instrumentation", traced}};
+    for (const auto& result : results) {
+        report.Add("poll_path")
+            .Text("variant", result.first)
+            .Number("ns_per_sample", result.second.nanosecondsPerSample)
+            .Number("allocations_per_sample", result.second.allocationsPerSample);
+    }
+}
+
+// Transport that only counts the writes, for the cost of the send path itself
+class CountingTransport : public Transport {
+public:
+    bool IsOpen() const override { return true; }
+    void Close() override {}
+    bool Configure(const SerialSettings&) override { return true; }
+    bool Write(const char*, size_t length) override {
+        writes++;
+        bytes += length;
+        return true;
+    }
+    bool WriteGather(const OutputSegment* segments, size_t count) override {
+        writes++;
+        for (size_t i = 0; i < count; i++) {
+            bytes += segments[i].length;
+        }
+        return true;
+    }
+    long Read(char*, size_t, int) override { return 0; }
+
+    uint64_t writes = 0;
+    uint64_t bytes = 0;
+};
+
+static void benchmarkCommandBuild() {
+    const int iterations = 1000000;
+    const std::string text = "12.345";
+
+    PollPathResult previous = measurePollPath([&] {
+        std::string command = "VOLT " + text;
+        textSink = command.size();
+    }, iterations);
+
+    ScpiMessage message;
+    PollPathResult fromText = measurePollPath([&] {
+        BuildCommandFromText<SCPI_VOLTAGE>(SIMULATED_SUPPLY, text.c_str(), message);
+        textSink = message.length;
+    }, iterations);
+
+    double value = 12.345;
+    PollPathResult fromNumber = measurePollPath([&] {
+        BuildCommand<SCPI_VOLTAGE>(SIMULATED_SUPPLY, value, message);
+        textSink = message.length;
+    }, iterations);
+
+    const std::pair<const char*, PollPathResult> results[] = {
+        {"concatenation, unchecked (previous)", previous}, {"table, parsed and checked text", fromText},
+        {"table, checked number", fromNumber}};
+    printf("Command building, %d commands\n", iterations);
+    printf("%-36s %10s %14s\n", "", "ns/command", "allocs/command");
+    for (const auto& result : results) {
+        printf("%-36s %10.1f %14.2f\n", result.first, result.second.nanosecondsPerSample, result.second.allocationsPerSample);
+        report.Add("command_build")
+            .Text("variant", result.first)
+            .Number("ns_per_command", result.second.nanosecondsPerSample)
+            .Number("allocations_per_command", result.second.allocationsPerSample);
+    }
+    printf("\n");
+}
+
+static void benchmarkSendPath() {
+    const int commands = 1000000;
+    const int burst = 10;
+    const std::string command = "SOUR:VOLT:LEV:IMM:AMPL 12.345";  // Longer than the small-string buffer
+
+    struct SendPathResult {
+        const char* name;
+        PollPathResult cost;
+        double writesPerCommand;
+    };
+    std::vector<SendPathResult> results;
+
+    CountingTransport transport;
+    PollPathResult previous = measurePollPath([&] {
+        std::string message = command + "\n";
+        transport.Write(message.c_str(), message.size());
+    }, commands);
+    results.push_back({"concatenate and write (previous)", previous, 1.0});
+
+    transport.writes = 0;
+    PollPathResult single = measurePollPath([&] { sendCommand(transport, command); }, commands);
+    results.push_back({"sendCommand, gathered write", single, static_cast<double>(transport.writes) / (commands + 1)});
+
+    transport.writes = 0;
+    CommandBuffer buffer;
+    PollPathResult coalesced = measurePollPath([&] {
+        for (int i = 0; i < burst; i++) {
+            buffer.Append(command);
+        }
+        buffer.Flush(transport);
+    }, commands / burst);
+    coalesced.nanosecondsPerSample /= burst;
+    coalesced.allocationsPerSample /= burst;
+    results.push_back({"command buffer, bursts of 10", coalesced,
+                       static_cast<double>(transport.writes) / (commands / burst + 1) / burst});
+
+    printf("Send path, %d commands\n", commands);
+    printf("%-34s %10s %14s %14s\n", "", "ns/command", "allocs/command", "writes/command");
+    for (const SendPathResult& result : results) {
+        printf("%-34s %10.1f %14.2f %14.2f\n", result.name, result.cost.nanosecondsPerSample,
+               result.cost.allocationsPerSample, result.writesPerCommand);
+        report.Add("send_path")
+            .Text("variant", result.name)
+            .Number("ns_per_command", result.cost.nanosecondsPerSample)
+            .Number("allocations_per_command", result.cost.allocationsPerSample)
+            .Number("writes_per_command", result.writesPerCommand);
+    }
+    printf("\n");
+}
+
+static void benchmarkTimeSeries() {
+    using namespace std::chrono;
+    TimeSeriesStore store;
+    const int samples = 10000000;  // About 28 hours at 100 samples/s
+
+    auto first = steady_clock::now();
+    auto start = steady_clock::now();
+    for (int i = 0; i < samples; i++) {
+        Sample sample;
+        sample.timestamp = first + milliseconds(10) * i;
+        sample.voltage = 12.0 + (i % 100) * 0.001;
+        sample.current = 1.0 + (i % 10) * 0.01;
+        sample.valid = true;
+        store.Add(sample);
+    }
+    duration<double, std::nano> addTime = steady_clock::now() - start;
+
+    printf("Time-series store, %d samples\n", samples);
+    printf("%-34s %10.1f ns\n", "add", addTime.count() / samples);
+    report.Add("time_series").Text("operation", "add").Number("ns", addTime.count() / samples);
+    auto now = first + milliseconds(10) * (samples - 1);
+    const std::pair<const char*, nanoseconds> windows[] = {
+        {"window 1 s", seconds(1)}, {"window 1 min", minutes(1)}, {"window 1 h", hours(1)}, {"window 1 day", hours(24)}};
+    for (const auto& window : windows) {
+        const int queries = 100000;
+        start = steady_clock::now();
+        for (int i = 0; i < queries; i++) {
+            sink = store.Window(TimeSeriesStore::VOLTAGE, window.second, now).mean;
+        }
+        duration<double, std::nano> queryTime = steady_clock::now() - start;
+        printf("%-34s %10.1f ns\n", window.first, queryTime.count() / queries);
+        report.Add("time_series").Text("operation", window.first).Number("ns", queryTime.count() / queries);
+    }
+    printf("\n");
+}
+
+// Min/max decimation by visiting every sample, what the levels of MinMaxSeries avoid
+static void scanColumns(const MinMaxSeries& series, int64_t start, int64_t duration, size_t count, ChartColumn* columns) {
+    size_t index = series.LowerBound(start);
+    for (size_t i = 0; i < count; i++) {
+        int64_t end = start + static_cast<int64_t>(i + 1) * duration;
+        ChartColumn& column = columns[i];
+        column.empty = true;
+        for (; index < series.Size() && series.Time(index) < end; index++) {
+            double value = series.Value(index);
+            if (column.empty) {
+                column = {false, value, value, value, value};
+            }
+            column.minimum = std::min(column.minimum, value);
+            column.maximum = std::max(column.maximum, value);
+            column.last = value;
+        }
+    }
+}
+
+static void benchmarkStripChart() {
+    using namespace std::chrono;
+    const size_t columnCount = 600;  // About the width of the panel's chart
+    const int64_t period = 20000000;  // 50 samples/s
+    std::vector<ChartColumn> columns(columnCount);
+
+    printf("Strip chart, %zu columns\n", columnCount);
+    printf("%10s %10s %14s %14s %14s %14s\n", "samples", "add ns", "whole levels", "whole scan", "minute levels", "minute scan");
+    for (size_t samples : {10000, 100000, 1000000, 4000000}) {
+        MinMaxSeries series;
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < samples; i++) {
+            series.Add(static_cast<int64_t>(i) * period, 12.0 + (i % 1000) * 0.001 + (i % 7) * 0.01);
+        }
+        duration<double, std::nano> addTime = steady_clock::now() - start;
+
+        // Microseconds per frame of the whole history and of the last minute
+        int64_t end = static_cast<int64_t>(samples) * period;
+        auto frame = [&](void (*decimate)(const MinMaxSeries&, int64_t, int64_t, size_t, ChartColumn*), int64_t span) {
+            int64_t duration = std::max<int64_t>(span / static_cast<int64_t>(columnCount), 1);
+            const int frames = 20;
+            auto frameStart = steady_clock::now();
+            for (int i = 0; i < frames; i++) {
+                decimate(series, end - duration * static_cast<int64_t>(columnCount), duration, columnCount, columns.data());
+                sink = columns[columnCount - 1].maximum;
+            }
+            return duration_cast<std::chrono::duration<double, std::micro>>(steady_clock::now() - frameStart).count() / frames;
+        };
+        double wholeLevels = frame(DecimateColumns, end);
+        double wholeScan = frame(scanColumns, end);
+        double minuteLevels = frame(DecimateColumns, 60000000000LL);
+        double minuteScan = frame(scanColumns, 60000000000LL);
+
+        printf("%10zu %10.1f %11.1f us %11.1f us %11.1f us %11.1f us\n", samples, addTime.count() / samples, wholeLevels,
+               wholeScan, minuteLevels, minuteScan);
+        report.Add("strip_chart")
+            .Number("samples", static_cast<double>(samples))
+            .Number("add_ns", addTime.count() / samples)
+            .Number("whole_levels_us", wholeLevels)
+            .Number("whole_scan_us", wholeScan)
+            .Number("minute_levels_us", minuteLevels)
+            .Number("minute_scan_us", minuteScan);
+    }
+    printf("\n");
+}
+
+static void benchmarkTriggers() {
+    using namespace std::chrono;
+    const int samples = 2000000;
+    const int spikeInterval = 200000;  // A 5-sample over-current spike now and then
+
+    TriggerSettings settings;
+    std::string error;
+    settings.Parse("current level above 2.5 hysteresis 0.1\n"
+                   "current edge falling 0.1\n"
+                   "voltage window 11.5 12.5\n"
+                   "current slew rising 500\n"
+                   "pre 200\n"
+                   "post 200\n",
+                   error);
+    TriggerEngine triggers;
+    triggers.Configure(settings);
+
+    auto first = steady_clock::now();
+    size_t kept = 0;
+    TriggerCapture capture;
+    auto start = steady_clock::now();
+    for (int i = 0; i < samples; i++) {
+        Sample sample;
+        sample.timestamp = first + milliseconds(1) * i;
+        sample.voltage = 12.0 + (i % 100) * 0.001;
+        sample.current = i % spikeInterval >= spikeInterval / 2 && i % spikeInterval < spikeInterval / 2 + 5 ? 3.0 : 1.0 + (i % 10) * 0.01;
+        sample.valid = true;
+        triggers.Process(sample);
+        // The UI collects the records a few times a second
+        if (i % 100 == 0) {
+            while (triggers.PopCapture(capture)) {
+                kept += capture.samples.size();
+            }
+        }
+    }
+    duration<double, std::nano> processTime = steady_clock::now() - start;
+    while (triggers.PopCapture(capture)) {
+        kept += capture.samples.size();
+    }
+
+    printf("Triggers, 4 conditions, %d samples\n", samples);
+    printf("%-34s %10.1f ns\n", "process", processTime.count() / samples);
+    printf("%-34s %10llu (%llu missed)\n", "triggers", static_cast<unsigned long long>(triggers.Fired()),
+           static_cast<unsigned long long>(triggers.Missed()));
+    printf("%-34s %10zu of %d\n\n", "samples kept", kept, samples);
+    report.Add("triggers")
+        .Number("samples", static_cast<double>(samples))
+        .Number("process_ns", processTime.count() / samples)
+        .Number("fired", static_cast<double>(triggers.Fired()))
+        .Number("missed", static_cast<double>(triggers.Missed()))
+        .Number("samples_kept", static_cast<double>(kept));
+}
+
+static void benchmarkCaptureLog() {
+    const char* path = "benchmark_capture.cap";
+    const uint64_t records = 20000000;
+    CaptureLog log;
+    if (!log.Open(path)) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return;
+    }
+
+    // Appending as fast as the writer keeps up; a full queue is retried, not dropped
+    Sample sample;
+    sample.valid = true;
+    uint64_t retries = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < records; i++) {
+        sample.timestamp = std::chrono::steady_clock::now();
+        sample.voltage = static_cast<double>(i);
+        while (!log.Append(sample)) {
+            retries++;
+            std::this_thread::yield();
+        }
+    }
+    log.Close();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("Capture log, %llu records (%.0f MB)\n", static_cast<unsigned long long>(records),
+           records * sizeof(CaptureRecord) / 1e6);
+    printf("%-34s %10.0f records/s\n", "append and write", records / elapsed.count());
+    printf("%-34s %10llu\n", "appends retried on a full queue", static_cast<unsigned long long>(retries));
+    printf("\n");
+    report.Add("capture_log")
+        .Number("records", static_cast<double>(records))
+        .Number("records_per_second", records / elapsed.count())
+        .Number("retries", static_cast<double>(retries));
+    remove(path);
+}
+
+// Counting the samples of each quantity the engine delivers during one phase of the scenario
+static void countSamples(AcquisitionEngine& engine, std::chrono::milliseconds duration, size_t& voltages, size_t& currents) {
+    voltages = currents = 0;
+    auto end = std::chrono::steady_clock::now() + duration;
+    Sample sample;
+    while (std::chrono::steady_clock::now() < end) {
+        while (engine.PopSample(sample)) {
+            voltages += sample.valid && sample.hasVoltage;
+            currents += sample.valid && sample.hasCurrent;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// One second of stable output, then one second of a 1 s voltage ramp
+static void benchmarkSchedule(const char* name, const PollSchedule& schedule, unsigned long baudRate, int latencyMs) {
+    SimulatorOptions options;
+    options.baudRate = baudRate;
+    options.responseLatencyMs = latencyMs;
+    PowerSupplySimulator simulator(options);
+    std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+    if (!transport) {
+        return;
+    }
+
+    Transport& port = *transport;
+    AcquisitionEngine engine(
+        [&port](const std::string& message, std::string& response) {
+            return SendSCPICommandAndGetResponse(port, message, response) == QUERY_ANSWERED;
+        },
+        [&port](const std::string& message) {
+            std::string line = message + "\n";
+            return port.Write(line.c_str(), line.size());
+        });
+    engine.PostCommand("RISE 1");
+    engine.PostCommand("OUTP ON");
+    engine.Start(schedule);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));  // Past the transient hold of OUTP ON
+
+    Sample sample;
+    while (engine.PopSample(sample)) {
+    }
+
+    size_t stableVoltages, stableCurrents, rampVoltages, rampCurrents;
+    countSamples(engine, std::chrono::milliseconds(1000), stableVoltages, stableCurrents);
+    engine.PostCommand("VOLT 10");
+    countSamples(engine, std::chrono::milliseconds(1000), rampVoltages, rampCurrents);
+    PollReport pollReport = engine.Report();
+    engine.Stop();
+
+    printf("%-10s %9zu %9zu %9zu %9zu %9lld %11.0f %10.0f\n", name, stableVoltages, stableCurrents, rampVoltages,
+           rampCurrents, static_cast<long long>(pollReport.roundTrip.count()), pollReport.jitter.mean,
+           pollReport.jitter.maximum);
+    report.Add("polling")
+        .Text("schedule", name)
+        .Number("baud", baudRate)
+        .Number("stable_voltage_per_second", stableVoltages)
+        .Number("stable_current_per_second", stableCurrents)
+        .Number("ramp_voltage_per_second", rampVoltages)
+        .Number("ramp_current_per_second", rampCurrents)
+        .Number("round_trip_us", static_cast<double>(pollReport.roundTrip.count()))
+        .Number("jitter_mean_us", pollReport.jitter.mean)
+        .Number("jitter_max_us", pollReport.jitter.maximum);
+}
+
+static void benchmarkPolling(unsigned long baudRate, int latencyMs) {
+    printf("Polling, %lu baud, %d ms instrument latency (samples per second)\n", baudRate, latencyMs);
+    printf("%-10s %9s %9s %9s %9s %9s %11s %10s\n", "schedule", "stable V", "stable I", "ramp V", "ramp I", "rtt us",
+           "jitter us", "max us");
+
+    benchmarkSchedule("fixed", PollSchedule::Fixed(std::chrono::milliseconds(500)), baudRate, latencyMs);
+
+    PollSchedule adaptive;
+    adaptive.rates[POLL_CURRENT].slowest = std::chrono::milliseconds(500);
+    adaptive.rates[POLL_VOLTAGE].fastest = std::chrono::milliseconds(20);
+    adaptive.rates[POLL_VOLTAGE].slowest = std::chrono::milliseconds(1000);
+    benchmarkSchedule("adaptive", adaptive, baudRate, latencyMs);
+    printf("\n");
+}
+
+// Polling as fast as the link allows, without and with the status byte in every message;
+// with it, two bad commands are posted and the errors they cause are counted
+static void benchmarkStatusMonitoring(unsigned long baudRate, int latencyMs) {
+    printf("Status monitoring, %lu baud, %d ms instrument latency\n", baudRate, latencyMs);
+    printf("%-10s %10s %10s %10s\n", "status", "samples/s", "errors", "expected");
+    for (bool monitored : {false, true}) {
+        SimulatorOptions options;
+        options.baudRate = baudRate;
+        options.responseLatencyMs = latencyMs;
+        PowerSupplySimulator simulator(options);
+        std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+        if (!transport) {
+            return;
+        }
+
+        Transport& port = *transport;
+        AcquisitionEngine engine(
+            [&port](const std::string& message, std::string& response) {
+                return SendSCPICommandAndGetResponse(port, message, response) == QUERY_ANSWERED;
+            },
+            [&port](const std::string& message) { return sendCommand(port, message); });
+        engine.SetStatusMonitoring(monitored);
+        engine.Start(std::chrono::milliseconds(0));
+
+        size_t voltages, currents;
+        countSamples(engine, std::chrono::milliseconds(1000), voltages, currents);
+        int expected = 0;
+        if (monitored) {
+            engine.PostCommand("VOLT 999");  // -222 Data out of range
+            engine.PostCommand("BOGUS 1");   // -113 Undefined header
+            expected = 2;
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+        engine.Stop();
+
+        int errors = 0;
+        DeviceError error;
+        while (engine.PopError(error)) {
+            errors++;
+        }
+        const char* name = monitored ? "*STB?" : "off";
+        printf("%-10s %10zu %10d %10d\n", name, voltages, errors, expected);
+        report.Add("status_monitoring")
+            .Text("status", name)
+            .Number("baud", baudRate)
+            .Number("samples_per_second", voltages)
+            .Number("errors_delivered", errors)
+            .Number("errors_expected", expected);
+    }
+    printf("\n");
+}
+
+// A 2 s ramp of 1000 steps (one every 2 ms) written to a simulated supply while it is being polled
+static void benchmarkSequencer(unsigned long baudRate, int latencyMs) {
+    SimulatorOptions options;
+    options.baudRate = baudRate;
+    options.responseLatencyMs = latencyMs;
+    PowerSupplySimulator simulator(options);
+    std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+    if (!transport) {
+        return;
+    }
+
+    Transport& port = *transport;
+    AcquisitionEngine engine(
+        [&port](const std::string& message, std::string& response) {
+            return SendSCPICommandAndGetResponse(port, message, response) == QUERY_ANSWERED;
+        },
+        [&port](const std::string& message) {
+            std::string line = message + "\n";
+            return port.WriteMessage(line.c_str(), line.size());
+        });
+    engine.Start(PollSchedule());
+
+    Sequence sequence;
+    std::string error;
+    if (!sequence.Parse("OUTP ON\nramp VOLT 0 10 2s 1000\nramp VOLT 10 0 2s 1000\n", error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return;
+    }
+    SequencePlayer player;
+    player.Start(sequence, [&](const char* data, size_t length) {
+        engine.NotifyTransient();
+        return port.WriteMessage(data, length);
+    });
+    while (player.IsRunning()) {
+        Sample sample;
+        while (engine.PopSample(sample)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    player.Stop();
+    engine.Stop();
+
+    RunningStatistics timingError = player.TimingError();
+    RunningStatistics writeTime;
+    size_t failed = 0;
+    for (const StepTiming& timing : player.Timings()) {
+        writeTime.Add(std::chrono::duration<double, std::micro>(timing.written - timing.actual).count());
+        failed += !timing.ok;
+    }
+    printf("Sequencer, %zu steps over %.1f s, %lu baud, polled at the same time\n", sequence.Steps().size(),
+           std::chrono::duration<double>(sequence.Duration()).count(), baudRate);
+    printf("%-34s %10.1f us mean %10.1f us max\n", "start of the write against plan", timingError.mean,
+           timingError.maximum);
+    printf("%-34s %10.1f us mean %10.1f us max\n", "write", writeTime.mean, writeTime.maximum);
+    printf("%-34s %10zu\n", "failed writes", failed);
+    printf("\n");
+    report.Add("sequencer")
+        .Number("steps", static_cast<double>(sequence.Steps().size()))
+        .Number("baud", baudRate)
+        .Number("timing_error_mean_us", timingError.mean)
+        .Number("timing_error_max_us", timingError.maximum)
+        .Number("write_mean_us", writeTime.mean)
+        .Number("write_max_us", writeTime.maximum)
+        .Number("failed_writes", static_cast<double>(failed));
+}
+
+// Round trips of single queries at each baud rate the panel offers
+static void benchmarkQueryLatency(int latencyMs) {
+    const int queries = 100;
+    printf("Query latency, %d queries of MEAS:VOLT? per baud rate, %d ms instrument latency\n", queries, latencyMs);
+    printf("%8s %12s %10s %10s %10s\n", "baud", "queries/s", "p50 us", "p99 us", "max us");
+    for (unsigned long baudRate : STANDARD_BAUD_RATES) {
+        SimulatorOptions options;
+        options.baudRate = baudRate;
+        options.responseLatencyMs = latencyMs;
+        PowerSupplySimulator simulator(options);
+        std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+        if (!transport) {
+            return;
+        }
+
+        std::vector<double> latencies;
+        std::string response;
+        SendSCPICommandAndGetResponse(*transport, "*IDN?", response);  // Warming up
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < queries; i++) {
+            auto sent = std::chrono::steady_clock::now();
+            SendSCPICommandAndGetResponse(*transport, "MEAS:VOLT?", response);
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        simulator.Stop();
+
+        std::sort(latencies.begin(), latencies.end());
+        double p50 = percentile(latencies, 0.5);
+        double p99 = percentile(latencies, 0.99);
+        double maximum = percentile(latencies, 1.0);
+        printf("%8lu %12.1f %10.0f %10.0f %10.0f\n", baudRate, queries / elapsed.count(), p50, p99, maximum);
+        report.Add("query_latency")
+            .Number("baud", baudRate)
+            .Number("latency_ms", latencyMs)
+            .Number("queries_per_second", queries / elapsed.count())
+            .Number("p50_us", p50)
+            .Number("p99_us", p99)
+            .Number("max_us", maximum);
+    }
+    printf("\n");
+}
+
+// Polling voltage and current as two queries against one batched program message
+// A scripted run as test scripts write it: every step sets all the settings, only the voltage changes
+static void benchmarkStateCache(unsigned long baudRate, int latencyMs) {
+    const int steps = 50;
+    printf("State cache, %d steps of 5 setting commands, %lu baud, %d ms instrument latency\n", steps, baudRate, latencyMs);
+    printf("%-14s %10s %10s %12s\n", "", "issued", "sent", "elapsed ms");
+    for (bool cached : {false, true}) {
+        SimulatorOptions options;
+        options.baudRate = baudRate;
+        options.responseLatencyMs = latencyMs;
+        PowerSupplySimulator simulator(options);
+        std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+        if (!transport) {
+            return;
+        }
+
+        DeviceStateCache state(SIMULATED_SUPPLY);
+        std::string response;
+        auto start = std::chrono::steady_clock::now();
+        if (cached) {
+            state.ReadBack([&transport](const std::string& message, std::string& answer) {
+                return SendSCPICommandAndGetResponse(*transport, message, answer) == QUERY_ANSWERED;
+            });
+        }
+        int issued = 0;
+        int sent = 0;
+        for (int step = 0; step < steps; step++) {
+            char voltage[32];
+            snprintf(voltage, sizeof(voltage), "VOLT %d", step % 10);
+            const char* commands[] = {voltage, "CURR 2", "RISE 0.1", "FALL 0.1", "OUTP ON"};
+            for (const char* command : commands) {
+                issued++;
+                if (!cached || state.ShouldSend(command)) {
+                    sendCommand(*transport, command);
+                    sent++;
+                }
+            }
+        }
+        SendSCPICommandAndGetResponse(*transport, "*OPC?", response);  // Waiting until everything is carried out
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        simulator.Stop();
+
+        const char* name = cached ? "cached" : "uncached";
+        printf("%-14s %10d %10d %12.1f\n", name, issued, sent, elapsed);
+        report.Add("state_cache")
+            .Text("variant", name)
+            .Number("baud", baudRate)
+            .Number("commands_issued", issued)
+            .Number("commands_sent", sent)
+            .Number("elapsed_ms", elapsed);
+    }
+    printf("\n");
+}
+
+static void benchmarkBatching(unsigned long baudRate, int latencyMs) {
+    const int samples = 200;
+    SimulatorOptions options;
+    options.baudRate = baudRate;
+    options.responseLatencyMs = latencyMs;
+    PowerSupplySimulator simulator(options);
+    std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+    if (!transport) {
+        return;
+    }
+    Transport& port = *transport;
+
+    double voltage = 0.0;
+    double current = 0.0;
+    std::string response;
+    auto unbatched = [&] {
+        SendSCPICommandAndGetResponse(port, "MEAS:VOLT?", response);
+        ParseScpiNumber(response, voltage);
+        SendSCPICommandAndGetResponse(port, "MEAS:CURR?", response);
+        ParseScpiNumber(response, current);
+    };
+    ScpiBatch batch(
+        [&port](const std::string& message) {
+            std::string line = message + "\n";
+            return port.WriteMessage(line.c_str(), line.size());
+        },
+        [&port](const std::string& message, std::string& batchResponse) {
+            return SendSCPICommandAndGetResponse(port, message, batchResponse) == QUERY_ANSWERED;
+        });
+    auto batched = [&] {
+        batch.Query("MEAS:VOLT?", [&voltage](bool ok, const std::string& text) {
+            if (ok) {
+                ParseScpiNumber(text, voltage);
+            }
+        });
+        batch.Query("MEAS:CURR?", [&current](bool ok, const std::string& text) {
+            if (ok) {
+                ParseScpiNumber(text, current);
+            }
+        });
+        batch.Flush();
+    };
+
+    printf("Batched polling, %d samples of voltage and current, %lu baud, %d ms instrument latency\n", samples,
+           baudRate, latencyMs);
+    printf("%-12s %12s %10s %10s\n", "poll", "samples/s", "p50 us", "p99 us");
+    const std::pair<const char*, std::function<void()>> variants[] = {{"unbatched", unbatched}, {"batched", batched}};
+    for (const auto& variant : variants) {
+        std::vector<double> latencies;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < samples; i++) {
+            auto sampleStart = std::chrono::steady_clock::now();
+            variant.second();
+            latencies.push_back(
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sampleStart).count());
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        sink = voltage + current;
+
+        std::sort(latencies.begin(), latencies.end());
+        double p50 = percentile(latencies, 0.5);
+        double p99 = percentile(latencies, 0.99);
+        printf("%-12s %12.1f %10.0f %10.0f\n", variant.first, samples / elapsed.count(), p50, p99);
+        report.Add("batching")
+            .Text("poll", variant.first)
+            .Number("baud", baudRate)
+            .Number("latency_ms", latencyMs)
+            .Number("samples_per_second", samples / elapsed.count())
+            .Number("p50_us", p50)
+            .Number("p99_us", p99);
+    }
+    simulator.Stop();
+    printf("\n");
+}
+
+static void benchmarkBlockDecode() {
+    const size_t values = 1000000;
+    BlockBuffer block;
+    char* payload = block.Reserve(values * 4);
+    std::string ascii;
+    for (size_t i = 0; i < values; i++) {
+        float value = 12.0f + static_cast<float>(i % 1000) * 0.001f;
+        uint32_t word;
+        std::memcpy(&word, &value, 4);
+        for (int b = 0; b < 4; b++) {
+            payload[i * 4 + b] = static_cast<char>(word >> (8 * (3 - b)));
+        }
+        char text[NUMBER_BUFFER_SIZE];
+        ascii.append(text, FormatNumber(value, text, sizeof(text), 4));
+        ascii += ',';
+    }
+    std::vector<float> decoded(values);
+
+    printf("Block decoding, %zu values\n", values);
+    printf("%-34s %10s %10s\n", "", "ns/value", "MB/s");
+    const int rounds = 20;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        DecodeFloatBlock(payload, values * 4, BLOCK_BIG_ENDIAN, decoded.data());
+        sink = decoded[round];
+    }
+    double binary = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (rounds * values);
+
+    start = std::chrono::steady_clock::now();
+    size_t parsed = 0;
+    const char* cursor = ascii.data();
+    const char* end = ascii.data() + ascii.size();
+    while (cursor < end) {
+        const char* comma = static_cast<const char*>(std::memchr(cursor, ',', end - cursor));
+        double value;
+        if (ParseScpiNumber(cursor, comma, value)) {
+            decoded[parsed++] = static_cast<float>(value);
+        }
+        cursor = comma + 1;
+    }
+    double text = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / values;
+    sink = decoded[parsed - 1];
+
+    const std::pair<const char*, std::pair<double, double>> variants[] = {
+        {"REAL,32 block, byte-swapped", {binary, 4.0}}, {"ASCII list, parsed", {text, ascii.size() / static_cast<double>(values)}}};
+    for (const auto& variant : variants) {
+        printf("%-34s %10.2f %10.0f\n", variant.first, variant.second.first, variant.second.second * 1e3 / variant.second.first);
+        report.Add("block_decode")
+            .Text("format", variant.first)
+            .Number("ns_per_value", variant.second.first)
+            .Number("megabytes_per_second", variant.second.second * 1e3 / variant.second.first);
+    }
+    printf("\n");
+}
+
+static void benchmarkArrayFetch(unsigned long baudRate, int latencyMs) {
+    const int samples = 1000;
+    SimulatorOptions options;
+    options.baudRate = baudRate;
+    options.responseLatencyMs = latencyMs;
+    PowerSupplySimulator simulator(options);
+    std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+    if (!transport) {
+        return;
+    }
+    sendCommand(*transport, "VOLT 5;:OUTP ON;:SENS:SWE:POIN " + std::to_string(samples));
+
+    std::vector<float> values(samples);
+    std::string response;
+    BlockBuffer block;
+    BlockDecoder decoder;
+    auto poll = [&] {
+        for (int i = 0; i < samples; i++) {
+            double value;
+            SendSCPICommandAndGetResponse(*transport, "MEAS:VOLT?", response);
+            values[i] = ParseScpiNumber(response, value) ? static_cast<float>(value) : 0.0f;
+        }
+        return samples;
+    };
+    auto fetchAscii = [&] {
+        sendCommand(*transport, "FORM ASC");
+        response = query(*transport, "FETC:ARR:VOLT?", 60000);
+        int count = 0;
+        size_t field = 0;
+        while (field < response.size() && count < samples) {
+            size_t comma = std::min(response.find(',', field), response.size());
+            double value;
+            if (ParseScpiNumber(response.data() + field, response.data() + comma, value)) {
+                values[count++] = static_cast<float>(value);
+            }
+            field = comma + 1;
+        }
+        return count;
+    };
+    auto fetchBlock = [&] {
+        sendCommand(*transport, "FORM REAL,32");
+        decoder.Reset(block);
+        if (!QueryBlock(*transport, "FETC:ARR:VOLT?", decoder)) {
+            return 0;
+        }
+        return static_cast<int>(DecodeFloatBlock(block.Data(), block.Size(), BLOCK_BIG_ENDIAN, values.data()));
+    };
+
+    printf("Array fetch, %d voltage samples, %lu baud, %d ms instrument latency\n", samples, baudRate, latencyMs);
+    printf("%-24s %10s %12s %14s\n", "read as", "samples", "elapsed ms", "samples/s");
+    const std::pair<const char*, std::function<int()>> variants[] = {
+        {"MEAS:VOLT? polls", poll}, {"FETC:ARR:VOLT? ASCII", fetchAscii}, {"FETC:ARR:VOLT? REAL,32", fetchBlock}};
+    for (const auto& variant : variants) {
+        auto start = std::chrono::steady_clock::now();
+        int count = variant.second();
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        sink = values[samples - 1];
+        printf("%-24s %10d %12.1f %14.1f\n", variant.first, count, elapsed, count * 1e3 / elapsed);
+        report.Add("array_fetch")
+            .Text("read_as", variant.first)
+            .Number("baud", baudRate)
+            .Number("latency_ms", latencyMs)
+            .Number("samples", count)
+            .Number("elapsed_ms", elapsed)
+            .Number("samples_per_second", count * 1e3 / elapsed);
+    }
+    simulator.Stop();
+    printf("\n");
+}
+
+static void benchmarkBaudNegotiation(int latencyMs) {
+    const int samples = 50;
+    SimulatorOptions options;
+    options.baudRate = DEFAULT_BAUD_RATE;
+    options.responseLatencyMs = latencyMs;
+    options.supportedBaudRates = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+    options.reliableBaudRate = 230400;
+    options.lineErrorRate = 0.02;
+    PowerSupplySimulator simulator(options);
+    std::unique_ptr<Transport> transport = simulator.StartLoopback();
+    SerialSettings settings;
+    settings.baudRate = DEFAULT_BAUD_RATE;
+    transport->Configure(settings);
+
+    std::string response;
+    auto pollRate = [&] {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < samples; i++) {
+            SendSCPICommandAndGetResponse(*transport, "MEAS:VOLT?;:MEAS:CURR?", response);
+        }
+        return samples / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    double before = pollRate();
+    auto start = std::chrono::steady_clock::now();
+    BaudNegotiationResult result = NegotiateBaudRate(*transport, SIMULATED_SUPPLY, settings);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    double after = pollRate();
+    simulator.Stop();
+
+    printf("Baud negotiation from %lu baud, responses garbled above %lu baud, %d ms instrument latency\n",
+           DEFAULT_BAUD_RATE, options.reliableBaudRate, latencyMs);
+    printf("%-30s %10s %12s %14s %14s\n", "result", "baud", "elapsed ms", "samples/s old", "samples/s new");
+    printf("%-30s %10lu %12.1f %14.1f %14.1f\n", DescribeBaudNegotiation(result.status), result.baudRate, elapsed,
+           before, after);
+    for (const BaudAttempt& attempt : result.attempts) {
+        printf("  %lu baud: %s, %d good round trips\n", attempt.baudRate,
+               !attempt.accepted ? "refused" : (attempt.stable ? "stable" : "unstable, fell back"), attempt.roundTrips);
+    }
+    report.Add("baud_negotiation")
+        .Text("result", DescribeBaudNegotiation(result.status))
+        .Number("from_baud", DEFAULT_BAUD_RATE)
+        .Number("baud", result.baudRate)
+        .Number("attempts", static_cast<double>(result.attempts.size()))
+        .Number("elapsed_ms", elapsed)
+        .Number("samples_per_second_before", before)
+        .Number("samples_per_second_after", after);
+    printf("\n");
+}
+
+// The supply is polled every 10 ms; its port is closed, and the open function finds a freshly
+// powered supply once the port is back
+static void benchmarkReconnect(int latencyMs, std::chrono::milliseconds absence) {
+    using namespace std::chrono;
+    SimulatorOptions options;
+    options.responseLatencyMs = latencyMs;
+    PowerSupplySimulator original(options);
+    PowerSupplySimulator replacement(options);
+    SerialSettings settings;
+    settings.baudRate = DEFAULT_BAUD_RATE;
+
+    std::atomic<int64_t> unpluggedAt{0};  // steady_clock nanoseconds, 0 while the port is there
+    std::atomic<int64_t> lostAt{0};
+    std::atomic<bool> restored{false};
+    LinkEvent restoredEvent;
+    std::mutex eventMutex;
+    auto open = [&]() -> std::unique_ptr<Transport> {
+        int64_t unplugged = unpluggedAt;
+        if (unplugged == 0 || steady_clock::now().time_since_epoch().count() < unplugged + nanoseconds(absence).count()) {
+            return nullptr;
+        }
+        return replacement.StartLoopback();
+    };
+    LinkSupervisor link(original.StartLoopback(), settings, open, [&](const LinkEvent& event) {
+        if (event.kind == LINK_LOST) {
+            lostAt = steady_clock::now().time_since_epoch().count();
+        } else if (event.kind == LINK_RESTORED) {
+            std::lock_guard<std::mutex> lock(eventMutex);
+            restoredEvent = event;
+            restored = true;
+        }
+    });
+    link.Configure(settings);
+    link.SetRestoreMessage("VOLT 12;:CURR 1.5");
+
+    AcquisitionEngine engine(
+        [&link](const std::string& message, std::string& response) {
+            return SendSCPICommandAndGetResponse(link, message, response) == QUERY_ANSWERED;
+        },
+        [&link](const std::string& message) { return sendCommand(link, message); });
+    engine.SetLinkSupervisor(&link);
+    engine.PostCommand("VOLT 12");
+    engine.PostCommand("CURR 1.5");
+    engine.Start(milliseconds(10));
+    std::this_thread::sleep_for(milliseconds(300));
+
+    // The longest time between valid samples, across the loss and until a sample after the restore
+    Sample sample;
+    steady_clock::time_point previous;
+    double gap = 0.0;
+    auto drain = [&] {
+        bool after = false;
+        while (engine.PopSample(sample)) {
+            if (!sample.valid) {
+                continue;
+            }
+            if (previous != steady_clock::time_point()) {
+                gap = std::max(gap, duration<double, std::milli>(sample.timestamp - previous).count());
+            }
+            previous = sample.timestamp;
+            after = restored;
+        }
+        return after;
+    };
+    drain();
+    steady_clock::time_point unplugged = steady_clock::now();
+    unpluggedAt = unplugged.time_since_epoch().count();
+    original.Stop();
+
+    steady_clock::time_point end = unplugged + absence + seconds(5);
+    while (!drain() && steady_clock::now() < end) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    engine.Stop();
+
+    double detection = lostAt != 0 ? (lostAt - unpluggedAt) / 1e6 : 0.0;
+    double downtime = 0.0;
+    int attempts = 0;
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        downtime = restoredEvent.downtime.count() / 1e3;
+        attempts = restoredEvent.attempts;
+    }
+    double voltage = 0.0;
+    bool setpointRestored = restored && ParseScpiNumber(replacement.Process("VOLT?"), voltage) && voltage == 12.0;
+    link.Close();
+    replacement.Stop();
+
+    printf("%10lld %12.1f %12.1f %9d %12.1f %10s\n", static_cast<long long>(absence.count()), detection, downtime,
+           attempts, gap, setpointRestored ? "yes" : "no");
+    report.Add("reconnect")
+        .Number("absence_ms", static_cast<double>(absence.count()))
+        .Number("latency_ms", latencyMs)
+        .Number("detection_ms", detection)
+        .Number("reconnect_ms", downtime)
+        .Number("attempts", attempts)
+        .Number("sample_gap_ms", gap)
+        .Number("setpoints_restored", setpointRestored ? 1 : 0);
+}
+
+static void benchmarkReplay(unsigned long baudRate, int latencyMs) {
+    const int samples = 200;
+    const char* const tracePath = "benchmark_replay.trace";
+    auto poll = [](Transport& port, std::string& response, double& voltage, double& current) {
+        SendSCPICommandAndGetResponse(port, "MEAS:VOLT?;:MEAS:CURR?", response);
+        size_t separator = response.find(';');
+        return separator != std::string::npos && ParseScpiNumber(response.data(), response.data() + separator, voltage) &&
+               ParseScpiNumber(response.data() + separator + 1, response.data() + response.size(), current);
+    };
+
+    // Recording the polls of a simulated supply
+    SimulatorOptions options;
+    options.baudRate = baudRate;
+    options.responseLatencyMs = latencyMs;
+    PowerSupplySimulator simulator(options);
+    std::unique_ptr<Transport> transport = connectSimulator(simulator, baudRate);
+    if (!transport) {
+        return;
+    }
+    RecordingTransport recorder(std::move(transport));
+    if (!recorder.Start(tracePath)) {
+        fprintf(stderr, "Failed to create %s\n", tracePath);
+        return;
+    }
+    double voltage = 0.0;
+    double current = 0.0;
+    std::string response;
+    int parsed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < samples; i++) {
+        parsed += poll(recorder, response, voltage, current) ? 1 : 0;
+    }
+    std::chrono::duration<double> recorded = std::chrono::steady_clock::now() - start;
+    recorder.Stop();
+    uint64_t traceBytes = recorder.RecordedBytes();
+    simulator.Stop();
+
+    auto trace = std::make_shared<TrafficTrace>();
+    std::string error;
+    bool loaded = trace->Load(tracePath, error);
+    std::remove(tracePath);
+    if (!loaded) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return;
+    }
+
+    printf("Traffic replay, %d polls recorded at %lu baud, %d ms instrument latency, %.1f trace bytes per poll\n",
+           samples, baudRate, latencyMs, static_cast<double>(traceBytes) / samples);
+    printf("%-10s %12s %12s %10s %12s\n", "run", "samples/s", "elapsed ms", "parsed", "mismatches");
+    printf("%-10s %12.1f %12.1f %10d %12s\n", "recorded", samples / recorded.count(), recorded.count() * 1e3, parsed, "-");
+    report.Add("replay")
+        .Text("run", "recorded")
+        .Number("baud", baudRate)
+        .Number("latency_ms", latencyMs)
+        .Number("samples_per_second", samples / recorded.count())
+        .Number("elapsed_ms", recorded.count() * 1e3)
+        .Number("trace_bytes_per_sample", static_cast<double>(traceBytes) / samples);
+
+    for (ReplayTiming timing : {REPLAY_FAST, REPLAY_ORIGINAL}) {
+        ReplayTransport replay(trace, timing);
+        int replayed = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < samples; i++) {
+            replayed += poll(replay, response, voltage, current) ? 1 : 0;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        sink = voltage + current;
+
+        const char* name = timing == REPLAY_FAST ? "fast" : "original";
+        printf("%-10s %12.1f %12.1f %10d %12llu%s\n", name, samples / elapsed.count(), elapsed.count() * 1e3, replayed,
+               static_cast<unsigned long long>(replay.Mismatches()), replay.Finished() ? "" : " (not finished)");
+        report.Add("replay")
+            .Text("run", name)
+            .Number("baud", baudRate)
+            .Number("latency_ms", latencyMs)
+            .Number("samples_per_second", samples / elapsed.count())
+            .Number("elapsed_ms", elapsed.count() * 1e3)
+            .Number("parsed", replayed)
+            .Number("mismatches", static_cast<double>(replay.Mismatches()))
+            .Number("finished", replay.Finished() ? 1 : 0);
+    }
+    printf("\n");
+}
+
+// Aggregate samples per second of a rack of simulated supplies polled as fast as the links allow
+static double benchmarkRack(size_t devices, unsigned long baudRate, int latencyMs, std::chrono::milliseconds duration) {
+    SimulatorOptions options;
+    options.baudRate = baudRate;
+    options.responseLatencyMs = latencyMs;
+
+    std::vector<std::unique_ptr<PowerSupplySimulator>> simulators;
+    DeviceRegistry registry;
+
+    // The registry multiplexes the ports' handles, so the rack is always run on pseudo-terminals
+    for (size_t i = 0; i < devices; i++) {
+        simulators.emplace_back(new PowerSupplySimulator(options));
+        std::string path = simulators.back()->StartPty();
+        std::unique_ptr<Transport> transport = OpenSerialTransport(path.c_str());
+        SerialSettings settings;
+        settings.baudRate = baudRate;
+        if (!transport || !transport->Configure(settings)) {
+            fprintf(stderr, "Failed to open simulated supply %s\n", path.c_str());
+            return 0.0;
+        }
+        registry.Add(path, std::move(transport), std::chrono::microseconds(0));
+    }
+
+    registry.Start();
+    std::this_thread::sleep_for(duration);
+    registry.Stop();
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < registry.Count(); i++) {
+        total += registry.Session(i).SamplesTaken();
+    }
+    return total / std::chrono::duration<double>(duration).count();
+}
+
+#if defined(__cpp_impl_coroutine)
+// One device's poll loop: both measurements are queried before the first answer is awaited
+static Task<void> pollClient(ScpiClient& client, Cancellation& stop, uint64_t& samples) {
+    while (!stop.IsCancelled()) {
+        ScpiClient::QueryAwaitable voltageQuery = client.Query("MEAS:VOLT?", CLIENT_RESPONSE_TIMEOUT, &stop);
+        ScpiClient::QueryAwaitable currentQuery = client.Query("MEAS:CURR?", CLIENT_RESPONSE_TIMEOUT, &stop);
+        ScpiResult voltage = co_await voltageQuery;
+        ScpiResult current = co_await currentQuery;
+        if (voltage.status == ScpiResult::FAILED || current.status == ScpiResult::FAILED) {
+            co_return;
+        }
+        double value;
+        if (voltage.Ok() && current.Ok() && ParseMeasurement(voltage.response, value) &&
+            ParseMeasurement(current.response, value)) {
+            samples++;
+        }
+    }
+}
+
+// Aggregate samples per second of simulated supplies polled by coroutines on one event loop thread
+static double benchmarkCoroutineClient(size_t devices, unsigned long baudRate, int latencyMs,
+                                       std::chrono::milliseconds duration) {
+    SimulatorOptions options;
+    options.baudRate = baudRate;
+    options.responseLatencyMs = latencyMs;
+
+    EventLoop loop;
+    std::vector<std::unique_ptr<PowerSupplySimulator>> simulators;
+    std::vector<std::unique_ptr<Transport>> transports;
+    std::vector<std::unique_ptr<ScpiClient>> clients;
+    std::vector<uint64_t> samples(devices, 0);
+    for (size_t i = 0; i < devices; i++) {
+        simulators.emplace_back(new PowerSupplySimulator(options));
+        std::string path = simulators.back()->StartPty();
+        std::unique_ptr<Transport> transport = OpenSerialTransport(path.c_str());
+        SerialSettings settings;
+        settings.baudRate = baudRate;
+        if (!transport || !transport->Configure(settings)) {
+            fprintf(stderr, "Failed to open simulated supply %s\n", path.c_str());
+            return 0.0;
+        }
+        transports.push_back(std::move(transport));
+        clients.emplace_back(new ScpiClient(loop, *transports.back()));
+    }
+
+    Cancellation stop;
+    std::thread thread([&loop] { loop.Run(); });
+    loop.Post([&] {
+        for (size_t i = 0; i < devices; i++) {
+            if (clients[i]->Open()) {
+                Spawn(pollClient(*clients[i], stop, samples[i]));
+            }
+        }
+    });
+    std::this_thread::sleep_for(duration);
+    loop.Post([&] {
+        stop.Cancel();
+        clients.clear();
+    });
+    loop.Stop();
+    thread.join();
+
+    uint64_t total = 0;
+    for (uint64_t count : samples) {
+        total += count;
+    }
+    return total / std::chrono::duration<double>(duration).count();
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    std::string jsonPath;
+    std::vector<const char*> arguments;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--loopback") == 0) {
+            useLoopback = true;
+        } else {
+            arguments.push_back(argv[i]);
+        }
+    }
+    unsigned long baudRate = arguments.size() > 0 ? std::strtoul(arguments[0], nullptr, 10) : 115200;
+    int latencyMs = arguments.size() > 1 ? std::atoi(arguments[1]) : 2;
+
+    report.Add("environment")
+        .Text("transport", useLoopback ? "loopback" : "pty")
+        .Number("baud", baudRate)
+        .Number("latency_ms", latencyMs)
+        .Number("hardware_threads", std::thread::hardware_concurrency())
+#ifdef __VERSION__
+        .Text("compiler", __VERSION__)
+#endif
+        .Text("build", __DATE__);
+
+    benchmarkPollPath();
+    benchmarkCommandBuild();
+    benchmarkSendPath();
+    benchmarkTimeSeries();
+    benchmarkStripChart();
+    benchmarkTriggers();
+    benchmarkBlockDecode();
+    benchmarkCaptureLog();
+    ResetInstrumentation();  // Dropping the exchanges traced by the poll path benchmark
+    benchmarkPolling(baudRate, latencyMs);
+    benchmarkSequencer(baudRate, latencyMs);
+    benchmarkStatusMonitoring(baudRate, latencyMs);
+
+    benchmarkQueryLatency(latencyMs);
+    benchmarkBatching(baudRate, latencyMs);
+    benchmarkStateCache(baudRate, latencyMs);
+    benchmarkReplay(baudRate, latencyMs);
+    benchmarkBaudNegotiation(latencyMs);
+    benchmarkArrayFetch(baudRate, latencyMs);
+
+    printf("Reconnect, supply polled every 10 ms, %d ms instrument latency\n", latencyMs);
+    printf("%10s %12s %12s %9s %12s %10s\n", "absent ms", "notice ms", "restore ms", "attempts", "gap ms", "restored");
+    for (int absence : {0, 100, 500}) {
+        benchmarkReconnect(latencyMs, std::chrono::milliseconds(absence));
+    }
+    printf("\n");
+
+    printf("Instrumentation of the polling, sequencer, latency and batching runs\n");
+    PrintInstrumentation(stdout);
+    printf("\n");
+    for (const CommandStatistics& command : InstrumentationSnapshot()) {
+        if (command.counters[COUNTER_CALLS] == 0) {
+            continue;
+        }
+        const HistogramSnapshot& total = command.metrics[METRIC_TOTAL];
+        report.Add("instrumentation")
+            .Text("command", command.name)
+            .Number("calls", static_cast<double>(command.counters[COUNTER_CALLS]))
+            .Number("timeouts", static_cast<double>(command.counters[COUNTER_TIMEOUTS]))
+            .Number("p50_us", total.Percentile(0.5) / 1e3)
+            .Number("p99_us", total.Percentile(0.99) / 1e3)
+            .Number("max_us", total.maximum / 1e3);
+    }
+
+    printf("Rack throughput, %lu baud, %d ms instrument latency\n", baudRate, latencyMs);
+    printf("%8s %14s %18s\n", "devices", "samples/s", "samples/s/device");
+    for (size_t devices : {1, 2, 4, 8, 16, 32}) {
+        double rate = benchmarkRack(devices, baudRate, latencyMs, std::chrono::milliseconds(1000));
+        printf("%8zu %14.1f %18.1f\n", devices, rate, rate / devices);
+        report.Add("rack")
+            .Number("devices", static_cast<double>(devices))
+            .Number("baud", baudRate)
+            .Number("samples_per_second", rate)
+            .Number("samples_per_second_per_device", rate / devices);
+    }
+
+#if defined(__cpp_impl_coroutine)
+    printf("\nCoroutine client throughput, %lu baud, %d ms instrument latency\n", baudRate, latencyMs);
+    printf("%8s %14s %18s\n", "devices", "samples/s", "samples/s/device");
+    for (size_t devices : {1, 2, 4, 8, 16, 32}) {
+        double rate = benchmarkCoroutineClient(devices, baudRate, latencyMs, std::chrono::milliseconds(1000));
+        printf("%8zu %14.1f %18.1f\n", devices, rate, rate / devices);
+        report.Add("coroutine_client")
+            .Number("devices", static_cast<double>(devices))
+            .Number("baud", baudRate)
+            .Number("samples_per_second", rate)
+            .Number("samples_per_second_per_device", rate / devices);
+    }
+#endif
+
+    if (!jsonPath.empty() && !report.Write(jsonPath)) {
+        fprintf(stderr, "Failed to write %s\n", jsonPath.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,402 @@
+#include "capture_log.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int64_t nanosecondsSinceEpoch(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+uint32_t CaptureChecksum(const CaptureRecord& record) {
+    uint64_t words[3];
+    std::memcpy(words, &record, sizeof(words));
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ ((static_cast<uint64_t>(record.device) << 16) | record.status);
+    for (uint64_t word : words) {
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    return static_cast<uint32_t>(hash);
+}
+
+bool IsValidCaptureRecord(const CaptureRecord& record) {
+    return record.checksum == CaptureChecksum(record);
+}
+
+CaptureLog::CaptureLog() {
+}
+
+CaptureLog::~CaptureLog() {
+    Close();
+}
+
+bool CaptureLog::IsOpen() const {
+    return open;
+}
+
+uint64_t CaptureLog::RecordsWritten() const {
+    return recordsWritten;
+}
+
+uint64_t CaptureLog::DroppedRecords() const {
+    return droppedRecords;
+}
+
+bool CaptureLog::Append(const Sample& sample, uint16_t device) {
+    if (!open.load(std::memory_order_acquire)) {
+        return false;
+    }
+    CaptureRecord record;
+    record.timestamp = nanosecondsSinceEpoch(sample.timestamp) - startSteadyTime;
+    record.voltage = sample.voltage;
+    record.current = sample.current;
+    record.device = device;
+    record.status = (sample.valid ? CAPTURE_STATUS_VALID : 0) | (sample.hasVoltage ? 0 : CAPTURE_STATUS_NO_VOLTAGE) |
+                    (sample.hasCurrent ? 0 : CAPTURE_STATUS_NO_CURRENT);
+    record.checksum = 0;  // Computed by the writer
+    if (!queue.Push(record)) {
+        droppedRecords++;
+        return false;
+    }
+    return true;
+}
+
+bool CaptureLog::Open(const std::string& path) {
+    Close();
+
+    // Records appended after the previous capture was closed are not part of this one
+    CaptureRecord stale;
+    while (queue.Pop(stale)) {
+    }
+
+#ifdef _WIN32
+    file = CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return false;
+    }
+#else
+    file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0) {
+        return false;
+    }
+#endif
+    fileSize = 0;
+    recordCount = 0;
+    recordsWritten = 0;
+    droppedRecords = 0;
+
+    if (!mapSegment(0)) {
+        Close();
+        return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    startSteadyTime = nanosecondsSinceEpoch(now);
+
+    CaptureHeader header = {};
+    std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.recordSize = sizeof(CaptureRecord);
+    header.startSystemTime =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    header.startSteadyTime = startSteadyTime;
+    std::memcpy(view, &header, sizeof(header));
+
+    stopping = false;
+    writer = std::thread(&CaptureLog::writerLoop, this);
+    open.store(true, std::memory_order_release);
+    return true;
+}
+
+void CaptureLog::Close() {
+    open = false;
+    if (writer.joinable()) {
+        stopping = true;
+        writer.join();
+    }
+
+    bool hasFile;
+#ifdef _WIN32
+    hasFile = file != nullptr;
+#else
+    hasFile = file >= 0;
+#endif
+    if (!hasFile) {
+        return;
+    }
+
+    // The count in the header tells the reader that the capture was closed cleanly
+    bool headerMapped = view != nullptr && mappedSegment == 0;
+    if (headerMapped) {
+        reinterpret_cast<CaptureHeader*>(view)->recordCount = recordCount;
+    }
+    unmapSegment();
+    uint64_t usedSize = sizeof(CaptureHeader) + recordCount * sizeof(CaptureRecord);
+
+#ifdef _WIN32
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(usedSize);
+    SetFilePointerEx(file, position, NULL, FILE_BEGIN);
+    SetEndOfFile(file);
+    if (!headerMapped) {
+        position.QuadPart = offsetof(CaptureHeader, recordCount);
+        SetFilePointerEx(file, position, NULL, FILE_BEGIN);
+        DWORD written;
+        WriteFile(file, &recordCount, sizeof(recordCount), &written, NULL);
+    }
+    FlushFileBuffers(file);
+    CloseHandle(file);
+    file = nullptr;
+#else
+    if (ftruncate(file, static_cast<off_t>(usedSize)) != 0) {
+        // The capture is still readable, the reader stops at the first empty record
+    }
+    if (!headerMapped) {
+        ssize_t written = pwrite(file, &recordCount, sizeof(recordCount), offsetof(CaptureHeader, recordCount));
+        (void)written;
+    }
+    fsync(file);
+    ::close(file);
+    file = -1;
+#endif
+}
+
+// Writer thread: moving the queued records into the mapped file
+void CaptureLog::writerLoop() {
+    auto lastFlush = std::chrono::steady_clock::now();
+    CaptureRecord record;
+    for (;;) {
+        bool stopRequested = stopping;
+        bool wrote = false;
+        while (queue.Pop(record)) {
+            if (!writeRecord(record)) {
+                droppedRecords++;
+            }
+            wrote = true;
+        }
+        if (stopRequested) {
+            break;  // Everything appended before Close has been written
+        }
+
+        // Bounding what a power failure can lose, on this thread so the producer never waits for the disk
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastFlush >= std::chrono::seconds(1)) {
+            flushSegment();
+            lastFlush = now;
+        }
+        if (!wrote) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    flushSegment();
+}
+
+bool CaptureLog::writeRecord(const CaptureRecord& queued) {
+    uint64_t offset = sizeof(CaptureHeader) + recordCount * sizeof(CaptureRecord);
+    uint64_t segment = offset / SEGMENT_SIZE;
+    if (view == nullptr || segment != mappedSegment) {
+        flushSegment();
+        unmapSegment();
+        if (!mapSegment(segment)) {
+            return false;
+        }
+    }
+
+    CaptureRecord record = queued;
+    record.checksum = CaptureChecksum(record);
+    std::memcpy(view + (offset - segment * SEGMENT_SIZE), &record, sizeof(record));
+    recordCount++;
+    recordsWritten++;
+    return true;
+}
+
+bool CaptureLog::mapSegment(uint64_t segment) {
+    uint64_t offset = segment * SEGMENT_SIZE;
+    uint64_t needed = offset + SEGMENT_SIZE;
+
+#ifdef _WIN32
+    mapping = CreateFileMapping(file, NULL, PAGE_READWRITE, static_cast<DWORD>(needed >> 32),
+                                static_cast<DWORD>(needed), NULL);
+    if (mapping == NULL) {
+        mapping = nullptr;
+        return false;
+    }
+    fileSize = needed;
+    view = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_WRITE, static_cast<DWORD>(offset >> 32),
+                                            static_cast<DWORD>(offset), SEGMENT_SIZE));
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+        return false;
+    }
+#else
+    if (fileSize < needed) {
+        // Reserving the blocks now: a write through the mapping into a hole on a full disk
+        // would raise SIGBUS instead of returning an error
+        int result = posix_fallocate(file, static_cast<off_t>(fileSize), static_cast<off_t>(needed - fileSize));
+        if (result == EOPNOTSUPP || result == EINVAL) {
+            result = ftruncate(file, static_cast<off_t>(needed)) == 0 ? 0 : errno;
+        }
+        if (result != 0) {
+            return false;
+        }
+        fileSize = needed;
+    }
+    void* address = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file, static_cast<off_t>(offset));
+    if (address == MAP_FAILED) {
+        return false;
+    }
+    view = static_cast<char*>(address);
+#endif
+    mappedSegment = segment;
+    return true;
+}
+
+void CaptureLog::unmapSegment() {
+    if (view == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+    mapping = nullptr;
+#else
+    munmap(view, SEGMENT_SIZE);
+#endif
+    view = nullptr;
+}
+
+void CaptureLog::flushSegment() {
+    if (view == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    FlushViewOfFile(view, 0);
+    FlushFileBuffers(file);
+#else
+    msync(view, SEGMENT_SIZE, MS_SYNC);
+#endif
+}
+
+CaptureReader::~CaptureReader() {
+    Close();
+}
+
+bool CaptureReader::Open(const std::string& path) {
+    Close();
+
+#ifdef _WIN32
+    file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                      FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || static_cast<uint64_t>(fileSize.QuadPart) < sizeof(CaptureHeader)) {
+        Close();
+        return false;
+    }
+    size = static_cast<uint64_t>(fileSize.QuadPart);
+    mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        mapping = nullptr;
+        Close();
+        return false;
+    }
+    view = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (view == nullptr) {
+        Close();
+        return false;
+    }
+#else
+    file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || static_cast<uint64_t>(status.st_size) < sizeof(CaptureHeader)) {
+        Close();
+        return false;
+    }
+    size = static_cast<uint64_t>(status.st_size);
+    void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+    if (address == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    view = static_cast<const char*>(address);
+    madvise(address, size, MADV_SEQUENTIAL);
+#endif
+
+    const CaptureHeader& header = Header();
+    if (std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 || header.version != CAPTURE_VERSION ||
+        header.recordSize != sizeof(CaptureRecord)) {
+        Close();
+        return false;
+    }
+
+    size_t available = static_cast<size_t>((size - sizeof(CaptureHeader)) / sizeof(CaptureRecord));
+    count = available;
+    if (header.recordCount != available) {
+        // Not closed cleanly: the records are kept up to the first one that is not intact, which
+        // leaves out a torn record, everything after it and the unused pre-allocated space
+        const CaptureRecord* records = Records();
+        count = 0;
+        while (count < available && IsValidCaptureRecord(records[count])) {
+            count++;
+        }
+    }
+    return true;
+}
+
+void CaptureReader::Close() {
+#ifdef _WIN32
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+    }
+    if (mapping != nullptr) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+    if (file != nullptr) {
+        CloseHandle(file);
+        file = nullptr;
+    }
+#else
+    if (view != nullptr) {
+        munmap(const_cast<char*>(view), size);
+    }
+    if (file >= 0) {
+        ::close(file);
+        file = -1;
+    }
+#endif
+    view = nullptr;
+    size = 0;
+    count = 0;
+}
+
+const CaptureHeader& CaptureReader::Header() const {
+    return *reinterpret_cast<const CaptureHeader*>(view);
+}
+
+size_t CaptureReader::Count() const {
+    return count;
+}
+
+const CaptureRecord* CaptureReader::Records() const {
+    return reinterpret_cast<const CaptureRecord*>(view + sizeof(CaptureHeader));
+}
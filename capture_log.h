@@ -0,0 +1,131 @@
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "acquisition.h"
+#include "spsc_queue.h"
+
+// Binary capture file: a 64-byte header followed by fixed 32-byte records.
+// The writer pre-allocates the file in segments and fills them through a memory mapping.
+// A record counts only if its checksum matches, so after a crash the file ends at the last
+// record that was completely written (the rest of the pre-allocated segment is zeros).
+
+const char CAPTURE_MAGIC[8] = {'P', 'S', 'U', 'C', 'A', 'P', 'T', '1'};
+const uint32_t CAPTURE_VERSION = 1;
+
+struct CaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    int64_t startSystemTime;  // Nanoseconds since the Unix epoch when the capture was opened
+    int64_t startSteadyTime;  // steady_clock nanoseconds at the same moment, the records are relative to it
+    uint64_t recordCount;     // Set on a clean close, 0 while the capture is being written
+    uint8_t reserved[24];
+};
+
+// Status bits of a record
+const uint16_t CAPTURE_STATUS_VALID = 0x0001;       // The instrument answered and the answer was parsed
+const uint16_t CAPTURE_STATUS_NO_VOLTAGE = 0x0002;  // The voltage was not polled for this record
+const uint16_t CAPTURE_STATUS_NO_CURRENT = 0x0004;  // The current was not polled for this record
+
+struct CaptureRecord {
+    int64_t timestamp;  // Nanoseconds since CaptureHeader::startSteadyTime
+    double voltage;
+    double current;
+    uint16_t device;    // Index of the supply in a rack, 0 for the panel
+    uint16_t status;
+    uint32_t checksum;
+};
+
+static_assert(sizeof(CaptureHeader) == 64, "The capture header is part of the file format");
+static_assert(sizeof(CaptureRecord) == 32, "The capture record is part of the file format");
+
+uint32_t CaptureChecksum(const CaptureRecord& record);
+bool IsValidCaptureRecord(const CaptureRecord& record);
+
+// Writer of a capture file. Append only queues the record, a writer thread copies the records
+// into the mapped file, so a slow disk or a segment switch never stalls the acquisition.
+class CaptureLog {
+public:
+    // The file grows by one segment at a time (a multiple of the page size and of the
+    // Windows allocation granularity)
+    static const size_t SEGMENT_SIZE = 64 * 1024 * 1024;
+
+    CaptureLog();
+    ~CaptureLog();
+
+    CaptureLog(const CaptureLog&) = delete;
+    CaptureLog& operator=(const CaptureLog&) = delete;
+
+    // Creating (or overwriting) the capture file and starting the writer thread
+    bool Open(const std::string& path);
+    // Writing the queued records, trimming the pre-allocated space and closing the file
+    void Close();
+    bool IsOpen() const;
+
+    // Called from one producer thread (e.g. the acquisition engine). Returns false if the
+    // capture is not open or the writer is so far behind that the queue is full.
+    bool Append(const Sample& sample, uint16_t device = 0);
+
+    uint64_t RecordsWritten() const;
+    uint64_t DroppedRecords() const;
+
+private:
+    void writerLoop();
+    bool writeRecord(const CaptureRecord& record);
+    bool mapSegment(uint64_t segment);
+    void unmapSegment();
+    void flushSegment();
+
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+    char* view = nullptr;           // Mapped segment
+    uint64_t mappedSegment = 0;
+    uint64_t fileSize = 0;
+
+    std::atomic<bool> open{false};
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+    int64_t startSteadyTime = 0;
+    uint64_t recordCount = 0;
+
+    SpscQueue<CaptureRecord, 65536> queue;
+    std::atomic<uint64_t> recordsWritten{0};
+    std::atomic<uint64_t> droppedRecords{0};
+};
+
+// Read-only view of a capture file, mapped as a whole so it can be scanned at disk speed
+class CaptureReader {
+public:
+    ~CaptureReader();
+
+    bool Open(const std::string& path);
+    void Close();
+
+    const CaptureHeader& Header() const;
+    // Records that were completely written; after a crash everything from the first torn record on is left out
+    size_t Count() const;
+    const CaptureRecord* Records() const;
+
+private:
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+    const char* view = nullptr;
+    uint64_t size = 0;
+    size_t count = 0;
+};
+
+#endif // CAPTURE_LOG_H
@@ -0,0 +1,186 @@
+/*****************************************************************************************************************
+ * Reader of capture files written by CaptureLog (capture_log.h).
+ *
+ * capture_tool csv <capture> [<output.csv>]   Exporting the records as CSV (to stdout without an output file)
+ * capture_tool stats <capture>                Per-device min/max/mean/RMS/standard deviation of the valid records
+ *
+ * The capture is memory-mapped and scanned sequentially, the CSV text is built with std::to_chars in a large
+ * buffer, so both commands run at about the speed of the disk.
+ ***************************************************************************************************************/
+
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "capture_log.h"
+#include "numeric.h"  // NUMBER_BUFFER_SIZE
+#include "statistics.h"
+
+// Output buffer of the CSV export
+class CsvWriter {
+public:
+    explicit CsvWriter(FILE* output) : output(output) {}
+
+    void Text(const char* text) {
+        size_t length = strlen(text);
+        reserve(length);
+        memcpy(buffer + used, text, length);
+        used += length;
+    }
+
+    // Shortest text that reads back as the same double
+    void Number(double value) {
+        reserve(NUMBER_BUFFER_SIZE);
+        used = static_cast<size_t>(std::to_chars(buffer + used, buffer + used + NUMBER_BUFFER_SIZE, value).ptr - buffer);
+    }
+
+    void Integer(long long value) {
+        reserve(24);
+        used = static_cast<size_t>(std::to_chars(buffer + used, buffer + used + 24, value).ptr - buffer);
+    }
+
+    // Nanoseconds as seconds with nine decimals, in integer arithmetic
+    void Seconds(int64_t nanoseconds) {
+        if (nanoseconds < 0) {
+            Char('-');
+            nanoseconds = -nanoseconds;
+        }
+        Integer(nanoseconds / 1000000000);
+        Char('.');
+        char fraction[10];
+        std::to_chars_result result = std::to_chars(fraction, fraction + sizeof(fraction), nanoseconds % 1000000000 + 1000000000);
+        reserve(9);
+        memcpy(buffer + used, fraction + 1, static_cast<size_t>(result.ptr - fraction) - 1);
+        used += 9;
+    }
+
+    void Char(char c) {
+        reserve(1);
+        buffer[used++] = c;
+    }
+
+    bool Flush() {
+        bool ok = fwrite(buffer, 1, used, output) == used;
+        used = 0;
+        return ok;
+    }
+
+private:
+    void reserve(size_t length) {
+        if (used + length > sizeof(buffer)) {
+            Flush();
+        }
+    }
+
+    FILE* output;
+    char buffer[1 << 20];
+    size_t used = 0;
+};
+
+static int exportCsv(const CaptureReader& reader, const char* outputPath) {
+    FILE* output = outputPath != nullptr ? fopen(outputPath, "wb") : stdout;
+    if (output == nullptr) {
+        fprintf(stderr, "Cannot create %s\n", outputPath);
+        return 1;
+    }
+
+    std::unique_ptr<CsvWriter> buffered(new CsvWriter(output));  // The buffer is too large for the stack
+    CsvWriter& writer = *buffered;
+    writer.Text("time_s,voltage,current,device,status\n");
+    const CaptureRecord* records = reader.Records();
+    for (size_t i = 0; i < reader.Count(); i++) {
+        const CaptureRecord& record = records[i];
+        writer.Seconds(record.timestamp);
+        writer.Char(',');
+        writer.Number(record.voltage);
+        writer.Char(',');
+        writer.Number(record.current);
+        writer.Char(',');
+        writer.Integer(record.device);
+        writer.Char(',');
+        writer.Integer(record.status);
+        writer.Char('\n');
+    }
+    bool ok = writer.Flush();
+    if (output != stdout) {
+        ok = fclose(output) == 0 && ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error writing the CSV file\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void printStatistics(const char* name, const RunningStatistics& statistics) {
+    printf("  %-8s min %-12g max %-12g mean %-12g rms %-12g std %g\n", name, statistics.minimum, statistics.maximum,
+           statistics.mean, statistics.Rms(), statistics.StandardDeviation());
+}
+
+static int printCaptureStatistics(const CaptureReader& reader) {
+    struct DeviceStatistics {
+        RunningStatistics voltage;
+        RunningStatistics current;
+        uint64_t invalid = 0;
+    };
+    std::map<uint16_t, DeviceStatistics> devices;
+
+    const CaptureRecord* records = reader.Records();
+    for (size_t i = 0; i < reader.Count(); i++) {
+        const CaptureRecord& record = records[i];
+        DeviceStatistics& device = devices[record.device];
+        if (record.status & CAPTURE_STATUS_VALID) {
+            if (!(record.status & CAPTURE_STATUS_NO_VOLTAGE)) {
+                device.voltage.Add(record.voltage);
+            }
+            if (!(record.status & CAPTURE_STATUS_NO_CURRENT)) {
+                device.current.Add(record.current);
+            }
+        } else {
+            device.invalid++;
+        }
+    }
+
+    double duration = reader.Count() > 1 ? (records[reader.Count() - 1].timestamp - records[0].timestamp) * 1e-9 : 0.0;
+    printf("%zu records over %.3f s", reader.Count(), duration);
+    if (duration > 0.0) {
+        printf(" (%.1f records/s)", (reader.Count() - 1) / duration);
+    }
+    printf("\n");
+    for (const auto& entry : devices) {
+        printf("device %u: %llu voltage and %llu current readings, %llu invalid records\n", entry.first,
+               static_cast<unsigned long long>(entry.second.voltage.count),
+               static_cast<unsigned long long>(entry.second.current.count),
+               static_cast<unsigned long long>(entry.second.invalid));
+        printStatistics("voltage", entry.second.voltage);
+        printStatistics("current", entry.second.current);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || (strcmp(argv[1], "csv") != 0 && strcmp(argv[1], "stats") != 0)) {
+        fprintf(stderr, "Usage: %s csv <capture> [<output.csv>]\n       %s stats <capture>\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    CaptureReader reader;
+    if (!reader.Open(argv[2])) {
+        fprintf(stderr, "%s is not a readable capture file\n", argv[2]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int result = strcmp(argv[1], "csv") == 0 ? exportCsv(reader, argc > 3 ? argv[3] : nullptr)
+                                             : printCaptureStatistics(reader);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double megabytes = reader.Count() * sizeof(CaptureRecord) / 1e6;
+    fprintf(stderr, "Scanned %.1f MB in %.3f s (%.0f MB/s)\n", megabytes, elapsed.count(),
+            elapsed.count() > 0.0 ? megabytes / elapsed.count() : 0.0);
+    return result;
+}
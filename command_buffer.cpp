@@ -0,0 +1,39 @@
+#include "command_buffer.h"
+
+CommandBuffer::CommandBuffer(size_t capacity) {
+    buffer.reserve(capacity);
+}
+
+void CommandBuffer::Append(const char* command, size_t length) {
+    buffer.append(command, length);
+    buffer += '\n';
+}
+
+void CommandBuffer::Append(const std::string& command) {
+    Append(command.data(), command.size());
+}
+
+void CommandBuffer::AppendMessage(const char* message, size_t length) {
+    buffer.append(message, length);
+}
+
+bool CommandBuffer::Flush(Transport& transport) {
+    if (buffer.empty()) {
+        return true;
+    }
+    bool written = transport.WriteMessage(buffer.data(), buffer.size());
+    buffer.clear();
+    return written;
+}
+
+bool CommandBuffer::Empty() const {
+    return buffer.empty();
+}
+
+size_t CommandBuffer::Size() const {
+    return buffer.size();
+}
+
+void CommandBuffer::Clear() {
+    buffer.clear();
+}
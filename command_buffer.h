@@ -0,0 +1,34 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <cstddef>
+#include <string>
+
+#include "transport.h"
+
+// Outgoing commands collected in a reused, pre-sized buffer and written with one call, so a
+// burst of commands costs one system call and, once the buffer has its size, no allocation
+class CommandBuffer {
+public:
+    static const size_t DEFAULT_CAPACITY = 4096;
+
+    explicit CommandBuffer(size_t capacity = DEFAULT_CAPACITY);
+
+    // Adding a command and its line terminator
+    void Append(const char* command, size_t length);
+    void Append(const std::string& command);
+    // Adding a message that already ends with the terminator
+    void AppendMessage(const char* message, size_t length);
+
+    // Writing everything collected as one message; the buffer is emptied even if the write fails
+    bool Flush(Transport& transport);
+
+    bool Empty() const;
+    size_t Size() const;
+    void Clear();
+
+private:
+    std::string buffer;  // Cleared, never shrunk
+};
+
+#endif // COMMAND_BUFFER_H
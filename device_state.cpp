@@ -0,0 +1,194 @@
+#include "device_state.h"
+
+#include <vector>
+
+#include "numeric.h"
+
+// Command of the table that programs each setting
+static const ScpiCommandId settingCommands[SETTING_COUNT] = {
+    SCPI_VOLTAGE, SCPI_CURRENT, SCPI_RISE, SCPI_FALL, SCPI_OUTPUT, SCPI_REMOTE,
+};
+
+static bool findSetting(ScpiCommandId id, DeviceSetting& setting) {
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        if (settingCommands[i] == id) {
+            setting = static_cast<DeviceSetting>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+DeviceStateCache::DeviceStateCache(const ScpiModel& model)
+    : model(&model) {}
+
+void DeviceStateCache::SetModel(const ScpiModel& model) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->model = &model;
+    for (Entry& entry : entries) {
+        entry.known = false;
+    }
+}
+
+double DeviceStateCache::normalize(DeviceSetting setting, double value) const {
+    const ScpiCommandSpec& spec = model->commands[settingCommands[setting]];
+    if (spec.parameter != PARAMETER_NUMBER) {
+        return value;
+    }
+    char text[NUMBER_BUFFER_SIZE];
+    size_t length = FormatNumber(value, text, sizeof(text), spec.precision);
+    ParseScpiNumber(text, text + length, value);
+    return value;
+}
+
+bool DeviceStateCache::ReadBack(const ScpiBatch::QueryFunction& query) {
+    // The settings are queried with the model's mnemonic and a '?' ("VOLT?"), all in one message
+    std::vector<DeviceSetting> queried;
+    std::string message;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < SETTING_COUNT; i++) {
+            const ScpiCommandSpec& spec = model->commands[settingCommands[i]];
+            if (spec.shortForm != nullptr && spec.parameter != PARAMETER_NONE) {
+                AppendToProgramMessage(message, std::string(spec.shortForm) + '?');
+                queried.push_back(static_cast<DeviceSetting>(i));
+            }
+        }
+    }
+    if (queried.empty()) {
+        return true;
+    }
+
+    std::string response;
+    if (!query(message, response)) {
+        return false;
+    }
+    std::vector<std::string> parts;
+    SplitResponseMessage(response, parts);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (parts.size() != queried.size()) {
+        return false;  // The answers cannot be told apart
+    }
+    bool complete = true;
+    for (size_t i = 0; i < queried.size(); i++) {
+        DeviceSetting setting = queried[i];
+        Entry& entry = entries[setting];
+        double value = 0.0;
+        bool on = false;
+        if (model->commands[settingCommands[setting]].parameter == PARAMETER_BOOLEAN) {
+            entry.known = DecodeScpiBoolean(parts[i], on);
+            value = on ? 1.0 : 0.0;
+        } else {
+            entry.known = ParseScpiNumber(parts[i], value);
+        }
+        entry.value = normalize(setting, value);
+        complete = complete && entry.known;
+    }
+    return complete;
+}
+
+bool DeviceStateCache::ShouldSend(const std::string& command) {
+    // Queries change nothing
+    bool isQuery = command.find('?') != std::string::npos;
+    bool isCompound = command.find(';') != std::string::npos;
+    if (isQuery && !isCompound) {
+        return true;
+    }
+
+    size_t headerStart = 0;
+    while (headerStart < command.size() && (isBlank(command[headerStart]) || command[headerStart] == ':')) {
+        headerStart++;
+    }
+    size_t headerEnd = headerStart;
+    while (headerEnd < command.size() && !isBlank(command[headerEnd])) {
+        headerEnd++;
+    }
+    std::string header = command.substr(headerStart, headerEnd - headerStart);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const ScpiCommandSpec* spec = isCompound ? nullptr : FindScpiCommand(*model, header);
+    DeviceSetting setting;
+    if (spec == nullptr || !findSetting(spec->id, setting)) {
+        // Common commands other than *RST and *RCL leave the settings alone, anything else
+        // may change them in ways the cache does not follow
+        if (isCompound || header.empty() || header[0] != '*' || header == "*RST" || header == "*RCL") {
+            for (Entry& entry : entries) {
+                entry.known = false;
+            }
+        }
+        return true;
+    }
+
+    double value = 1.0;  // Commands without a parameter (SYST:REM) switch the setting on
+    const char* parameter = command.data() + headerEnd;
+    const char* end = command.data() + command.size();
+    bool valid = true;
+    if (spec->parameter == PARAMETER_NUMBER) {
+        valid = ParseScpiNumber(parameter, end, value);
+    } else if (spec->parameter == PARAMETER_BOOLEAN) {
+        bool on = false;
+        valid = DecodeScpiBoolean(std::string(parameter, end), on);
+        value = on ? 1.0 : 0.0;
+    }
+
+    Entry& entry = entries[setting];
+    if (!valid) {
+        // The supply decides what to make of it
+        entry.known = false;
+        return true;
+    }
+    value = normalize(setting, value);
+    if (setting == SETTING_REMOTE) {
+        // The LOCAL key on the front panel ends remote control without the cache knowing, and the
+        // knobs may have changed anything since: always sent, and nothing else is known any more
+        for (Entry& other : entries) {
+            other.known = false;
+        }
+        entry.known = true;
+        entry.value = value;
+        return true;
+    }
+    bool filtered = setting != SETTING_OUTPUT || (outputPolled && value != 0.0);
+    if (filtered && entry.known && entry.value == value) {
+        skippedCommands++;
+        return false;
+    }
+    entry.known = true;
+    entry.value = value;
+    return true;
+}
+
+void DeviceStateCache::SetOutputPolled(bool polled) {
+    std::lock_guard<std::mutex> lock(mutex);
+    outputPolled = polled;
+}
+
+bool DeviceStateCache::Get(DeviceSetting setting, double& value) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!entries[setting].known) {
+        return false;
+    }
+    value = entries[setting].value;
+    return true;
+}
+
+void DeviceStateCache::Invalidate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Entry& entry : entries) {
+        entry.known = false;
+    }
+}
+
+void DeviceStateCache::Invalidate(DeviceSetting setting) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[setting].known = false;
+}
+
+uint64_t DeviceStateCache::SkippedCommands() const {
+    return skippedCommands;
+}
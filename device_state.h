@@ -0,0 +1,72 @@
+#ifndef DEVICE_STATE_H
+#define DEVICE_STATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "scpi_batch.h"
+#include "scpi_commands.h"
+
+// Programmed settings of a supply mirrored by the cache
+enum DeviceSetting {
+    SETTING_VOLTAGE,
+    SETTING_CURRENT,
+    SETTING_RISE,
+    SETTING_FALL,
+    SETTING_OUTPUT,  // 0 or 1
+    SETTING_REMOTE,  // 0 or 1; there is no query for it, it is known once SYST:REM has been sent
+    SETTING_COUNT
+};
+
+// Shadow copy of what the supply is programmed to. It is filled on connect by one batched
+// read-back and kept up to date by the commands sent; a setting command that would not change
+// anything is not sent at all. Anything the cache cannot follow (*RST, an unknown command,
+// a failed write, a reconnect) invalidates it. Used from several threads.
+class DeviceStateCache {
+public:
+    explicit DeviceStateCache(const ScpiModel& model = GENERIC_SUPPLY);
+
+    // The connected model; the cache is invalidated
+    void SetModel(const ScpiModel& model);
+
+    // Reading back the settings that have a query with one program message ("VOLT?;:CURR?;...").
+    // Returns false if the response is incomplete, the settings that were read are kept.
+    bool ReadBack(const ScpiBatch::QueryFunction& query);
+
+    // Deciding whether a command has to be sent: false if it only sets what the supply already has.
+    // Otherwise the cache is updated as if the command had been carried out; Invalidate if it was not.
+    // The supply switches its output off by itself (protection, front panel), so OUTP OFF is always
+    // sent, and OUTP ON only skipped while the output state is polled. SYST:REM is always sent and
+    // forgets the other settings, which the front panel may have changed while it was in local.
+    bool ShouldSend(const std::string& command);
+
+    // Whether OUTP? is part of the periodic poll, which keeps SETTING_OUTPUT current (off by default)
+    void SetOutputPolled(bool polled);
+
+    // Cached setting; false if it is not known
+    bool Get(DeviceSetting setting, double& value) const;
+
+    void Invalidate();
+    void Invalidate(DeviceSetting setting);
+
+    uint64_t SkippedCommands() const;
+
+private:
+    struct Entry {
+        bool known = false;
+        double value = 0.0;
+    };
+
+    // The value as the supply stores it, rounded to the decimals the commands are sent with
+    double normalize(DeviceSetting setting, double value) const;
+
+    mutable std::mutex mutex;
+    const ScpiModel* model;
+    Entry entries[SETTING_COUNT];
+    bool outputPolled = false;
+    std::atomic<uint64_t> skippedCommands{0};
+};
+
+#endif // DEVICE_STATE_H
@@ -0,0 +1,351 @@
+#include "event_loop.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+struct EventLoop::WatchedHandle {
+    OVERLAPPED overlapped;  // Must stay the first member, completions are mapped back through it
+    NativeHandle handle;
+    DataCallback onData;
+    Callback onError;
+    bool closing;
+    bool socket;
+    char buffer[4096];
+};
+#else
+struct EventLoop::WatchedHandle {
+    NativeHandle handle;
+    DataCallback onData;
+    Callback onError;
+};
+#endif
+
+#ifdef _WIN32
+
+EventLoop::EventLoop() {
+    completionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+}
+
+EventLoop::~EventLoop() {
+    for (auto& entry : watches) {
+        CancelIoEx(entry.first, &entry.second->overlapped);
+    }
+    // Waiting for the cancelled reads, their buffers must not be freed while the driver owns them
+    size_t pending = watches.size() + retired.size();
+    while (pending > 0) {
+        DWORD bytes;
+        ULONG_PTR key;
+        OVERLAPPED* overlapped = NULL;
+        if (!GetQueuedCompletionStatus(completionPort, &bytes, &key, &overlapped, 1000) && overlapped == NULL) {
+            break;
+        }
+        if (overlapped != NULL) {
+            pending--;
+        }
+    }
+    CloseHandle(completionPort);
+}
+
+bool EventLoop::IsValid() const {
+    return completionPort != NULL;
+}
+
+void EventLoop::issueRead(WatchedHandle& watched) {
+    watched.overlapped = OVERLAPPED();
+    if (!ReadFile(watched.handle, watched.buffer, sizeof(watched.buffer), NULL, &watched.overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        NativeHandle handle = watched.handle;
+        Post([this, handle] { fail(handle); });
+    }
+}
+
+bool EventLoop::Watch(NativeHandle handle, DataCallback onData, Callback onError) {
+    if (watches.count(handle) != 0) {
+        return false;
+    }
+    std::unique_ptr<WatchedHandle> watched(new WatchedHandle());
+    watched->handle = handle;
+    watched->onData = std::move(onData);
+    watched->onError = std::move(onError);
+    watched->closing = false;
+    watched->socket = false;
+
+    // A handle can be associated with only one completion port for its whole lifetime
+    if (CreateIoCompletionPort(handle, completionPort, reinterpret_cast<ULONG_PTR>(watched.get()), 0) == NULL) {
+        return false;
+    }
+    WatchedHandle& entry = *watched;
+    watches[handle] = std::move(watched);
+    issueRead(entry);
+    return true;
+}
+
+bool EventLoop::WatchSocket(NativeHandle handle, DataCallback onData, Callback onError) {
+    if (!Watch(handle, std::move(onData), std::move(onError))) {
+        return false;
+    }
+    watches[handle]->socket = true;
+    return true;
+}
+
+void EventLoop::Unwatch(NativeHandle handle) {
+    auto it = watches.find(handle);
+    if (it == watches.end()) {
+        return;
+    }
+    it->second->closing = true;
+    CancelIoEx(handle, &it->second->overlapped);
+    retired.push_back(std::move(it->second));
+    watches.erase(it);
+}
+
+void EventLoop::wake() {
+    PostQueuedCompletionStatus(completionPort, 0, 0, NULL);
+}
+
+void EventLoop::waitForEvents(int timeoutMs) {
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED* overlapped = NULL;
+    BOOL ok = GetQueuedCompletionStatus(completionPort, &bytes, &key, &overlapped,
+                                        timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs));
+    if (overlapped == NULL) {
+        return;  // Timeout or wake-up
+    }
+
+    WatchedHandle* watched = reinterpret_cast<WatchedHandle*>(key);
+    if (watched->closing) {
+        // The cancelled read has completed, now the buffer can be freed
+        retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                     [watched](const std::unique_ptr<WatchedHandle>& entry) { return entry.get() == watched; }),
+                      retired.end());
+        return;
+    }
+
+    NativeHandle handle = watched->handle;
+    if (!ok || (bytes == 0 && watched->socket)) {
+        fail(handle);
+        return;
+    }
+    if (bytes > 0) {
+        watched->onData(watched->buffer, bytes);
+    }
+    // The callback may have unwatched the handle
+    auto it = watches.find(handle);
+    if (it != watches.end() && it->second.get() == watched) {
+        issueRead(*watched);
+    }
+}
+
+#else
+
+EventLoop::EventLoop() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+}
+
+EventLoop::~EventLoop() {
+    close(wakeFd);
+    close(epollFd);
+}
+
+bool EventLoop::IsValid() const {
+    return epollFd >= 0 && wakeFd >= 0;
+}
+
+bool EventLoop::Watch(NativeHandle handle, DataCallback onData, Callback onError) {
+    if (handle < 0 || watches.count(handle) != 0) {
+        return false;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = handle;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, handle, &event) != 0) {
+        return false;
+    }
+
+    std::unique_ptr<WatchedHandle> watched(new WatchedHandle());
+    watched->handle = handle;
+    watched->onData = std::move(onData);
+    watched->onError = std::move(onError);
+    watches[handle] = std::move(watched);
+    return true;
+}
+
+// epoll reports a closed socket like a hung-up port
+bool EventLoop::WatchSocket(NativeHandle handle, DataCallback onData, Callback onError) {
+    return Watch(handle, std::move(onData), std::move(onError));
+}
+
+void EventLoop::Unwatch(NativeHandle handle) {
+    auto it = watches.find(handle);
+    if (it == watches.end()) {
+        return;
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, handle, nullptr);
+    retired.push_back(std::move(it->second));
+    watches.erase(it);
+}
+
+void EventLoop::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd, &one, sizeof(one));
+    (void)written;
+}
+
+void EventLoop::waitForEvents(int timeoutMs) {
+    epoll_event events[64];
+    int count = epoll_wait(epollFd, events, 64, timeoutMs);
+
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wakeFd) {
+            uint64_t value;
+            ssize_t bytesRead = read(wakeFd, &value, sizeof(value));
+            (void)bytesRead;
+            continue;
+        }
+
+        // A tty in raw mode returns 0 from read() when it is drained, so the end of the stream
+        // is taken from the event flags, not from the read result
+        bool failed = (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+            // Draining the descriptor; the callback may unwatch it, so it is looked up every time
+            for (;;) {
+                auto it = watches.find(fd);
+                if (it == watches.end()) {
+                    failed = false;
+                    break;
+                }
+                ssize_t bytesRead = read(fd, readBuffer, sizeof(readBuffer));
+                if (bytesRead > 0) {
+                    it->second->onData(readBuffer, static_cast<size_t>(bytesRead));
+                    continue;
+                }
+                if (bytesRead < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (bytesRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    failed = true;
+                }
+                break;
+            }
+        }
+        if (failed) {
+            fail(fd);
+        }
+    }
+    retired.clear();
+}
+
+#endif
+
+void EventLoop::fail(NativeHandle handle) {
+    auto it = watches.find(handle);
+    if (it == watches.end()) {
+        return;
+    }
+    Callback onError = it->second->onError;
+    Unwatch(handle);
+    if (onError) {
+        onError();
+    }
+}
+
+EventLoop::TimerId EventLoop::AddTimer(std::chrono::steady_clock::time_point when, Callback callback) {
+    TimerId id = nextTimerId++;
+    timers[id] = std::move(callback);
+    timerQueue.push(Timer{when, id});
+    return id;
+}
+
+void EventLoop::CancelTimer(TimerId id) {
+    timers.erase(id);
+}
+
+void EventLoop::Post(Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(postedMutex);
+        posted.push_back(std::move(callback));
+    }
+    wake();
+}
+
+void EventLoop::Stop() {
+    stopped = true;
+    wake();
+}
+
+void EventLoop::runPosted() {
+    {
+        std::lock_guard<std::mutex> lock(postedMutex);
+        running.swap(posted);
+    }
+    for (Callback& callback : running) {
+        callback();
+    }
+    running.clear();
+}
+
+void EventLoop::runTimers() {
+    auto now = std::chrono::steady_clock::now();
+    while (!timerQueue.empty() && timerQueue.top().when <= now) {
+        TimerId id = timerQueue.top().id;
+        timerQueue.pop();
+        auto it = timers.find(id);
+        if (it == timers.end()) {
+            continue;  // Cancelled
+        }
+        Callback callback = std::move(it->second);
+        timers.erase(it);
+        callback();
+    }
+}
+
+int EventLoop::timeoutUntilNextTimer(std::chrono::steady_clock::time_point limit) const {
+    auto next = limit;
+    if (!timerQueue.empty() && timerQueue.top().when < next) {
+        next = timerQueue.top().when;
+    }
+    if (next == std::chrono::steady_clock::time_point::max()) {
+        return -1;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (next <= now) {
+        return 0;
+    }
+    // Rounding up, so the loop does not wake up just before the timer is due
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now) + std::chrono::milliseconds(1);
+    return static_cast<int>(std::min<long long>(wait.count(), 60000));
+}
+
+void EventLoop::Run() {
+    RunUntil(std::chrono::steady_clock::time_point::max());
+}
+
+void EventLoop::RunUntil(std::chrono::steady_clock::time_point deadline) {
+    while (!stopped && std::chrono::steady_clock::now() < deadline) {
+        runPosted();
+        runTimers();
+        if (stopped) {
+            break;
+        }
+        waitForEvents(timeoutUntilNextTimer(deadline));
+    }
+    runPosted();
+    stopped = false;
+}
@@ -0,0 +1,94 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include "transport.h"
+
+// Single-threaded event loop for many ports: I/O readiness/completion (epoll on Linux,
+// I/O completion ports on Windows), timers and callbacks posted from other threads.
+// Everything except Post and Stop must be called on the loop thread.
+class EventLoop {
+public:
+    typedef std::function<void()> Callback;
+    typedef std::function<void(const char* data, size_t length)> DataCallback;
+    typedef uint64_t TimerId;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool IsValid() const;
+
+    // Delivering every byte that arrives on the handle to onData; onError is called once
+    // if the handle fails or hangs up (the handle is unwatched at that point)
+    bool Watch(NativeHandle handle, DataCallback onData, Callback onError);
+    // The same for a connected socket, whose peer closing it is reported through onError
+    // (on Windows a read of zero bytes, which on a port is only a read timeout)
+    bool WatchSocket(NativeHandle handle, DataCallback onData, Callback onError);
+    void Unwatch(NativeHandle handle);
+
+    TimerId AddTimer(std::chrono::steady_clock::time_point when, Callback callback);
+    void CancelTimer(TimerId id);
+
+    // Thread-safe: running the callback on the loop thread
+    void Post(Callback callback);
+
+    // Running until Stop is called
+    void Run();
+    // Processing events until the deadline or Stop
+    void RunUntil(std::chrono::steady_clock::time_point deadline);
+    // Thread-safe
+    void Stop();
+
+private:
+    struct WatchedHandle;
+    struct Timer {
+        std::chrono::steady_clock::time_point when;
+        TimerId id;
+        bool operator>(const Timer& other) const { return when > other.when || (when == other.when && id > other.id); }
+    };
+
+    void waitForEvents(int timeoutMs);
+    void wake();
+    void runPosted();
+    void runTimers();
+    int timeoutUntilNextTimer(std::chrono::steady_clock::time_point limit) const;
+
+#ifdef _WIN32
+    void issueRead(WatchedHandle& watched);
+    void* completionPort;
+#else
+    int epollFd;
+    int wakeFd;
+    char readBuffer[4096];
+#endif
+
+    void fail(NativeHandle handle);
+
+    std::map<NativeHandle, std::unique_ptr<WatchedHandle>> watches;
+    // Unwatched handles are destroyed only when none of their callbacks can still be running
+    std::vector<std::unique_ptr<WatchedHandle>> retired;
+
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timerQueue;
+    std::map<TimerId, Callback> timers;  // Cancelled timers are removed here and skipped in the queue
+    TimerId nextTimerId = 1;
+
+    std::mutex postedMutex;
+    std::vector<Callback> posted;
+    std::vector<Callback> running;  // Posted callbacks being run, swapped with posted
+
+    std::atomic<bool> stopped{false};
+};
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,300 @@
+#include "instrumentation.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// Counters of one command on one thread
+struct CommandCounters {
+    LatencyHistogram metrics[IO_METRIC_COUNT];
+    std::atomic<uint64_t> counters[IO_COUNTER_COUNT] = {};
+};
+
+// Counters of one thread; the commands are allocated on their first use by the thread
+struct ThreadCounters {
+    std::atomic<CommandCounters*> commands[MAX_INSTRUMENTED_COMMANDS] = {};
+
+    ~ThreadCounters() {
+        for (auto& command : commands) {
+            delete command.load();
+        }
+    }
+};
+
+const size_t MAX_NAME_LENGTH = 31;
+const char* const METRIC_NAMES[IO_METRIC_COUNT] = {"write", "first byte", "response", "total"};
+
+// The threads' counters are kept after the threads end, so nothing recorded is lost
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadCounters>> threads;
+
+// Command names, published by count (written before the count is raised)
+char commandNames[MAX_INSTRUMENTED_COMMANDS][MAX_NAME_LENGTH + 1];
+std::atomic<int> commandCount{0};
+
+thread_local ThreadCounters* localCounters = nullptr;
+
+}  // namespace
+
+// Adding to a counter only its own thread writes: no read-modify-write instruction is needed
+static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+static CommandCounters& localCommand(CommandId command) {
+    if (localCounters == nullptr) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        threads.emplace_back(new ThreadCounters());
+        localCounters = threads.back().get();
+    }
+    CommandCounters* counters = localCounters->commands[command].load(std::memory_order_relaxed);
+    if (counters == nullptr) {
+        counters = new CommandCounters();
+        localCounters->commands[command].store(counters, std::memory_order_release);
+    }
+    return *counters;
+}
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) {
+    const uint64_t linear = uint64_t(1) << SUB_BUCKET_BITS;
+    // Not std::min, which takes MAX_VALUE by reference and needs a definition of it to link without optimization
+    if (value > MAX_VALUE) {
+        value = MAX_VALUE;
+    }
+    if (value < linear) {
+        return static_cast<size_t>(value);
+    }
+    int highestBit = 63;
+    while (!(value >> highestBit)) {
+        highestBit--;
+    }
+    int exponent = highestBit - SUB_BUCKET_BITS + 1;
+    return (static_cast<size_t>(exponent) << (SUB_BUCKET_BITS - 1)) + static_cast<size_t>(value >> exponent);
+}
+
+uint64_t LatencyHistogram::BucketLowest(size_t index) {
+    if (index < (size_t(1) << SUB_BUCKET_BITS)) {
+        return index;
+    }
+    size_t exponent = (index >> (SUB_BUCKET_BITS - 1)) - 1;
+    return static_cast<uint64_t>(index - (exponent << (SUB_BUCKET_BITS - 1))) << exponent;
+}
+
+uint64_t LatencyHistogram::BucketHighest(size_t index) {
+    return index + 1 < BUCKET_COUNT ? BucketLowest(index + 1) - 1 : MAX_VALUE;
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+    bump(counts[BucketIndex(value)], 1);
+    bump(total, 1);
+    bump(sum, value);
+    if (value > maximum.load(std::memory_order_relaxed)) {
+        maximum.store(value, std::memory_order_relaxed);
+    }
+}
+
+void HistogramSnapshot::Add(const LatencyHistogram& histogram) {
+    counts.resize(LatencyHistogram::BUCKET_COUNT);
+    for (size_t i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+        counts[i] += histogram.counts[i].load(std::memory_order_relaxed);
+    }
+    count += histogram.total.load(std::memory_order_relaxed);
+    sum += histogram.sum.load(std::memory_order_relaxed);
+    maximum = std::max(maximum, histogram.maximum.load(std::memory_order_relaxed));
+}
+
+double HistogramSnapshot::Percentile(double share) const {
+    // The bucket counts and the total are read one by one, so they are added up again here
+    uint64_t bucketTotal = 0;
+    for (uint64_t bucketCount : counts) {
+        bucketTotal += bucketCount;
+    }
+    if (bucketTotal == 0) {
+        return 0.0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::max(1.0, std::min(1.0, share) * static_cast<double>(bucketTotal) + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            // The middle of the bucket, but never above the largest value recorded
+            double middle = (LatencyHistogram::BucketLowest(i) + LatencyHistogram::BucketHighest(i)) / 2.0;
+            return std::min(middle, static_cast<double>(maximum));
+        }
+    }
+    return static_cast<double>(maximum);
+}
+
+double HistogramSnapshot::Mean() const {
+    return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+}
+
+CommandId InstrumentedCommand(const char* text, size_t length) {
+    // The header: up to the first blank, without the terminator
+    size_t end = 0;
+    while (end < length && text[end] != ' ' && text[end] != '\t' && text[end] != '\r' && text[end] != '\n') {
+        end++;
+    }
+    end = std::min(end, MAX_NAME_LENGTH);
+
+    int count = commandCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        if (std::strncmp(commandNames[i], text, end) == 0 && commandNames[i][end] == '\0') {
+            return i;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    count = commandCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        if (std::strncmp(commandNames[i], text, end) == 0 && commandNames[i][end] == '\0') {
+            return i;
+        }
+    }
+    if (count >= MAX_INSTRUMENTED_COMMANDS - 1) {
+        // The last slot collects the commands that did not fit
+        if (count == MAX_INSTRUMENTED_COMMANDS - 1) {
+            std::strcpy(commandNames[count], "(other)");
+            commandCount.store(MAX_INSTRUMENTED_COMMANDS, std::memory_order_release);
+        }
+        return MAX_INSTRUMENTED_COMMANDS - 1;
+    }
+    std::memcpy(commandNames[count], text, end);
+    commandNames[count][end] = '\0';
+    commandCount.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+CommandId InstrumentedCommand(const std::string& text) {
+    return InstrumentedCommand(text.data(), text.size());
+}
+
+void RecordLatency(CommandId command, IoMetric metric, std::chrono::nanoseconds latency) {
+    localCommand(command).metrics[metric].Record(static_cast<uint64_t>(std::max<int64_t>(0, latency.count())));
+}
+
+void AddToCounter(CommandId command, IoCounter counter, uint64_t amount) {
+    bump(localCommand(command).counters[counter], amount);
+}
+
+std::vector<CommandStatistics> InstrumentationSnapshot() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::vector<CommandStatistics> statistics(commandCount.load(std::memory_order_acquire));
+    for (size_t i = 0; i < statistics.size(); i++) {
+        statistics[i].name = commandNames[i];
+        for (const auto& thread : threads) {
+            const CommandCounters* counters = thread->commands[i].load(std::memory_order_acquire);
+            if (counters == nullptr) {
+                continue;
+            }
+            for (int metric = 0; metric < IO_METRIC_COUNT; metric++) {
+                statistics[i].metrics[metric].Add(counters->metrics[metric]);
+            }
+            for (int counter = 0; counter < IO_COUNTER_COUNT; counter++) {
+                statistics[i].counters[counter] += counters->counters[counter].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return statistics;
+}
+
+void PrintInstrumentation(FILE* file) {
+    std::fprintf(file, "%-24s %-10s %10s %10s %10s %10s %10s %10s %10s\n", "command", "metric", "count", "mean us",
+                 "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+    for (const CommandStatistics& command : InstrumentationSnapshot()) {
+        if (command.counters[COUNTER_CALLS] == 0) {
+            continue;  // Nothing recorded since the last reset
+        }
+        for (int metric = 0; metric < IO_METRIC_COUNT; metric++) {
+            const HistogramSnapshot& histogram = command.metrics[metric];
+            if (histogram.count == 0) {
+                continue;
+            }
+            std::fprintf(file, "%-24s %-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", command.name.c_str(),
+                         METRIC_NAMES[metric], static_cast<unsigned long long>(histogram.count), histogram.Mean() / 1e3,
+                         histogram.Percentile(0.5) / 1e3, histogram.Percentile(0.9) / 1e3,
+                         histogram.Percentile(0.99) / 1e3, histogram.Percentile(0.999) / 1e3, histogram.maximum / 1e3);
+        }
+        std::fprintf(file, "%-24s calls %llu, bytes written %llu, bytes read %llu, timeouts %llu, errors %llu\n",
+                     command.name.c_str(), static_cast<unsigned long long>(command.counters[COUNTER_CALLS]),
+                     static_cast<unsigned long long>(command.counters[COUNTER_BYTES_WRITTEN]),
+                     static_cast<unsigned long long>(command.counters[COUNTER_BYTES_READ]),
+                     static_cast<unsigned long long>(command.counters[COUNTER_TIMEOUTS]),
+                     static_cast<unsigned long long>(command.counters[COUNTER_ERRORS]));
+    }
+}
+
+bool DumpInstrumentation(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    PrintInstrumentation(file);
+    return std::fclose(file) == 0;
+}
+
+void ResetInstrumentation() {
+    // Values recorded while the counters are being cleared may be lost
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto& thread : threads) {
+        for (auto& command : thread->commands) {
+            CommandCounters* counters = command.load(std::memory_order_acquire);
+            if (counters == nullptr) {
+                continue;
+            }
+            for (LatencyHistogram& histogram : counters->metrics) {
+                for (auto& bucket : histogram.counts) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                histogram.total.store(0, std::memory_order_relaxed);
+                histogram.sum.store(0, std::memory_order_relaxed);
+                histogram.maximum.store(0, std::memory_order_relaxed);
+            }
+            for (auto& counter : counters->counters) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+CommandTrace::CommandTrace(const std::string& command) : CommandTrace(command.data(), command.size()) {
+}
+
+CommandTrace::CommandTrace(const char* command, size_t length)
+    : command(InstrumentedCommand(command, length)), start(std::chrono::steady_clock::now()), written(start) {
+}
+
+CommandTrace::~CommandTrace() {
+    RecordLatency(command, METRIC_TOTAL, std::chrono::steady_clock::now() - start);
+    AddToCounter(command, COUNTER_CALLS);
+}
+
+void CommandTrace::Written(size_t bytes, bool ok) {
+    written = std::chrono::steady_clock::now();
+    RecordLatency(command, METRIC_WRITE, written - start);
+    AddToCounter(command, COUNTER_BYTES_WRITTEN, bytes);
+    if (!ok) {
+        AddToCounter(command, COUNTER_ERRORS);
+    }
+}
+
+void CommandTrace::Received(std::chrono::steady_clock::time_point firstByte, size_t bytes, bool complete) {
+    auto now = std::chrono::steady_clock::now();
+    if (firstByte != std::chrono::steady_clock::time_point()) {
+        RecordLatency(command, METRIC_FIRST_BYTE, firstByte - written);
+    }
+    AddToCounter(command, COUNTER_BYTES_READ, bytes);
+    if (complete) {
+        RecordLatency(command, METRIC_RESPONSE, now - written);
+    } else {
+        AddToCounter(command, COUNTER_TIMEOUTS);
+    }
+}
+
+void CommandTrace::Failed() {
+    AddToCounter(command, COUNTER_ERRORS);
+}
@@ -0,0 +1,121 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Low-overhead instrumentation of the SCPI I/O: per-command latency histograms and counters.
+// Every thread records into its own counters (plain relaxed stores, no locks and no shared
+// cache lines); readers add up the counters of all threads while they are being written.
+
+// Latencies of one command exchange
+enum IoMetric {
+    METRIC_WRITE,       // Writing the message
+    METRIC_FIRST_BYTE,  // From the end of the write to the first byte of the response
+    METRIC_RESPONSE,    // From the end of the write to the response terminator
+    METRIC_TOTAL,       // The whole exchange (or a measured code path, e.g. the UI timer)
+    IO_METRIC_COUNT
+};
+
+enum IoCounter {
+    COUNTER_CALLS,
+    COUNTER_BYTES_WRITTEN,
+    COUNTER_BYTES_READ,
+    COUNTER_TIMEOUTS,
+    COUNTER_ERRORS,
+    IO_COUNTER_COUNT
+};
+
+// Histogram with log-linear buckets (as HdrHistogram): 2^(SUB_BUCKET_BITS - 1) buckets per power
+// of two, so any value is known to about 3 %, from 1 ns up to MAX_VALUE (longer values are clamped)
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 6;
+    static const int MAX_VALUE_BITS = 40;  // About 18 minutes in nanoseconds
+    static const uint64_t MAX_VALUE = (uint64_t(1) << MAX_VALUE_BITS) - 1;
+    static const size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) << (SUB_BUCKET_BITS - 1);
+
+    static size_t BucketIndex(uint64_t value);
+    // Smallest and largest value counted in a bucket
+    static uint64_t BucketLowest(size_t index);
+    static uint64_t BucketHighest(size_t index);
+
+    // Called only by the owning thread
+    void Record(uint64_t value);
+
+    std::atomic<uint64_t> counts[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> maximum{0};
+};
+
+// Histogram added up over the threads, for reading
+struct HistogramSnapshot {
+    std::vector<uint64_t> counts;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t maximum = 0;
+
+    void Add(const LatencyHistogram& histogram);
+    // Value (ns) below which the given share (0..1) of the values lies, to the bucket's resolution
+    double Percentile(double share) const;
+    double Mean() const;
+};
+
+// Everything recorded for one command
+struct CommandStatistics {
+    std::string name;
+    HistogramSnapshot metrics[IO_METRIC_COUNT];
+    uint64_t counters[IO_COUNTER_COUNT] = {};
+};
+
+// Index of a command in the instrumentation; commands are named by their header ("VOLT 5" is "VOLT")
+typedef int CommandId;
+
+const int MAX_INSTRUMENTED_COMMANDS = 64;  // Further commands are counted together as "(other)"
+
+CommandId InstrumentedCommand(const char* text, size_t length);
+CommandId InstrumentedCommand(const std::string& text);
+
+void RecordLatency(CommandId command, IoMetric metric, std::chrono::nanoseconds latency);
+void AddToCounter(CommandId command, IoCounter counter, uint64_t amount = 1);
+
+// File the panel writes the instrumentation to when it closes
+const char* const INSTRUMENTATION_FILE = "instrumentation.txt";
+
+// Statistics of the commands recorded so far, in the order the commands were first seen
+std::vector<CommandStatistics> InstrumentationSnapshot();
+// Writing the table of percentiles and counters (microseconds) as text
+void PrintInstrumentation(FILE* file);
+// The same into a file; false if it cannot be written
+bool DumpInstrumentation(const std::string& path);
+void ResetInstrumentation();
+
+// Timing of one exchange of a command (or of a code path); the total and the call are recorded
+// when it goes out of scope
+class CommandTrace {
+public:
+    explicit CommandTrace(const std::string& command);
+    CommandTrace(const char* command, size_t length);
+    ~CommandTrace();
+
+    CommandTrace(const CommandTrace&) = delete;
+    CommandTrace& operator=(const CommandTrace&) = delete;
+
+    void Written(size_t bytes, bool ok);
+    // firstByte is a default time_point if nothing arrived
+    void Received(std::chrono::steady_clock::time_point firstByte, size_t bytes, bool complete);
+    void Failed();
+
+private:
+    CommandId command;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point written;
+};
+
+#endif // INSTRUMENTATION_H
@@ -0,0 +1,196 @@
+#include "line_reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "scpi_block.h"
+#include "transport.h"
+
+size_t LineReader::Buffered() const {
+    return partial.size() + (tail - head);
+}
+
+void LineReader::Clear() {
+    head = tail = scanned = 0;
+    partial.clear();
+}
+
+// Appending the bytes in [head, tail) to the line and emptying the ring
+void LineReader::moveBufferedTo(std::string& line) {
+    while (head != tail) {
+        size_t offset = head & (CAPACITY - 1);
+        size_t count = std::min(tail - head, CAPACITY - offset);
+        line.append(ring + offset, count);
+        head += count;
+    }
+    head = tail = scanned = 0;
+}
+
+bool LineReader::extractLine(std::string& line, char terminator) {
+    // Only the bytes that arrived since the last search are scanned
+    while (scanned != tail) {
+        size_t offset = scanned & (CAPACITY - 1);
+        size_t count = std::min(tail - scanned, CAPACITY - offset);
+        const char* found = static_cast<const char*>(std::memchr(ring + offset, terminator, count));
+        if (found == nullptr) {
+            scanned += count;
+            continue;
+        }
+
+        size_t end = scanned + static_cast<size_t>(found - (ring + offset));
+        if (!partial.empty()) {
+            // Swapping only when a long line was set aside, otherwise the line would lose its capacity
+            line.swap(partial);
+            partial.clear();
+        }
+        while (head != end) {
+            size_t from = head & (CAPACITY - 1);
+            size_t length = std::min(end - head, CAPACITY - from);
+            line.append(ring + from, length);
+            head += length;
+        }
+        head = scanned = end + 1;  // Skipping the terminator
+
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool LineReader::TakeBufferedLine(std::string& line, char terminator) {
+    line.clear();
+    return extractLine(line, terminator);
+}
+
+LineReader::Status LineReader::ReadLine(Transport& transport, std::string& line,
+                                        std::chrono::steady_clock::time_point deadline, char terminator,
+                                        LineTiming* timing) {
+    line.clear();
+    if (timing != nullptr) {
+        timing->bytesRead = 0;
+        timing->firstByte = Buffered() > 0 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    }
+    for (;;) {
+        if (extractLine(line, terminator)) {
+            return LINE_COMPLETE;
+        }
+
+        if (tail - head == CAPACITY) {
+            // The ring is full without a terminator, keeping the beginning of the line aside
+            moveBufferedTo(partial);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return TIMEOUT;
+        }
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1);
+
+        // Reading into the contiguous free part of the ring
+        size_t offset = tail & (CAPACITY - 1);
+        size_t space = std::min(CAPACITY - (tail - head), CAPACITY - offset);
+        long bytesRead = transport.Read(ring + offset, space, static_cast<int>(remaining.count()));
+        if (bytesRead < 0) {
+            return READ_ERROR;
+        }
+        if (timing != nullptr && bytesRead > 0) {
+            if (timing->firstByte == std::chrono::steady_clock::time_point()) {
+                timing->firstByte = std::chrono::steady_clock::now();
+            }
+            timing->bytesRead += static_cast<size_t>(bytesRead);
+        }
+        tail += static_cast<size_t>(bytesRead);
+    }
+}
+
+LineReader::Status LineReader::ReadBlock(Transport& transport, BlockDecoder& block, std::chrono::milliseconds idleTimeout,
+                                         LineTiming* timing) {
+    if (timing != nullptr) {
+        timing->bytesRead = 0;
+        timing->firstByte = Buffered() > 0 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    }
+    if (!partial.empty()) {
+        partial.erase(0, block.Feed(partial.data(), partial.size()));
+    }
+    auto deadline = std::chrono::steady_clock::now() + idleTimeout;
+    for (;;) {
+        // What is buffered first, in the order it arrived
+        while (head != tail && (block.GetState() == BlockDecoder::HEADER || block.GetState() == BlockDecoder::PAYLOAD ||
+                                block.GetState() == BlockDecoder::TERMINATOR)) {
+            size_t offset = head & (CAPACITY - 1);
+            size_t count = std::min(tail - head, CAPACITY - offset);
+            size_t used = block.Feed(ring + offset, count);
+            head += used;
+            if (used < count) {
+                break;
+            }
+        }
+        scanned = std::max(scanned, head);
+        if (block.GetState() == BlockDecoder::COMPLETE) {
+            return LINE_COMPLETE;
+        }
+        if (block.GetState() == BlockDecoder::MALFORMED) {
+            return MALFORMED;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return TIMEOUT;
+        }
+        int remaining = static_cast<int>(
+            (std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1)).count());
+
+        long bytesRead;
+        if (block.GetState() == BlockDecoder::PAYLOAD) {
+            // The ring is empty, so the rest of the payload is read where it belongs
+            bytesRead = transport.Read(block.PayloadCursor(), block.PayloadRemaining(), remaining);
+            if (bytesRead > 0) {
+                block.PayloadWritten(static_cast<size_t>(bytesRead));
+            }
+        } else {
+            size_t offset = tail & (CAPACITY - 1);
+            size_t space = std::min(CAPACITY - (tail - head), CAPACITY - offset);
+            bytesRead = transport.Read(ring + offset, space, remaining);
+            if (bytesRead > 0) {
+                tail += static_cast<size_t>(bytesRead);
+            }
+        }
+        if (bytesRead < 0) {
+            return READ_ERROR;
+        }
+        if (bytesRead > 0) {
+            if (timing != nullptr) {
+                if (timing->firstByte == std::chrono::steady_clock::time_point()) {
+                    timing->firstByte = std::chrono::steady_clock::now();
+                }
+                timing->bytesRead += static_cast<size_t>(bytesRead);
+            }
+            deadline = std::chrono::steady_clock::now() + idleTimeout;
+        }
+    }
+}
+
+void LineReader::Feed(const char* data, size_t length, const std::function<void(const std::string&)>& onLine,
+                      char terminator) {
+    while (length > 0) {
+        if (tail - head == CAPACITY) {
+            // Every complete line has been handed out, so the ring holds the beginning of one long line
+            moveBufferedTo(partial);
+        }
+
+        size_t offset = tail & (CAPACITY - 1);
+        size_t count = std::min(length, std::min(CAPACITY - (tail - head), CAPACITY - offset));
+        std::memcpy(ring + offset, data, count);
+        tail += count;
+        data += count;
+        length -= count;
+
+        fedLine.clear();
+        while (extractLine(fedLine, terminator)) {
+            onLine(fedLine);
+            fedLine.clear();
+        }
+    }
+}
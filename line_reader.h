@@ -0,0 +1,60 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+class BlockDecoder;
+class Transport;
+
+// Timing of one ReadLine call, for the instrumentation
+struct LineTiming {
+    std::chrono::steady_clock::time_point firstByte;  // When the first byte of the line was available
+    size_t bytesRead = 0;                             // Bytes read from the transport during the call
+};
+
+// Ring-buffered reader of terminated responses. ReadLine returns as soon as the terminator
+// arrives; bytes received after the terminator stay buffered for the next call.
+class LineReader {
+public:
+    enum Status { LINE_COMPLETE, TIMEOUT, READ_ERROR, MALFORMED };
+
+    static const size_t CAPACITY = 4096;  // Power of two
+
+    // Reading one line (without the terminator and a trailing '\r') until the deadline.
+    // Lines longer than the ring are collected in pieces, so there is no length limit.
+    Status ReadLine(Transport& transport, std::string& line, std::chrono::steady_clock::time_point deadline,
+                    char terminator = '\n', LineTiming* timing = nullptr);
+
+    // Reading one definite-length block response (scpi_block.h) into the decoder's destination;
+    // the payload is read from the transport straight into it, past the ring. A block may take
+    // long to arrive, so the call fails only after idleTimeout without a byte (TIMEOUT), or with
+    // MALFORMED if the response is not a block.
+    Status ReadBlock(Transport& transport, BlockDecoder& block, std::chrono::milliseconds idleTimeout,
+                     LineTiming* timing = nullptr);
+
+    // Taking a complete line if one is already buffered, without reading the transport
+    bool TakeBufferedLine(std::string& line, char terminator = '\n');
+
+    // Push mode for the event loop: adding received bytes and calling onLine for every completed line
+    void Feed(const char* data, size_t length, const std::function<void(const std::string&)>& onLine,
+              char terminator = '\n');
+
+    size_t Buffered() const;
+    void Clear();
+
+private:
+    bool extractLine(std::string& line, char terminator);
+    void moveBufferedTo(std::string& line);
+
+    char ring[CAPACITY];
+    size_t head = 0;     // Monotonic read position
+    size_t tail = 0;     // Monotonic write position
+    size_t scanned = 0;  // Bytes in [head, scanned) are known to contain no terminator
+    std::string partial; // Beginning of a line that did not fit into the ring
+    std::string fedLine; // Line handed out by Feed, reused between calls
+};
+
+#endif // LINE_READER_H
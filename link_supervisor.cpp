@@ -0,0 +1,276 @@
+#include "link_supervisor.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "numeric.h"
+#include "scpi.h"
+#include "scpi_batch.h"
+#include "serial.h"
+
+std::string DescribeLinkEvent(const LinkEvent& event) {
+    if (event.kind == LINK_LOST) {
+        return "Link lost (" + event.reason + "), reconnecting";
+    }
+    char text[96];
+    if (event.kind == LINK_RETRYING) {
+        snprintf(text, sizeof(text), "Still reconnecting after %d attempts (", event.attempts);
+        return text + event.reason + ")";
+    }
+    snprintf(text, sizeof(text), "Link restored in %.0f ms (%d attempt%s) at %lu baud", event.downtime.count() / 1e3,
+             event.attempts, event.attempts == 1 ? "" : "s", event.baudRate);
+    return text;
+}
+
+LinkSupervisor::LinkSupervisor(std::unique_ptr<Transport> port, const SerialSettings& settings, OpenFunction open,
+                               EventFunction events, const LinkSupervisorOptions& options)
+    : open(std::move(open)), events(std::move(events)), options(options), port(std::move(port)), settings(settings) {
+    worker = std::thread(&LinkSupervisor::supervise, this);
+}
+
+LinkSupervisor::~LinkSupervisor() {
+    Close();
+}
+
+void LinkSupervisor::SetRestoreMessage(const std::string& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    restoreMessage = message;
+}
+
+void LinkSupervisor::SetFallbackSettings(const SerialSettings& newSettings) {
+    std::lock_guard<std::mutex> lock(mutex);
+    fallbackSettings = newSettings;
+    fallbackSet = true;
+}
+
+void LinkSupervisor::Answered() {
+    std::lock_guard<std::mutex> lock(mutex);
+    missed = 0;
+}
+
+void LinkSupervisor::DeadlineMissed() {
+    int count;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        count = ++missed;
+    }
+    if (count >= options.missedDeadlines) {
+        lost(nullptr, std::to_string(count) + " messages not answered");
+    }
+}
+
+bool LinkSupervisor::Connected() const {
+    return connected;
+}
+
+uint64_t LinkSupervisor::Reconnects() const {
+    return reconnects;
+}
+
+bool LinkSupervisor::IsOpen() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !closed;
+}
+
+void LinkSupervisor::Close() {
+    std::shared_ptr<Transport> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        connected = false;
+        dropped = std::move(port);
+    }
+    changed.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (dropped) {
+        dropped->Close();
+    }
+}
+
+bool LinkSupervisor::Configure(const SerialSettings& newSettings) {
+    std::shared_ptr<Transport> transport;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        settings = newSettings;
+        transport = port;
+    }
+    // A lost port gets the settings when it is reopened
+    return !transport || transport->Configure(newSettings);
+}
+
+bool LinkSupervisor::Write(const char* data, size_t length) {
+    const OutputSegment segment = {data, length};
+    return WriteGather(&segment, 1);
+}
+
+bool LinkSupervisor::WriteGather(const OutputSegment* segments, size_t count) {
+    std::shared_ptr<Transport> transport = current();
+    if (!transport) {
+        return false;
+    }
+    if (!transport->WriteGather(segments, count)) {
+        lost(transport.get(), "write error");
+        return false;
+    }
+    return true;
+}
+
+long LinkSupervisor::Read(char* buffer, size_t size, int timeoutMs) {
+    std::shared_ptr<Transport> transport = current();
+    if (!transport) {
+        return -1;
+    }
+    long count = transport->Read(buffer, size, timeoutMs);
+    if (count < 0) {
+        lost(transport.get(), "read error");
+    }
+    return count;
+}
+
+NativeHandle LinkSupervisor::Handle() const {
+    std::shared_ptr<Transport> transport = current();
+    return transport ? transport->Handle() : INVALID_NATIVE_HANDLE;
+}
+
+std::shared_ptr<Transport> LinkSupervisor::current() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return port;
+}
+
+// Dropping the port (failed: the one an error came from, nullptr: the current one); it is closed
+// when the last reader lets go of it, and the supervisor's thread starts reopening it
+void LinkSupervisor::lost(const Transport* failed, const std::string& reason) {
+    std::shared_ptr<Transport> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed || !port || (failed != nullptr && failed != port.get())) {
+            return;  // Already noticed, or an error of a port that has been replaced
+        }
+        dropped = std::move(port);
+        connected = false;
+        lostReason = reason;
+        lostAt = std::chrono::steady_clock::now();
+    }
+    changed.notify_all();
+}
+
+// One attempt: opening, configuring and restoring. After fallbackAfter failed attempts at the last
+// settings, every other one is made at the fallback settings. A terminator first ends whatever the
+// supply got of a message cut off by the loss; anything it still answers to that is skipped until
+// the *OPC?. lineSettings is what was tried, failure why it did not work.
+bool LinkSupervisor::reopen(std::unique_ptr<Transport>& reopened, int attempt, SerialSettings& lineSettings,
+                            std::string& failure) {
+    std::string message;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lineSettings = settings;
+        if (attempt > options.fallbackAfter && (attempt - options.fallbackAfter) % 2 == 1) {
+            if (fallbackSet) {
+                lineSettings = fallbackSettings;
+            } else {
+                lineSettings.baudRate = DEFAULT_BAUD_RATE;
+            }
+        }
+        message = restoreMessage;
+    }
+    reopened = open ? open() : nullptr;
+    if (!reopened) {
+        failure = "port not available";
+        return false;
+    }
+    if (!reopened->Configure(lineSettings)) {
+        failure = "cannot configure " + std::to_string(lineSettings.baudRate) + " baud";
+        reopened.reset();
+        return false;
+    }
+    AppendToProgramMessage(message, "*OPC?");
+
+    try {
+        if (reopened->WriteMessage("\n", 1) && sendCommand(*reopened, message)) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.restoreTimeoutMs);
+            std::string line;
+            while (reopened->ReadLine(line, deadline) == LineReader::LINE_COMPLETE) {
+                // The answer of *OPC? is the last field of the response
+                size_t field = line.rfind(';');
+                field = field == std::string::npos ? 0 : field + 1;
+                double value;
+                if (ParseScpiNumber(line.data() + field, line.data() + line.size(), value) && value == 1.0) {
+                    return true;
+                }
+            }
+        }
+    } catch (const std::runtime_error&) {
+    }
+    failure = "no answer at " + std::to_string(lineSettings.baudRate) + " baud";
+    reopened.reset();
+    return false;
+}
+
+// Supervisor thread: waiting for a loss, then reopening with waits that grow from firstRetry to lastRetry
+void LinkSupervisor::supervise() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return closed || !port; });
+        if (closed) {
+            return;
+        }
+        LinkEvent event;
+        event.kind = LINK_LOST;
+        event.reason = lostReason;
+        std::chrono::steady_clock::time_point since = lostAt;
+        lock.unlock();
+        if (events) {
+            events(event);
+        }
+
+        std::unique_ptr<Transport> reopened;
+        SerialSettings lineSettings;
+        std::string failure;
+        std::chrono::milliseconds retry = options.firstRetry;
+        int attempts = 1;
+        int nextReport = options.firstReport;
+        while (!reopen(reopened, attempts, lineSettings, failure)) {
+            if (attempts == nextReport) {
+                // Reported less and less often, so a long outage does not flood the log
+                nextReport *= 2;
+                LinkEvent retrying;
+                retrying.kind = LINK_RETRYING;
+                retrying.reason = failure;
+                retrying.attempts = attempts;
+                if (events) {
+                    events(retrying);
+                }
+            }
+            lock.lock();
+            if (changed.wait_for(lock, retry, [this] { return closed; })) {
+                return;
+            }
+            lock.unlock();
+            retry = std::min(retry * 2, options.lastRetry);
+            attempts++;
+        }
+
+        event.kind = LINK_RESTORED;
+        event.reason.clear();
+        event.attempts = attempts;
+        event.baudRate = lineSettings.baudRate;
+        event.downtime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since);
+        lock.lock();
+        if (closed) {
+            return;
+        }
+        settings = lineSettings;  // The fallback, if the supply came back at it
+        port = std::move(reopened);
+        missed = 0;
+        connected = true;
+        reconnects++;
+        lock.unlock();
+        if (events) {
+            events(event);
+        }
+        lock.lock();
+    }
+}
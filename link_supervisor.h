@@ -0,0 +1,110 @@
+#ifndef LINK_SUPERVISOR_H
+#define LINK_SUPERVISOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "transport.h"
+
+struct LinkSupervisorOptions {
+    int missedDeadlines = 3;                   // Exchanges in a row without an answer that mean the link is lost
+    std::chrono::milliseconds firstRetry{20};  // Before the second reopen, doubled after each failed one
+    std::chrono::milliseconds lastRetry{250};  // Longest wait between reopens
+    int restoreTimeoutMs = 500;                // For the answer to the restore message
+    int fallbackAfter = 3;                     // Failed reopens at the last settings before the fallback is tried in turn
+    int firstReport = 10;                      // Failed reopens before the first LINK_RETRYING, doubled for each next one
+};
+
+enum LinkEventKind {
+    LINK_LOST,      // Read or write error, or too many missed deadlines; the port is reopened in the background
+    LINK_RETRYING,  // Still not reopened
+    LINK_RESTORED   // Reopened, configured and restored
+};
+
+struct LinkEvent {
+    LinkEventKind kind = LINK_LOST;
+    std::string reason;                     // LINK_LOST: what gave it away; LINK_RETRYING: why the last reopen failed
+    int attempts = 0;                       // LINK_RETRYING: reopens so far; LINK_RESTORED: reopens it took
+    unsigned long baudRate = 0;             // LINK_RESTORED: rate the port was reopened at
+    std::chrono::microseconds downtime{0};  // LINK_RESTORED: from the loss being noticed to the restored supply
+};
+
+// Text for the panel and the log, e.g. "Link restored in 180 ms (3 attempts) at 9600 baud"
+std::string DescribeLinkEvent(const LinkEvent& event);
+
+// Transport that keeps the link to a supply up. It passes everything to the port, notices a read or
+// write error at once and missed deadlines as reported by the poller, and then reopens the port on
+// its own thread with growing waits, configures it as the last Configure did and sends the restore
+// message (the supply's programmed setpoints, one program message) with *OPC?, so the supply is
+// known to answer before the new port is put in. Meanwhile reads and writes fail at once. A supply
+// that was power-cycled comes back at its own rate rather than a negotiated one, so after a few
+// failed reopens every other one is made at the fallback settings.
+class LinkSupervisor : public Transport {
+public:
+    // Opening the port again; nullptr while it is not there
+    typedef std::function<std::unique_ptr<Transport>()> OpenFunction;
+    // Called on the supervisor's thread
+    typedef std::function<void(const LinkEvent&)> EventFunction;
+
+    LinkSupervisor(std::unique_ptr<Transport> port, const SerialSettings& settings, OpenFunction open,
+                   EventFunction events, const LinkSupervisorOptions& options = LinkSupervisorOptions());
+    ~LinkSupervisor() override;
+
+    // Program message sent to a reopened port before it is used (empty: none)
+    void SetRestoreMessage(const std::string& message);
+
+    // Settings of the supply after a power cycle, e.g. the rate selected in the panel; without them
+    // DEFAULT_BAUD_RATE with the framing of the last settings
+    void SetFallbackSettings(const SerialSettings& settings);
+
+    // Outcome of an exchange with queries, from the poller
+    void Answered();
+    void DeadlineMissed();
+
+    bool Connected() const;
+    uint64_t Reconnects() const;
+
+    // Open until Close, also while the port is being reopened
+    bool IsOpen() const override;
+    void Close() override;
+    bool Configure(const SerialSettings& settings) override;
+    bool Write(const char* data, size_t length) override;
+    bool WriteGather(const OutputSegment* segments, size_t count) override;
+    long Read(char* buffer, size_t size, int timeoutMs) override;
+    NativeHandle Handle() const override;
+
+private:
+    std::shared_ptr<Transport> current() const;
+    void lost(const Transport* failed, const std::string& reason);
+    bool reopen(std::unique_ptr<Transport>& reopened, int attempt, SerialSettings& lineSettings, std::string& failure);
+    void supervise();
+
+    OpenFunction open;
+    EventFunction events;
+    LinkSupervisorOptions options;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::shared_ptr<Transport> port;  // nullptr while the link is lost; readers keep their copy until they return
+    SerialSettings settings;
+    SerialSettings fallbackSettings;
+    bool fallbackSet = false;
+    std::string restoreMessage;
+    std::string lostReason;
+    std::chrono::steady_clock::time_point lostAt;
+    int missed = 0;
+    bool closed = false;
+
+    std::atomic<bool> connected{true};
+    std::atomic<uint64_t> reconnects{0};
+    std::thread worker;
+};
+
+#endif // LINK_SUPERVISOR_H
@@ -19,6 +19,8 @@
  * - WindowProc: The main window procedure handling messages, including commands from the user interface.
  * - CreatePowerSupplyControlPanel: A function that dynamically creates the controls for interacting with the power supply.
  * - Communication functions (e.g., OpenCOMPort, SendSCPICommandAndGetResponse): These handle the communication with the power supply device over the serial port.
+ * - AcquisitionEngine: Polls the measurements on its own thread and passes timestamped samples to the UI through a lock-free queue.
+ * - LinkSupervisor: Notices a lost port, reopens it in the background and restores the programmed setpoints.
  *
  * This code is intended to be a starting point for applications requiring serial communication with power supplies or similar devices.
  * It is also a demonstration of basic WinAPI usage for creating a simple GUI in C++.
@@ -28,15 +30,27 @@
  ***************************************************************************************************************/
 
 #include <windows.h>
+#include <commdlg.h>
+#include <stdexcept>
 #include "scpi.h"
+#include "scpi_commands.h"
+#include "device_state.h"
 #include "serial.h"
+#include "acquisition.h"
+#include "port_discovery.h"
+#include "timeseries.h"
+#include "capture_log.h"
+#include "sequencer.h"
+#include "instrumentation.h"
+#include "strip_chart.h"
+#include "trigger.h"
+#include "traffic_trace.h"
+#include "baud_negotiation.h"
+#include "link_supervisor.h"
 
 // Global variable for Delay
 static int global_delay = 0;
 
-static double maxVoltage = 0.0;
-static double maxCurrent = 0.0;
-
 // Global Control ids
 #define BASE_ID 1000
 
@@ -50,6 +64,11 @@ static double maxCurrent = 0.0;
 #define ID_OUTPUT_ON_BUTTON (BASE_ID + 106)
 #define ID_OUTPUT_OFF_BUTTON (BASE_ID + 107)
 #define ID_SYST_REM_BUTTON (BASE_ID + 108)
+#define ID_CAPTURE_CHECKBOX (BASE_ID + 109)
+#define ID_RUN_PROFILE_BUTTON (BASE_ID + 110)
+#define ID_STOP_PROFILE_BUTTON (BASE_ID + 111)
+#define ID_TRAFFIC_CHECKBOX (BASE_ID + 112)
+#define ID_NEGOTIATE_CHECKBOX (BASE_ID + 113)
 
 // Ids of input fields for the power supply
 #define ID_VOLTAGE_EDIT (BASE_ID + 200)
@@ -75,9 +94,21 @@ static double maxCurrent = 0.0;
 #define ID_COMBO_BOX_STOP_BITS (BASE_ID + 311)  // ComboBoxStopBits
 
 #define ID_SETTINGS_GROUP (BASE_ID + 312)
+#define ID_STRIP_CHART (BASE_ID + 313)
 
 #define IDT_TIMER1 1
 
+// Errors reported by the supply and the link, and the reconnects, one line each
+static const char* const ERROR_LOG_FILE = "device_errors.log";
+
+// Messages posted by the port discovery threads
+#define WM_PORT_DISCOVERED (WM_APP + 1)      // lParam: DiscoveredPort* owned by the receiver
+#define WM_PORT_DISCOVERY_DONE (WM_APP + 2)
+// Posted by the sequencer's timing thread when a sequence has been played or stopped
+#define WM_SEQUENCE_DONE (WM_APP + 3)
+// Posted by the link supervisor's thread; lParam: LinkEvent* owned by the receiver, wParam: the connection it is of
+#define WM_LINK_EVENT (WM_APP + 4)
+
 // Structure for storing connection parameters and settings
 struct PowerSupplyConfig {
     std::string name;
@@ -96,9 +127,387 @@ struct PowerSupplyConfig {
 // Global variables for storing configurations
 PowerSupplyConfig powerSupplies;
 
+// Command table of the connected supply, chosen from its *IDN? response
+static const ScpiModel* supplyModel = &GENERIC_SUPPLY;
+
+// Settings of the connected supply, read back on connect; "Set" commands that would not change
+// them are not sent
+static DeviceStateCache supplyState;
+
+// Voltage and current of the session, right of the panel
+static StripChart stripChart;
+
+// Measurement polling runs on the acquisition engine's thread, the UI only drains its samples
+static AcquisitionEngine acquisitionEngine(
+    [](const std::string& command, std::string& response) {
+        if (comPort) {
+            return SendSCPICommandAndGetResponse(*comPort, command, response) == QUERY_ANSWERED;
+        }
+        response.clear();
+        return false;
+    },
+    [](const std::string& command) {
+        try {
+            if(sendCommand(command))
+            {
+                return true;
+            }
+        } catch (const std::runtime_error&) {
+        }
+        supplyState.Invalidate();
+        return false;
+    });
+
+// Polling schedule of the acquisition engine: the current is followed closely, the voltage more
+// slowly; both are polled as fast as the link allows while they change and after output commands
+static PollSchedule MakePollSchedule()
+{
+    PollSchedule schedule;
+    schedule.rates[POLL_CURRENT].fastest = std::chrono::milliseconds(0);
+    schedule.rates[POLL_CURRENT].slowest = std::chrono::milliseconds(500);
+    schedule.rates[POLL_VOLTAGE].fastest = std::chrono::milliseconds(20);
+    schedule.rates[POLL_VOLTAGE].slowest = std::chrono::milliseconds(1000);
+    return schedule;
+}
+
+// Binary capture of the samples, written while the "Capture" box is checked
+static CaptureLog captureLog;
+
+// Triggers read from triggers.txt on connect; the samples around each event are appended to
+// trigger_captures.csv instead of logging everything at full rate
+static TriggerSettings triggerSettings;
+static TriggerEngine triggerEngine;
+
+// Tap on the open port that records its traffic while the "Record traffic" box is checked;
+// owned by comPort, so it goes when the port is reopened
+static RecordingTransport* trafficTap = nullptr;
+
+// Supervisor of the open port under the tap, owned by it; counts the connections, so the events
+// of an earlier one still in the message queue are not taken for the current one's
+static LinkSupervisor* linkSupervisor = nullptr;
+static WPARAM linkGeneration = 0;
+
+// Setpoint sequences are played from their own timing thread. The commands are written straight
+// to the port (a write never splits a poll's query from its answer, and the sequences have no
+// queries), and the engine is told to poll at full rate while the output changes.
+static SequencePlayer sequencePlayer;
+static std::string sequenceProfilePath;  // Empty for sequences made by the panel itself
+
+// Ports known from the cache and the discovery, the first one is the last used port
+static std::vector<DiscoveredPort> knownPorts;
+static PortDiscovery portDiscovery;
+
 // Function for creating a power supply control panel
 void CreatePowerSupplyControlPanel(HWND hwnd, const PowerSupplyConfig& config, int offsetX);
 
+// Probing the COM ports in the background, the results are posted to the window as they come in
+static void StartPortDiscovery(HWND hwnd)
+{
+    DiscoveryOptions options;
+    options.settings = ReadSerialSettings(GetDlgItem(hwnd, ID_COMBO_BOX_BAUD_RATE), GetDlgItem(hwnd, ID_COMBO_BOX_BYTE_SIZE),
+                                          GetDlgItem(hwnd, ID_COMBO_BOX_PARITY), GetDlgItem(hwnd, ID_COMBO_BOX_STOP_BITS));
+
+    portDiscovery.Start(CandidatePortNames(), options,
+        [hwnd](const DiscoveredPort& port) {
+            DiscoveredPort* result = new DiscoveredPort(port);
+            if(!PostMessage(hwnd, WM_PORT_DISCOVERED, 0, (LPARAM)result))
+            {
+                delete result;
+            }
+        },
+        [hwnd]() { PostMessage(hwnd, WM_PORT_DISCOVERY_DONE, 0, 0); });
+}
+
+// Starting a capture into a new file named after the local time, e.g. capture_20240131_154500.cap
+static bool StartCapture(HWND hWnd)
+{
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "capture_%04u%02u%02u_%02u%02u%02u.cap", now.wYear, now.wMonth, now.wDay,
+             now.wHour, now.wMinute, now.wSecond);
+
+    if(!captureLog.Open(fileName))
+    {
+        MessageBox(hWnd, "Failed to create the capture file.", "Error", MB_OK | MB_ICONERROR);
+        return false;
+    }
+    acquisitionEngine.SetCaptureLog(&captureLog);
+    return true;
+}
+
+// Recording the port's traffic into a new file named after the local time, e.g. traffic_20240131_154500.trace
+static bool StartTrafficRecording(HWND hWnd)
+{
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "traffic_%04u%02u%02u_%02u%02u%02u.trace", now.wYear, now.wMonth, now.wDay,
+             now.wHour, now.wMinute, now.wSecond);
+
+    if(!trafficTap->Start(fileName))
+    {
+        MessageBox(hWnd, "Failed to create the traffic file.", "Error", MB_OK | MB_ICONERROR);
+        return false;
+    }
+    return true;
+}
+
+// Putting the open port under a supervisor that reopens it at the same settings when it is lost,
+// or at the ones selected in the panel if the supply was power-cycled; its events are posted to the window
+static LinkSupervisor* SuperviseCOMPort(HWND hwnd, const std::string& portName, const SerialSettings& settings)
+{
+    WPARAM generation = ++linkGeneration;
+    LinkSupervisor* supervisor = new LinkSupervisor(std::move(comPort), settings,
+        [portName]() { return OpenSerialTransport(portName.c_str(), false); },
+        [hwnd, generation](const LinkEvent& event) {
+            LinkEvent* posted = new LinkEvent(event);
+            if(!PostMessage(hwnd, WM_LINK_EVENT, generation, (LPARAM)posted))
+            {
+                delete posted;
+            }
+        });
+    supervisor->SetFallbackSettings(settings);
+    return supervisor;
+}
+
+template <ScpiCommandId Id>
+static void AppendSetpoint(std::string& message, const std::string& setting)
+{
+    ScpiMessage command;
+    if(!setting.empty() && BuildCommandFromText<Id>(*supplyModel, setting.c_str(), command) == SCPI_BUILD_OK)
+    {
+        AppendToProgramMessage(message, command.Text());
+    }
+}
+
+// The setpoints programmed from the panel, sent as one message to a reconnected supply. The output
+// is left as the supply has it: switched on by itself after the supply lost power, it could harm the load.
+static void UpdateRestoreMessage()
+{
+    if(!linkSupervisor)
+    {
+        return;
+    }
+    std::string message;
+    AppendSetpoint<SCPI_VOLTAGE>(message, powerSupplies.voltage);
+    AppendSetpoint<SCPI_CURRENT>(message, powerSupplies.current);
+    AppendSetpoint<SCPI_RISE>(message, powerSupplies.rise);
+    AppendSetpoint<SCPI_FALL>(message, powerSupplies.fall);
+    linkSupervisor->SetRestoreMessage(message);
+}
+
+// *IDN? response of the open port, empty if the supply does not answer
+static std::string IdentifySupply()
+{
+    ScpiMessage identify;
+    BuildCommand<SCPI_IDENTIFY>(GENERIC_SUPPLY, identify);
+    try
+    {
+        return query(identify.Text());
+    }
+    catch(const std::runtime_error&)
+    {
+        return std::string();
+    }
+}
+
+// A supply left at another rate by a negotiation is looked for there first; the port ends at
+// the rate the supply answered at, or at the selected one
+static std::string ConnectAtKnownRate(const std::string& portName, SerialSettings& settings)
+{
+    for(const DiscoveredPort& port : knownPorts)
+    {
+        if(port.name == portName && port.baudRate != 0 && port.baudRate != settings.baudRate)
+        {
+            SerialSettings remembered = settings;
+            remembered.baudRate = port.baudRate;
+            if(ConfigureCOMPort(remembered))
+            {
+                std::string identity = IdentifySupply();
+                if(!identity.empty())
+                {
+                    settings = remembered;
+                    return identity;
+                }
+            }
+            ConfigureCOMPort(settings);
+            break;
+        }
+    }
+    return IdentifySupply();
+}
+
+// Configuring the triggers while the engine is stopped; without a trigger file there are none
+static void LoadTriggers(HWND hWnd)
+{
+    triggerSettings = TriggerSettings();
+    std::string error;
+    if(GetFileAttributes(TRIGGER_FILE) != INVALID_FILE_ATTRIBUTES && !triggerSettings.Load(TRIGGER_FILE, error))
+    {
+        MessageBox(hWnd, error.c_str(), "Trigger error", MB_OK | MB_ICONERROR);
+    }
+    triggerEngine.Configure(triggerSettings);
+    acquisitionEngine.SetTriggerEngine(&triggerEngine);
+}
+
+// Showing a trigger in the status line and appending its record to the capture file
+static void ReportTrigger(HWND hWnd, const TriggerCapture& capture)
+{
+    std::string description = DescribeTrigger(triggerSettings.conditions[capture.condition]);
+    std::string text = "Trigger " + std::to_string(capture.sequence) + ": " + description;
+    if(!AppendTriggerCapture(TRIGGER_CAPTURE_FILE, capture, description))
+    {
+        text += " (not saved)";
+    }
+    SetWindowText(GetDlgItem(hWnd, ID_TEXT_OUTPUT), text.c_str());
+}
+
+// Playing a sequence; WM_SEQUENCE_DONE is posted when it is over
+static void StartSequence(HWND hWnd, const Sequence& sequence, const std::string& profilePath)
+{
+    sequencePlayer.Stop();
+    sequenceProfilePath = profilePath;
+    sequencePlayer.Start(sequence,
+        [](const char* data, size_t length) {
+            supplyState.Invalidate();
+            acquisitionEngine.NotifyTransient();
+            return comPort && comPort->WriteMessage(data, length);
+        },
+        [hWnd]() { PostMessage(hWnd, WM_SEQUENCE_DONE, 0, 0); });
+}
+
+// Asking for a profile file and playing it
+static void RunProfile(HWND hWnd)
+{
+    if(!comPort)
+    {
+        MessageBox(hWnd, "Please connect to the power supply first.", "Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    char fileName[MAX_PATH] = "";
+    OPENFILENAME dialog = {};
+    dialog.lStructSize = sizeof(dialog);
+    dialog.hwndOwner = hWnd;
+    dialog.lpstrFilter = "Profiles (*.txt;*.csv)\0*.txt;*.csv\0All files\0*.*\0";
+    dialog.lpstrFile = fileName;
+    dialog.nMaxFile = sizeof(fileName);
+    dialog.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
+    if(!GetOpenFileName(&dialog))
+    {
+        return;
+    }
+
+    Sequence sequence;
+    std::string error;
+    if(!sequence.Load(fileName, error))
+    {
+        MessageBox(hWnd, error.c_str(), "Profile error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    StartSequence(hWnd, sequence, fileName);
+}
+
+// Showing a message in the status line and appending it to the error log
+static void LogDeviceEvent(HWND hWnd, const std::string& text)
+{
+    SetWindowText(GetDlgItem(hWnd, ID_TEXT_OUTPUT), text.c_str());
+
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    if(FILE* log = fopen(ERROR_LOG_FILE, "a"))
+    {
+        fprintf(log, "%04u-%02u-%02u %02u:%02u:%02u.%03u %s\n", now.wYear, now.wMonth, now.wDay, now.wHour,
+                now.wMinute, now.wSecond, now.wMilliseconds, text.c_str());
+        fclose(log);
+    }
+}
+
+// Showing an error of the supply or the link and logging it
+static void ReportDeviceError(HWND hWnd, const DeviceError& error)
+{
+    // A refused setting leaves the supply as it was, so the cache may be wrong
+    supplyState.Invalidate();
+    LogDeviceEvent(hWnd, FormatDeviceError(error));
+}
+
+// While the engine is running it owns the port, so commands are passed to it. Errors are
+// reported, not thrown: they would otherwise leave through the window procedure.
+static void SendToPowerSupply(HWND hWnd, const std::string& command)
+{
+    if(!supplyState.ShouldSend(command))
+    {
+        return;
+    }
+
+    DeviceError error;
+    error.kind = DeviceError::LINK_ERROR;
+    if(acquisitionEngine.IsRunning())
+    {
+        if(acquisitionEngine.PostCommand(command))
+        {
+            return;
+        }
+        error.message = "too many commands waiting to be sent";
+    }
+    else
+    {
+        try
+        {
+            if(sendCommand(command))
+            {
+                return;
+            }
+            error.message = "the command could not be sent";
+        }
+        catch(const std::runtime_error& e)
+        {
+            error.message = e.what();
+        }
+    }
+    ReportDeviceError(hWnd, error);
+}
+
+static void SendToPowerSupply(HWND hWnd, const ScpiMessage& message)
+{
+    SendToPowerSupply(hWnd, message.Text());
+}
+
+// Sending a setpoint typed into an edit box; text that is not a number in the supply's range
+// is refused with a message instead of being sent
+template <ScpiCommandId Id>
+static void SendSetpoint(HWND hWnd, int editId, std::string& setting)
+{
+    char buffer[256];
+    GetWindowText(GetDlgItem(hWnd, editId), buffer, sizeof(buffer));
+
+    ScpiMessage message;
+    ScpiBuildResult result = BuildCommandFromText<Id>(*supplyModel, buffer, message);
+    if(result != SCPI_BUILD_OK)
+    {
+        MessageBox(hWnd, DescribeBuildResult(supplyModel->commands[Id], result).c_str(), "Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    setting = buffer;
+    UpdateRestoreMessage();
+    SendToPowerSupply(hWnd, message);
+}
+
+// Showing a setting read back from the supply in its edit box
+static void ShowSetting(HWND hWnd, int editId, DeviceSetting setting, std::string& text)
+{
+    double value;
+    if(!supplyState.Get(setting, value))
+    {
+        return;
+    }
+    char buffer[NUMBER_BUFFER_SIZE];
+    FormatNumber(value, buffer, sizeof(buffer));
+    text = buffer;
+    SetWindowText(GetDlgItem(hWnd, editId), buffer);
+}
+
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
@@ -118,7 +527,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         CLASS_NAME,
         "Power Supply Control Panel",
         WS_OVERLAPPEDWINDOW,
-        CW_USEDEFAULT, CW_USEDEFAULT, 435, 700,
+        CW_USEDEFAULT, CW_USEDEFAULT, 1040, 700,
         NULL, NULL, hInstance, NULL
     );
 
@@ -132,6 +541,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     ShowWindow(hwnd, nCmdShow);
     UpdateWindow(hwnd);
 
+    StartPortDiscovery(hwnd);
+
     MSG msg;
     while(GetMessage(&msg, NULL, 0, 0))
     {
@@ -150,30 +561,144 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         {
             if(wParam == IDT_TIMER1)
             {
-                if(hComPort != INVALID_HANDLE_VALUE)
+                CommandTrace trace("WM_TIMER");
+
+                DeviceError error;
+                while(acquisitionEngine.PopError(error))
                 {
-                    std::string voltage = SendSCPICommandAndGetResponse(hComPort, "MEAS:VOLT?");
-                    UpdateVoltageDisplay(hWnd, ID_VOLTAGE_DISPLAY, voltage);
+                    ReportDeviceError(hWnd, error);
+                }
 
-                    std::string current = SendSCPICommandAndGetResponse(hComPort, "MEAS:CURR?");
-                    UpdateCurrentDisplay(hWnd, ID_CURRENT_DISPLAY, current);
+                TriggerCapture capture;
+                while(triggerEngine.PopCapture(capture))
+                {
+                    ReportTrigger(hWnd, capture);
+                }
 
-                    if(std::stod(voltage) > maxVoltage)
+                // Draining the samples collected since the last tick; voltage and current have
+                // their own poll rates, so a sample may carry only one of them
+                Sample sample;
+                double latestVoltage = 0.0;
+                double latestCurrent = 0.0;
+                bool voltageUpdated = false;
+                bool currentUpdated = false;
+                while(acquisitionEngine.PopSample(sample))
+                {
+                    if(!sample.valid)
                     {
-                        maxVoltage = std::stod(voltage);
+                        continue;
                     }
-                    if(std::stod(current) > maxCurrent)
+                    if(sample.hasVoltage)
                     {
-                        maxCurrent = std::stod(current);
+                        latestVoltage = sample.voltage;
+                        voltageUpdated = true;
                     }
+                    if(sample.hasCurrent)
+                    {
+                        latestCurrent = sample.current;
+                        currentUpdated = true;
+                    }
+                    measurementHistory.Add(sample);
+                    stripChart.Add(sample);
+                }
+                stripChart.Update();
 
-                    UpdateMaxVoltageDisplay(hWnd, ID_MAX_VOLTAGE_DISPLAY, reduceTrailingZeros(maxVoltage));
-                    UpdateMaxCurrentDisplay(hWnd, ID_MAX_CURRENT_DISPLAY, reduceTrailingZeros(maxCurrent));
+                if(voltageUpdated)
+                {
+                    UpdateVoltageDisplay(hWnd, ID_VOLTAGE_DISPLAY, latestVoltage);
+                }
+                if(currentUpdated)
+                {
+                    UpdateCurrentDisplay(hWnd, ID_CURRENT_DISPLAY, latestCurrent);
+                }
+                if(voltageUpdated || currentUpdated)
+                {
+                    UpdateMaxVoltageDisplay(hWnd, ID_MAX_VOLTAGE_DISPLAY, measurementHistory.Session(TimeSeriesStore::VOLTAGE).maximum);
+                    UpdateMaxCurrentDisplay(hWnd, ID_MAX_CURRENT_DISPLAY, measurementHistory.Session(TimeSeriesStore::CURRENT).maximum);
                 }
             }
         }
         break;
 
+    case WM_DRAWITEM:
+        if(wParam == ID_CONNECT_LED)
+        {
+            DrawLed((const DRAWITEMSTRUCT*)lParam);
+            return TRUE;
+        }
+        break;
+
+    case WM_PORT_DISCOVERED:
+        {
+            std::unique_ptr<DiscoveredPort> port((DiscoveredPort*)lParam);
+            AddDiscoveredPort(GetDlgItem(hWnd, ID_COMBO_BOX_PORT), *port);
+
+            bool known = false;
+            for(DiscoveredPort& knownPort : knownPorts)
+            {
+                if(knownPort.name == port->name)
+                {
+                    if(!port->identity.empty())
+                    {
+                        knownPort.identity = port->identity;
+                    }
+                    known = true;
+                }
+            }
+            if(!known)
+            {
+                knownPorts.push_back(*port);
+            }
+            return 0;
+        }
+
+    case WM_SEQUENCE_DONE:
+        {
+            if(sequencePlayer.IsRunning() || sequenceProfilePath.empty())
+            {
+                return 0;
+            }
+            // Summary of the timing, the details go next to the profile
+            std::vector<StepTiming> timings = sequencePlayer.Timings();
+            RunningStatistics timingError = sequencePlayer.TimingError();
+            char summary[128];
+            snprintf(summary, sizeof(summary), "Profile: %u steps, error %.0f us avg, %.0f us max",
+                     (unsigned)timings.size(), timingError.mean, timingError.maximum);
+            SetWindowText(GetDlgItem(hWnd, ID_TEXT_OUTPUT), summary);
+
+            // Against the steps played: the file may have been changed since it was loaded
+            WriteTimingReport(sequenceProfilePath + ".timing.csv", sequencePlayer.PlayedSequence(), timings);
+            return 0;
+        }
+
+    case WM_LINK_EVENT:
+        {
+            std::unique_ptr<LinkEvent> event((LinkEvent*)lParam);
+            if(wParam != linkGeneration)
+            {
+                return 0;
+            }
+            // The supply may have been reset meanwhile
+            supplyState.Invalidate();
+            if(event->kind == LINK_RESTORED)
+            {
+                SetLedColor(GetDlgItem(hWnd, ID_CONNECT_LED), RGB(0, 255, 0));  // Green
+                SetWindowText(GetDlgItem(hWnd, ID_COMBO_BOX_BAUD_RATE), std::to_string(event->baudRate).c_str());
+            }
+            else
+            {
+                SetLedColor(GetDlgItem(hWnd, ID_CONNECT_LED), RGB(255, 0, 0));  // Red
+            }
+            LogDeviceEvent(hWnd, DescribeLinkEvent(*event));
+            return 0;
+        }
+
+    case WM_PORT_DISCOVERY_DONE:
+        {
+            SavePortCache(PORT_CACHE_FILE, knownPorts);
+            return 0;
+        }
+
     case WM_COMMAND:
         {
             int wmId = LOWORD(wParam);
@@ -181,9 +706,8 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             {
                 StartPollingTimer(hWnd, IDT_TIMER1);
                 HWND hComboBoxPortLocal = GetDlgItem(hWnd, ID_COMBO_BOX_PORT);
-                char selectedPort[256];
-                GetWindowText(hComboBoxPortLocal, selectedPort, sizeof(selectedPort));
-                if(strlen(selectedPort) == 0)
+                std::string selectedPort = GetSelectedPortName(hComboBoxPortLocal);
+                if(selectedPort.empty())
                 {
                     MessageBox(hWnd, "Please select a COM port.", "Error", MB_OK | MB_ICONERROR);
                     return 0;
@@ -196,23 +720,89 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
                 HWND hConnectLedLocal = GetDlgItem(hWnd, ID_CONNECT_LED);
 
-                if (OpenCOMPort(selectedPort) && ConfigureCOMPort(hComboBoxPortLocal, hComboBoxBaudRateLocal, hComboBoxByteSizeLocal, hComboBoxParityLocal, hComboBoxStopBitsLocal))
+                // The sequencer, the engine and the discovery must release the port before it is reopened
+                supplyState.Invalidate();
+                sequencePlayer.Stop();
+                acquisitionEngine.Stop();
+                portDiscovery.Cancel();
+                portDiscovery.Wait();
+                trafficTap = nullptr;
+                linkSupervisor = nullptr;
+                acquisitionEngine.SetLinkSupervisor(nullptr);
+
+                if (OpenCOMPort(selectedPort.c_str()) && ConfigureCOMPort(hComboBoxPortLocal, hComboBoxBaudRateLocal, hComboBoxByteSizeLocal, hComboBoxParityLocal, hComboBoxStopBitsLocal))
                 {
-                    // Successful opening of the COM port
-                    // getting information about the source
-                    std::string str = query("*IDN?");
+                    // Successful opening of the COM port: from here on a lost port is reopened, and all
+                    // traffic can be recorded
+                    SerialSettings lineSettings = ReadSerialSettings(hComboBoxBaudRateLocal, hComboBoxByteSizeLocal, hComboBoxParityLocal, hComboBoxStopBitsLocal);
+                    linkSupervisor = SuperviseCOMPort(hWnd, selectedPort, lineSettings);
+                    trafficTap = new RecordingTransport(std::unique_ptr<Transport>(linkSupervisor));
+                    comPort.reset(trafficTap);
+                    if(SendMessage(GetDlgItem(hWnd, ID_TRAFFIC_CHECKBOX), BM_GETCHECK, 0, 0) == BST_CHECKED &&
+                       !StartTrafficRecording(hWnd))
+                    {
+                        SendMessage(GetDlgItem(hWnd, ID_TRAFFIC_CHECKBOX), BM_SETCHECK, BST_UNCHECKED, 0);
+                    }
+
+                    // getting information about the source (empty if the supply does not identify itself)
+                    std::string str = ConnectAtKnownRate(selectedPort, lineSettings);
+                    ScpiIdentity identity;
                     std::string id_supply_power;
-                    if(!str.empty())
+                    supplyModel = &GENERIC_SUPPLY;
+                    if(DecodeResponse<SCPI_IDENTIFY>(str, identity))
+                    {
+                        id_supply_power = identity.model + " " + identity.serialNumber;
+                        supplyModel = &FindScpiModel(identity);
+                    }
+
+                    // Moving both ends to the highest rate the supply runs reliably at
+                    if(!str.empty() && SendMessage(GetDlgItem(hWnd, ID_NEGOTIATE_CHECKBOX), BM_GETCHECK, 0, 0) == BST_CHECKED)
                     {
-                        id_supply_power = str.substr(12, 26);
+                        BaudNegotiationResult negotiation = NegotiateBaudRate(*comPort, *supplyModel, lineSettings);
+                        if(negotiation.status == BAUD_LINK_LOST)
+                        {
+                            SetLedColor(hConnectLedLocal, RGB(255, 0, 0));  // Red
+                            MessageBox(hWnd, DescribeBaudNegotiation(negotiation.status), "Error", MB_OK | MB_ICONERROR);
+                            return 0;
+                        }
+                        if(negotiation.status != BAUD_RAISED)
+                        {
+                            // Connected at the old rate, but the box asked for more
+                            MessageBox(hWnd, DescribeBaudNegotiation(negotiation.status), "Max baud rate", MB_OK | MB_ICONINFORMATION);
+                        }
                     }
+                    SetWindowText(hComboBoxBaudRateLocal, std::to_string(lineSettings.baudRate).c_str());
+
+                    // What the supply is set to, with one batched query
+                    supplyState.SetModel(*supplyModel);
+                    acquisitionEngine.SetModel(*supplyModel);
+                    supplyState.ReadBack([](const std::string& message, std::string& response) {
+                        return SendSCPICommandAndGetResponse(*comPort, message, response) == QUERY_ANSWERED;
+                    });
+                    ShowSetting(hWnd, ID_VOLTAGE_EDIT, SETTING_VOLTAGE, powerSupplies.voltage);
+                    ShowSetting(hWnd, ID_CURRENT_EDIT, SETTING_CURRENT, powerSupplies.current);
+                    ShowSetting(hWnd, ID_RISE_EDIT, SETTING_RISE, powerSupplies.rise);
+                    ShowSetting(hWnd, ID_FALL_EDIT, SETTING_FALL, powerSupplies.fall);
+                    UpdateRestoreMessage();
 
                     HWND hTextOutputLocal = GetDlgItem(hWnd, ID_TEXT_OUTPUT);
 
                     SetWindowText(hTextOutputLocal, id_supply_power.c_str());
 
+                    // Remembering the port, so it is offered first on the next launch
+                    DiscoveredPort usedPort;
+                    usedPort.name = selectedPort;
+                    usedPort.identity = str;
+                    usedPort.baudRate = lineSettings.baudRate;
+                    MarkPortUsed(knownPorts, usedPort);
+                    SavePortCache(PORT_CACHE_FILE, knownPorts);
+
                     // Successful connection, set the green color of the diode
                     SetLedColor(hConnectLedLocal, RGB(0, 255, 0));  // Green
+
+                    LoadTriggers(hWnd);
+                    acquisitionEngine.SetLinkSupervisor(linkSupervisor);
+                    acquisitionEngine.Start(MakePollSchedule());
                 }
                 else
                 {
@@ -222,60 +812,105 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 }
             }
 
-            if(wmId == ID_SYST_REM_BUTTON)
+            if(wmId == ID_CAPTURE_CHECKBOX)
             {
-                sendCommand("SYST:REM");
+                HWND hCaptureCheckBox = GetDlgItem(hWnd, ID_CAPTURE_CHECKBOX);
+                if(SendMessage(hCaptureCheckBox, BM_GETCHECK, 0, 0) == BST_CHECKED)
+                {
+                    if(!StartCapture(hWnd))
+                    {
+                        SendMessage(hCaptureCheckBox, BM_SETCHECK, BST_UNCHECKED, 0);
+                    }
+                }
+                else
+                {
+                    captureLog.Close();
+                }
+            }
+
+            // Without a connection the recording starts on connect
+            if(wmId == ID_TRAFFIC_CHECKBOX && trafficTap)
+            {
+                HWND hTrafficCheckBox = GetDlgItem(hWnd, ID_TRAFFIC_CHECKBOX);
+                if(SendMessage(hTrafficCheckBox, BM_GETCHECK, 0, 0) == BST_CHECKED)
+                {
+                    if(!StartTrafficRecording(hWnd))
+                    {
+                        SendMessage(hTrafficCheckBox, BM_SETCHECK, BST_UNCHECKED, 0);
+                    }
+                }
+                else
+                {
+                    trafficTap->Stop();
+                }
+            }
+
+            if(wmId == ID_RUN_PROFILE_BUTTON)
+            {
+                RunProfile(hWnd);
+            }
+            else if(wmId == ID_STOP_PROFILE_BUTTON)
+            {
+                sequencePlayer.Stop();
+            }
+            else if(wmId == ID_SYST_REM_BUTTON)
+            {
+                ScpiMessage message;
+                BuildCommand<SCPI_REMOTE>(*supplyModel, message);
+                SendToPowerSupply(hWnd, message);
             }
             else if(wmId == ID_OUTPUT_ON_BUTTON)
             {
-                if(global_delay > 0)
+                // The delay is timed by the sequencer, so the window keeps responding meanwhile
+                ScpiMessage message;
+                BuildSwitch<SCPI_OUTPUT>(*supplyModel, true, message);
+                Sequence sequence;
+                std::string error;
+                if(global_delay > 0 && comPort &&
+                   sequence.Parse("wait " + std::to_string(global_delay) + "ms\n" + message.Text() + "\n", error))
+                {
+                    StartSequence(hWnd, sequence, std::string());
+                }
+                else
                 {
-                    Sleep(global_delay);
+                    SendToPowerSupply(hWnd, message);
                 }
-                sendCommand("OUTP ON");
             }
             else if(wmId == ID_OUTPUT_OFF_BUTTON)
             {
-                sendCommand("OUTP OFF");
+                sequencePlayer.Stop();
+                ScpiMessage message;
+                BuildSwitch<SCPI_OUTPUT>(*supplyModel, false, message);
+                SendToPowerSupply(hWnd, message);
             }
             else if(wmId == ID_SET_VOLTAGE_BUTTON)
             {
-                char buffer[256];
-                GetWindowText(GetDlgItem(hWnd, ID_VOLTAGE_EDIT), buffer, sizeof(buffer));
-                powerSupplies.voltage = buffer;
-                std::string cmd = "VOLT " + powerSupplies.voltage;
-                sendCommand(cmd);
+                SendSetpoint<SCPI_VOLTAGE>(hWnd, ID_VOLTAGE_EDIT, powerSupplies.voltage);
             }
             else if(wmId == ID_SET_CURRENT_BUTTON)
             {
-                char buffer[256];
-                GetWindowText(GetDlgItem(hWnd, ID_CURRENT_EDIT), buffer, sizeof(buffer));
-                powerSupplies.current = buffer;
-                std::string cmd = "CURR " + powerSupplies.current;
-                sendCommand(cmd);
+                SendSetpoint<SCPI_CURRENT>(hWnd, ID_CURRENT_EDIT, powerSupplies.current);
             }
             else if(wmId == ID_SET_RISE_BUTTON)
             {
-                char buffer[256];
-                GetWindowText(GetDlgItem(hWnd, ID_RISE_EDIT), buffer, sizeof(buffer));
-                powerSupplies.rise = buffer;
-                std::string cmd = "RISE " + powerSupplies.rise;
-                sendCommand(cmd);
+                SendSetpoint<SCPI_RISE>(hWnd, ID_RISE_EDIT, powerSupplies.rise);
             }
             else if(wmId == ID_SET_FALL_BUTTON)
             {
-                char buffer[256];
-                GetWindowText(GetDlgItem(hWnd, ID_FALL_EDIT), buffer, sizeof(buffer));
-                powerSupplies.fall = buffer;
-                std::string cmd = "FALL " + powerSupplies.fall;
-                sendCommand(cmd);
+                SendSetpoint<SCPI_FALL>(hWnd, ID_FALL_EDIT, powerSupplies.fall);
             }
             else if(wmId == ID_SET_DELAY_BUTTON)
             {
                 char buffer[256];
                 GetWindowText(GetDlgItem(hWnd, ID_DELAY_EDIT), buffer, sizeof(buffer));
+                double delay;
+                if(!ParseScpiNumber(buffer, buffer + strlen(buffer), delay) || delay < 0.0 || delay > 3600000.0)
+                {
+                    MessageBox(hWnd, "The delay must be a number of milliseconds.", "Error", MB_OK | MB_ICONERROR);
+                    return 0;
+                }
                 powerSupplies.delay = buffer;
-                global_delay = std::stoi(powerSupplies.delay);
+                global_delay = (int)delay;
             }
         }
         break;
@@ -284,6 +919,16 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     case WM_DESTROY:
         {
             StopPollingTimer(hWnd, IDT_TIMER1);
+            sequencePlayer.Stop();
+            acquisitionEngine.Stop();
+            captureLog.Close();
+            if(trafficTap)
+            {
+                trafficTap->Stop();
+            }
+            DumpInstrumentation(INSTRUMENTATION_FILE);
+            portDiscovery.Cancel();
+            portDiscovery.Wait();
             PostQuitMessage(0);
             return 0;
         }
@@ -310,7 +955,8 @@ void CreatePowerSupplyControlPanel(HWND hwnd, const PowerSupplyConfig& config, i
     // Creating a combo box for selecting a COM port
     HWND hComboBoxPort = CreateWindow("COMBOBOX", "", WS_VISIBLE | WS_CHILD | CBS_DROPDOWNLIST,
                                   margin + offsetX + 10, 75, 100, 100, hwnd, (HMENU)ID_COMBO_BOX_PORT, NULL, NULL);
-    PopulateCOMPorts(hComboBoxPort);
+    LoadPortCache(PORT_CACHE_FILE, knownPorts);
+    PopulateCOMPorts(hComboBoxPort, knownPorts);
 
     // Creating a ComboBox to select the data transfer rate
     HWND hComboBoxBaudRate = CreateWindow("COMBOBOX", NULL,
@@ -318,6 +964,10 @@ void CreatePowerSupplyControlPanel(HWND hwnd, const PowerSupplyConfig& config, i
                 margin + offsetX + 10, 120, 100, 200, hwnd, (HMENU)ID_COMBO_BOX_BAUD_RATE, NULL, NULL);
     PopulateBaudRates(hComboBoxBaudRate);
 
+    // Raising the baud rate on connect, as far as the supply and the cable allow
+    CreateWindow("BUTTON", "Max baud rate", WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                 margin + offsetX + 120, 120, 130, 25, hwnd, (HMENU)ID_NEGOTIATE_CHECKBOX, NULL, NULL);
+
     // Creating a ComboBox to select the byte size
     HWND hComboBoxByteSize = CreateWindow("COMBOBOX", NULL,
                 CBS_DROPDOWN | CBS_HASSTRINGS | WS_CHILD | WS_OVERLAPPED | WS_VISIBLE,
@@ -340,17 +990,23 @@ void CreatePowerSupplyControlPanel(HWND hwnd, const PowerSupplyConfig& config, i
     CreateWindow("BUTTON", "Connect", WS_VISIBLE | WS_CHILD,
                  margin + offsetX + 10, 300, 100, 30, hwnd, (HMENU)ID_CONNECT_BUTTON, NULL, NULL);
 
-    HWND hConnectLed = CreateWindow("STATIC", "", WS_VISIBLE | WS_CHILD | SS_CENTER,
+    HWND hConnectLed = CreateWindow("STATIC", "", WS_VISIBLE | WS_CHILD | SS_OWNERDRAW,
                                      margin + offsetX + 120, 300, 30, 30, hwnd, (HMENU)ID_CONNECT_LED, NULL, NULL);
 
+    // Recording every sample to a capture file
+    CreateWindow("BUTTON", "Capture", WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                 margin + offsetX + 170, 300, 100, 30, hwnd, (HMENU)ID_CAPTURE_CHECKBOX, NULL, NULL);
+
+    // Recording the traffic with the supply for trace_tool
+    CreateWindow("BUTTON", "Record traffic", WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
+                 margin + offsetX + 280, 300, 115, 30, hwnd, (HMENU)ID_TRAFFIC_CHECKBOX, NULL, NULL);
+
     // Set the initial color of the diode (gray)
-    HBRUSH hGrayBrush = CreateSolidBrush(RGB(128, 128, 128));
-    RECT ledRect = { 0, 0, 30, 30 };  // Creating a RECT object
-    HDC hdc = GetDC(hConnectLed);
-    FillRect(hdc, &ledRect, hGrayBrush); // Transmitting the address of the RECT object
-    ReleaseDC(hConnectLed, hdc);
-    DeleteObject(hGrayBrush);
+    SetLedColor(hConnectLed, RGB(128, 128, 128));
+
 
+    // Strip chart of the measurements next to the panel
+    stripChart.Create(hwnd, margin + offsetX + groupBoxWidth + 10, 40, 590, groupBoxHeight + 20, ID_STRIP_CHART);
 
     // Creating a GroupBox for power supply settings
     HWND hSettingsGroup = CreateWindow("BUTTON", "Power Supply Settings", WS_VISIBLE | WS_CHILD | BS_GROUPBOX,
@@ -415,5 +1071,10 @@ void CreatePowerSupplyControlPanel(HWND hwnd, const PowerSupplyConfig& config, i
                  margin + offsetX + 145, 560, 100, 30, hwnd, (HMENU)ID_OUTPUT_OFF_BUTTON, NULL, NULL);
     CreateWindow("BUTTON", "SYST:REM", WS_VISIBLE | WS_CHILD,
                  margin + offsetX + 280, 560, 100, 30, hwnd, (HMENU)ID_SYST_REM_BUTTON, NULL, NULL);
+
+    CreateWindow("BUTTON", "Run Profile", WS_VISIBLE | WS_CHILD,
+                 margin + offsetX + 10, 600, 100, 30, hwnd, (HMENU)ID_RUN_PROFILE_BUTTON, NULL, NULL);
+    CreateWindow("BUTTON", "Stop Profile", WS_VISIBLE | WS_CHILD,
+                 margin + offsetX + 145, 600, 100, 30, hwnd, (HMENU)ID_STOP_PROFILE_BUTTON, NULL, NULL);
 }
 
@@ -0,0 +1,62 @@
+#include "numeric.h"
+
+#include <charconv>
+#include <cstring>
+
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool ParseScpiNumber(const char* begin, const char* end, double& value) {
+    while (begin != end && isBlank(*begin)) {
+        begin++;
+    }
+    while (end != begin && isBlank(end[-1])) {
+        end--;
+    }
+    // std::from_chars does not accept an explicit plus sign, SCPI allows it
+    if (begin != end && *begin == '+') {
+        begin++;
+        if (begin != end && *begin == '-') {
+            return false;
+        }
+    }
+    if (begin == end) {
+        return false;
+    }
+
+    double parsed = 0.0;
+    std::from_chars_result result = std::from_chars(begin, end, parsed, std::chars_format::general);
+    if (result.ec != std::errc() || result.ptr != end) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+bool ParseScpiNumber(const std::string& text, double& value) {
+    return ParseScpiNumber(text.data(), text.data() + text.size(), value);
+}
+
+size_t FormatNumber(double value, char* buffer, size_t size, int precision) {
+    if (size == 0) {
+        return 0;
+    }
+    std::to_chars_result result = std::to_chars(buffer, buffer + size - 1, value, std::chars_format::fixed, precision);
+    if (result.ec != std::errc()) {
+        buffer[0] = '\0';
+        return 0;
+    }
+
+    size_t length = static_cast<size_t>(result.ptr - buffer);
+    if (std::memchr(buffer, '.', length) != nullptr) {
+        while (buffer[length - 1] == '0') {
+            length--;
+        }
+        if (buffer[length - 1] == '.') {
+            length--;
+        }
+    }
+    buffer[length] = '\0';
+    return length;
+}
@@ -0,0 +1,26 @@
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include <cstddef>
+#include <string>
+
+// Non-throwing conversions between numbers and SCPI text, built on std::from_chars/std::to_chars.
+// They work on caller-provided buffers and never allocate, so they can be used on the poll path.
+
+// Digits after the decimal point used by FormatNumber unless told otherwise (the same as std::to_string)
+const int DEFAULT_NUMBER_PRECISION = 6;
+
+// Longest text FormatNumber can produce for the values shown by the panel, with the terminating zero
+const size_t NUMBER_BUFFER_SIZE = 48;
+
+// Parsing an SCPI decimal number: NR1 ("12"), NR2 ("12.5") or NR3 ("1.25E+01").
+// Leading and trailing blanks (and the response terminator) are allowed, anything else is an error.
+// Returns false for empty, malformed or out-of-range text; value is not changed then.
+bool ParseScpiNumber(const char* begin, const char* end, double& value);
+bool ParseScpiNumber(const std::string& text, double& value);
+
+// Writing value with a fixed number of decimals and without trailing zeros ("12.5", "3", "-0.25").
+// Returns the length of the text, which is zero-terminated; 0 (and an empty text) if it does not fit.
+size_t FormatNumber(double value, char* buffer, size_t size, int precision = DEFAULT_NUMBER_PRECISION);
+
+#endif // NUMERIC_H
@@ -0,0 +1,145 @@
+#include "poll_scheduler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+PollSchedule PollSchedule::Fixed(microseconds period) {
+    PollSchedule schedule;
+    for (Rate& rate : schedule.rates) {
+        rate.fastest = period;
+        rate.slowest = period;
+    }
+    schedule.transientHold = std::chrono::milliseconds(0);
+    return schedule;
+}
+
+PollScheduler::PollScheduler(const PollSchedule& schedule) : schedule(schedule) {
+    if (this->schedule.linkBudget <= 0.0 || this->schedule.linkBudget > 1.0) {
+        this->schedule.linkBudget = 1.0;
+    }
+    Reset(steady_clock::now());
+}
+
+void PollScheduler::Reset(steady_clock::time_point now) {
+    roundTrip = microseconds(0);
+    transientUntil = now;
+    lastSent = now;
+    jitter.Clear();
+    for (int i = 0; i < POLL_QUANTITY_COUNT; i++) {
+        deadlines[i] = now;
+        periods[i] = fastestPeriod(static_cast<PollQuantity>(i));
+        haveLastValue[i] = false;
+    }
+}
+
+microseconds PollScheduler::fastestPeriod(PollQuantity quantity) const {
+    // The link is busy for one round trip per poll, the budget limits the share of that time
+    microseconds linkLimit(static_cast<int64_t>(roundTrip.count() / schedule.linkBudget));
+    return std::max(schedule.rates[quantity].fastest, linkLimit);
+}
+
+unsigned PollScheduler::Due(steady_clock::time_point now) const {
+    unsigned due = 0;
+    for (int i = 0; i < POLL_QUANTITY_COUNT; i++) {
+        if (deadlines[i] <= now) {
+            due |= 1u << i;
+        }
+    }
+    if (due != 0) {
+        for (int i = 0; i < POLL_QUANTITY_COUNT; i++) {
+            if (deadlines[i] <= now + roundTrip) {
+                due |= 1u << i;
+            }
+        }
+    }
+    return due;
+}
+
+steady_clock::time_point PollScheduler::NextDeadline() const {
+    return *std::min_element(deadlines, deadlines + POLL_QUANTITY_COUNT);
+}
+
+void PollScheduler::Completed(unsigned polled, steady_clock::time_point sent, steady_clock::time_point received) {
+    auto elapsed = std::chrono::duration_cast<microseconds>(received - sent);
+    // Exponential smoothing, the first measurement is taken as it is
+    roundTrip = roundTrip.count() == 0 ? elapsed : (roundTrip * 7 + elapsed) / 8;
+
+    for (int i = 0; i < POLL_QUANTITY_COUNT; i++) {
+        if (!(polled & (1u << i))) {
+            continue;
+        }
+        if (sent >= deadlines[i]) {
+            jitter.Add(static_cast<double>(std::chrono::duration_cast<microseconds>(sent - deadlines[i]).count()));
+        }
+    }
+    lastSent = sent;
+}
+
+void PollScheduler::Measured(PollQuantity quantity, bool valid, double value) {
+    microseconds fastest = fastestPeriod(quantity);
+    microseconds slowest = std::max(schedule.rates[quantity].slowest, fastest);
+    microseconds& period = periods[quantity];
+
+    bool changing = !valid || !haveLastValue[quantity] ||
+                    std::fabs(value - lastValues[quantity]) > schedule.rates[quantity].stableDelta;
+    if (valid) {
+        lastValues[quantity] = value;
+        haveLastValue[quantity] = true;
+    }
+
+    if (changing || lastSent < transientUntil) {
+        period = fastest;
+    } else {
+        period = std::min(slowest, std::max(fastest, microseconds(static_cast<int64_t>(period.count() * schedule.backoff))));
+    }
+
+    // Keeping the cadence; a deadline that has already passed is not caught up
+    deadlines[quantity] += period;
+    if (deadlines[quantity] < lastSent) {
+        deadlines[quantity] = lastSent + period;
+    }
+}
+
+void PollScheduler::Transient(steady_clock::time_point now) {
+    transientUntil = now + schedule.transientHold;
+    for (int i = 0; i < POLL_QUANTITY_COUNT; i++) {
+        periods[i] = fastestPeriod(static_cast<PollQuantity>(i));
+        deadlines[i] = std::min(deadlines[i], now);
+    }
+}
+
+microseconds PollScheduler::Period(PollQuantity quantity) const {
+    return periods[quantity];
+}
+
+microseconds PollScheduler::RoundTrip() const {
+    return roundTrip;
+}
+
+const RunningStatistics& PollScheduler::Jitter() const {
+    return jitter;
+}
+
+bool IsTransientCommand(const std::string& command) {
+    static const char* const headers[] = {"OUTP", "VOLT", "CURR", "RISE", "FALL", "*RST", "APPL"};
+
+    size_t start = command.find_first_not_of(" :");
+    if (start == std::string::npos || command.find('?') != std::string::npos) {
+        return false;  // Queries do not change anything
+    }
+    for (const char* header : headers) {
+        size_t i = 0;
+        while (header[i] != '\0' && start + i < command.size() &&
+               std::toupper(static_cast<unsigned char>(command[start + i])) == header[i]) {
+            i++;
+        }
+        if (header[i] == '\0') {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,77 @@
+#ifndef POLL_SCHEDULER_H
+#define POLL_SCHEDULER_H
+
+#include <chrono>
+#include <string>
+
+#include "statistics.h"
+
+// Quantities polled by the acquisition engine, each on its own schedule
+enum PollQuantity { POLL_VOLTAGE, POLL_CURRENT, POLL_QUANTITY_COUNT };
+
+// Polling configuration
+struct PollSchedule {
+    struct Rate {
+        // Shortest period; zero polls as fast as the link budget allows
+        std::chrono::microseconds fastest{0};
+        // Longest period, reached while the readings are stable
+        std::chrono::microseconds slowest{500000};
+        // A reading that differs from the previous one by more than this is a transient
+        double stableDelta = 0.001;
+    };
+
+    Rate rates[POLL_QUANTITY_COUNT];
+    double linkBudget = 0.5;  // Share of the link's time that polling may take (0..1]
+    double backoff = 1.5;     // Period growth per stable reading
+    std::chrono::milliseconds transientHold{2000};  // Fastest polling kept after an output change
+
+    // Every quantity polled at the same fixed period
+    static PollSchedule Fixed(std::chrono::microseconds period);
+};
+
+// Adaptive, deadline-driven poll scheduler. It measures the round-trip time of the link, polls
+// at the fastest rate the budget allows while a quantity is changing (or after a command that
+// changes the output), and backs off towards the slowest period while the readings are stable.
+// Used from one thread only (the acquisition engine's).
+class PollScheduler {
+public:
+    explicit PollScheduler(const PollSchedule& schedule = PollSchedule());
+
+    void Reset(std::chrono::steady_clock::time_point now);
+
+    // Quantities (bit 1 << PollQuantity) to poll now; a quantity due before the answer to this
+    // poll could arrive is included, so it shares the same message
+    unsigned Due(std::chrono::steady_clock::time_point now) const;
+    std::chrono::steady_clock::time_point NextDeadline() const;
+
+    // The poll of the due quantities was sent at sent and answered at received
+    void Completed(unsigned polled, std::chrono::steady_clock::time_point sent,
+                   std::chrono::steady_clock::time_point received);
+    // Result of one quantity of the last poll, adapting its period
+    void Measured(PollQuantity quantity, bool valid, double value);
+    // The output is about to change (OUTP, VOLT, CURR, RISE, FALL, *RST): polling at full rate for a while
+    void Transient(std::chrono::steady_clock::time_point now);
+
+    std::chrono::microseconds Period(PollQuantity quantity) const;
+    std::chrono::microseconds RoundTrip() const;
+    // Lateness of the polls against their deadlines, in microseconds
+    const RunningStatistics& Jitter() const;
+
+private:
+    std::chrono::microseconds fastestPeriod(PollQuantity quantity) const;
+
+    PollSchedule schedule;
+    std::chrono::microseconds roundTrip{0};  // Smoothed
+    std::chrono::steady_clock::time_point deadlines[POLL_QUANTITY_COUNT];
+    std::chrono::microseconds periods[POLL_QUANTITY_COUNT];
+    double lastValues[POLL_QUANTITY_COUNT];
+    bool haveLastValue[POLL_QUANTITY_COUNT];
+    std::chrono::steady_clock::time_point transientUntil;
+    std::chrono::steady_clock::time_point lastSent;
+    RunningStatistics jitter;
+};
+
+// Whether a command changes the output, so the readings are about to move
+bool IsTransientCommand(const std::string& command);
+
+#endif // POLL_SCHEDULER_H
@@ -0,0 +1,158 @@
+#include "port_discovery.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "scpi.h"
+#include "serial.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <cstring>
+#endif
+
+PortDiscovery::~PortDiscovery() {
+    Cancel();
+    Wait();
+}
+
+void PortDiscovery::Start(const std::vector<std::string>& candidateNames, const DiscoveryOptions& discoveryOptions,
+                          ResultCallback resultCallback, FinishedCallback finishedCallback) {
+    Cancel();
+    Wait();
+
+    candidates = candidateNames;
+    options = discoveryOptions;
+    onResult = std::move(resultCallback);
+    onFinished = std::move(finishedCallback);
+    nextCandidate = 0;
+    cancelled = false;
+
+    size_t count = std::max<size_t>(1, std::min(options.parallelism, candidates.size()));
+    activeWorkers = count;
+    for (size_t i = 0; i < count; i++) {
+        workers.emplace_back([this] {
+            for (;;) {
+                size_t index = nextCandidate++;
+                if (index >= candidates.size() || cancelled) {
+                    break;
+                }
+                probe(candidates[index]);
+            }
+            // The last worker to finish reports the end of the discovery
+            if (--activeWorkers == 0 && onFinished) {
+                onFinished();
+            }
+        });
+    }
+}
+
+void PortDiscovery::Cancel() {
+    cancelled = true;
+}
+
+void PortDiscovery::Wait() {
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void PortDiscovery::probe(const std::string& name) {
+    std::unique_ptr<Transport> transport = OpenSerialTransport(name.c_str(), false);
+    if (!transport) {
+        return;
+    }
+
+    DiscoveredPort port;
+    port.name = name;
+    if (options.identify && transport->Configure(options.settings)) {
+        try {
+            port.identity = query(*transport, "*IDN?", options.identifyTimeoutMs);
+        } catch (const std::runtime_error&) {
+            port.identity.clear();
+        }
+    }
+    transport.reset();
+
+    if (!cancelled && onResult) {
+        onResult(port);
+    }
+}
+
+std::vector<std::string> CandidatePortNames() {
+    std::vector<std::string> names;
+#ifdef _WIN32
+    for (int i = 1; i <= 256; i++) {
+        char portName[10];
+        snprintf(portName, sizeof(portName), "COM%d", i);
+        names.push_back(portName);
+    }
+#else
+    static const char* const prefixes[] = {"ttyS", "ttyUSB", "ttyACM"};
+    DIR* dir = opendir("/dev");
+    if (dir != nullptr) {
+        while (dirent* entry = readdir(dir)) {
+            for (const char* prefix : prefixes) {
+                if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0) {
+                    names.push_back(std::string("/dev/") + entry->d_name);
+                    break;
+                }
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(names.begin(), names.end());
+#endif
+    return names;
+}
+
+// Cache format: one port per line, "<name>\t<identity>[\t<negotiated baud rate>]"
+bool LoadPortCache(const std::string& path, std::vector<DiscoveredPort>& ports) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    ports.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        DiscoveredPort port;
+        port.name = line.substr(0, tab);
+        if (tab != std::string::npos) {
+            size_t rateTab = line.find('\t', tab + 1);
+            port.identity = line.substr(tab + 1, rateTab == std::string::npos ? std::string::npos : rateTab - tab - 1);
+            if (rateTab != std::string::npos) {
+                port.baudRate = std::strtoul(line.c_str() + rateTab + 1, nullptr, 10);
+            }
+        }
+        if (!port.name.empty()) {
+            ports.push_back(port);
+        }
+    }
+    return true;
+}
+
+bool SavePortCache(const std::string& path, const std::vector<DiscoveredPort>& ports) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    for (const DiscoveredPort& port : ports) {
+        file << port.name << '\t' << port.identity;
+        if (port.baudRate != 0) {
+            file << '\t' << port.baudRate;
+        }
+        file << '\n';
+    }
+    return static_cast<bool>(file);
+}
+
+void MarkPortUsed(std::vector<DiscoveredPort>& ports, const DiscoveredPort& used) {
+    ports.erase(std::remove_if(ports.begin(), ports.end(),
+                               [&used](const DiscoveredPort& port) { return port.name == used.name; }),
+                ports.end());
+    ports.insert(ports.begin(), used);
+}
@@ -0,0 +1,66 @@
+#ifndef PORT_DISCOVERY_H
+#define PORT_DISCOVERY_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transport.h"
+
+// A serial port found by the discovery, with the identity of the instrument behind it
+struct DiscoveredPort {
+    std::string name;
+    std::string identity;  // *IDN? response, empty if not identified
+    unsigned long baudRate = 0;  // Rate the instrument was last used at (it may have been negotiated), 0 if unknown
+};
+
+// Discovery options
+struct DiscoveryOptions {
+    size_t parallelism = 8;       // Ports probed at the same time
+    bool identify = true;         // Sending *IDN? to every port that could be opened
+    int identifyTimeoutMs = 300;
+    SerialSettings settings;      // Line settings used for the *IDN? probe
+};
+
+// Probing serial ports in the background with bounded parallelism.
+// The callbacks are called on the worker threads.
+class PortDiscovery {
+public:
+    typedef std::function<void(const DiscoveredPort&)> ResultCallback;
+    typedef std::function<void()> FinishedCallback;
+
+    ~PortDiscovery();
+
+    void Start(const std::vector<std::string>& candidates, const DiscoveryOptions& options,
+               ResultCallback onResult, FinishedCallback onFinished);
+    void Cancel();
+    void Wait();
+
+private:
+    void probe(const std::string& name);
+
+    std::vector<std::string> candidates;
+    DiscoveryOptions options;
+    ResultCallback onResult;
+    FinishedCallback onFinished;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextCandidate{0};
+    std::atomic<size_t> activeWorkers{0};
+    std::atomic<bool> cancelled{false};
+};
+
+// Names of the serial ports that may exist on this system (COM1..COM256 or /dev/tty*)
+std::vector<std::string> CandidatePortNames();
+
+// Cache of the ports found last time; the first entry is the last used port
+const char* const PORT_CACHE_FILE = "port_cache.txt";
+bool LoadPortCache(const std::string& path, std::vector<DiscoveredPort>& ports);
+bool SavePortCache(const std::string& path, const std::vector<DiscoveredPort>& ports);
+
+// Moving the port to the front of the cache entries (adding it if missing)
+void MarkPortUsed(std::vector<DiscoveredPort>& ports, const DiscoveredPort& used);
+
+#endif // PORT_DISCOVERY_H
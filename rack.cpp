@@ -0,0 +1,233 @@
+#include "rack.h"
+
+#include "capture_log.h"
+#include "scpi.h"
+#include "scpi_batch.h"
+
+DeviceSession::DeviceSession(size_t index, const std::string& name, std::unique_ptr<Transport> transport,
+                             std::chrono::microseconds pollPeriod, const ScpiModel& model)
+    : index(index), name(name), transport(std::move(transport)), pollPeriod(pollPeriod), state(model) {
+    AppendToProgramMessage(pollMessage, model.commands[SCPI_MEASURE_VOLTAGE].shortForm);
+    AppendToProgramMessage(pollMessage, model.commands[SCPI_MEASURE_CURRENT].shortForm);
+    pollMessage += '\n';
+}
+
+size_t DeviceSession::Index() const {
+    return index;
+}
+
+const std::string& DeviceSession::Name() const {
+    return name;
+}
+
+bool DeviceSession::Online() const {
+    return online;
+}
+
+uint64_t DeviceSession::SamplesTaken() const {
+    return samplesTaken;
+}
+
+uint64_t DeviceSession::Timeouts() const {
+    return timeouts;
+}
+
+const DeviceStateCache& DeviceSession::State() const {
+    return state;
+}
+
+DeviceRegistry::DeviceRegistry() {
+    resyncMessage = std::string(RESYNC_QUERY) + '\n';
+}
+
+DeviceRegistry::~DeviceRegistry() {
+    Stop();
+}
+
+size_t DeviceRegistry::Add(const std::string& name, std::unique_ptr<Transport> transport,
+                           std::chrono::microseconds pollPeriod, const ScpiModel& model) {
+    size_t index = sessions.size();
+    sessions.emplace_back(new DeviceSession(index, name, std::move(transport), pollPeriod, model));
+    return index;
+}
+
+size_t DeviceRegistry::Count() const {
+    return sessions.size();
+}
+
+const DeviceSession& DeviceRegistry::Session(size_t index) const {
+    return *sessions[index];
+}
+
+uint64_t DeviceRegistry::DroppedSamples() const {
+    return droppedSamples;
+}
+
+void DeviceRegistry::SetCaptureLog(CaptureLog* log) {
+    captureLog = log;
+}
+
+bool DeviceRegistry::PopSample(RackSample& sample) {
+    return samples.Pop(sample);
+}
+
+// The commands posted in a burst are collected and written with one call; a poll due
+// before the flush takes them along with its own message
+void DeviceRegistry::PostCommand(size_t device, const std::string& command) {
+    loop.Post([this, device, command] {
+        DeviceSession& session = *sessions[device];
+        if (!session.online || !session.state.ShouldSend(command)) {
+            return;
+        }
+        session.output.Append(command);
+        if (!session.flushPosted) {
+            session.flushPosted = true;
+            loop.Post([this, &session] { flushOutput(session); });
+        }
+    });
+}
+
+void DeviceRegistry::flushOutput(DeviceSession& session) {
+    session.flushPosted = false;
+    if (session.online && !session.output.Flush(*session.transport)) {
+        onError(session);
+    }
+}
+
+void DeviceRegistry::Start() {
+    Stop();
+    worker = std::thread([this] {
+        for (size_t i = 0; i < sessions.size(); i++) {
+            // Spreading the first polls over one period, so the devices do not all fire at once
+            DeviceSession& session = *sessions[i];
+            session.nextPoll = std::chrono::steady_clock::now() + session.pollPeriod * i / sessions.size();
+            startSession(session);
+        }
+        loop.Run();
+
+        for (auto& session : sessions) {
+            loop.Unwatch(session->transport->Handle());
+            loop.CancelTimer(session->pollTimer);
+            loop.CancelTimer(session->timeoutTimer);
+            session->inFlight = false;
+            session->resyncing = false;
+            session->online = false;
+        }
+    });
+}
+
+void DeviceRegistry::Stop() {
+    if (worker.joinable()) {
+        loop.Stop();
+        worker.join();
+    }
+}
+
+void DeviceRegistry::startSession(DeviceSession& session) {
+    session.reader.Clear();
+    bool watched = loop.Watch(session.transport->Handle(),
+        [this, &session](const char* data, size_t length) {
+            session.reader.Feed(data, length, [this, &session](const std::string& line) { onResponse(session, line); });
+        },
+        [this, &session] { onError(session); });
+
+    session.online = watched;
+    if (watched) {
+        schedulePoll(session);
+    }
+}
+
+void DeviceRegistry::schedulePoll(DeviceSession& session) {
+    auto now = std::chrono::steady_clock::now();
+    if (session.nextPoll <= now) {
+        poll(session);
+        return;
+    }
+    session.pollTimer = loop.AddTimer(session.nextPoll, [this, &session] {
+        session.pollTimer = 0;
+        poll(session);
+    });
+}
+
+void DeviceRegistry::poll(DeviceSession& session) {
+    session.requestSent = std::chrono::steady_clock::now();
+    const std::string& message = session.resyncing ? resyncMessage : session.pollMessage;
+    session.output.AppendMessage(message.c_str(), message.size());
+    if (!session.output.Flush(*session.transport)) {
+        onError(session);
+        return;
+    }
+    session.inFlight = true;
+    session.timeoutTimer = loop.AddTimer(session.requestSent + std::chrono::milliseconds(RESPONSE_TIMEOUT_MS),
+                                         [this, &session] {
+                                             session.timeoutTimer = 0;
+                                             onTimeout(session);
+                                         });
+}
+
+void DeviceRegistry::onResponse(DeviceSession& session, const std::string& response) {
+    if (!session.inFlight) {
+        return;  // Late answer to a poll that has already timed out
+    }
+    if (session.resyncing) {
+        if (response != RESYNC_ANSWER) {
+            return;  // Late answer to the poll that timed out
+        }
+        session.resyncing = false;
+        session.inFlight = false;
+        loop.CancelTimer(session.timeoutTimer);
+        session.timeoutTimer = 0;
+        session.nextPoll = std::chrono::steady_clock::now();
+        schedulePoll(session);
+        return;
+    }
+    session.inFlight = false;
+    loop.CancelTimer(session.timeoutTimer);
+    session.timeoutTimer = 0;
+
+    RackSample rackSample;
+    rackSample.device = session.index;
+    rackSample.sample.timestamp = session.requestSent;
+    SplitResponseMessage(response, responseParts);
+    rackSample.sample.valid = responseParts.size() == 2 &&
+                              ParseMeasurement(responseParts[0], rackSample.sample.voltage) &&
+                              ParseMeasurement(responseParts[1], rackSample.sample.current);
+    session.samplesTaken++;
+    if (!samples.Push(rackSample)) {
+        droppedSamples++;
+    }
+    if (CaptureLog* log = captureLog.load()) {
+        log->Append(rackSample.sample, static_cast<uint16_t>(session.index));
+    }
+
+    session.nextPoll += session.pollPeriod;
+    auto now = std::chrono::steady_clock::now();
+    if (session.nextPoll < now) {
+        session.nextPoll = now;  // Not catching up on missed polls
+    }
+    schedulePoll(session);
+}
+
+// The answer may still come and would be taken for the next poll's: the next message is
+// RESYNC_QUERY, and polling resumes once it is answered
+void DeviceRegistry::onTimeout(DeviceSession& session) {
+    session.timeouts++;
+    session.inFlight = false;
+    session.resyncing = true;
+    session.reader.Clear();
+    session.nextPoll = std::chrono::steady_clock::now();
+    schedulePoll(session);
+}
+
+void DeviceRegistry::onError(DeviceSession& session) {
+    loop.Unwatch(session.transport->Handle());
+    loop.CancelTimer(session.pollTimer);
+    loop.CancelTimer(session.timeoutTimer);
+    session.pollTimer = 0;
+    session.timeoutTimer = 0;
+    session.inFlight = false;
+    session.resyncing = false;
+    session.online = false;
+    session.output.Clear();
+    session.state.Invalidate();
+}
@@ -0,0 +1,116 @@
+#ifndef RACK_H
+#define RACK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "acquisition.h"
+#include "command_buffer.h"
+#include "device_state.h"
+#include "event_loop.h"
+#include "line_reader.h"
+#include "spsc_queue.h"
+#include "transport.h"
+
+// Sample of one power supply in the rack
+struct RackSample {
+    size_t device = 0;
+    Sample sample;
+};
+
+// Session of one power supply: its port, polling schedule and response framing.
+// Sessions are driven by the registry's event loop, there is no thread per port.
+class DeviceSession {
+public:
+    DeviceSession(size_t index, const std::string& name, std::unique_ptr<Transport> transport,
+                  std::chrono::microseconds pollPeriod, const ScpiModel& model = GENERIC_SUPPLY);
+
+    size_t Index() const;
+    const std::string& Name() const;
+    bool Online() const;
+    uint64_t SamplesTaken() const;
+    uint64_t Timeouts() const;
+    // Settings programmed through PostCommand; commands that would not change them are not sent
+    const DeviceStateCache& State() const;
+
+private:
+    friend class DeviceRegistry;
+
+    size_t index;
+    std::string name;
+    std::unique_ptr<Transport> transport;
+    std::chrono::microseconds pollPeriod;
+    std::string pollMessage;    // The model's measurement queries, with the terminator
+
+    LineReader reader;
+    CommandBuffer output;       // Commands posted since the last write, sent together
+    bool flushPosted = false;
+    DeviceStateCache state;
+    std::chrono::steady_clock::time_point nextPoll;
+    std::chrono::steady_clock::time_point requestSent;
+    EventLoop::TimerId pollTimer = 0;
+    EventLoop::TimerId timeoutTimer = 0;
+    bool inFlight = false;
+    bool resyncing = false;     // After a timeout, until the answer to RESYNC_QUERY (scpi.h)
+    std::atomic<bool> online{false};
+    std::atomic<uint64_t> samplesTaken{0};
+    std::atomic<uint64_t> timeouts{0};
+};
+
+// Registry of the power supplies in a rack. All sessions are polled from one event loop
+// thread, so the polls of different devices overlap and the aggregate sample rate grows
+// with the number of ports.
+class DeviceRegistry {
+public:
+    DeviceRegistry();
+    ~DeviceRegistry();
+
+    DeviceRegistry(const DeviceRegistry&) = delete;
+    DeviceRegistry& operator=(const DeviceRegistry&) = delete;
+
+    // Adding a supply; only before Start. A poll period of zero polls as fast as the link allows.
+    // The model's command table gives the poll queries and the settings of its state.
+    size_t Add(const std::string& name, std::unique_ptr<Transport> transport, std::chrono::microseconds pollPeriod,
+               const ScpiModel& model = GENERIC_SUPPLY);
+
+    size_t Count() const;
+    const DeviceSession& Session(size_t index) const;
+
+    void Start();
+    void Stop();
+
+    // Called from one consumer thread (e.g. the UI)
+    bool PopSample(RackSample& sample);
+    void PostCommand(size_t device, const std::string& command);
+
+    uint64_t DroppedSamples() const;
+
+    // Every sample is also appended to the capture log (with the device index) while it is open
+    void SetCaptureLog(CaptureLog* log);
+
+private:
+    void startSession(DeviceSession& session);
+    void schedulePoll(DeviceSession& session);
+    void poll(DeviceSession& session);
+    void flushOutput(DeviceSession& session);
+    void onResponse(DeviceSession& session, const std::string& response);
+    void onTimeout(DeviceSession& session);
+    void onError(DeviceSession& session);
+
+    EventLoop loop;
+    std::thread worker;
+    std::vector<std::unique_ptr<DeviceSession>> sessions;
+    std::string resyncMessage;
+    std::vector<std::string> responseParts;
+
+    SpscQueue<RackSample, 16384> samples;
+    std::atomic<uint64_t> droppedSamples{0};
+    std::atomic<CaptureLog*> captureLog{nullptr};
+};
+
+#endif // RACK_H
@@ -1,65 +1,174 @@
 #include "scpi.h"
 #include "serial.h"
 
-bool sendCommand(const std::string& command) {
-    DWORD bytes_written;
-    std::string cmd = command + "\n";
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
 
-    if (!WriteFile(hComPort, cmd.c_str(), cmd.length(), &bytes_written, NULL))
-    {
-        throw std::runtime_error("Error writing to serial port");
-        return false;
+#include "instrumentation.h"
+#include "numeric.h"
+#include "scpi_commands.h"
+#include "timeseries.h"
+#include "trace_sink.h"
+
+// The open COM port, for the overloads without a transport
+static Transport& activePort() {
+    if (!comPort) {
+        throw std::runtime_error("COM port is not open");
     }
-    printf("%s", cmd.c_str());
-    return true;
+    return *comPort;
 }
 
-std::string query(const std::string& command) {
-    sendCommand(command);
-    char buffer[256];
-    DWORD bytes_read;
-    if (!ReadFile(hComPort, buffer, sizeof(buffer), &bytes_read, NULL)) {
-            throw std::runtime_error("Error reading from serial port");
+// Reading one response line; returns as soon as the terminator arrives
+static QueryStatus readResponse(Transport& transport, std::string& response, int timeoutMs, CommandTrace& trace) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    LineTiming timing;
+    LineReader::Status status = transport.ReadLine(response, deadline, &timing);
+    if (status != LineReader::READ_ERROR) {
+        trace.Received(timing.firstByte, timing.bytesRead, status == LineReader::LINE_COMPLETE);
+    }
+    switch (status) {
+    case LineReader::LINE_COMPLETE:
+        return QUERY_ANSWERED;
+    case LineReader::TIMEOUT:
+        // An incomplete response must not be taken for the beginning of the next one, nor a late
+        // answer for the next response
+        transport.DiscardInput();
+        transport.SetLateAnswerPending(true);
+        response.clear();
+        return QUERY_TIMEOUT;
+    default:
+        // Nor what arrived before the error, which may be from a port that has been reopened since
+        trace.Failed();
+        transport.DiscardInput();
+        response.clear();
+        return QUERY_FAILED;
     }
-    return std::string(buffer, bytes_read);
 }
 
-void checkError() {
-    std::string error = query("SYST:ERR?");
-    if (error.find("No error") == std::string::npos) {
-        throw std::runtime_error("SCPI Error: " + error);
+static const char TERMINATOR[] = "\n";
+
+// Before a query after a timeout: sending RESYNC_QUERY and dropping what arrives up to its answer.
+// The OS input buffer cannot be flushed instead, as the late answer may still be on the line.
+static QueryStatus resynchronize(Transport& transport, int timeoutMs) {
+    if (!transport.LateAnswerPending()) {
+        return QUERY_ANSWERED;
+    }
+    CommandTrace trace(RESYNC_QUERY, sizeof(RESYNC_QUERY) - 1);
+    const OutputSegment segments[] = {{RESYNC_QUERY, sizeof(RESYNC_QUERY) - 1}, {TERMINATOR, 1}};
+    bool written = transport.WriteMessage(segments, 2);
+    trace.Written(sizeof(RESYNC_QUERY), written);
+    if (!written) {
+        return QUERY_FAILED;
+    }
+    commandTrace.WriteLine(RESYNC_QUERY, sizeof(RESYNC_QUERY) - 1);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::string line;
+    while (true) {
+        LineTiming timing;
+        LineReader::Status status = transport.ReadLine(line, deadline, &timing);
+        if (status == LineReader::READ_ERROR) {
+            trace.Failed();
+            transport.DiscardInput();
+            return QUERY_FAILED;
+        }
+        if (status == LineReader::TIMEOUT) {
+            trace.Received(timing.firstByte, timing.bytesRead, false);
+            transport.DiscardInput();
+            return QUERY_TIMEOUT;  // Still pending
+        }
+        if (status == LineReader::LINE_COMPLETE && line == RESYNC_ANSWER) {
+            trace.Received(timing.firstByte, timing.bytesRead, true);
+            transport.SetLateAnswerPending(false);
+            return QUERY_ANSWERED;
+        }
     }
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writing the command and its terminator as one message, without copying them together
+static bool writeCommand(Transport& transport, const std::string& command, CommandTrace& trace) {
+    const OutputSegment segments[] = {{command.data(), command.size()}, {TERMINATOR, 1}};
 
-void StartPollingTimer(HWND hwnd, int ID_TIMER) {
-    SetTimer(hwnd, ID_TIMER, 500, NULL);  // Setting a timer with an interval of 1 second
+    bool written = transport.WriteMessage(segments, 2);
+    trace.Written(command.size() + 1, written);
+    if (!written)
+    {
+        throw std::runtime_error("Error writing to serial port");
+        return false;
+    }
+    commandTrace.WriteLine(command.data(), command.size());
+    return true;
 }
 
-void StopPollingTimer(HWND hwnd, int ID_TIMER) {
-    KillTimer(hwnd, ID_TIMER);
+bool sendCommand(Transport& transport, const std::string& command) {
+    CommandTrace trace(command);
+    return writeCommand(transport, command, trace);
 }
 
+bool sendCommand(const std::string& command) {
+    return sendCommand(activePort(), command);
+}
 
-void UpdateVoltageDisplay(HWND hwnd, int ID_VOLTAGE_DISPLAY, const std::string& voltage) {
-    std::string displayText = "Actual Voltage: " + voltage;
-    SetWindowText(GetDlgItem(hwnd, ID_VOLTAGE_DISPLAY), displayText.c_str());
+std::string query(Transport& transport, const std::string& command, int timeoutMs) {
+    std::string response;
+    switch (resynchronize(transport, timeoutMs)) {
+    case QUERY_TIMEOUT:
+        return response;  // The supply does not answer; the query is not sent into the late answers
+    case QUERY_FAILED:
+        throw std::runtime_error("Error reading from serial port");
+    default:
+        break;
+    }
+    CommandTrace trace(command);
+    writeCommand(transport, command, trace);
+    if (readResponse(transport, response, timeoutMs, trace) == QUERY_FAILED) {
+            throw std::runtime_error("Error reading from serial port");
+    }
+    return response;
 }
 
-void UpdateCurrentDisplay(HWND hwnd, int ID_CURRENT_DISPLAY, const std::string& current) {
-    std::string displayText = "Actual Current: " + current;
-    SetWindowText(GetDlgItem(hwnd, ID_CURRENT_DISPLAY), displayText.c_str());
+std::string query(const std::string& command) {
+    return query(activePort(), command);
 }
 
-void UpdateMaxVoltageDisplay(HWND hwnd, int ID_MAX_VOLTAGE_DISPLAY, const std::string& voltage) {
-    std::string displayText = "Max Voltage: " + voltage;
-    SetWindowText(GetDlgItem(hwnd, ID_MAX_VOLTAGE_DISPLAY), displayText.c_str());
+bool QueryBlock(Transport& transport, const std::string& command, BlockDecoder& block, int timeoutMs) {
+    switch (resynchronize(transport, timeoutMs)) {
+    case QUERY_TIMEOUT:
+        return false;
+    case QUERY_FAILED:
+        throw std::runtime_error("Error reading from serial port");
+    default:
+        break;
+    }
+    CommandTrace trace(command);
+    writeCommand(transport, command, trace);
+    LineTiming timing;
+    LineReader::Status status = transport.ReadBlock(block, std::chrono::milliseconds(timeoutMs), &timing);
+    if (status == LineReader::READ_ERROR) {
+        trace.Failed();
+        throw std::runtime_error("Error reading from serial port");
+    }
+    trace.Received(timing.firstByte, timing.bytesRead, status == LineReader::LINE_COMPLETE);
+    if (status != LineReader::LINE_COMPLETE) {
+        // The rest of the block may still be arriving and must not be taken for the next response:
+        // with the header read it is read to its end, otherwise the next query resynchronizes first
+        char scratch[4096];
+        if (!block.Skip(scratch, sizeof(scratch)) ||
+            transport.ReadBlock(block, std::chrono::milliseconds(timeoutMs)) != LineReader::LINE_COMPLETE) {
+            transport.DiscardInput();
+            transport.SetLateAnswerPending(true);
+        }
+        return false;
+    }
+    return true;
 }
 
-void UpdateMaxCurrentDisplay(HWND hwnd, int ID_MAX_CURRENT_DISPLAY, const std::string& current) {
-    std::string displayText = "Max Current: " + current;
-    SetWindowText(GetDlgItem(hwnd, ID_MAX_CURRENT_DISPLAY), displayText.c_str());
+void checkError() {
+    std::string response = query(GENERIC_SUPPLY.commands[SCPI_NEXT_ERROR].shortForm);
+    ScpiError error;
+    if (!DecodeResponse<SCPI_NEXT_ERROR>(response, error) || error.code != 0) {
+        throw std::runtime_error("SCPI Error: " + response);
+    }
 }
 
 std::string removeNewLine(const std::string& str)
@@ -72,48 +181,109 @@ std::string removeNewLine(const std::string& str)
     return result;
 }
 
-std::string SendSCPICommandAndGetResponse(HANDLE hComPort, const std::string& command) {
-    DWORD bytesWritten;
-    WriteFile(hComPort, command.c_str(), command.length(), &bytesWritten, NULL);
+QueryStatus SendSCPICommandAndGetResponse(Transport& transport, const std::string& command, std::string& response) {
+    QueryStatus status = resynchronize(transport, RESPONSE_TIMEOUT_MS);
+    if (status != QUERY_ANSWERED) {
+        response.clear();
+        return status;
+    }
 
-    // Sending a line completion command (for example, \n)
-    const char terminator = '\n';
-    WriteFile(hComPort, &terminator, 1, &bytesWritten, NULL);
+    // The command and its line terminator go out as one message, so a command written by the
+    // sequencer from another thread cannot end up between them
+    CommandTrace trace(command);
+    const OutputSegment segments[] = {{command.data(), command.size()}, {TERMINATOR, 1}};
+    bool written = transport.WriteMessage(segments, 2);
+    trace.Written(command.size() + 1, written);
+    if (!written) {
+        response.clear();
+        return QUERY_FAILED;
+    }
 
     // Reading the response
-    char buffer[256];
-    DWORD bytesRead;
-    ReadFile(hComPort, buffer, sizeof(buffer) - 1, &bytesRead, NULL);
-    buffer[bytesRead] = '\0';  // Completing the line
+    return readResponse(transport, response, RESPONSE_TIMEOUT_MS, trace);
+}
+
+std::string SendSCPICommandAndGetResponse(Transport& transport, const std::string& command) {
+    std::string response;
+    SendSCPICommandAndGetResponse(transport, command, response);
+    return response;
+}
 
-    return std::string(buffer);
+void RegisterMinMaxValues(double voltage, double current)
+{
+    Sample sample;
+    sample.timestamp = std::chrono::steady_clock::now();
+    sample.voltage = voltage;
+    sample.current = current;
+    sample.valid = true;
+    measurementHistory.Add(sample);
 }
 
 std::string reduceTrailingZeros(double value)
 {
-    std::string stringValue = std::to_string(value);
-    size_t pos = stringValue.find_last_not_of('0');
-    if(pos != std::string::npos && stringValue[pos] == '.')
-    {
-        pos--;
-    }
-    return stringValue.substr(0, pos + 1);
+    char buffer[NUMBER_BUFFER_SIZE];
+    size_t length = FormatNumber(value, buffer, sizeof(buffer));
+    return std::string(buffer, length);
 }
 
-void SetLedColor(HWND hLed, COLORREF color) {
-    HBRUSH hBrush = CreateSolidBrush(color);
-    HDC hdc = GetDC(hLed);
+//////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    RECT rect;
-    GetClientRect(hLed, &rect);
+#ifdef _WIN32
 
-    FillRect(hdc, &rect, hBrush);
+void StartPollingTimer(HWND hwnd, int ID_TIMER) {
+    // Setting a timer with an interval of 500 ms; it only refreshes the displays,
+    // the polling itself is scheduled by the acquisition engine
+    SetTimer(hwnd, ID_TIMER, 500, NULL);
+}
 
-    ReleaseDC(hLed, hdc);
-    DeleteObject(hBrush);
+void StopPollingTimer(HWND hwnd, int ID_TIMER) {
+    KillTimer(hwnd, ID_TIMER);
+}
+
+
+// Showing "<label><value>" in a static control; the text is built on the stack
+static void setDisplayValue(HWND hwnd, int id, const char* label, double value) {
+    char displayText[64];
+    size_t labelLength = strlen(label);
+    memcpy(displayText, label, labelLength);
+    FormatNumber(value, displayText + labelLength, sizeof(displayText) - labelLength);
+
+    // Setting the same text again still repaints the control, several times a second
+    HWND display = GetDlgItem(hwnd, id);
+    char shownText[64];
+    if (GetWindowText(display, shownText, sizeof(shownText)) > 0 && strcmp(shownText, displayText) == 0) {
+        return;
+    }
+    SetWindowText(display, displayText);
+}
+
+void UpdateVoltageDisplay(HWND hwnd, int ID_VOLTAGE_DISPLAY, double voltage) {
+    setDisplayValue(hwnd, ID_VOLTAGE_DISPLAY, "Actual Voltage: ", voltage);
 }
 
+void UpdateCurrentDisplay(HWND hwnd, int ID_CURRENT_DISPLAY, double current) {
+    setDisplayValue(hwnd, ID_CURRENT_DISPLAY, "Actual Current: ", current);
+}
+
+void UpdateMaxVoltageDisplay(HWND hwnd, int ID_MAX_VOLTAGE_DISPLAY, double voltage) {
+    setDisplayValue(hwnd, ID_MAX_VOLTAGE_DISPLAY, "Max Voltage: ", voltage);
+}
 
+void UpdateMaxCurrentDisplay(HWND hwnd, int ID_MAX_CURRENT_DISPLAY, double current) {
+    setDisplayValue(hwnd, ID_MAX_CURRENT_DISPLAY, "Max Current: ", current);
+}
 
+// The LED is owner drawn: the color is kept with the control and painted by DrawLed, so it
+// survives the window being covered and repainted
+void SetLedColor(HWND hLed, COLORREF color) {
+    SetWindowLongPtr(hLed, GWLP_USERDATA, (LONG_PTR)color);
+    InvalidateRect(hLed, NULL, FALSE);
+}
 
+void DrawLed(const DRAWITEMSTRUCT* item) {
+    HBRUSH hBrush = CreateSolidBrush((COLORREF)GetWindowLongPtr(item->hwndItem, GWLP_USERDATA));
+    FillRect(item->hDC, &item->rcItem, hBrush);
+    DeleteObject(hBrush);
+}
 
+#endif
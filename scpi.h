@@ -1,14 +1,44 @@
 #ifndef SCPI_H
 #define SCPI_H
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <string>
 
-//Functions for controlling the power supply
+#include "scpi_block.h"
+#include "transport.h"
+
+// Time to wait for the response to a query
+const int RESPONSE_TIMEOUT_MS = 1000;
+
+// After a query timed out its answer may still arrive and be taken for the next query's. Before the
+// next query this is sent and every line up to its answer dropped; no single query is answered "1;1".
+// Common commands take no ':' in a program message (AppendToProgramMessage), a strict parser rejects ":*OPC?".
+const char RESYNC_QUERY[] = "*OPC?;*OPC?";
+const char RESYNC_ANSWER[] = "1;1";
+
+// Outcome of a query
+enum QueryStatus {
+    QUERY_ANSWERED,
+    QUERY_TIMEOUT,  // No answer in time, or the supply could not be resynchronized after an earlier timeout
+    QUERY_FAILED    // The port failed
+};
+
+//Functions for controlling the power supply (the overloads without a transport use the open COM port)
+bool sendCommand(Transport& transport, const std::string& command);
 bool sendCommand(const std::string& command);
 
+// Empty on timeout; throws std::runtime_error if the port fails
+std::string query(Transport& transport, const std::string& command, int timeoutMs = RESPONSE_TIMEOUT_MS);
 std::string query(const std::string& command);
 
+// Query answered with a definite-length block (e.g. FETC:ARR:VOLT?), read into the decoder's buffer, which
+// the caller has Reset. False if the block is longer than the decoder takes or no complete block came
+// with no byte for timeoutMs; the rest of such a block is read and dropped. Throws like query if the
+// port fails.
+bool QueryBlock(Transport& transport, const std::string& command, BlockDecoder& block, int timeoutMs = RESPONSE_TIMEOUT_MS);
+
 void checkError();
 
 void SetVoltage();
@@ -16,20 +46,27 @@ void SetCurrent();
 void SetRiseTime();
 void SetFallTime();
 
+std::string removeNewLine(const std::string& str);
+std::string SendSCPICommandAndGetResponse(Transport& transport, const std::string& command);
+// Reading the response into a caller-owned string, which keeps its capacity between polls; the
+// response is empty unless the query was answered
+QueryStatus SendSCPICommandAndGetResponse(Transport& transport, const std::string& command, std::string& response);
+
+// Adding a measurement to measurementHistory (timeseries.h), which keeps the minima and maxima
+void RegisterMinMaxValues(double voltage, double current);
+std::string reduceTrailingZeros(double value);
+
+#ifdef _WIN32
 void SetLedColor(HWND hLed, COLORREF color);
+void DrawLed(const DRAWITEMSTRUCT* item);  // WM_DRAWITEM of the LED
 
 void StartPollingTimer(HWND hwnd, int ID_TIMER);
 void StopPollingTimer(HWND hwnd, int ID_TIMER);
-void UpdateVoltageDisplay(HWND hwnd, int ID_VOLTAGE_DISPLAY, const std::string& voltage);
-void UpdateCurrentDisplay(HWND hwnd, int ID_CURRENT_DISPLAY, const std::string& current);
-
-std::string removeNewLine(const std::string& str);
-std::string SendSCPICommandAndGetResponse(HANDLE hComPort, const std::string& command);
+void UpdateVoltageDisplay(HWND hwnd, int ID_VOLTAGE_DISPLAY, double voltage);
+void UpdateCurrentDisplay(HWND hwnd, int ID_CURRENT_DISPLAY, double current);
 
-void UpdateMaxVoltageDisplay(HWND hwnd, int ID_MAX_VOLTAGE_DISPLAY, const std::string& voltage);
-void UpdateMaxCurrentDisplay(HWND hwnd, int ID_MAX_CURRENT_DISPLAY, const std::string& current);
-
-void RegisterMinMaxValues(double voltage, double current);
-std::string reduceTrailingZeros(double value);
+void UpdateMaxVoltageDisplay(HWND hwnd, int ID_MAX_VOLTAGE_DISPLAY, double voltage);
+void UpdateMaxCurrentDisplay(HWND hwnd, int ID_MAX_CURRENT_DISPLAY, double current);
+#endif
 
 #endif // SCPI_H
@@ -0,0 +1,145 @@
+#include "scpi_batch.h"
+
+#include <memory>
+#include <stdexcept>
+
+void AppendToProgramMessage(std::string& message, const std::string& command) {
+    if (!message.empty()) {
+        message += ';';
+        // Common commands (*IDN?, *STB?) and commands that are already rooted need no ':'
+        if (!command.empty() && command[0] != '*' && command[0] != ':') {
+            message += ':';
+        }
+    }
+    message += command;
+}
+
+// Storing [begin, end) as part number index, reusing the string that is already there
+static void assignPart(std::vector<std::string>& parts, size_t index, const char* begin, const char* end) {
+    if (index < parts.size()) {
+        parts[index].assign(begin, end);
+    } else {
+        parts.emplace_back(begin, end);
+    }
+}
+
+void SplitResponseMessage(const std::string& response, std::vector<std::string>& parts) {
+    // Removing the response terminator
+    size_t length = response.size();
+    while (length > 0 && (response[length - 1] == '\n' || response[length - 1] == '\r')) {
+        length--;
+    }
+
+    const char* text = response.data();
+    size_t count = 0;
+    size_t start = 0;
+    bool quoted = false;
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == ';' && !quoted) {
+            assignPart(parts, count++, text + start, text + i);
+            start = i + 1;
+        }
+    }
+    assignPart(parts, count++, text + start, text + length);
+    parts.resize(count);
+}
+
+ScpiBatch::ScpiBatch(CommandFunction commandFunction, QueryFunction queryFunction, size_t maxMessageLength)
+    : commandFunction(std::move(commandFunction)), queryFunction(std::move(queryFunction)),
+      maxMessageLength(maxMessageLength) {
+}
+
+void ScpiBatch::Command(const std::string& command) {
+    entries.push_back(Entry{command, false, ResponseCallback()});
+}
+
+std::future<std::string> ScpiBatch::Query(const std::string& query) {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    std::future<std::string> result = promise->get_future();
+    Query(query, [promise](bool ok, const std::string& response) {
+        if (ok) {
+            promise->set_value(response);
+        } else {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error("SCPI query failed: " + response)));
+        }
+    });
+    return result;
+}
+
+void ScpiBatch::Query(const std::string& query, ResponseCallback callback) {
+    entries.push_back(Entry{query, true, std::move(callback)});
+}
+
+size_t ScpiBatch::Pending() const {
+    return entries.size();
+}
+
+bool ScpiBatch::Flush() {
+    bool ok = true;
+    size_t first = 0;
+    size_t length = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        size_t entryLength = entries[i].text.size() + 2;
+        if (i > first && length + entryLength > maxMessageLength) {
+            ok = sendMessage(first, i) && ok;
+            first = i;
+            length = 0;
+        }
+        length += entryLength;
+    }
+    if (first < entries.size()) {
+        ok = sendMessage(first, entries.size()) && ok;
+    }
+    entries.clear();
+    return ok;
+}
+
+// Sending entries [first, last) as one program message and dispatching the responses
+bool ScpiBatch::sendMessage(size_t first, size_t last) {
+    message.clear();
+    size_t queries = 0;
+    for (size_t i = first; i < last; i++) {
+        AppendToProgramMessage(message, entries[i].text);
+        if (entries[i].isQuery) {
+            queries++;
+        }
+    }
+
+    if (queries == 0) {
+        try {
+            return commandFunction(message);
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+    }
+
+    std::string error;
+    try {
+        if (!queryFunction(message, rawResponse)) {
+            error = "no response";
+        } else {
+            SplitResponseMessage(rawResponse, responses);
+            if (responses.size() != queries) {
+                error = "expected " + std::to_string(queries) + " responses, got " + std::to_string(responses.size());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        error = e.what();
+    }
+
+    size_t response = 0;
+    for (size_t i = first; i < last; i++) {
+        if (!entries[i].isQuery) {
+            continue;
+        }
+        if (error.empty()) {
+            entries[i].callback(true, responses[response++]);
+        } else {
+            entries[i].callback(false, error);
+        }
+    }
+    return error.empty();
+}
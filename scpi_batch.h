@@ -0,0 +1,63 @@
+#ifndef SCPI_BATCH_H
+#define SCPI_BATCH_H
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+// Batching of SCPI commands: queued commands and queries are joined into one
+// ";:"-separated program message, sent with a single write and the combined
+// response is split back into one result per query.
+class ScpiBatch {
+public:
+    typedef std::function<bool(const std::string&)> CommandFunction;
+    // Sending the message and reading its response into the given string (reused between flushes,
+    // so a steady poll does not allocate); false if no response came, which fails every query of
+    // the message; may throw std::runtime_error on I/O errors
+    typedef std::function<bool(const std::string& message, std::string& response)> QueryFunction;
+    typedef std::function<void(bool ok, const std::string& response)> ResponseCallback;
+
+    // Most instruments have an input buffer of a few hundred bytes,
+    // longer batches are sent as several messages
+    static const size_t DEFAULT_MAX_MESSAGE_LENGTH = 240;
+
+    ScpiBatch(CommandFunction commandFunction, QueryFunction queryFunction,
+              size_t maxMessageLength = DEFAULT_MAX_MESSAGE_LENGTH);
+
+    void Command(const std::string& command);
+    std::future<std::string> Query(const std::string& query);
+    void Query(const std::string& query, ResponseCallback callback);
+
+    // Sending everything queued so far; returns false if any message failed
+    bool Flush();
+
+    size_t Pending() const;
+
+private:
+    struct Entry {
+        std::string text;
+        bool isQuery;
+        ResponseCallback callback;
+    };
+
+    bool sendMessage(size_t first, size_t last);
+
+    CommandFunction commandFunction;
+    QueryFunction queryFunction;
+    size_t maxMessageLength;
+    std::vector<Entry> entries;
+    std::string message;  // reused between flushes
+    std::string rawResponse;
+    std::vector<std::string> responses;
+};
+
+// Joining one more command to a program message ("MEAS:VOLT?" + "MEAS:CURR?" -> "MEAS:VOLT?;:MEAS:CURR?")
+void AppendToProgramMessage(std::string& message, const std::string& command);
+
+// Splitting a combined response at ';' outside of quoted strings.
+// The strings already in parts are reused, so splitting similar responses does not allocate.
+void SplitResponseMessage(const std::string& response, std::vector<std::string>& parts);
+
+#endif // SCPI_BATCH_H
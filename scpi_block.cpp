@@ -0,0 +1,235 @@
+#include "scpi_block.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define SCPI_BLOCK_SSSE3
+#endif
+
+char* BlockBuffer::Reserve(size_t required) {
+    if (required > capacity) {
+        // Not zero-filled, the payload overwrites it
+        storage.reset(new char[required]);
+        capacity = required;
+    }
+    size = 0;
+    return storage.get();
+}
+
+char* BlockBuffer::Data() {
+    return storage.get();
+}
+
+const char* BlockBuffer::Data() const {
+    return storage.get();
+}
+
+size_t BlockBuffer::Size() const {
+    return size;
+}
+
+void BlockBuffer::SetSize(size_t newSize) {
+    size = newSize;
+}
+
+void BlockDecoder::Reset(char* target, size_t targetCapacity) {
+    state = HEADER;
+    destination = target;
+    capacity = targetCapacity;
+    buffer = nullptr;
+    headerPosition = lengthDigits = length = received = 0;
+    scratch = nullptr;
+    scratchSize = 0;
+}
+
+void BlockDecoder::Reset(BlockBuffer& target, size_t targetMaxLength) {
+    Reset(nullptr, 0);
+    buffer = &target;
+    maxLength = targetMaxLength;
+}
+
+bool BlockDecoder::startPayload() {
+    if (buffer != nullptr) {
+        if (length > maxLength) {
+            return false;  // Not allocated for a corrupted header
+        }
+        destination = buffer->Reserve(length);
+        capacity = length;
+    }
+    if (length > capacity) {
+        return false;
+    }
+    state = length > 0 ? PAYLOAD : TERMINATOR;
+    return true;
+}
+
+size_t BlockDecoder::Feed(const char* data, size_t size) {
+    size_t used = 0;
+    while (used < size) {
+        char c = data[used];
+        switch (state) {
+        case HEADER:
+            if (headerPosition == 0) {
+                if (c != '#') {
+                    state = MALFORMED;
+                    return used;
+                }
+            } else if (headerPosition == 1) {
+                if (c < '1' || c > '9') {
+                    state = MALFORMED;  // Not a digit, or the indefinite form
+                    return used;
+                }
+                lengthDigits = static_cast<size_t>(c - '0');
+            } else {
+                if (c < '0' || c > '9') {
+                    state = MALFORMED;
+                    return used;
+                }
+                length = length * 10 + static_cast<size_t>(c - '0');
+            }
+            used++;
+            if (headerPosition++ == lengthDigits + 1 && !startPayload()) {
+                state = MALFORMED;
+                return used;
+            }
+            break;
+        case PAYLOAD: {
+            size_t count = std::min(size - used, length - received);
+            if (scratch == nullptr) {
+                std::memcpy(destination + received, data + used, count);
+            }
+            used += count;
+            PayloadWritten(count);
+            break;
+        }
+        case TERMINATOR:
+            used++;
+            if (c == '\n') {
+                state = COMPLETE;
+            } else if (c != '\r' && scratch == nullptr) {
+                state = MALFORMED;
+                return used;
+            }
+            break;
+        default:
+            return used;
+        }
+    }
+    return used;
+}
+
+bool BlockDecoder::Skip(char* target, size_t targetSize) {
+    if (headerPosition < lengthDigits + 2 || targetSize == 0) {
+        return false;
+    }
+    scratch = target;
+    scratchSize = targetSize;
+    if (state != COMPLETE) {
+        state = received < length ? PAYLOAD : TERMINATOR;
+    }
+    return true;
+}
+
+char* BlockDecoder::PayloadCursor() {
+    return scratch != nullptr ? scratch : destination + received;
+}
+
+size_t BlockDecoder::PayloadRemaining() const {
+    if (state != PAYLOAD) {
+        return 0;
+    }
+    return scratch != nullptr ? std::min(length - received, scratchSize) : length - received;
+}
+
+void BlockDecoder::PayloadWritten(size_t count) {
+    received += count;
+    if (received == length) {
+        if (buffer != nullptr && scratch == nullptr) {
+            buffer->SetSize(length);
+        }
+        state = TERMINATOR;
+    }
+}
+
+BlockDecoder::State BlockDecoder::GetState() const {
+    return state;
+}
+
+size_t BlockDecoder::Length() const {
+    return length;
+}
+
+const char* BlockDecoder::Payload() const {
+    return destination;
+}
+
+static bool littleEndianHost() {
+    const uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+static inline uint32_t byteSwap(uint32_t value) {
+#ifdef _MSC_VER
+    return _byteswap_ulong(value);
+#else
+    return __builtin_bswap32(value);
+#endif
+}
+
+static inline uint64_t byteSwap(uint64_t value) {
+#ifdef _MSC_VER
+    return _byteswap_uint64(value);
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+// Reversing the bytes of each word, in place if output == input
+template <typename Word>
+static void swapWords(const char* input, size_t count, char* output) {
+    size_t i = 0;
+#ifdef SCPI_BLOCK_SSSE3
+    const __m128i reverse = sizeof(Word) == 4 ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+                                              : _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const size_t perVector = 16 / sizeof(Word);
+    for (; i + perVector <= count; i += perVector) {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * sizeof(Word)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * sizeof(Word)), _mm_shuffle_epi8(words, reverse));
+    }
+#endif
+    for (; i < count; i++) {
+        Word word;
+        std::memcpy(&word, input + i * sizeof(Word), sizeof(Word));
+        word = byteSwap(word);
+        std::memcpy(output + i * sizeof(Word), &word, sizeof(Word));
+    }
+}
+
+template <typename Value, typename Word>
+static size_t decodeBlock(const char* payload, size_t length, BlockByteOrder order, Value* values) {
+    static_assert(sizeof(Value) == sizeof(Word), "a value is swapped as one word");
+    size_t count = length / sizeof(Value);
+    char* output = reinterpret_cast<char*>(values);
+    if ((order == BLOCK_LITTLE_ENDIAN) == littleEndianHost()) {
+        if (output != payload) {
+            std::memmove(output, payload, count * sizeof(Value));
+        }
+    } else {
+        swapWords<Word>(payload, count, output);
+    }
+    return count;
+}
+
+size_t DecodeFloatBlock(const char* payload, size_t length, BlockByteOrder order, float* values) {
+    return decodeBlock<float, uint32_t>(payload, length, order, values);
+}
+
+size_t DecodeDoubleBlock(const char* payload, size_t length, BlockByteOrder order, double* values) {
+    return decodeBlock<double, uint64_t>(payload, length, order, values);
+}
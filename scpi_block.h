@@ -0,0 +1,91 @@
+#ifndef SCPI_BLOCK_H
+#define SCPI_BLOCK_H
+
+#include <cstddef>
+#include <memory>
+
+// IEEE 488.2 definite-length arbitrary block, the response of array queries such as FETC:ARR:VOLT?:
+// '#', one digit n, n digits giving the payload length, the payload and the response terminator.
+// The indefinite form "#0" is not supported.
+
+// Longest payload a reused buffer is grown to by default: a full sweep (SENS:SWE:POIN 1048576) of
+// FORM REAL,64, with room to spare. A header announcing more is taken for a corrupted one.
+const size_t DEFAULT_MAX_BLOCK_LENGTH = 16 << 20;
+
+enum BlockByteOrder {
+    BLOCK_BIG_ENDIAN,    // FORM:BORD NORM, the default of IEEE 488.2
+    BLOCK_LITTLE_ENDIAN  // FORM:BORD SWAP
+};
+
+// Payload storage reused between responses: a steady stream of fetches allocates only when a
+// block is larger than every one before it
+class BlockBuffer {
+public:
+    // Room for size bytes; the contents are not kept when it grows
+    char* Reserve(size_t size);
+
+    char* Data();
+    const char* Data() const;
+    size_t Size() const;  // Of the last payload
+    void SetSize(size_t size);
+
+private:
+    std::unique_ptr<char[]> storage;
+    size_t capacity = 0;
+    size_t size = 0;
+};
+
+// Streaming decoder of one block. The header is parsed from the bytes fed to it, the payload goes
+// straight to its destination: instead of feeding it, the caller may read the transport into
+// PayloadCursor() and report the bytes with PayloadWritten, which is how LineReader::ReadBlock
+// reads the payload without copying it.
+class BlockDecoder {
+public:
+    enum State { HEADER, PAYLOAD, TERMINATOR, COMPLETE, MALFORMED };
+
+    // Into a caller-provided buffer; a longer block is malformed
+    void Reset(char* destination, size_t capacity);
+    // Into a reused buffer, grown to the length of the block; a block longer than maxLength is malformed
+    void Reset(BlockBuffer& buffer, size_t maxLength = DEFAULT_MAX_BLOCK_LENGTH);
+
+    // Consuming bytes of the response; returns how many were used, which is fewer than given
+    // once the block is complete or malformed
+    size_t Feed(const char* data, size_t length);
+
+    // After a block failed once its header was read (too long for the destination, or the read
+    // timed out): the rest of the payload and everything up to the terminator are consumed without
+    // being kept, read through scratch, so the block can be read to its end. False if the header
+    // was not complete, which leaves the length of the rest unknown.
+    bool Skip(char* scratch, size_t scratchSize);
+
+    char* PayloadCursor();
+    size_t PayloadRemaining() const;
+    void PayloadWritten(size_t count);
+
+    State GetState() const;
+    size_t Length() const;  // Of the payload, once the header is complete
+    const char* Payload() const;
+
+private:
+    bool startPayload();
+
+    State state = MALFORMED;  // Until Reset
+    char* destination = nullptr;
+    size_t capacity = 0;
+    BlockBuffer* buffer = nullptr;
+    size_t maxLength = 0;  // Of a block into buffer
+    size_t headerPosition = 0;  // Characters of the header seen
+    size_t lengthDigits = 0;
+    size_t length = 0;
+    size_t received = 0;  // Payload bytes written
+    char* scratch = nullptr;  // While skipping
+    size_t scratchSize = 0;
+};
+
+// Payload of FORM REAL,32 (or REAL,64) as values in the byte order of this machine; returns the
+// number of values. values may be the payload itself. Swapping is done 16 bytes at a time with
+// SSSE3 where the compiler targets it (-mssse3, /arch:AVX), otherwise one value at a time.
+size_t DecodeFloatBlock(const char* payload, size_t length, BlockByteOrder order, float* values);
+size_t DecodeDoubleBlock(const char* payload, size_t length, BlockByteOrder order, double* values);
+
+#endif // SCPI_BLOCK_H
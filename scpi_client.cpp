@@ -0,0 +1,276 @@
+#include "scpi_client.h"
+
+#include <algorithm>
+
+#if defined(__cpp_impl_coroutine)
+
+// Coroutine that starts at once and frees itself when it is over, for Spawn
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static DetachedTask runDetached(Task<void> task) {
+    co_await task;
+}
+
+void Spawn(Task<void> task) {
+    runDetached(std::move(task));
+}
+
+void Cancellation::Cancel() {
+    if (cancelled) {
+        return;
+    }
+    cancelled = true;
+    // The callbacks resume coroutines, which may register or unregister other callbacks
+    std::map<uint64_t, std::function<void()>> cancelling;
+    cancelling.swap(callbacks);
+    for (auto& entry : cancelling) {
+        entry.second();
+    }
+}
+
+bool Cancellation::IsCancelled() const {
+    return cancelled;
+}
+
+uint64_t Cancellation::Register(std::function<void()> callback) {
+    uint64_t id = nextId++;
+    callbacks.emplace(id, std::move(callback));
+    return id;
+}
+
+void Cancellation::Unregister(uint64_t id) {
+    callbacks.erase(id);
+}
+
+DelayAwaitable::DelayAwaitable(EventLoop& loop, std::chrono::steady_clock::time_point when, Cancellation* cancellation)
+    : loop(loop), when(when), cancellation(cancellation) {}
+
+bool DelayAwaitable::await_ready() noexcept {
+    if (cancellation != nullptr && cancellation->IsCancelled()) {
+        elapsed = false;
+        return true;
+    }
+    elapsed = when <= std::chrono::steady_clock::now();
+    return elapsed;
+}
+
+void DelayAwaitable::await_suspend(std::coroutine_handle<> awaiting) {
+    waiter = awaiting;
+    timer = loop.AddTimer(when, [this] {
+        timer = 0;
+        finish(true);
+    });
+    if (cancellation != nullptr) {
+        cancellationId = cancellation->Register([this] {
+            cancellationId = 0;
+            finish(false);
+        });
+    }
+}
+
+bool DelayAwaitable::await_resume() const noexcept {
+    return elapsed;
+}
+
+void DelayAwaitable::finish(bool hasElapsed) {
+    if (timer != 0) {
+        loop.CancelTimer(timer);
+        timer = 0;
+    }
+    if (cancellationId != 0) {
+        cancellation->Unregister(cancellationId);
+        cancellationId = 0;
+    }
+    elapsed = hasElapsed;
+    std::exchange(waiter, nullptr).resume();
+}
+
+DelayAwaitable Delay(EventLoop& loop, std::chrono::steady_clock::duration duration, Cancellation* cancellation) {
+    return DelayAwaitable(loop, std::chrono::steady_clock::now() + duration, cancellation);
+}
+
+ScpiClient::QueryAwaitable::QueryAwaitable(std::shared_ptr<Operation> operation)
+    : operation(std::move(operation)) {}
+
+bool ScpiClient::QueryAwaitable::await_ready() const noexcept {
+    return operation->done;
+}
+
+void ScpiClient::QueryAwaitable::await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    operation->waiter = awaiting;
+}
+
+ScpiResult ScpiClient::QueryAwaitable::await_resume() {
+    return std::move(operation->result);
+}
+
+ScpiClient::ScpiClient(EventLoop& loop, Transport& transport)
+    : loop(loop), transport(transport) {}
+
+ScpiClient::~ScpiClient() {
+    if (open) {
+        loop.Unwatch(transport.Handle());
+        open = false;
+    }
+    std::deque<std::shared_ptr<Operation>> cancelled;
+    cancelled.swap(pending);
+    for (auto& operation : cancelled) {
+        release(*operation);
+        finish(*operation, ScpiResult::CANCELLED);
+    }
+}
+
+bool ScpiClient::Open() {
+    if (open) {
+        return true;
+    }
+    reader.Clear();
+    open = loop.Watch(transport.Handle(),
+        [this](const char* data, size_t length) {
+            reader.Feed(data, length, [this](const std::string& line) { onLine(line); });
+        },
+        [this] { onError(); });
+    return open;
+}
+
+bool ScpiClient::IsOpen() const {
+    return open;
+}
+
+EventLoop& ScpiClient::Loop() const {
+    return loop;
+}
+
+size_t ScpiClient::InFlight() const {
+    return pending.size();
+}
+
+bool ScpiClient::write(const std::string& text) {
+    static const char terminator = '\n';
+    const OutputSegment segments[] = {{text.data(), text.size()}, {&terminator, 1}};
+    return open && transport.WriteMessage(segments, 2);
+}
+
+bool ScpiClient::Send(const std::string& command) {
+    return write(command);
+}
+
+ScpiClient::QueryAwaitable ScpiClient::Query(const std::string& query, std::chrono::milliseconds timeout,
+                                             Cancellation* cancellation) {
+    auto operation = std::make_shared<Operation>();
+    QueryAwaitable awaitable(operation);
+    if (cancellation != nullptr && cancellation->IsCancelled()) {
+        operation->done = true;
+        operation->result.status = ScpiResult::CANCELLED;
+        return awaitable;
+    }
+    if (!write(query)) {
+        operation->done = true;
+        operation->result.status = ScpiResult::FAILED;
+        return awaitable;
+    }
+
+    operation->timeout = timeout;
+    armTimer(*operation, std::chrono::steady_clock::now() + timeout);
+    if (cancellation != nullptr) {
+        Operation* raw = operation.get();
+        operation->cancellation = cancellation;
+        operation->cancellationId = cancellation->Register([this, raw] {
+            raw->cancellationId = 0;
+            finish(*raw, ScpiResult::CANCELLED);
+            awaitLateAnswer(*raw);
+        });
+    }
+    pending.push_back(std::move(operation));
+    return awaitable;
+}
+
+// The timer of a pending operation; it is cancelled whenever the operation leaves the queue
+void ScpiClient::armTimer(Operation& operation, std::chrono::steady_clock::time_point when) {
+    Operation* raw = &operation;
+    operation.timer = loop.AddTimer(when, [this, raw] {
+        raw->timer = 0;
+        onTimer(*raw);
+    });
+}
+
+void ScpiClient::onTimer(Operation& operation) {
+    if (!operation.done) {
+        finish(operation, ScpiResult::TIMEOUT);
+        awaitLateAnswer(operation);
+        return;
+    }
+
+    // The answer is lost, the next answer belongs to the next query
+    for (auto it = pending.begin(); it != pending.end(); ++it) {
+        if (it->get() == &operation) {
+            pending.erase(it);
+            break;
+        }
+    }
+    if (pending.empty()) {
+        reader.Clear();
+    }
+}
+
+// The awaiter has been told, the answer is still waited for as long again (a second at least) from now
+void ScpiClient::awaitLateAnswer(Operation& operation) {
+    release(operation);
+    armTimer(operation, std::chrono::steady_clock::now() + std::max(operation.timeout, CLIENT_RESPONSE_TIMEOUT));
+}
+
+void ScpiClient::release(Operation& operation) {
+    if (operation.timer != 0) {
+        loop.CancelTimer(operation.timer);
+        operation.timer = 0;
+    }
+}
+
+void ScpiClient::onLine(const std::string& line) {
+    if (pending.empty()) {
+        return;  // Unsolicited
+    }
+    std::shared_ptr<Operation> operation = std::move(pending.front());
+    pending.pop_front();
+    release(*operation);
+    if (operation->done) {
+        return;  // Late answer to a query that timed out or was cancelled
+    }
+    operation->result.response = line;
+    finish(*operation, ScpiResult::OK);
+}
+
+void ScpiClient::onError() {
+    open = false;
+    std::deque<std::shared_ptr<Operation>> failed;
+    failed.swap(pending);
+    for (auto& operation : failed) {
+        release(*operation);
+        finish(*operation, ScpiResult::FAILED);
+    }
+}
+
+void ScpiClient::finish(Operation& operation, ScpiResult::Status status) {
+    if (operation.done) {
+        return;
+    }
+    operation.done = true;
+    operation.result.status = status;
+    if (operation.cancellationId != 0) {
+        operation.cancellation->Unregister(operation.cancellationId);
+        operation.cancellationId = 0;
+    }
+    if (operation.waiter) {
+        std::exchange(operation.waiter, nullptr).resume();
+    }
+}
+
+#endif // __cpp_impl_coroutine
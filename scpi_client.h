@@ -0,0 +1,269 @@
+#ifndef SCPI_CLIENT_H
+#define SCPI_CLIENT_H
+
+// Asynchronous SCPI client for C++20 coroutines, driven by the event loop (I/O completion ports
+// on Windows, non-blocking descriptors and epoll on Linux):
+//
+//     Task<void> Poll(ScpiClient& client) {
+//         for (;;) {
+//             ScpiResult voltage = co_await client.Query("MEAS:VOLT?");
+//             ...
+//             co_await Delay(client.Loop(), std::chrono::milliseconds(100));
+//         }
+//     }
+//     loop.Post([&] { Spawn(Poll(client)); });
+//
+// Any number of clients and queries can be in flight on one loop thread. Everything here must be
+// used on the loop thread. Only compiled where coroutines are available (/std:c++20, -std=c++20).
+
+#if defined(__cpp_impl_coroutine)
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "event_loop.h"
+#include "line_reader.h"
+#include "transport.h"
+
+// Time to wait for the response to a query (the same as RESPONSE_TIMEOUT_MS of scpi.h)
+const std::chrono::milliseconds CLIENT_RESPONSE_TIMEOUT(1000);
+
+// Coroutine producing a T. It starts when it is awaited (or given to Spawn) and resumes its
+// awaiter when it finishes; exceptions are passed on to the awaiter.
+template <typename T>
+class Task;
+
+class TaskPromiseBase {
+public:
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+            std::coroutine_handle<> continuation = finished.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+
+    T takeResult() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+
+private:
+    std::optional<T> value;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object();
+    void return_void() {}
+
+    void takeResult() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+template <typename T>
+class Task {
+public:
+    typedef TaskPromise<T> promise_type;
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return handle.promise().takeResult(); }
+
+private:
+    friend class TaskPromise<T>;
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// Running a task on its own; it is destroyed when it finishes. As with std::thread, an exception
+// leaving the task ends the program.
+void Spawn(Task<void> task);
+
+// Cancelling the queries and delays it was given to; they finish with CANCELLED (or false)
+class Cancellation {
+public:
+    Cancellation() = default;
+    Cancellation(const Cancellation&) = delete;
+    Cancellation& operator=(const Cancellation&) = delete;
+
+    void Cancel();
+    bool IsCancelled() const;
+
+    // For the awaitables: the callback is run once by Cancel unless it is removed before
+    uint64_t Register(std::function<void()> callback);
+    void Unregister(uint64_t id);
+
+private:
+    std::map<uint64_t, std::function<void()>> callbacks;
+    uint64_t nextId = 1;
+    bool cancelled = false;
+};
+
+struct ScpiResult {
+    enum Status { OK, TIMEOUT, CANCELLED, FAILED };
+
+    Status status = FAILED;
+    std::string response;  // Without the terminator
+
+    bool Ok() const { return status == OK; }
+};
+
+// co_await Delay(loop, 10ms): true when the time has passed, false if it was cancelled
+class DelayAwaitable {
+public:
+    DelayAwaitable(EventLoop& loop, std::chrono::steady_clock::time_point when, Cancellation* cancellation);
+
+    bool await_ready() noexcept;
+    void await_suspend(std::coroutine_handle<> awaiting);
+    bool await_resume() const noexcept;
+
+private:
+    void finish(bool elapsed);
+
+    EventLoop& loop;
+    std::chrono::steady_clock::time_point when;
+    Cancellation* cancellation;
+    std::coroutine_handle<> waiter;
+    EventLoop::TimerId timer = 0;
+    uint64_t cancellationId = 0;
+    bool elapsed = false;
+};
+
+DelayAwaitable Delay(EventLoop& loop, std::chrono::steady_clock::duration duration, Cancellation* cancellation = nullptr);
+
+// SCPI client of one port. Queries are written as soon as Query is called and answered in order,
+// so several queries of one client can be in flight (pipelined) before the first is awaited.
+class ScpiClient {
+    struct Operation;
+
+public:
+    // co_await client.Query(...) gives the ScpiResult
+    class QueryAwaitable {
+    public:
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> awaiting) noexcept;
+        ScpiResult await_resume();
+
+    private:
+        friend class ScpiClient;
+        explicit QueryAwaitable(std::shared_ptr<Operation> operation);
+
+        std::shared_ptr<Operation> operation;
+    };
+
+    ScpiClient(EventLoop& loop, Transport& transport);
+    // Queries still pending finish with CANCELLED
+    ~ScpiClient();
+
+    ScpiClient(const ScpiClient&) = delete;
+    ScpiClient& operator=(const ScpiClient&) = delete;
+
+    // Watching the port; false if the loop does not accept it
+    bool Open();
+    bool IsOpen() const;
+    EventLoop& Loop() const;
+
+    // Sending a query. A query that times out or is cancelled keeps its place until its answer
+    // arrives (or one more timeout, a second at least, has passed), so a late answer is not taken for the next one.
+    QueryAwaitable Query(const std::string& query, std::chrono::milliseconds timeout = CLIENT_RESPONSE_TIMEOUT,
+                         Cancellation* cancellation = nullptr);
+    // Sending a command without a response
+    bool Send(const std::string& command);
+
+    // Queries pending (including the ones that timed out and still wait for their answer)
+    size_t InFlight() const;
+
+private:
+    struct Operation {
+        std::coroutine_handle<> waiter;
+        ScpiResult result;
+        bool done = false;
+        std::chrono::milliseconds timeout{0};
+        EventLoop::TimerId timer = 0;
+        Cancellation* cancellation = nullptr;
+        uint64_t cancellationId = 0;
+    };
+
+    bool write(const std::string& text);
+    void armTimer(Operation& operation, std::chrono::steady_clock::time_point when);
+    void onTimer(Operation& operation);
+    void awaitLateAnswer(Operation& operation);
+    void release(Operation& operation);
+    void onLine(const std::string& line);
+    void onError();
+    void finish(Operation& operation, ScpiResult::Status status);
+
+    EventLoop& loop;
+    Transport& transport;
+    LineReader reader;
+    bool open = false;
+    std::deque<std::shared_ptr<Operation>> pending;  // In the order of the answers
+};
+
+#endif // __cpp_impl_coroutine
+
+#endif // SCPI_CLIENT_H
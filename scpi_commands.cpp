@@ -0,0 +1,203 @@
+#include "scpi_commands.h"
+
+#include <cctype>
+#include <charconv>
+#include <cstring>
+
+std::string ScpiMessage::Text() const {
+    return std::string(text, length);
+}
+
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static std::string trim(const std::string& str) {
+    size_t begin = 0;
+    size_t end = str.size();
+    while (begin < end && isBlank(str[begin])) {
+        begin++;
+    }
+    while (end > begin && isBlank(str[end - 1])) {
+        end--;
+    }
+    return str.substr(begin, end - begin);
+}
+
+static bool equalsIgnoringCase(const char* a, const char* b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (std::toupper(static_cast<unsigned char>(a[i])) != std::toupper(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool equalsIgnoringCase(const std::string& text, const char* other) {
+    return other != nullptr && text.size() == std::strlen(other) && equalsIgnoringCase(text.data(), other, text.size());
+}
+
+// Starting the message with the mnemonic
+static ScpiBuildResult writeHeader(const ScpiCommandSpec& spec, ScpiMessage& message) {
+    message.length = 0;
+    message.text[0] = '\0';
+    if (spec.shortForm == nullptr) {
+        return SCPI_BUILD_UNSUPPORTED;
+    }
+    size_t length = std::strlen(spec.shortForm);
+    if (length + 1 >= SCPI_MESSAGE_SIZE) {
+        return SCPI_BUILD_UNSUPPORTED;
+    }
+    std::memcpy(message.text, spec.shortForm, length + 1);
+    message.length = length;
+    return SCPI_BUILD_OK;
+}
+
+// Adding " <parameter>"
+static ScpiBuildResult writeParameter(const char* parameter, size_t length, ScpiMessage& message) {
+    if (message.length + 1 + length + 1 > SCPI_MESSAGE_SIZE) {
+        return SCPI_BUILD_OUT_OF_RANGE;
+    }
+    message.text[message.length++] = ' ';
+    std::memcpy(message.text + message.length, parameter, length);
+    message.length += length;
+    message.text[message.length] = '\0';
+    return SCPI_BUILD_OK;
+}
+
+ScpiBuildResult BuildScpiCommand(const ScpiCommandSpec& spec, ScpiMessage& message) {
+    return writeHeader(spec, message);
+}
+
+ScpiBuildResult BuildScpiCommand(const ScpiCommandSpec& spec, double value, ScpiMessage& message) {
+    ScpiBuildResult result = writeHeader(spec, message);
+    if (result != SCPI_BUILD_OK) {
+        return result;
+    }
+    // Written so that NaN is out of range as well
+    if (!(value >= spec.minimum && value <= spec.maximum)) {
+        return SCPI_BUILD_OUT_OF_RANGE;
+    }
+    char number[NUMBER_BUFFER_SIZE];
+    size_t length = FormatNumber(value, number, sizeof(number), spec.precision);
+    if (length == 0) {
+        return SCPI_BUILD_OUT_OF_RANGE;
+    }
+    return writeParameter(number, length, message);
+}
+
+ScpiBuildResult BuildScpiSwitch(const ScpiCommandSpec& spec, bool on, ScpiMessage& message) {
+    ScpiBuildResult result = writeHeader(spec, message);
+    if (result != SCPI_BUILD_OK) {
+        return result;
+    }
+    return on ? writeParameter("ON", 2, message) : writeParameter("OFF", 3, message);
+}
+
+ScpiBuildResult BuildScpiCommandFromText(const ScpiCommandSpec& spec, const char* text, ScpiMessage& message) {
+    double value;
+    if (!ParseScpiNumber(text, text + std::strlen(text), value)) {
+        writeHeader(spec, message);
+        return spec.shortForm == nullptr ? SCPI_BUILD_UNSUPPORTED : SCPI_BUILD_NOT_A_NUMBER;
+    }
+    return BuildScpiCommand(spec, value, message);
+}
+
+std::string DescribeBuildResult(const ScpiCommandSpec& spec, ScpiBuildResult result) {
+    switch (result) {
+    case SCPI_BUILD_OK:
+        return std::string();
+    case SCPI_BUILD_UNSUPPORTED:
+        return "The command is not supported by this power supply";
+    default:
+        break;
+    }
+
+    char minimum[NUMBER_BUFFER_SIZE];
+    char maximum[NUMBER_BUFFER_SIZE];
+    FormatNumber(spec.minimum, minimum, sizeof(minimum));
+    FormatNumber(spec.maximum, maximum, sizeof(maximum));
+    std::string text = std::string(spec.shortForm) + " expects a number from " + minimum + " to " + maximum;
+    if (spec.unit[0] != '\0') {
+        text += ' ';
+        text += spec.unit;
+    }
+    return text;
+}
+
+bool DecodeScpiBoolean(const std::string& response, bool& value) {
+    std::string text = trim(response);
+    if (text == "1" || equalsIgnoringCase(text, "ON")) {
+        value = true;
+        return true;
+    }
+    if (text == "0" || equalsIgnoringCase(text, "OFF")) {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+bool DecodeScpiIdentity(const std::string& response, ScpiIdentity& identity) {
+    std::string fields[4];
+    size_t start = 0;
+    for (size_t i = 0; i < 4; i++) {
+        size_t comma = response.find(',', start);
+        if ((comma == std::string::npos) != (i == 3)) {
+            return false;  // Not exactly four fields
+        }
+        fields[i] = trim(response.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        start = comma + 1;
+    }
+    if (fields[0].empty() || fields[1].empty()) {
+        return false;
+    }
+    identity.manufacturer = fields[0];
+    identity.model = fields[1];
+    identity.serialNumber = fields[2];
+    identity.firmware = fields[3];
+    return true;
+}
+
+bool DecodeScpiError(const std::string& response, ScpiError& error) {
+    std::string text = trim(response);
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    if (begin != end && *begin == '+') {
+        begin++;
+    }
+
+    int code = 0;
+    std::from_chars_result result = std::from_chars(begin, end, code);
+    if (result.ec != std::errc() || result.ptr == end || *result.ptr != ',') {
+        return false;
+    }
+
+    std::string message = trim(std::string(result.ptr + 1, end));
+    if (message.size() >= 2 && message.front() == '"' && message.back() == '"') {
+        message = message.substr(1, message.size() - 2);
+    }
+    error.code = code;
+    error.message = message;
+    return true;
+}
+
+const ScpiModel& FindScpiModel(const ScpiIdentity& identity) {
+    for (const ScpiModel* model : SCPI_MODELS) {
+        size_t prefixLength = std::strlen(model->model);
+        if (equalsIgnoringCase(identity.manufacturer, model->manufacturer) && identity.model.size() >= prefixLength &&
+            equalsIgnoringCase(identity.model.data(), model->model, prefixLength)) {
+            return *model;
+        }
+    }
+    return GENERIC_SUPPLY;
+}
+
+const ScpiCommandSpec* FindScpiCommand(const ScpiModel& model, const std::string& header) {
+    for (const ScpiCommandSpec& spec : model.commands) {
+        if (equalsIgnoringCase(header, spec.shortForm) || equalsIgnoringCase(header, spec.longForm)) {
+            return &spec;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,282 @@
+#ifndef SCPI_COMMANDS_H
+#define SCPI_COMMANDS_H
+
+#include <cstddef>
+#include <string>
+
+#include "numeric.h"
+
+// Table-driven SCPI commands. Each supply model describes the commands the panel uses in a
+// constexpr table (mnemonics, parameter, unit, range, response); the tables are checked when
+// the program is compiled, and the typed builders and decoders below refuse at compile time to
+// send a number to a command without one or to read a number from an identity.
+// Supporting a new model means adding a table and listing it in SCPI_MODELS.
+
+// Commands the panel sends, the same for every model; a model's table says how it spells them
+enum ScpiCommandId {
+    SCPI_VOLTAGE,
+    SCPI_CURRENT,
+    SCPI_RISE,
+    SCPI_FALL,
+    SCPI_OUTPUT,
+    SCPI_REMOTE,
+    SCPI_IDENTIFY,
+    SCPI_NEXT_ERROR,
+    SCPI_MEASURE_VOLTAGE,
+    SCPI_MEASURE_CURRENT,
+    SCPI_STATUS_BYTE,
+    SCPI_EVENT_STATUS,
+    SCPI_SERIAL_BAUD,
+    SCPI_FORMAT_BINARY,
+    SCPI_SWEEP_POINTS,
+    SCPI_FETCH_VOLTAGE_ARRAY,
+    SCPI_FETCH_CURRENT_ARRAY,
+    SCPI_COMMAND_COUNT
+};
+
+enum ScpiParameterType {
+    PARAMETER_NONE,
+    PARAMETER_NUMBER,   // Decimal number within [minimum, maximum]
+    PARAMETER_BOOLEAN   // ON or OFF
+};
+
+enum ScpiResponseType {
+    RESPONSE_NONE,      // Not a query
+    RESPONSE_NUMBER,
+    RESPONSE_BOOLEAN,   // 0/1 or OFF/ON
+    RESPONSE_IDENTITY,  // *IDN?: manufacturer,model,serial number,firmware
+    RESPONSE_ERROR,     // SYST:ERR?: code,"message"
+    RESPONSE_BLOCK      // Definite-length block of REAL,32 values (scpi_block.h)
+};
+
+struct ScpiCommandSpec {
+    ScpiCommandId id;
+    const char* shortForm;  // Sent by the builders; nullptr if the model does not have the command
+    const char* longForm;   // Also accepted by FindScpiCommand
+    ScpiParameterType parameter;
+    const char* unit;       // Of the parameter or of the response, for the messages
+    double minimum;
+    double maximum;
+    int precision;          // Decimals sent
+    ScpiResponseType response;
+};
+
+struct ScpiModel {
+    const char* manufacturer;  // Matched against the *IDN? response; nullptr for the generic table
+    const char* model;         // Prefix of the model field
+    ScpiCommandSpec commands[SCPI_COMMAND_COUNT];
+};
+
+// Any SCPI supply: the common mnemonics and ranges wide enough not to reject what the supply may accept.
+// Changing the baud rate and the array fetch are left out: not every supply has them, and one that
+// does not know a command may not say so.
+inline constexpr ScpiModel GENERIC_SUPPLY = {nullptr, nullptr, {
+    {SCPI_VOLTAGE, "VOLT", "VOLTAGE", PARAMETER_NUMBER, "V", 0.0, 1000.0, DEFAULT_NUMBER_PRECISION, RESPONSE_NONE},
+    {SCPI_CURRENT, "CURR", "CURRENT", PARAMETER_NUMBER, "A", 0.0, 1000.0, DEFAULT_NUMBER_PRECISION, RESPONSE_NONE},
+    {SCPI_RISE, "RISE", "RISE", PARAMETER_NUMBER, "s", 0.0, 3600.0, DEFAULT_NUMBER_PRECISION, RESPONSE_NONE},
+    {SCPI_FALL, "FALL", "FALL", PARAMETER_NUMBER, "s", 0.0, 3600.0, DEFAULT_NUMBER_PRECISION, RESPONSE_NONE},
+    {SCPI_OUTPUT, "OUTP", "OUTPUT", PARAMETER_BOOLEAN, "", 0.0, 0.0, 0, RESPONSE_NONE},
+    {SCPI_REMOTE, "SYST:REM", "SYSTEM:REMOTE", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NONE},
+    {SCPI_IDENTIFY, "*IDN?", "*IDN?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_IDENTITY},
+    {SCPI_NEXT_ERROR, "SYST:ERR?", "SYSTEM:ERROR?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_ERROR},
+    {SCPI_MEASURE_VOLTAGE, "MEAS:VOLT?", "MEASURE:VOLTAGE?", PARAMETER_NONE, "V", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_MEASURE_CURRENT, "MEAS:CURR?", "MEASURE:CURRENT?", PARAMETER_NONE, "A", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_STATUS_BYTE, "*STB?", "*STB?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_EVENT_STATUS, "*ESR?", "*ESR?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_SERIAL_BAUD, nullptr, nullptr, PARAMETER_NUMBER, "baud", 300.0, 4000000.0, 0, RESPONSE_NONE},
+    {SCPI_FORMAT_BINARY, nullptr, nullptr, PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NONE},
+    {SCPI_SWEEP_POINTS, nullptr, nullptr, PARAMETER_NUMBER, "", 1.0, 1048576.0, 0, RESPONSE_NONE},
+    {SCPI_FETCH_VOLTAGE_ARRAY, nullptr, nullptr, PARAMETER_NONE, "V", 0.0, 0.0, 0, RESPONSE_BLOCK},
+    {SCPI_FETCH_CURRENT_ARRAY, nullptr, nullptr, PARAMETER_NONE, "A", 0.0, 0.0, 0, RESPONSE_BLOCK},
+}};
+
+// The simulator of simulator.h (60 V, 10 A, millivolt and milliampere resolution). Its digitizer keeps the
+// last SENS:SWE:POIN samples, fetched as an array in the format set by FORM.
+inline constexpr ScpiModel SIMULATED_SUPPLY = {"SIMULATED", "PSU-SIM", {
+    {SCPI_VOLTAGE, "VOLT", "VOLTAGE", PARAMETER_NUMBER, "V", 0.0, 60.0, 3, RESPONSE_NONE},
+    {SCPI_CURRENT, "CURR", "CURRENT", PARAMETER_NUMBER, "A", 0.0, 10.0, 3, RESPONSE_NONE},
+    {SCPI_RISE, "RISE", "RISE", PARAMETER_NUMBER, "s", 0.0, 3600.0, 3, RESPONSE_NONE},
+    {SCPI_FALL, "FALL", "FALL", PARAMETER_NUMBER, "s", 0.0, 3600.0, 3, RESPONSE_NONE},
+    {SCPI_OUTPUT, "OUTP", "OUTPUT", PARAMETER_BOOLEAN, "", 0.0, 0.0, 0, RESPONSE_NONE},
+    {SCPI_REMOTE, "SYST:REM", "SYSTEM:REMOTE", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NONE},
+    {SCPI_IDENTIFY, "*IDN?", "*IDN?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_IDENTITY},
+    {SCPI_NEXT_ERROR, "SYST:ERR?", "SYSTEM:ERROR?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_ERROR},
+    {SCPI_MEASURE_VOLTAGE, "MEAS:VOLT?", "MEASURE:VOLTAGE?", PARAMETER_NONE, "V", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_MEASURE_CURRENT, "MEAS:CURR?", "MEASURE:CURRENT?", PARAMETER_NONE, "A", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_STATUS_BYTE, "*STB?", "*STB?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_EVENT_STATUS, "*ESR?", "*ESR?", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NUMBER},
+    {SCPI_SERIAL_BAUD, "SYST:COMM:SER:BAUD", "SYSTEM:COMMUNICATE:SERIAL:BAUD", PARAMETER_NUMBER, "baud", 300.0, 4000000.0, 0, RESPONSE_NONE},
+    {SCPI_FORMAT_BINARY, "FORM REAL,32", "FORMAT:DATA REAL,32", PARAMETER_NONE, "", 0.0, 0.0, 0, RESPONSE_NONE},
+    {SCPI_SWEEP_POINTS, "SENS:SWE:POIN", "SENSE:SWEEP:POINTS", PARAMETER_NUMBER, "", 1.0, 1048576.0, 0, RESPONSE_NONE},
+    {SCPI_FETCH_VOLTAGE_ARRAY, "FETC:ARR:VOLT?", "FETCH:ARRAY:VOLTAGE?", PARAMETER_NONE, "V", 0.0, 0.0, 0, RESPONSE_BLOCK},
+    {SCPI_FETCH_CURRENT_ARRAY, "FETC:ARR:CURR?", "FETCH:ARRAY:CURRENT?", PARAMETER_NONE, "A", 0.0, 0.0, 0, RESPONSE_BLOCK},
+}};
+
+// Bits of the status byte (*STB?) and of the standard event status register (*ESR?), IEEE 488.2
+const int STATUS_ERROR_AVAILABLE = 0x04;  // The error queue is not empty (SCPI)
+const int STATUS_EVENT_SUMMARY = 0x20;    // A standard event has occurred, *ESR? tells which
+const int EVENT_QUERY_ERROR = 0x04;
+const int EVENT_DEVICE_ERROR = 0x08;
+const int EVENT_EXECUTION_ERROR = 0x10;
+const int EVENT_COMMAND_ERROR = 0x20;
+const int EVENT_ERRORS = EVENT_QUERY_ERROR | EVENT_DEVICE_ERROR | EVENT_EXECUTION_ERROR | EVENT_COMMAND_ERROR;
+
+// Models recognized by FindScpiModel, most specific first
+inline constexpr const ScpiModel* SCPI_MODELS[] = {&SIMULATED_SUPPLY};
+
+// Compile-time checks of a table: every command in its slot, the parameter and response types
+// of the generic table, sane ranges and '?' exactly on the queries
+
+constexpr bool IsQueryMnemonic(const char* mnemonic) {
+    size_t length = 0;
+    while (mnemonic[length] != '\0') {
+        length++;
+    }
+    return length > 0 && mnemonic[length - 1] == '?';
+}
+
+constexpr bool IsValidCommand(const ScpiCommandSpec& spec, const ScpiCommandSpec& reference, size_t slot) {
+    if (spec.id != static_cast<ScpiCommandId>(slot) || spec.parameter != reference.parameter ||
+        spec.response != reference.response || spec.minimum > spec.maximum || spec.precision < 0 ||
+        spec.unit == nullptr) {
+        return false;
+    }
+    if (spec.shortForm == nullptr) {
+        return true;  // Not supported by the model
+    }
+    bool query = spec.response != RESPONSE_NONE;
+    return spec.longForm != nullptr && IsQueryMnemonic(spec.shortForm) == query &&
+           IsQueryMnemonic(spec.longForm) == query && (!query || spec.parameter == PARAMETER_NONE);
+}
+
+constexpr bool IsValidModel(const ScpiModel& model) {
+    for (size_t i = 0; i < SCPI_COMMAND_COUNT; i++) {
+        if (!IsValidCommand(model.commands[i], GENERIC_SUPPLY.commands[i], i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(IsValidModel(GENERIC_SUPPLY), "invalid SCPI command table GENERIC_SUPPLY");
+static_assert(IsValidModel(SIMULATED_SUPPLY), "invalid SCPI command table SIMULATED_SUPPLY");
+
+constexpr ScpiParameterType ParameterOf(ScpiCommandId id) {
+    return GENERIC_SUPPLY.commands[id].parameter;
+}
+
+constexpr ScpiResponseType ResponseOf(ScpiCommandId id) {
+    return GENERIC_SUPPLY.commands[id].response;
+}
+
+// Building commands
+
+// Longest command the builders produce, with the terminating zero
+const size_t SCPI_MESSAGE_SIZE = 64;
+
+// A command built on the stack, without its line terminator
+struct ScpiMessage {
+    char text[SCPI_MESSAGE_SIZE];
+    size_t length = 0;
+
+    std::string Text() const;
+};
+
+enum ScpiBuildResult {
+    SCPI_BUILD_OK,
+    SCPI_BUILD_UNSUPPORTED,   // The model does not have the command
+    SCPI_BUILD_NOT_A_NUMBER,
+    SCPI_BUILD_OUT_OF_RANGE
+};
+
+// Untyped builders; the parameter must match spec.parameter
+ScpiBuildResult BuildScpiCommand(const ScpiCommandSpec& spec, ScpiMessage& message);
+ScpiBuildResult BuildScpiCommand(const ScpiCommandSpec& spec, double value, ScpiMessage& message);
+ScpiBuildResult BuildScpiSwitch(const ScpiCommandSpec& spec, bool on, ScpiMessage& message);
+// Parsing the number from text typed by the user (e.g. an edit box)
+ScpiBuildResult BuildScpiCommandFromText(const ScpiCommandSpec& spec, const char* text, ScpiMessage& message);
+
+// Message for the user, e.g. "VOLT expects a number from 0 to 60 V"
+std::string DescribeBuildResult(const ScpiCommandSpec& spec, ScpiBuildResult result);
+
+// Typed builders: BuildCommand<SCPI_VOLTAGE>(model, 5.0, message), BuildSwitch<SCPI_OUTPUT>(model, true, message)
+
+template <ScpiCommandId Id>
+ScpiBuildResult BuildCommand(const ScpiModel& model, ScpiMessage& message) {
+    static_assert(ParameterOf(Id) == PARAMETER_NONE, "the command needs a parameter");
+    return BuildScpiCommand(model.commands[Id], message);
+}
+
+template <ScpiCommandId Id>
+ScpiBuildResult BuildCommand(const ScpiModel& model, double value, ScpiMessage& message) {
+    static_assert(ParameterOf(Id) == PARAMETER_NUMBER, "the command takes no number");
+    return BuildScpiCommand(model.commands[Id], value, message);
+}
+
+template <ScpiCommandId Id>
+ScpiBuildResult BuildSwitch(const ScpiModel& model, bool on, ScpiMessage& message) {
+    static_assert(ParameterOf(Id) == PARAMETER_BOOLEAN, "the command takes no ON/OFF");
+    return BuildScpiSwitch(model.commands[Id], on, message);
+}
+
+template <ScpiCommandId Id>
+ScpiBuildResult BuildCommandFromText(const ScpiModel& model, const char* text, ScpiMessage& message) {
+    static_assert(ParameterOf(Id) == PARAMETER_NUMBER, "the command takes no number");
+    return BuildScpiCommandFromText(model.commands[Id], text, message);
+}
+
+// Decoding responses
+
+struct ScpiIdentity {
+    std::string manufacturer;
+    std::string model;
+    std::string serialNumber;
+    std::string firmware;
+};
+
+struct ScpiError {
+    int code = 0;  // 0 is "No error"
+    std::string message;
+};
+
+// Untyped decoders; they return false for a malformed response and leave the result unchanged
+bool DecodeScpiBoolean(const std::string& response, bool& value);
+bool DecodeScpiIdentity(const std::string& response, ScpiIdentity& identity);
+bool DecodeScpiError(const std::string& response, ScpiError& error);
+
+// Typed decoders: DecodeResponse<SCPI_MEASURE_VOLTAGE>(response, voltage)
+
+template <ScpiCommandId Id>
+bool DecodeResponse(const std::string& response, double& value) {
+    static_assert(ResponseOf(Id) == RESPONSE_NUMBER, "the response is not a number");
+    return ParseScpiNumber(response, value);
+}
+
+template <ScpiCommandId Id>
+bool DecodeResponse(const std::string& response, bool& value) {
+    static_assert(ResponseOf(Id) == RESPONSE_BOOLEAN, "the response is not a boolean");
+    return DecodeScpiBoolean(response, value);
+}
+
+template <ScpiCommandId Id>
+bool DecodeResponse(const std::string& response, ScpiIdentity& identity) {
+    static_assert(ResponseOf(Id) == RESPONSE_IDENTITY, "the response is not an identity");
+    return DecodeScpiIdentity(response, identity);
+}
+
+template <ScpiCommandId Id>
+bool DecodeResponse(const std::string& response, ScpiError& error) {
+    static_assert(ResponseOf(Id) == RESPONSE_ERROR, "the response is not an error");
+    return DecodeScpiError(response, error);
+}
+
+// Models
+
+// Table of the identified supply; GENERIC_SUPPLY if the model is not known
+const ScpiModel& FindScpiModel(const ScpiIdentity& identity);
+
+// Command of the model with the given header in short or long form, case-insensitive
+// (e.g. "volt", "VOLTAGE", "meas:curr?"); nullptr if there is none
+const ScpiCommandSpec* FindScpiCommand(const ScpiModel& model, const std::string& header);
+
+#endif // SCPI_COMMANDS_H
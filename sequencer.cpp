@@ -0,0 +1,482 @@
+#include "sequencer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "numeric.h"
+#include "scpi_batch.h"
+#include "scpi_commands.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+// Commands joined into one message stay within the instrument's input buffer
+static const size_t MAX_STEP_LENGTH = ScpiBatch::DEFAULT_MAX_MESSAGE_LENGTH;
+// Guard against a repeat that would expand to more than the memory can hold
+static const size_t MAX_COMMANDS = 1000000;
+
+#ifdef _WIN32
+// The sleep only ends on a scheduler tick, 1 ms with timeBeginPeriod(1)
+static const nanoseconds SPIN_MARGIN = std::chrono::milliseconds(2);
+#else
+static const nanoseconds SPIN_MARGIN = std::chrono::microseconds(200);
+#endif
+
+namespace {
+
+struct ProfileLine {
+    int number;
+    std::string text;
+};
+
+struct PlannedCommand {
+    nanoseconds time;
+    std::string command;
+    int line;
+};
+
+class ProfileParser {
+public:
+    ProfileParser(const std::vector<ProfileLine>& lines, std::vector<PlannedCommand>& commands)
+        : lines(lines), commands(commands) {
+    }
+
+    // Parsing lines [first, last) of a block that starts at start; end is where the block's last
+    // command or wait ends
+    bool ParseBlock(size_t first, size_t last, nanoseconds start, nanoseconds& end, std::string& error);
+
+private:
+    bool parseCommand(const std::string& text, int line, nanoseconds time, std::string& error);
+    bool fail(int line, const std::string& message, std::string& error) const;
+
+    const std::vector<ProfileLine>& lines;
+    std::vector<PlannedCommand>& commands;
+};
+
+}  // namespace
+
+static std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+static std::string toUpper(std::string text) {
+    for (char& c : text) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return text;
+}
+
+static std::vector<std::string> splitWords(const std::string& text) {
+    std::vector<std::string> words;
+    std::istringstream stream(text);
+    std::string word;
+    while (stream >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+static bool endsWith(const std::string& text, const char* suffix) {
+    size_t length = std::char_traits<char>::length(suffix);
+    return text.size() > length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// "250ms", "1.5", "2s", "1min" -> nanoseconds; seconds unless a unit is given
+static bool parseDuration(const std::string& text, nanoseconds& duration) {
+    std::string lower = text;
+    for (char& c : lower) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    double scale = 1e9;
+    size_t unitLength = 0;
+    if (endsWith(lower, "min")) {
+        scale = 60e9;
+        unitLength = 3;
+    } else if (endsWith(lower, "us")) {
+        scale = 1e3;
+        unitLength = 2;
+    } else if (endsWith(lower, "ms")) {
+        scale = 1e6;
+        unitLength = 2;
+    } else if (endsWith(lower, "s")) {
+        unitLength = 1;
+    }
+
+    double value;
+    if (!ParseScpiNumber(text.data(), text.data() + text.size() - unitLength, value) || value < 0.0 ||
+        value * scale > 1e18) {
+        return false;
+    }
+    duration = nanoseconds(static_cast<int64_t>(value * scale + 0.5));
+    return true;
+}
+
+// Setpoint and output commands a profile may contain (those of the command table with a
+// parameter); queries would leave answers in the input buffer
+static const ScpiCommandSpec* findSequenceCommand(const std::string& header) {
+    const ScpiCommandSpec* spec = FindScpiCommand(GENERIC_SUPPLY, header);
+    if (spec == nullptr || spec->response != RESPONSE_NONE || spec->parameter == PARAMETER_NONE) {
+        return nullptr;
+    }
+    return spec;
+}
+
+static void appendNumber(std::string& command, double value) {
+    char buffer[NUMBER_BUFFER_SIZE];
+    size_t length = FormatNumber(value, buffer, sizeof(buffer));
+    command.append(buffer, length);
+}
+
+bool ProfileParser::fail(int line, const std::string& message, std::string& error) const {
+    error = "Line " + std::to_string(line) + ": " + message;
+    return false;
+}
+
+bool ProfileParser::parseCommand(const std::string& text, int line, nanoseconds time, std::string& error) {
+    std::string command = trim(text);
+    if (command.find('?') != std::string::npos) {
+        return fail(line, "queries are not allowed in a profile", error);
+    }
+
+    size_t headerStart = command.find_first_not_of(':');
+    size_t headerEnd = command.find_first_of(" \t", headerStart);
+    std::string header = command.substr(headerStart, headerEnd == std::string::npos ? std::string::npos : headerEnd - headerStart);
+    const ScpiCommandSpec* spec = header.empty() ? nullptr : findSequenceCommand(header);
+    if (spec == nullptr) {
+        return fail(line, "unsupported command \"" + command + "\"", error);
+    }
+
+    // The argument is checked against the command's range and sent in the panel's format, as the
+    // panel's own commands are
+    std::string argument = headerEnd == std::string::npos ? std::string() : trim(command.substr(headerEnd));
+    ScpiMessage message;
+    ScpiBuildResult result;
+    if (spec->parameter == PARAMETER_BOOLEAN) {
+        bool on;
+        if (!DecodeScpiBoolean(argument, on)) {
+            return fail(line, std::string(spec->shortForm) + " expects ON or OFF", error);
+        }
+        result = BuildScpiSwitch(*spec, on, message);
+    } else {
+        result = BuildScpiCommandFromText(*spec, argument.c_str(), message);
+    }
+    if (result != SCPI_BUILD_OK) {
+        return fail(line, DescribeBuildResult(*spec, result), error);
+    }
+    command = message.Text();
+
+    if (commands.size() >= MAX_COMMANDS) {
+        return fail(line, "the profile has too many commands", error);
+    }
+    commands.push_back({time, command, line});
+    return true;
+}
+
+bool ProfileParser::ParseBlock(size_t first, size_t last, nanoseconds start, nanoseconds& end, std::string& error) {
+    nanoseconds cursor = start;
+    end = start;
+
+    for (size_t i = first; i < last; i++) {
+        const ProfileLine& line = lines[i];
+
+        // CSV: time,command[,command...]
+        if (line.text.find(',') != std::string::npos) {
+            std::vector<std::string> fields;
+            std::istringstream stream(line.text);
+            std::string field;
+            while (std::getline(stream, field, ',')) {
+                fields.push_back(trim(field));
+            }
+            nanoseconds time;
+            if (fields.size() < 2 || !parseDuration(fields[0], time)) {
+                return fail(line.number, "expected time,command[,command...]", error);
+            }
+            cursor = start + time;
+            for (size_t f = 1; f < fields.size(); f++) {
+                if (!fields[f].empty() && !parseCommand(fields[f], line.number, cursor, error)) {
+                    return false;
+                }
+            }
+            end = std::max(end, cursor);
+            continue;
+        }
+
+        std::vector<std::string> words = splitWords(line.text);
+        std::string keyword = toUpper(words[0]);
+
+        if (keyword == "WAIT" || keyword == "AT") {
+            nanoseconds duration;
+            if (words.size() != 2 || !parseDuration(words[1], duration)) {
+                return fail(line.number, "expected " + words[0] + " <time>", error);
+            }
+            cursor = keyword == "WAIT" ? cursor + duration : start + duration;
+        } else if (keyword == "RAMP") {
+            double from, to, steps;
+            nanoseconds duration;
+            if (words.size() != 6 || !ParseScpiNumber(words[2], from) || !ParseScpiNumber(words[3], to) ||
+                !parseDuration(words[4], duration) || !ParseScpiNumber(words[5], steps) || steps < 1.0 ||
+                steps != static_cast<double>(static_cast<int64_t>(steps)) || steps > static_cast<double>(MAX_COMMANDS)) {
+                return fail(line.number, "expected ramp VOLT|CURR <from> <to> <time> <steps>", error);
+            }
+            std::string header = toUpper(words[1]);
+            const ScpiCommandSpec* spec = FindScpiCommand(GENERIC_SUPPLY, header);
+            if (spec == nullptr || (spec->id != SCPI_VOLTAGE && spec->id != SCPI_CURRENT)) {
+                return fail(line.number, "only VOLT and CURR can be ramped", error);
+            }
+            int64_t count = static_cast<int64_t>(steps);
+            for (int64_t k = 0; k <= count; k++) {
+                std::string command = header + ' ';
+                appendNumber(command, from + (to - from) * static_cast<double>(k) / static_cast<double>(count));
+                nanoseconds offset(static_cast<int64_t>(static_cast<double>(duration.count()) * k / count));
+                if (!parseCommand(command, line.number, cursor + offset, error)) {
+                    return false;
+                }
+            }
+            cursor += duration;
+        } else if (keyword == "REPEAT") {
+            double passes;
+            if (words.size() != 2 || !ParseScpiNumber(words[1], passes) || passes < 1.0 ||
+                passes != static_cast<double>(static_cast<int64_t>(passes)) || passes > static_cast<double>(MAX_COMMANDS)) {
+                return fail(line.number, "expected repeat <count>", error);
+            }
+            // Finding the matching end
+            size_t blockEnd = i + 1;
+            for (int depth = 1; blockEnd < last; blockEnd++) {
+                std::string word = toUpper(splitWords(lines[blockEnd].text)[0]);
+                if (word == "REPEAT") {
+                    depth++;
+                } else if (word == "END" && --depth == 0) {
+                    break;
+                }
+            }
+            if (blockEnd == last) {
+                return fail(line.number, "repeat without end", error);
+            }
+            for (int64_t pass = 0; pass < static_cast<int64_t>(passes); pass++) {
+                nanoseconds passEnd;
+                if (!ParseBlock(i + 1, blockEnd, cursor, passEnd, error)) {
+                    return false;
+                }
+                cursor = passEnd;
+            }
+            i = blockEnd;
+        } else if (keyword == "END") {
+            return fail(line.number, "end without repeat", error);
+        } else if (!parseCommand(line.text, line.number, cursor, error)) {
+            return false;
+        }
+        end = std::max(end, cursor);
+    }
+    return true;
+}
+
+bool Sequence::Load(const std::string& path, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return Parse(text.str(), error);
+}
+
+bool Sequence::Parse(const std::string& text, std::string& error) {
+    std::vector<ProfileLine> lines;
+    std::istringstream input(text);
+    std::string line;
+    for (int number = 1; std::getline(input, line); number++) {
+        line = trim(line.substr(0, line.find('#')));
+        if (!line.empty()) {
+            lines.push_back({number, line});
+        }
+    }
+
+    std::vector<PlannedCommand> commands;
+    ProfileParser parser(lines, commands);
+    nanoseconds end;
+    if (!parser.ParseBlock(0, lines.size(), nanoseconds(0), end, error)) {
+        return false;
+    }
+    if (commands.empty()) {
+        error = "The profile has no commands";
+        return false;
+    }
+
+    // Commands keep their order within the same time
+    std::stable_sort(commands.begin(), commands.end(),
+                     [](const PlannedCommand& a, const PlannedCommand& b) { return a.time < b.time; });
+
+    stream.clear();
+    steps.clear();
+    std::string message;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const PlannedCommand& command = commands[i];
+        if (message.empty()) {
+            steps.push_back({command.time, stream.size(), 0, command.line});
+        }
+        AppendToProgramMessage(message, command.command);
+
+        bool last = i + 1 == commands.size() || commands[i + 1].time != command.time ||
+                    message.size() + 2 + commands[i + 1].command.size() > MAX_STEP_LENGTH;
+        if (last) {
+            message += '\n';
+            stream += message;
+            steps.back().length = message.size();
+            message.clear();
+        }
+    }
+    return true;
+}
+
+const std::string& Sequence::Stream() const {
+    return stream;
+}
+
+const std::vector<SequenceStep>& Sequence::Steps() const {
+    return steps;
+}
+
+nanoseconds Sequence::Duration() const {
+    return steps.empty() ? nanoseconds(0) : steps.back().plannedTime;
+}
+
+SequencePlayer::~SequencePlayer() {
+    Stop();
+}
+
+void SequencePlayer::Start(const Sequence& sequence, WriteFunction write, FinishedCallback onFinished) {
+    Stop();
+
+    this->sequence = sequence;
+    this->write = write;
+    this->onFinished = onFinished;
+    {
+        // Allocated before the playback, the timing thread only fills it in
+        std::lock_guard<std::mutex> lock(timingsMutex);
+        timings.clear();
+        timings.reserve(sequence.Steps().size());
+    }
+
+    stopping = false;
+    running = true;
+    worker = std::thread(&SequencePlayer::run, this);
+}
+
+void SequencePlayer::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopCondition.notify_all();
+    if (worker.joinable()) {
+        if (worker.get_id() == std::this_thread::get_id()) {
+            worker.detach();  // Stopped from the finished callback
+        } else {
+            worker.join();
+        }
+    }
+}
+
+bool SequencePlayer::IsRunning() const {
+    return running;
+}
+
+const Sequence& SequencePlayer::PlayedSequence() const {
+    return sequence;
+}
+
+std::vector<StepTiming> SequencePlayer::Timings() const {
+    std::lock_guard<std::mutex> lock(timingsMutex);
+    return timings;
+}
+
+RunningStatistics SequencePlayer::TimingError() const {
+    RunningStatistics error;
+    std::lock_guard<std::mutex> lock(timingsMutex);
+    for (const StepTiming& timing : timings) {
+        error.Add(std::chrono::duration<double, std::micro>(timing.actual - timing.planned).count());
+    }
+    return error;
+}
+
+bool SequencePlayer::waitUntil(steady_clock::time_point deadline) {
+    // Sleeping through most of the wait (a stop wakes the thread up)...
+    if (deadline - steady_clock::now() > SPIN_MARGIN) {
+        std::unique_lock<std::mutex> lock(stopMutex);
+        if (stopCondition.wait_until(lock, deadline - SPIN_MARGIN, [this] { return stopping.load(); })) {
+            return false;
+        }
+    }
+    // ...and spinning through the last part, which the scheduler cannot time precisely
+    while (steady_clock::now() < deadline) {
+        if (stopping) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return !stopping;
+}
+
+void SequencePlayer::run() {
+#ifdef _WIN32
+    timeBeginPeriod(1);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+
+    const std::string& stream = sequence.Stream();
+    steady_clock::time_point start = steady_clock::now();
+    for (const SequenceStep& step : sequence.Steps()) {
+        if (!waitUntil(start + step.plannedTime)) {
+            break;
+        }
+        StepTiming timing;
+        timing.planned = step.plannedTime;
+        timing.actual = steady_clock::now() - start;
+        timing.ok = write(stream.data() + step.offset, step.length);
+        timing.written = steady_clock::now() - start;
+
+        std::lock_guard<std::mutex> lock(timingsMutex);
+        timings.push_back(timing);
+    }
+
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+    running = false;
+    if (onFinished) {
+        onFinished();
+    }
+}
+
+bool WriteTimingReport(const std::string& path, const Sequence& sequence, const std::vector<StepTiming>& timings) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    std::fprintf(file, "step,line,planned_ms,actual_ms,written_ms,error_us,ok\n");
+    const std::vector<SequenceStep>& steps = sequence.Steps();
+    for (size_t i = 0; i < timings.size() && i < steps.size(); i++) {
+        const StepTiming& timing = timings[i];
+        std::fprintf(file, "%zu,%d,%.3f,%.3f,%.3f,%.1f,%d\n", i, steps[i].sourceLine,
+                     std::chrono::duration<double, std::milli>(timing.planned).count(),
+                     std::chrono::duration<double, std::milli>(timing.actual).count(),
+                     std::chrono::duration<double, std::milli>(timing.written).count(),
+                     std::chrono::duration<double, std::micro>(timing.actual - timing.planned).count(),
+                     timing.ok ? 1 : 0);
+    }
+    return std::fclose(file) == 0;
+}
@@ -0,0 +1,105 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "statistics.h"
+
+// One message of a compiled sequence: the bytes [offset, offset + length) of the stream,
+// sent planned time after the start
+struct SequenceStep {
+    std::chrono::nanoseconds plannedTime{0};
+    size_t offset = 0;
+    size_t length = 0;
+    int sourceLine = 0;  // Line of the profile the (first) command came from
+};
+
+// Setpoint profile compiled ahead of time into one ready-to-send byte stream.
+//
+// Profile syntax, one item per line ('#' starts a comment, durations are in seconds unless
+// they have a unit: us, ms, s, min):
+//   VOLT 5 / CURR 1.5 / RISE 0.2 / FALL 0.2 / OUTP ON   command at the current time
+//   wait 250ms                                           advancing the current time
+//   at 1.5                                               setting the current time
+//   ramp VOLT 0 12 2s 200                                200 even steps from 0 to 12 V over 2 s
+//   repeat 10 ... end                                    repeating the enclosed lines
+//   0.5,VOLT 5,CURR 1                                    CSV: time, then the commands at that time
+// "at" and CSV times count from the start of the profile, or of the pass inside a repeat.
+// Commands must be in the command table with their whole header, and their arguments within its range.
+// Commands planned for the same time are joined into one program message.
+class Sequence {
+public:
+    bool Load(const std::string& path, std::string& error);
+    bool Parse(const std::string& text, std::string& error);
+
+    const std::string& Stream() const;
+    const std::vector<SequenceStep>& Steps() const;
+    std::chrono::nanoseconds Duration() const;
+
+private:
+    std::string stream;
+    std::vector<SequenceStep> steps;
+};
+
+// Planned and actual time of one step, from the start of the playback
+struct StepTiming {
+    std::chrono::nanoseconds planned{0};
+    std::chrono::nanoseconds actual{0};   // When the write started
+    std::chrono::nanoseconds written{0};  // When the write returned
+    bool ok = false;
+};
+
+// Playing a compiled sequence from a high-resolution timing thread: each step is slept for
+// until shortly before its planned time and then waited for by spinning, and the bytes are
+// written without any formatting on the way.
+class SequencePlayer {
+public:
+    typedef std::function<bool(const char* data, size_t length)> WriteFunction;
+    typedef std::function<void()> FinishedCallback;
+
+    ~SequencePlayer();
+
+    // The sequence is copied; onFinished is called on the timing thread when the last step is sent
+    // or the playback is stopped
+    void Start(const Sequence& sequence, WriteFunction write, FinishedCallback onFinished = FinishedCallback());
+    void Stop();
+    bool IsRunning() const;
+
+    // The sequence of the last Start, kept after the playback for its timing report
+    const Sequence& PlayedSequence() const;
+
+    // Timing of the steps played so far (all steps once the playback has finished)
+    std::vector<StepTiming> Timings() const;
+    // actual - planned over the played steps, in microseconds
+    RunningStatistics TimingError() const;
+
+private:
+    void run();
+    bool waitUntil(std::chrono::steady_clock::time_point deadline);
+
+    Sequence sequence;
+    WriteFunction write;
+    FinishedCallback onFinished;
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+
+    mutable std::mutex timingsMutex;
+    std::vector<StepTiming> timings;
+};
+
+// Writing the timing of every step as CSV (step, line, planned/actual/written in ms, error in us)
+bool WriteTimingReport(const std::string& path, const Sequence& sequence, const std::vector<StepTiming>& timings);
+
+#endif // SEQUENCER_H
@@ -1,100 +1,475 @@
 #include "serial.h"
+#include "port_discovery.h"
 
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+std::unique_ptr<Transport> comPort;
 
-HANDLE hComPort = {INVALID_HANDLE_VALUE};
 // Function for opening the COM port
 bool OpenCOMPort(const char* portName) {
     // Close the old connection, if there is one
-    if (hComPort != INVALID_HANDLE_VALUE) {
-        CloseHandle(hComPort);
-        hComPort = INVALID_HANDLE_VALUE;
-    }
+    comPort.reset();
 
     // Open a new COM port
-    hComPort = CreateFile(
-        portName,
+    comPort = OpenSerialTransport(portName);
+    return comPort != nullptr;
+}
+
+// Function for COM port configuration
+bool ConfigureCOMPort(const SerialSettings& settings) {
+    return comPort && comPort->Configure(settings);
+}
+
+#ifdef _WIN32
+
+std::unique_ptr<Transport> OpenSerialTransport(const char* portName, bool reportErrors) {
+    // COM10 and above can only be opened through the device namespace
+    std::string devicePath = portName;
+    if (devicePath.compare(0, 3, "COM") == 0) {
+        devicePath = "\\\\.\\" + devicePath;
+    }
+
+    HANDLE handle = CreateFile(
+        devicePath.c_str(),
         GENERIC_READ | GENERIC_WRITE,
         0,              // No sharing
         NULL,           // No security attributes
         OPEN_EXISTING,  // Open existing port
-        0,              // No overlapped I/O
+        FILE_FLAG_OVERLAPPED,  // Overlapped I/O, so the port can be driven by an I/O completion port
         NULL            // No template file
     );
 
-    if (hComPort == INVALID_HANDLE_VALUE) {
-        std::cerr << "Failed to open COM port: " << GetLastError() << std::endl;
-        return false;
+    if (handle == INVALID_HANDLE_VALUE) {
+        if (reportErrors) {
+            std::cerr << "Failed to open COM port: " << GetLastError() << std::endl;
+        }
+        return nullptr;
     }
 
-    return true;
+    return std::unique_ptr<Transport>(new Win32SerialTransport(handle));
 }
 
-// Function for COM port configuration
-bool ConfigureCOMPort(HWND hComboBoxPort, HWND hComboBoxBaudRate, HWND hComboBoxByteSize, HWND hComboBoxParity, HWND hComboBoxStopBits) {
-    DCB dcbSerialParams = {0};
+Win32SerialTransport::Win32SerialTransport(HANDLE handle) : handle(handle) {
+    readEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
 
-    char portName[256];
-    char baudRate[256];
-    char dataBits[256];
-    char parity[256];
-    char stopBits[256];
+Win32SerialTransport::~Win32SerialTransport() {
+    Close();
+    CloseHandle(readEvent);
+    CloseHandle(writeEvent);
+}
+
+bool Win32SerialTransport::IsOpen() const {
+    return handle != INVALID_HANDLE_VALUE;
+}
+
+void Win32SerialTransport::Close() {
+    if (handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool Win32SerialTransport::Configure(const SerialSettings& settings) {
+    DCB dcbSerialParams = {0};
+    dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
 
     // Get the current port settings
-    if (!GetCommState(hComPort, &dcbSerialParams)) {
+    if (!GetCommState(handle, &dcbSerialParams)) {
         std::cerr << "Failed to get COM port state: " << GetLastError() << std::endl;
         return false;
     }
 
-    GetWindowText(hComboBoxPort, portName, sizeof(portName));
-    GetWindowText(hComboBoxBaudRate, baudRate, sizeof(baudRate));
-    GetWindowText(hComboBoxByteSize, dataBits, sizeof(dataBits));
-    GetWindowText(hComboBoxParity, parity, sizeof(parity));
-    GetWindowText(hComboBoxStopBits, stopBits, sizeof(stopBits));
-
     // Configure Port Settings
-    dcbSerialParams.BaudRate = std::stoi(baudRate);
-    dcbSerialParams.ByteSize = std::stoi(dataBits);
-    dcbSerialParams.Parity = (parity == std::string("None")) ? NOPARITY :
-                              ((parity == std::string("Odd")) ? ODDPARITY :
-                              ((parity == std::string("Even")) ? EVENPARITY :
-                              ((parity == std::string("Mark")) ? MARKPARITY : SPACEPARITY)));
-    dcbSerialParams.StopBits = (stopBits == std::string("1")) ? ONESTOPBIT :
-                                ((stopBits == std::string("1.5")) ? ONE5STOPBITS : TWOSTOPBITS);
+    dcbSerialParams.BaudRate = settings.baudRate;
+    dcbSerialParams.ByteSize = static_cast<BYTE>(settings.byteSize);
+    dcbSerialParams.Parity = (settings.parity == 'N') ? NOPARITY :
+                              ((settings.parity == 'O') ? ODDPARITY :
+                              ((settings.parity == 'E') ? EVENPARITY :
+                              ((settings.parity == 'M') ? MARKPARITY : SPACEPARITY)));
+    dcbSerialParams.StopBits = (settings.stopBits == SerialSettings::ONE) ? ONESTOPBIT :
+                                ((settings.stopBits == SerialSettings::ONE_AND_HALF) ? ONE5STOPBITS : TWOSTOPBITS);
 
     // Set port parameters
-    if (!SetCommState(hComPort, &dcbSerialParams)) {
+    if (!SetCommState(handle, &dcbSerialParams)) {
         std::cerr << "Failed to set COM port state: " << GetLastError() << std::endl;
         return false;
     }
 
-    // Configure timeouts (default)
+    readTimeoutMs = -1;
+    return setReadTimeout(50);
+}
+
+// Configure timeouts so that ReadFile returns as soon as any byte arrives or the timeout expires
+bool Win32SerialTransport::setReadTimeout(int timeoutMs) {
+    if (timeoutMs == readTimeoutMs) {
+        return true;
+    }
+
     COMMTIMEOUTS timeouts = {0};
-    timeouts.ReadIntervalTimeout = 50;
-    timeouts.ReadTotalTimeoutConstant = 50;
-    timeouts.ReadTotalTimeoutMultiplier = 10;
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = timeoutMs > 0 ? MAXDWORD : 0;
+    timeouts.ReadTotalTimeoutConstant = timeoutMs > 0 ? timeoutMs : 0;
     timeouts.WriteTotalTimeoutConstant = 50;
     timeouts.WriteTotalTimeoutMultiplier = 10;
 
-    if (!SetCommTimeouts(hComPort, &timeouts)) {
+    if (!SetCommTimeouts(handle, &timeouts)) {
         std::cerr << "Failed to set COM port timeouts: " << GetLastError() << std::endl;
+        readTimeoutMs = -1;
+        return false;
+    }
+    readTimeoutMs = timeoutMs;
+    return true;
+}
+
+NativeHandle Win32SerialTransport::Handle() const {
+    return handle;
+}
+
+// The port is opened for overlapped I/O, the synchronous calls wait for their own completion.
+// Setting the low bit of hEvent keeps the completion away from an I/O completion port.
+bool Win32SerialTransport::waitForCompletion(BOOL started, OVERLAPPED& overlapped, DWORD& bytesTransferred) {
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    return GetOverlappedResult(handle, &overlapped, &bytesTransferred, TRUE) != FALSE;
+}
+
+bool Win32SerialTransport::Write(const char* data, size_t length) {
+    OVERLAPPED overlapped = {0};
+    overlapped.hEvent = (HANDLE)((ULONG_PTR)writeEvent | 1);
+    DWORD bytesWritten = 0;
+    BOOL started = WriteFile(handle, data, static_cast<DWORD>(length), &bytesWritten, &overlapped);
+    if (!waitForCompletion(started, overlapped, bytesWritten)) {
+        return false;
+    }
+    return bytesWritten == length;
+}
+
+long Win32SerialTransport::Read(char* buffer, size_t size, int timeoutMs) {
+    if (!setReadTimeout(timeoutMs)) {
+        return -1;
+    }
+    OVERLAPPED overlapped = {0};
+    overlapped.hEvent = (HANDLE)((ULONG_PTR)readEvent | 1);
+    DWORD bytesRead = 0;
+    BOOL started = ReadFile(handle, buffer, static_cast<DWORD>(size), &bytesRead, &overlapped);
+    if (!waitForCompletion(started, overlapped, bytesRead)) {
+        return -1;
+    }
+    return static_cast<long>(bytesRead);
+}
+
+// Line settings selected in the UI
+SerialSettings ReadSerialSettings(HWND hComboBoxBaudRate, HWND hComboBoxByteSize, HWND hComboBoxParity, HWND hComboBoxStopBits) {
+    char baudRate[256];
+    char dataBits[256];
+    char parity[256];
+    char stopBits[256];
+
+    GetWindowText(hComboBoxBaudRate, baudRate, sizeof(baudRate));
+    GetWindowText(hComboBoxByteSize, dataBits, sizeof(dataBits));
+    GetWindowText(hComboBoxParity, parity, sizeof(parity));
+    GetWindowText(hComboBoxStopBits, stopBits, sizeof(stopBits));
+
+    SerialSettings settings;
+    settings.baudRate = std::stoul(baudRate);
+    settings.byteSize = std::stoi(dataBits);
+    settings.parity = parity[0];  // "None", "Odd", "Even", "Mark" or "Space"
+    settings.stopBits = (stopBits == std::string("1")) ? SerialSettings::ONE :
+                         ((stopBits == std::string("1.5")) ? SerialSettings::ONE_AND_HALF : SerialSettings::TWO);
+    return settings;
+}
+
+// Function for COM port configuration from the settings selected in the UI
+bool ConfigureCOMPort(HWND hComboBoxPort, HWND hComboBoxBaudRate, HWND hComboBoxByteSize, HWND hComboBoxParity, HWND hComboBoxStopBits) {
+    (void)hComboBoxPort;
+    return ConfigureCOMPort(ReadSerialSettings(hComboBoxBaudRate, hComboBoxByteSize, hComboBoxParity, hComboBoxStopBits));
+}
+
+#else
+
+std::unique_ptr<Transport> OpenSerialTransport(const char* portName, bool reportErrors) {
+    return PosixSerialTransport::Open(portName, reportErrors);
+}
+
+std::unique_ptr<PosixSerialTransport> PosixSerialTransport::Open(const char* path, bool reportErrors) {
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        if (reportErrors) {
+            std::cerr << "Failed to open serial port " << path << ": " << errno << std::endl;
+        }
+        return nullptr;
+    }
+    // No sharing, like the Win32 backend
+    ioctl(fd, TIOCEXCL);
+    return std::unique_ptr<PosixSerialTransport>(new PosixSerialTransport(fd));
+}
+
+PosixSerialTransport::PosixSerialTransport(int fd) : fd(fd) {
+}
+
+PosixSerialTransport::~PosixSerialTransport() {
+    Close();
+}
+
+bool PosixSerialTransport::IsOpen() const {
+    return fd >= 0;
+}
+
+void PosixSerialTransport::Close() {
+    if (fd >= 0) {
+        // The exclusive flag outlives this descriptor if someone else keeps the device open
+        ioctl(fd, TIOCNXCL);
+        close(fd);
+        fd = -1;
+    }
+}
+
+int PosixSerialTransport::Descriptor() const {
+    return fd;
+}
+
+NativeHandle PosixSerialTransport::Handle() const {
+    return fd;
+}
+
+static speed_t baudRateToSpeed(unsigned long baudRate) {
+    switch (baudRate) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+#ifdef B230400
+    case 230400: return B230400;
+#endif
+#ifdef B460800
+    case 460800: return B460800;
+#endif
+#ifdef B921600
+    case 921600: return B921600;
+#endif
+    default: return B0;
+    }
+}
+
+bool PosixSerialTransport::Configure(const SerialSettings& settings) {
+    termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        std::cerr << "Failed to get serial port state: " << errno << std::endl;
         return false;
     }
 
+    speed_t speed = baudRateToSpeed(settings.baudRate);
+    if (speed == B0) {
+        std::cerr << "Unsupported baud rate: " << settings.baudRate << std::endl;
+        return false;
+    }
+
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~CSIZE;
+    tty.c_cflag |= (settings.byteSize == 5) ? CS5 :
+                   ((settings.byteSize == 6) ? CS6 :
+                   ((settings.byteSize == 7) ? CS7 : CS8));
+
+    tty.c_cflag &= ~(PARENB | PARODD);
+#ifdef CMSPAR
+    tty.c_cflag &= ~CMSPAR;
+#endif
+    if (settings.parity != 'N') {
+        tty.c_cflag |= PARENB;
+        if (settings.parity == 'O' || settings.parity == 'M') {
+            tty.c_cflag |= PARODD;
+        }
+#ifdef CMSPAR
+        if (settings.parity == 'M' || settings.parity == 'S') {
+            tty.c_cflag |= CMSPAR;
+        }
+#endif
+    }
+
+    // termios has no 1.5 stop bits, two are used instead
+    if (settings.stopBits == SerialSettings::ONE) {
+        tty.c_cflag &= ~CSTOPB;
+    } else {
+        tty.c_cflag |= CSTOPB;
+    }
+
+    // Reads are driven by poll(), read() itself never waits
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        std::cerr << "Failed to set serial port state: " << errno << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Waiting until the driver drains a full output buffer
+static bool waitWritable(int fd) {
+    pollfd pfd = {fd, POLLOUT, 0};
+    return poll(&pfd, 1, 1000) > 0;
+}
+
+bool PosixSerialTransport::Write(const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || !waitWritable(fd)) {
+                return false;
+            }
+            continue;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool PosixSerialTransport::WriteGather(const OutputSegment* segments, size_t count) {
+    // All segments with one system call; a partial write continues with the rest
+    const size_t MAX_SEGMENTS = 16;
+    if (count > MAX_SEGMENTS) {
+        return Transport::WriteGather(segments, count);
+    }
+    iovec vectors[MAX_SEGMENTS];
+    size_t remaining = 0;
+    for (size_t i = 0; i < count; i++) {
+        vectors[i].iov_base = const_cast<char*>(segments[i].data);
+        vectors[i].iov_len = segments[i].length;
+        remaining += segments[i].length;
+    }
+
+    iovec* next = vectors;
+    int left = static_cast<int>(count);
+    while (remaining > 0) {
+        ssize_t written = writev(fd, next, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || !waitWritable(fd)) {
+                return false;
+            }
+            continue;
+        }
+        remaining -= static_cast<size_t>(written);
+        size_t done = static_cast<size_t>(written);
+        while (left > 0 && done >= next->iov_len) {
+            done -= next->iov_len;
+            next++;
+            left--;
+        }
+        if (left > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + done;
+            next->iov_len -= done;
+        }
+    }
     return true;
 }
 
+long PosixSerialTransport::Read(char* buffer, size_t size, int timeoutMs) {
+    pollfd pfd = {fd, POLLIN, 0};
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+
+    if (ready < 0) {
+        return -1;
+    }
+    if (ready == 0) {
+        return 0;
+    }
+
+    ssize_t bytesRead = read(fd, buffer, size);
+    if (bytesRead < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    if (bytesRead == 0) {
+        return -1;  // Hang-up
+    }
+    return static_cast<long>(bytesRead);
+}
+
+#endif
+
+#ifdef _WIN32
+
 //Functions for filling ComboBox
-void PopulateCOMPorts(HWND hComboBoxPort) {
-    for (int i = 1; i <= 256; i++) {
-        char portName[10];
-        snprintf(portName, sizeof(portName), "COM%d", i);
-
-        HANDLE hCOM = CreateFile(portName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
-        if (hCOM != INVALID_HANDLE_VALUE) {
-            CloseHandle(hCOM);
-            SendMessage(hComboBoxPort, CB_ADDSTRING, 0, (LPARAM)portName);
-            printf("%s\n", portName);
+// The combo box shows "<port> | <identity>", the port name is the text before the separator
+static const char PORT_IDENTITY_SEPARATOR[] = " | ";
+
+static std::string comboTextForPort(const DiscoveredPort& port) {
+    if (port.identity.empty()) {
+        return port.name;
+    }
+    return port.name + PORT_IDENTITY_SEPARATOR + port.identity;
+}
+
+std::string GetSelectedPortName(HWND hComboBoxPort) {
+    char text[512];
+    GetWindowText(hComboBoxPort, text, sizeof(text));
+    std::string name = text;
+    return name.substr(0, name.find(PORT_IDENTITY_SEPARATOR));
+}
+
+// Filling in the ports known from the previous session, the last used one is selected
+void PopulateCOMPorts(HWND hComboBoxPort, const std::vector<DiscoveredPort>& cachedPorts) {
+    for (const DiscoveredPort& port : cachedPorts) {
+        SendMessage(hComboBoxPort, CB_ADDSTRING, 0, (LPARAM)comboTextForPort(port).c_str());
+    }
+    if (!cachedPorts.empty()) {
+        SendMessage(hComboBoxPort, CB_SETCURSEL, 0, 0);
+    }
+}
+
+// Adding a port found by the discovery, or updating its identity if it is already listed
+void AddDiscoveredPort(HWND hComboBoxPort, const DiscoveredPort& port) {
+    int count = (int)SendMessage(hComboBoxPort, CB_GETCOUNT, 0, 0);
+    for (int i = 0; i < count; i++) {
+        char text[512];
+        SendMessage(hComboBoxPort, CB_GETLBTEXT, i, (LPARAM)text);
+        std::string name = text;
+        if (name.substr(0, name.find(PORT_IDENTITY_SEPARATOR)) != port.name) {
+            continue;
+        }
+        if (port.identity.empty() || name == comboTextForPort(port)) {
+            return;
+        }
+        int selected = (int)SendMessage(hComboBoxPort, CB_GETCURSEL, 0, 0);
+        SendMessage(hComboBoxPort, CB_DELETESTRING, i, 0);
+        SendMessage(hComboBoxPort, CB_INSERTSTRING, i, (LPARAM)comboTextForPort(port).c_str());
+        if (selected == i) {
+            SendMessage(hComboBoxPort, CB_SETCURSEL, i, 0);
         }
+        return;
+    }
+
+    SendMessage(hComboBoxPort, CB_ADDSTRING, 0, (LPARAM)comboTextForPort(port).c_str());
+    if (count == 0) {
+        SendMessage(hComboBoxPort, CB_SETCURSEL, 0, 0);
     }
 }
 
@@ -124,11 +499,17 @@ void PopulateStopBits(HWND hComboBoxStopBits) {
 void PopulateBaudRates(HWND hComboBoxBaudRate)
 {
     //Filling in the list of data transfer rates
-    std::vector<std::string> baudRates = {"4800", "9600", "19200", "38400", "57600", "115200"};
-    for (const std::string& rate : baudRates) {
-        SendMessage(hComboBoxBaudRate, CB_ADDSTRING, 0, (LPARAM)rate.c_str());
+    WPARAM defaultIndex = 0;
+    for (unsigned long rate : STANDARD_BAUD_RATES) {
+        std::string text = std::to_string(rate);
+        LRESULT index = SendMessage(hComboBoxBaudRate, CB_ADDSTRING, 0, (LPARAM)text.c_str());
+        if (rate == DEFAULT_BAUD_RATE) {
+            defaultIndex = static_cast<WPARAM>(index);
+        }
     }
 
     // Setting the default value
-    SendMessage(hComboBoxBaudRate, CB_SETCURSEL, 0, 0);
+    SendMessage(hComboBoxBaudRate, CB_SETCURSEL, defaultIndex, 0);
 }
+
+#endif
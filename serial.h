@@ -1,21 +1,91 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
-extern HANDLE hComPort;
+#include "transport.h"
 
-void PopulateCOMPorts(HWND hComboBoxPort);
+// Port opened by OpenCOMPort
+extern std::unique_ptr<Transport> comPort;
+
+// Baud rates offered by the panel (and measured by the benchmark), and the one selected at start,
+// the usual factory setting of the supplies; the rates above it are reached by negotiation
+const unsigned long STANDARD_BAUD_RATES[] = {4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+const unsigned long DEFAULT_BAUD_RATE = 9600;
+
+#ifdef _WIN32
+// Win32 serial port backend
+class Win32SerialTransport : public Transport {
+public:
+    explicit Win32SerialTransport(HANDLE handle);
+    ~Win32SerialTransport() override;
+
+    bool IsOpen() const override;
+    void Close() override;
+    bool Configure(const SerialSettings& settings) override;
+    bool Write(const char* data, size_t length) override;
+    long Read(char* buffer, size_t size, int timeoutMs) override;
+    NativeHandle Handle() const override;
+
+private:
+    bool setReadTimeout(int timeoutMs);
+    bool waitForCompletion(BOOL started, OVERLAPPED& overlapped, DWORD& bytesTransferred);
+
+    HANDLE handle;
+    // Completion events of the synchronous overlapped operations, one per direction: the sequencer
+    // writes from its own thread while the acquisition thread reads
+    HANDLE readEvent;
+    HANDLE writeEvent;
+    int readTimeoutMs = -1;  // read timeout currently programmed with SetCommTimeouts
+};
+#else
+// POSIX termios serial port backend (also used for pseudo-terminals)
+class PosixSerialTransport : public Transport {
+public:
+    explicit PosixSerialTransport(int fd);
+    ~PosixSerialTransport() override;
+
+    static std::unique_ptr<PosixSerialTransport> Open(const char* path, bool reportErrors = true);
+
+    bool IsOpen() const override;
+    void Close() override;
+    bool Configure(const SerialSettings& settings) override;
+    bool Write(const char* data, size_t length) override;
+    bool WriteGather(const OutputSegment* segments, size_t count) override;
+    long Read(char* buffer, size_t size, int timeoutMs) override;
+    NativeHandle Handle() const override;
+
+    int Descriptor() const;
+
+private:
+    int fd;
+};
+#endif
+
+// Opening the serial port with the backend of the current platform
+std::unique_ptr<Transport> OpenSerialTransport(const char* portName, bool reportErrors = true);
+
+bool OpenCOMPort(const char* portName);
+bool ConfigureCOMPort(const SerialSettings& settings);
+
+#ifdef _WIN32
+struct DiscoveredPort;
+
+void PopulateCOMPorts(HWND hComboBoxPort, const std::vector<DiscoveredPort>& cachedPorts);
+void AddDiscoveredPort(HWND hComboBoxPort, const DiscoveredPort& port);
+std::string GetSelectedPortName(HWND hComboBoxPort);
 void PopulateByteSizes(HWND hComboBoxByteSize);
 void PopulateParities(HWND hComboBoxParity);
 void PopulateStopBits(HWND hComboBoxStopBits);
 void PopulateBaudRates(HWND hComboBoxBaudRate);
+SerialSettings ReadSerialSettings(HWND hComboBoxBaudRate, HWND hComboBoxByteSize, HWND hComboBoxParity, HWND hComboBoxStopBits);
 bool ConfigureCOMPort(HWND hComboBoxPort, HWND hComboBoxBaudRate, HWND hComboBoxByteSize, HWND hComboBoxParity, HWND hComboBoxStopBits);
-bool OpenCOMPort(const char* portName);
+#endif
 
 #endif // SERIAL_H
-
-
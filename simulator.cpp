@@ -0,0 +1,594 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "scpi_commands.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "serial.h"
+#endif
+
+// SCPI keywords known to the simulator, in short and long form
+struct Keyword {
+    const char* shortForm;
+    const char* longForm;
+};
+
+static const Keyword keywords[] = {
+    {"MEAS", "MEASURE"}, {"VOLT", "VOLTAGE"}, {"CURR", "CURRENT"}, {"OUTP", "OUTPUT"},
+    {"SYST", "SYSTEM"}, {"ERR", "ERROR"}, {"REM", "REMOTE"}, {"LOC", "LOCAL"},
+    {"RISE", "RISE"}, {"FALL", "FALL"}, {"STAT", "STATE"}, {"SCAL", "SCALAR"},
+    {"DC", "DC"}, {"NEXT", "NEXT"}, {"COMM", "COMMUNICATE"}, {"SER", "SERIAL"},
+    {"FETC", "FETCH"}, {"ARR", "ARRAY"}, {"FORM", "FORMAT"}, {"BORD", "BORDER"}, {"DATA", "DATA"},
+    {"SENS", "SENSE"}, {"SWE", "SWEEP"}, {"POIN", "POINTS"},
+};
+
+// Nodes that may be omitted (MEAS:VOLT:DC? == MEAS:VOLT?, OUTP:STAT ON == OUTP ON, FORM:DATA == FORM)
+static bool isOptionalNode(const std::string& node) {
+    return node == "DC" || node == "SCAL" || node == "STAT" || node == "NEXT" || node == "DATA";
+}
+
+static std::string normalizeNode(std::string node) {
+    for (char& c : node) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    for (const Keyword& keyword : keywords) {
+        if (node == keyword.shortForm || node == keyword.longForm) {
+            return keyword.shortForm;
+        }
+    }
+    return node;
+}
+
+static std::string trim(const std::string& str) {
+    size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+// Numeric parameter with an optional unit suffix ("5", "5.0V", "1e-3 A")
+static bool parseNumber(const std::string& parameter, double& value) {
+    const char* begin = parameter.c_str();
+    char* end = nullptr;
+    value = std::strtod(begin, &end);
+    if (end == begin) {
+        return false;
+    }
+    for (; *end != '\0'; end++) {
+        if (!std::isalpha(static_cast<unsigned char>(*end)) && *end != ' ') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string formatNumber(double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.4f", value);
+    return buffer;
+}
+
+PowerSupplySimulator::PowerSupplySimulator(const SimulatorOptions& options)
+    : options(options), responseLatencyMs(options.responseLatencyMs), baudRate(options.baudRate),
+      lineErrorRate(options.lineErrorRate), lineBaudRate(options.lineBaudRate) {
+    reset();
+}
+
+PowerSupplySimulator::~PowerSupplySimulator() {
+    Stop();
+}
+
+void PowerSupplySimulator::reset() {
+    voltage = 0.0;
+    current = options.maxCurrent;
+    rise = 0.0;
+    fall = 0.0;
+    outputOn = false;
+    binaryFormat = false;
+    swappedByteOrder = false;
+    sweepPoints = 1024;
+    rampFrom = 0.0;
+    rampTo = 0.0;
+    rampSeconds = 0.0;
+    rampStart = std::chrono::steady_clock::now();
+}
+
+void PowerSupplySimulator::SetResponseLatency(int milliseconds) {
+    responseLatencyMs = milliseconds;
+}
+
+void PowerSupplySimulator::SetBaudRate(unsigned long rate) {
+    baudRate = rate;
+}
+
+void PowerSupplySimulator::SetLineErrorRate(double share) {
+    lineErrorRate = share;
+}
+
+unsigned long PowerSupplySimulator::LineBaudRate() const {
+    return lineBaudRate;
+}
+
+unsigned long PowerSupplySimulator::MessagesProcessed() const {
+    return messagesProcessed;
+}
+
+double PowerSupplySimulator::outputVoltageLocked(std::chrono::steady_clock::time_point now) const {
+    double setpoint = rampTo;
+    if (rampSeconds > 0.0) {
+        double elapsed = std::max(std::chrono::duration<double>(now - rampStart).count(), 0.0);
+        if (elapsed < rampSeconds) {
+            setpoint = rampFrom + (rampTo - rampFrom) * elapsed / rampSeconds;
+        }
+    }
+    // Constant current mode when the load would draw more than the limit
+    return std::min(setpoint, current * options.loadResistance);
+}
+
+void PowerSupplySimulator::startRamp(double target, double seconds) {
+    auto now = std::chrono::steady_clock::now();
+    rampFrom = outputVoltageLocked(now);
+    rampTo = target;
+    rampSeconds = seconds;
+    rampStart = now;
+}
+
+// The digitizer's buffer: the output over the last sweepPoints milliseconds, as an ASCII list or a
+// definite-length block of REAL,32 values
+std::string PowerSupplySimulator::fetchArray(bool voltageArray, std::chrono::steady_clock::time_point now) const {
+    std::string data;
+    if (!binaryFormat) {
+        for (size_t i = 0; i < sweepPoints; i++) {
+            double value = outputVoltageLocked(now - std::chrono::milliseconds(sweepPoints - 1 - i));
+            if (i > 0) {
+                data += ',';
+            }
+            data += formatNumber(voltageArray ? value : value / options.loadResistance);
+        }
+        return data;
+    }
+
+    std::string length = std::to_string(sweepPoints * 4);
+    data = "#" + std::to_string(length.size()) + length;
+    for (size_t i = 0; i < sweepPoints; i++) {
+        double value = outputVoltageLocked(now - std::chrono::milliseconds(sweepPoints - 1 - i));
+        float sample = static_cast<float>(voltageArray ? value : value / options.loadResistance);
+        uint32_t word;
+        std::memcpy(&word, &sample, 4);
+        // Big-endian unless swapped, whatever the byte order of this machine
+        for (int b = 0; b < 4; b++) {
+            int shift = swappedByteOrder ? 8 * b : 8 * (3 - b);
+            data += static_cast<char>((word >> shift) & 0xFF);
+        }
+    }
+    return data;
+}
+
+double PowerSupplySimulator::OutputVoltage() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return outputVoltageLocked(std::chrono::steady_clock::now());
+}
+
+double PowerSupplySimulator::OutputCurrent() {
+    return OutputVoltage() / options.loadResistance;
+}
+
+bool PowerSupplySimulator::OutputEnabled() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return outputOn;
+}
+
+void PowerSupplySimulator::pushError(int code, const char* message) {
+    // The class of the error is also flagged in the event status register
+    if (code <= -100 && code > -200) {
+        eventStatus |= EVENT_COMMAND_ERROR;
+    } else if (code <= -200 && code > -300) {
+        eventStatus |= EVENT_EXECUTION_ERROR;
+    } else if (code <= -300 && code > -400) {
+        eventStatus |= EVENT_DEVICE_ERROR;
+    } else if (code <= -400 && code > -500) {
+        eventStatus |= EVENT_QUERY_ERROR;
+    }
+
+    char buffer[96];
+    snprintf(buffer, sizeof(buffer), "%d,\"%s\"", code, message);
+    if (errorQueue.size() >= 16) {
+        errorQueue.back() = "-350,\"Queue overflow\"";
+        return;
+    }
+    errorQueue.push_back(buffer);
+}
+
+std::string PowerSupplySimulator::Process(const std::string& message) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    messagesProcessed++;
+
+    // Splitting the program message into units at ';' outside of quoted strings
+    std::vector<std::string> units;
+    std::string unit;
+    bool quoted = false;
+    for (char c : message) {
+        if (c == '"') {
+            quoted = !quoted;
+        }
+        if (c == ';' && !quoted) {
+            units.push_back(unit);
+            unit.clear();
+        } else {
+            unit += c;
+        }
+    }
+    units.push_back(unit);
+
+    std::string response;
+    std::string path;  // Header path that relative headers after ';' are resolved against
+    for (const std::string& rawUnit : units) {
+        std::string text = trim(rawUnit);
+        if (text.empty()) {
+            continue;
+        }
+
+        size_t space = text.find(' ');
+        std::string header = text.substr(0, space);
+        std::string parameter = space == std::string::npos ? std::string() : trim(text.substr(space + 1));
+
+        if (header[0] == '*') {
+            for (char& c : header) {
+                c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+            executeUnit(parameter.empty() ? header : header + " " + parameter, response);
+            continue;
+        }
+
+        bool isQuery = header.back() == '?';
+        if (isQuery) {
+            header.pop_back();
+        }
+        if (header.empty()) {
+            pushError(-113, "Undefined header");
+            continue;
+        }
+        if (header[0] == ':') {
+            header.erase(0, 1);
+            if (!header.empty() && header[0] == '*') {
+                pushError(-113, "Undefined header");  // Common commands are never rooted, as in IEEE 488.2
+                continue;
+            }
+        } else if (!path.empty()) {
+            header = path + ":" + header;
+        }
+
+        std::vector<std::string> nodes;
+        size_t start = 0;
+        while (start <= header.size()) {
+            size_t colon = header.find(':', start);
+            if (colon == std::string::npos) {
+                colon = header.size();
+            }
+            std::string node = normalizeNode(header.substr(start, colon - start));
+            if (!node.empty()) {
+                nodes.push_back(node);
+            }
+            start = colon + 1;
+        }
+
+        std::string normalized;
+        path.clear();
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (i + 1 < nodes.size()) {
+                path += (path.empty() ? "" : ":") + nodes[i];
+            }
+            if (isOptionalNode(nodes[i]) && i > 0) {
+                continue;
+            }
+            normalized += (normalized.empty() ? "" : ":") + nodes[i];
+        }
+        if (isQuery) {
+            normalized += '?';
+        }
+        executeUnit(parameter.empty() ? normalized : normalized + " " + parameter, response);
+    }
+    return response;
+}
+
+// Executing one normalized message unit, e.g. "VOLT 5.0" or "MEAS:CURR?"
+void PowerSupplySimulator::executeUnit(const std::string& unit, std::string& response) {
+    size_t space = unit.find(' ');
+    std::string header = unit.substr(0, space);
+    std::string parameter = space == std::string::npos ? std::string() : unit.substr(space + 1);
+
+    auto answer = [&response](const std::string& value) {
+        if (!response.empty()) {
+            response += ';';
+        }
+        response += value;
+    };
+
+    auto setNumber = [this, &parameter](double& target, double low, double high) {
+        double value;
+        if (!parseNumber(parameter, value)) {
+            pushError(-224, "Illegal parameter value");
+            return false;
+        }
+        if (value < low || value > high) {
+            pushError(-222, "Data out of range");
+            return false;
+        }
+        target = value;
+        return true;
+    };
+
+    auto now = std::chrono::steady_clock::now();
+
+    if (header == "*IDN?") {
+        answer(options.identity);
+    } else if (header == "*RST") {
+        reset();
+    } else if (header == "*CLS") {
+        errorQueue.clear();
+        eventStatus = 0;
+    } else if (header == "*STB?") {
+        int statusByte = (errorQueue.empty() ? 0 : STATUS_ERROR_AVAILABLE) | (eventStatus != 0 ? STATUS_EVENT_SUMMARY : 0);
+        answer(std::to_string(statusByte));
+    } else if (header == "*ESR?") {
+        answer(std::to_string(eventStatus));
+        eventStatus = 0;
+    } else if (header == "*OPC?") {
+        answer("1");
+    } else if (header == "MEAS:VOLT?") {
+        answer(formatNumber(outputVoltageLocked(now)));
+    } else if (header == "MEAS:CURR?") {
+        answer(formatNumber(outputVoltageLocked(now) / options.loadResistance));
+    } else if (header == "VOLT") {
+        double previous = voltage;
+        if (setNumber(voltage, 0.0, options.maxVoltage) && outputOn) {
+            startRamp(voltage, voltage >= previous ? rise : fall);
+        }
+    } else if (header == "VOLT?") {
+        answer(formatNumber(voltage));
+    } else if (header == "CURR") {
+        setNumber(current, 0.0, options.maxCurrent);
+    } else if (header == "CURR?") {
+        answer(formatNumber(current));
+    } else if (header == "RISE") {
+        setNumber(rise, 0.0, 3600.0);
+    } else if (header == "RISE?") {
+        answer(formatNumber(rise));
+    } else if (header == "FALL") {
+        setNumber(fall, 0.0, 3600.0);
+    } else if (header == "FALL?") {
+        answer(formatNumber(fall));
+    } else if (header == "OUTP") {
+        std::string state = normalizeNode(parameter);
+        if (state == "ON" || state == "1") {
+            if (!outputOn) {
+                outputOn = true;
+                startRamp(voltage, rise);
+            }
+        } else if (state == "OFF" || state == "0") {
+            if (outputOn) {
+                outputOn = false;
+                startRamp(0.0, fall);
+            }
+        } else {
+            pushError(-224, "Illegal parameter value");
+        }
+    } else if (header == "OUTP?") {
+        answer(outputOn ? "1" : "0");
+    } else if (header == "SYST:REM") {
+        remote = true;
+    } else if (header == "SYST:LOC") {
+        remote = false;
+    } else if (header == "SYST:COMM:SER:BAUD" && !options.supportedBaudRates.empty()) {
+        double value;
+        if (!parseNumber(parameter, value)) {
+            pushError(-224, "Illegal parameter value");
+        } else if (std::find(options.supportedBaudRates.begin(), options.supportedBaudRates.end(),
+                             static_cast<unsigned long>(value)) == options.supportedBaudRates.end()) {
+            pushError(-222, "Data out of range");
+        } else {
+            pendingBaudRate = static_cast<unsigned long>(value);
+        }
+    } else if (header == "SYST:COMM:SER:BAUD?" && !options.supportedBaudRates.empty()) {
+        answer(std::to_string(lineBaudRate));
+    } else if (header == "FORM") {
+        std::string format = normalizeNode(parameter);
+        if (format == "REAL,32" || format == "REAL") {
+            binaryFormat = true;
+        } else if (format == "ASC" || format == "ASCII") {
+            binaryFormat = false;
+        } else {
+            pushError(-224, "Illegal parameter value");
+        }
+    } else if (header == "FORM:BORD") {
+        std::string order = normalizeNode(parameter);
+        if (order == "NORM" || order == "NORMAL") {
+            swappedByteOrder = false;
+        } else if (order == "SWAP" || order == "SWAPPED") {
+            swappedByteOrder = true;
+        } else {
+            pushError(-224, "Illegal parameter value");
+        }
+    } else if (header == "SENS:SWE:POIN") {
+        double points = 0.0;
+        if (setNumber(points, 1.0, 1048576.0)) {
+            sweepPoints = static_cast<size_t>(points);
+        }
+    } else if (header == "SENS:SWE:POIN?") {
+        answer(std::to_string(sweepPoints));
+    } else if (header == "FETC:ARR:VOLT?") {
+        answer(fetchArray(true, now));
+    } else if (header == "FETC:ARR:CURR?") {
+        answer(fetchArray(false, now));
+    } else if (header == "SYST:ERR?") {
+        if (errorQueue.empty()) {
+            answer("0,\"No error\"");
+        } else {
+            answer(errorQueue.front());
+            errorQueue.pop_front();
+        }
+    } else {
+        pushError(-113, "Undefined header");
+    }
+}
+
+void PowerSupplySimulator::Start(std::unique_ptr<Transport> instrumentEnd) {
+    Stop();
+    transport = std::move(instrumentEnd);
+    running = true;
+    worker = std::thread(&PowerSupplySimulator::serve, this);
+}
+
+void PowerSupplySimulator::Stop() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+    transport.reset();
+#ifndef _WIN32
+    if (ptySlaveFd >= 0) {
+        close(ptySlaveFd);
+        ptySlaveFd = -1;
+    }
+#endif
+}
+
+std::unique_ptr<Transport> PowerSupplySimulator::StartLoopback() {
+    std::unique_ptr<LoopbackTransport> client;
+    std::unique_ptr<LoopbackTransport> instrument;
+    LoopbackTransport::CreatePair(client, instrument);
+    Start(std::move(instrument));
+    return client;
+}
+
+#ifndef _WIN32
+std::string PowerSupplySimulator::StartPty() {
+    Stop();
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        if (master >= 0) {
+            close(master);
+        }
+        return std::string();
+    }
+    std::string slaveName = ptsname(master);
+
+    // Raw mode, otherwise the line discipline would echo the commands back to the client
+    termios tty;
+    tcgetattr(master, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(master, TCSANOW, &tty);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    // Without an open slave, reads on the master fail until a client connects
+    ptySlaveFd = open(slaveName.c_str(), O_RDWR | O_NOCTTY);
+
+    transport.reset(new PosixSerialTransport(master));
+    running = true;
+    worker = std::thread(&PowerSupplySimulator::serve, this);
+    return slaveName;
+}
+#endif
+
+// Simulator thread: collecting command lines and answering them
+void PowerSupplySimulator::serve() {
+    std::string line;
+    char buffer[256];
+    while (running) {
+        long bytesRead = transport->Read(buffer, sizeof(buffer), 20);
+        if (bytesRead < 0) {
+            break;
+        }
+        for (long i = 0; i < bytesRead; i++) {
+            if (buffer[i] == '\n') {
+                handleLine(line);
+                line.clear();
+            } else if (buffer[i] != '\r') {
+                line += buffer[i];
+            }
+        }
+    }
+}
+
+void PowerSupplySimulator::handleLine(const std::string& line) {
+    unsigned long rate = baudRate;
+    if (rate > 0) {
+        // The command occupied the line for this long before the instrument could see its end
+        std::this_thread::sleep_for(std::chrono::duration<double>((line.size() + 1) * options.bitsPerCharacter / rate));
+    }
+
+    std::string response = Process(line);
+
+    int latency = responseLatencyMs;
+    if (latency > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(latency));
+    }
+    if (!response.empty()) {
+        std::string data = response + "\n";
+        corrupt(data);
+        writeThrottled(data);
+    }
+
+    // A new baud rate takes effect after the message, as on an instrument; with throttling the
+    // simulated line follows it
+    unsigned long newRate;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        newRate = pendingBaudRate;
+        pendingBaudRate = 0;
+    }
+    if (newRate != 0) {
+        lineBaudRate = newRate;
+        if (baudRate != 0) {
+            baudRate = newRate;
+        }
+        SerialSettings settings;
+        settings.baudRate = newRate;
+        transport->Configure(settings);
+    }
+}
+
+// Line errors: a corrupted character may also be a lost terminator
+void PowerSupplySimulator::corrupt(std::string& data) {
+    double share = lineErrorRate;
+    if (share <= 0.0 || (options.reliableBaudRate != 0 && lineBaudRate <= options.reliableBaudRate)) {
+        return;
+    }
+    std::uniform_real_distribution<double> draw(0.0, 1.0);
+    for (char& c : data) {
+        if (draw(lineNoise) < share) {
+            c = static_cast<char>(c ^ 0x5A);
+        }
+    }
+}
+
+// Writing at the pace of the simulated baud rate, a few characters at a time
+void PowerSupplySimulator::writeThrottled(const std::string& data) {
+    unsigned long rate = baudRate;
+    if (rate == 0) {
+        transport->Write(data.data(), data.size());
+        return;
+    }
+
+    const size_t chunk = 8;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> characterTime(options.bitsPerCharacter / rate);
+    for (size_t offset = 0; offset < data.size(); offset += chunk) {
+        size_t count = std::min(chunk, data.size() - offset);
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(characterTime * (offset + count)));
+        transport->Write(data.data() + offset, count);
+    }
+}
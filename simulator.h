@@ -0,0 +1,125 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transport.h"
+
+// Options of the simulated power supply
+struct SimulatorOptions {
+    std::string identity = "SIMULATED,PSU-SIM,000000,1.0";
+    double loadResistance = 10.0;  // Resistive load connected to the output, Ohm
+    double maxVoltage = 60.0;
+    double maxCurrent = 10.0;
+    int responseLatencyMs = 0;     // Processing time before the instrument answers
+    unsigned long baudRate = 0;    // Throttling of the simulated line, 0 - no throttling
+    double bitsPerCharacter = 10.0;
+
+    // Serial port of the instrument: the rates SYST:COMM:SER:BAUD accepts (empty: the command is
+    // unknown), and line errors corrupting that share of the response characters, only above
+    // reliableBaudRate if it is not 0
+    std::vector<unsigned long> supportedBaudRates;
+    unsigned long lineBaudRate = 9600;  // Reported by SYST:COMM:SER:BAUD? until changed
+    unsigned long reliableBaudRate = 0;
+    double lineErrorRate = 0.0;
+};
+
+// SCPI power supply simulator. Answers *IDN?, MEAS:VOLT?, MEAS:CURR?, VOLT, CURR, RISE, FALL,
+// OUTP, the SYST commands, SYST:COMM:SER:BAUD and the array fetch (FORM, FORM:BORD, SENS:SWE:POIN,
+// FETC:ARR:VOLT?, FETC:ARR:CURR?) over any Transport, e.g. a pseudo-terminal or a loopback pair.
+class PowerSupplySimulator {
+public:
+    explicit PowerSupplySimulator(const SimulatorOptions& options = SimulatorOptions());
+    ~PowerSupplySimulator();
+
+    PowerSupplySimulator(const PowerSupplySimulator&) = delete;
+    PowerSupplySimulator& operator=(const PowerSupplySimulator&) = delete;
+
+    // Executing one program message; returns the response without the terminator
+    // (empty if the message contained no queries)
+    std::string Process(const std::string& message);
+
+    // Serving the instrument end of a transport on a background thread
+    void Start(std::unique_ptr<Transport> transport);
+    void Stop();
+
+    // In-process simulator: returns the client end of a loopback pair
+    std::unique_ptr<Transport> StartLoopback();
+
+#ifndef _WIN32
+    // Simulator behind a pseudo-terminal; returns the path of the slave device
+    // that clients open like a serial port, or an empty string on failure
+    std::string StartPty();
+#endif
+
+    // Fault and line injection, may be changed while the simulator is running
+    void SetResponseLatency(int milliseconds);
+    void SetBaudRate(unsigned long baudRate);
+    void SetLineErrorRate(double share);
+
+    // Rate of the instrument's serial port, changed by SYST:COMM:SER:BAUD
+    unsigned long LineBaudRate() const;
+
+    double OutputVoltage();
+    double OutputCurrent();
+    bool OutputEnabled();
+    unsigned long MessagesProcessed() const;
+
+private:
+    void serve();
+    void handleLine(const std::string& line);
+    void writeThrottled(const std::string& data);
+    void corrupt(std::string& data);
+    void executeUnit(const std::string& unit, std::string& response);
+    void pushError(int code, const char* message);
+    double outputVoltageLocked(std::chrono::steady_clock::time_point now) const;
+    void startRamp(double target, double seconds);
+    std::string fetchArray(bool voltage, std::chrono::steady_clock::time_point now) const;
+    void reset();
+
+    SimulatorOptions options;
+    std::atomic<int> responseLatencyMs;
+    std::atomic<unsigned long> baudRate;
+    std::atomic<double> lineErrorRate;
+    std::atomic<unsigned long> lineBaudRate;
+
+    // Programmed state
+    std::mutex stateMutex;
+    double voltage = 0.0;
+    double current = 0.0;
+    double rise = 0.0;
+    double fall = 0.0;
+    bool outputOn = false;
+    bool remote = false;
+    std::deque<std::string> errorQueue;
+    int eventStatus = 0;  // Standard event status register, read and cleared by *ESR?
+    unsigned long pendingBaudRate = 0;  // Set by SYST:COMM:SER:BAUD, taken once the message is answered
+    bool binaryFormat = false;  // FORM REAL,32, otherwise ASCII
+    bool swappedByteOrder = false;
+    size_t sweepPoints = 1024;  // Samples of the digitizer, taken every millisecond
+
+    // Linear ramp of the output voltage started by VOLT/OUTP with RISE/FALL times
+    double rampFrom = 0.0;
+    double rampTo = 0.0;
+    double rampSeconds = 0.0;
+    std::chrono::steady_clock::time_point rampStart;
+
+    std::unique_ptr<Transport> transport;
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<unsigned long> messagesProcessed{0};
+    std::minstd_rand lineNoise;  // Simulator thread only; seeded the same on every run
+#ifndef _WIN32
+    int ptySlaveFd = -1;  // Keeps the pty alive while no client has it open
+#endif
+};
+
+#endif // SIMULATOR_H
@@ -0,0 +1,51 @@
+#include "statistics.h"
+
+#include <cmath>
+
+void RunningStatistics::Add(double value) {
+    count++;
+    if (count == 1) {
+        minimum = maximum = value;
+    } else if (value < minimum) {
+        minimum = value;
+    } else if (value > maximum) {
+        maximum = value;
+    }
+    double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+}
+
+// Combining two sets of statistics (Chan et al.), as if all their values had been added to one
+void RunningStatistics::Merge(const RunningStatistics& other) {
+    if (other.count == 0) {
+        return;
+    }
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+    uint64_t total = count + other.count;
+    double delta = other.mean - mean;
+    mean += delta * other.count / total;
+    m2 += other.m2 + delta * delta * (static_cast<double>(count) * other.count / total);
+    count = total;
+    if (other.minimum < minimum) {
+        minimum = other.minimum;
+    }
+    if (other.maximum > maximum) {
+        maximum = other.maximum;
+    }
+}
+
+void RunningStatistics::Clear() {
+    *this = RunningStatistics();
+}
+
+double RunningStatistics::Rms() const {
+    return count == 0 ? 0.0 : std::sqrt(mean * mean + m2 / count);
+}
+
+double RunningStatistics::StandardDeviation() const {
+    return count == 0 ? 0.0 : std::sqrt(m2 / count);
+}
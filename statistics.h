@@ -0,0 +1,23 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <cstdint>
+
+// Streaming statistics of one quantity: updated in O(1) per value and mergeable,
+// so statistics of buckets can be combined into statistics of a whole window
+struct RunningStatistics {
+    uint64_t count = 0;
+    double minimum = 0.0;
+    double maximum = 0.0;
+    double mean = 0.0;
+    double m2 = 0.0;  // Sum of squared deviations from the mean (Welford)
+
+    void Add(double value);
+    void Merge(const RunningStatistics& other);
+    void Clear();
+
+    double Rms() const;
+    double StandardDeviation() const;
+};
+
+#endif // STATISTICS_H
@@ -0,0 +1,452 @@
+#include "strip_chart.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "numeric.h"
+
+void MinMaxSeries::Add(int64_t time, double value) {
+    size_t entry = dropped + values.size();
+    times.push_back(time);
+    values.push_back(value);
+
+    for (Level& level : levels) {
+        entry /= FANOUT;
+        size_t local = entry - level.first;
+        if (local == level.minima.size()) {
+            level.minima.push_back(value);
+            level.maxima.push_back(value);
+        } else {
+            level.minima[local] = std::min(level.minima[local], value);
+            level.maxima[local] = std::max(level.maxima[local], value);
+        }
+    }
+}
+
+void MinMaxSeries::Clear() {
+    times.clear();
+    values.clear();
+    dropped = 0;
+    for (Level& level : levels) {
+        level.minima.clear();
+        level.maxima.clear();
+        level.first = 0;
+    }
+}
+
+// An entry of a level that covers dropped samples is dropped with them only when it covers nothing else.
+// One that still covers samples kept holds the extremes of the dropped ones too, but Range never reads it:
+// it takes an entry of a level only when the range starts at the entry's first sample.
+void MinMaxSeries::DropBefore(int64_t time) {
+    size_t count = LowerBound(time);
+    if (count == 0) {
+        return;
+    }
+    times.erase(times.begin(), times.begin() + count);
+    values.erase(values.begin(), values.begin() + count);
+    dropped += count;
+
+    size_t entry = dropped;
+    for (Level& level : levels) {
+        entry /= FANOUT;
+        size_t gone = std::min(entry - level.first, level.minima.size());
+        level.minima.erase(level.minima.begin(), level.minima.begin() + gone);
+        level.maxima.erase(level.maxima.begin(), level.maxima.begin() + gone);
+        level.first += gone;
+    }
+}
+
+size_t MinMaxSeries::Size() const {
+    return values.size();
+}
+
+int64_t MinMaxSeries::Time(size_t index) const {
+    return times[index];
+}
+
+double MinMaxSeries::Value(size_t index) const {
+    return values[index];
+}
+
+size_t MinMaxSeries::LowerBound(int64_t time, size_t from) const {
+    from = std::min(from, times.size());
+    return static_cast<size_t>(std::lower_bound(times.begin() + from, times.end(), time) - times.begin());
+}
+
+// The unaligned ends of the range are taken one by one, the aligned middle from the level above,
+// whose entries cover FANOUT times as many samples
+void MinMaxSeries::Range(size_t begin, size_t end, double& minimum, double& maximum) const {
+    minimum = std::numeric_limits<double>::infinity();
+    maximum = -std::numeric_limits<double>::infinity();
+
+    // Aligned as counted from the first sample ever added
+    begin += dropped;
+    end += dropped;
+    while (begin < end && begin % FANOUT != 0) {
+        minimum = std::min(minimum, values[begin - dropped]);
+        maximum = std::max(maximum, values[begin - dropped]);
+        begin++;
+    }
+    while (end > begin && end % FANOUT != 0) {
+        end--;
+        minimum = std::min(minimum, values[end - dropped]);
+        maximum = std::max(maximum, values[end - dropped]);
+    }
+    begin /= FANOUT;
+    end /= FANOUT;
+
+    for (size_t l = 0; begin < end; l++) {
+        const Level& level = levels[l];
+        bool top = l + 1 == LEVEL_COUNT;
+        while (begin < end && (top || begin % FANOUT != 0)) {
+            minimum = std::min(minimum, level.minima[begin - level.first]);
+            maximum = std::max(maximum, level.maxima[begin - level.first]);
+            begin++;
+        }
+        while (end > begin && end % FANOUT != 0) {
+            end--;
+            minimum = std::min(minimum, level.minima[end - level.first]);
+            maximum = std::max(maximum, level.maxima[end - level.first]);
+        }
+        begin /= FANOUT;
+        end /= FANOUT;
+    }
+}
+
+void DecimateColumns(const MinMaxSeries& series, int64_t start, int64_t duration, size_t count, ChartColumn* columns) {
+    size_t begin = series.LowerBound(start);
+    for (size_t i = 0; i < count; i++) {
+        size_t end = series.LowerBound(start + static_cast<int64_t>(i + 1) * duration, begin);
+        ChartColumn& column = columns[i];
+        column.empty = begin == end;
+        if (!column.empty) {
+            series.Range(begin, end, column.minimum, column.maximum);
+            column.first = series.Value(begin);
+            column.last = series.Value(end - 1);
+        }
+        begin = end;
+    }
+}
+
+#ifdef _WIN32
+
+static const char STRIP_CHART_CLASS[] = "PowerSupplyStripChart";
+
+// Width of the scale labels left of the plot
+static const int LABEL_WIDTH = 60;
+
+// Zoom limits: one second, one day
+static const int64_t MIN_SPAN = 1000000000LL;
+static const int64_t MAX_SPAN = 86400LL * 1000000000LL;
+
+static const COLORREF LANE_COLORS[] = {RGB(0, 0, 192), RGB(192, 0, 0)};
+static const char* const LANE_NAMES[] = {"V", "A"};
+
+// 1, 2 or 5 times a power of ten, at least the value
+static double niceCeiling(double value) {
+    if (value <= 0.0) {
+        return 0.0;
+    }
+    double power = std::pow(10.0, std::floor(std::log10(value)));
+    for (double step : {1.0, 2.0, 5.0, 10.0}) {
+        if (step * power >= value) {
+            return step * power;
+        }
+    }
+    return 10.0 * power;
+}
+
+StripChart::StripChart()
+    : origin(std::chrono::steady_clock::now()), span(DEFAULT_SPAN_SECONDS * 1000000000LL) {
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        lower[lane] = 0.0;
+        upper[lane] = 1.0;
+        pens[lane] = NULL;
+    }
+}
+
+StripChart::~StripChart() {
+    if (backDc != NULL) {
+        SelectObject(backDc, previousBitmap);
+        DeleteObject(backBitmap);
+        DeleteDC(backDc);
+    }
+    for (HPEN pen : pens) {
+        if (pen != NULL) {
+            DeleteObject(pen);
+        }
+    }
+}
+
+bool StripChart::Create(HWND parent, int x, int y, int chartWidth, int chartHeight, int id) {
+    HINSTANCE instance = GetModuleHandle(NULL);
+    WNDCLASS windowClass = {};
+    if (!GetClassInfo(instance, STRIP_CHART_CLASS, &windowClass)) {
+        windowClass.lpfnWndProc = windowProc;
+        windowClass.hInstance = instance;
+        windowClass.lpszClassName = STRIP_CHART_CLASS;
+        windowClass.hCursor = LoadCursor(NULL, IDC_ARROW);
+        RegisterClass(&windowClass);
+    }
+
+    hwnd = CreateWindowEx(0, STRIP_CHART_CLASS, "", WS_CHILD | WS_VISIBLE | WS_BORDER, x, y, chartWidth, chartHeight,
+                          parent, (HMENU)(INT_PTR)id, instance, this);
+    if (hwnd == NULL) {
+        return false;
+    }
+
+    RECT client;
+    GetClientRect(hwnd, &client);
+    width = client.right;
+    height = client.bottom;
+    plot = client;
+    plot.left = LABEL_WIDTH;
+
+    HDC windowDc = GetDC(hwnd);
+    backDc = CreateCompatibleDC(windowDc);
+    backBitmap = CreateCompatibleBitmap(windowDc, width, height);
+    ReleaseDC(hwnd, windowDc);
+    previousBitmap = SelectObject(backDc, backBitmap);
+    SetBkMode(backDc, TRANSPARENT);
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        pens[lane] = CreatePen(PS_SOLID, 1, LANE_COLORS[lane]);
+    }
+
+    redrawAll = true;
+    Update();
+    return true;
+}
+
+int64_t StripChart::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+// Columns are aligned to the origin, so a column drawn once stays valid while the chart scrolls
+int64_t StripChart::columnDuration() const {
+    return std::max<int64_t>(span / std::max<int64_t>(plot.right - plot.left, 1), 1);
+}
+
+void StripChart::Add(const Sample& sample) {
+    if (!sample.valid) {
+        return;
+    }
+    int64_t time = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(sample.timestamp - origin).count(), 0);
+    const bool present[LANE_COUNT] = {sample.hasVoltage, sample.hasCurrent};
+    const double value[LANE_COUNT] = {sample.voltage, sample.current};
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        if (!present[lane] || std::isnan(value[lane])) {
+            continue;
+        }
+        MinMaxSeries& laneSeries = series[lane];
+        if (laneSeries.Size() > 0) {
+            time = std::max(time, laneSeries.Time(laneSeries.Size() - 1));
+        }
+        laneSeries.Add(time, value[lane]);
+        extendScale(lane, value[lane]);
+        changedFrom = changedFrom < 0 ? time : std::min(changedFrom, time);
+    }
+}
+
+void StripChart::Clear() {
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        series[lane].Clear();
+        lower[lane] = 0.0;
+        upper[lane] = 1.0;
+    }
+    changedFrom = -1;
+    redrawAll = true;
+}
+
+// The scales only grow, each change redraws the whole plot once
+void StripChart::extendScale(int lane, double value) {
+    if (value > upper[lane]) {
+        upper[lane] = niceCeiling(value * 1.25);
+        redrawAll = true;
+    } else if (value < lower[lane]) {
+        lower[lane] = -niceCeiling(-value * 1.25);
+        redrawAll = true;
+    }
+}
+
+void StripChart::Update() {
+    if (hwnd == NULL) {
+        return;
+    }
+    // Nothing older than the widest zoom can be shown, keeping it would grow the panel for as long as it runs
+    int64_t present = now();
+    for (MinMaxSeries& laneSeries : series) {
+        laneSeries.DropBefore(present - MAX_SPAN);
+    }
+
+    int64_t plotWidth = plot.right - plot.left;
+    int64_t duration = columnDuration();
+    int64_t newest = present / duration;
+    int64_t leftmost = newest - plotWidth + 1;
+
+    if (redrawAll || drawnColumn < 0 || newest - drawnColumn >= plotWidth) {
+        drawLabels();
+        drawColumns(leftmost, newest, leftmost);
+        InvalidateRect(hwnd, NULL, FALSE);
+    } else {
+        // The newest column drawn may have got more samples, and so may older ones if samples came
+        // late; the column of the sample before them is drawn again for the line to them
+        int64_t first = drawnColumn;
+        if (changedFrom >= 0) {
+            for (const MinMaxSeries& laneSeries : series) {
+                size_t index = laneSeries.LowerBound(changedFrom);
+                int64_t time = index > 0 ? laneSeries.Time(index - 1) : changedFrom;
+                first = std::min(first, time / duration);
+            }
+        }
+        first = std::max(first, leftmost);
+
+        int shift = static_cast<int>(newest - drawnColumn);
+        if (shift > 0) {
+            BitBlt(backDc, plot.left, 0, static_cast<int>(plotWidth) - shift, height, backDc, plot.left + shift, 0, SRCCOPY);
+        }
+        drawColumns(first, newest, leftmost);
+
+        // After a scroll the whole plot has moved; otherwise only the redrawn columns changed
+        RECT dirty = plot;
+        if (shift == 0) {
+            dirty.left = plot.left + static_cast<int>(first - leftmost);
+        }
+        InvalidateRect(hwnd, &dirty, FALSE);
+    }
+    drawnColumn = newest;
+    changedFrom = -1;
+    redrawAll = false;
+}
+
+// Drawing the columns [firstColumn, lastColumn] into the bitmap, leftmost being the one at the plot's left edge
+void StripChart::drawColumns(int64_t firstColumn, int64_t lastColumn, int64_t leftmost) {
+    int64_t duration = columnDuration();
+    int left = plot.left + static_cast<int>(firstColumn - leftmost);
+    int right = plot.left + static_cast<int>(lastColumn - leftmost) + 1;
+
+    RECT area = {left, 0, right, height};
+    FillRect(backDc, &area, (HBRUSH)GetStockObject(WHITE_BRUSH));
+    IntersectClipRect(backDc, left, 0, right, height);
+
+    HGDIOBJ previousPen = SelectObject(backDc, GetStockObject(BLACK_PEN));
+    MoveToEx(backDc, left, height / 2, NULL);
+    LineTo(backDc, right, height / 2);
+
+    size_t count = static_cast<size_t>(lastColumn - firstColumn + 1);
+    columns.resize(count);
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        const MinMaxSeries& laneSeries = series[lane];
+        int top = lane * height / 2 + 2;
+        int bottom = (lane + 1) * height / 2 - 2;
+        double scale = (bottom - top) / (upper[lane] - lower[lane]);
+        auto y = [&](double value) { return bottom - static_cast<int>(std::lround((value - lower[lane]) * scale)); };
+
+        // The line comes in from the last sample before the first column, wherever that is
+        bool hasPrevious = false;
+        int previousX = 0;
+        double previousValue = 0.0;
+        size_t before = laneSeries.LowerBound(firstColumn * duration);
+        if (before > 0) {
+            hasPrevious = true;
+            previousX = plot.left + static_cast<int>(laneSeries.Time(before - 1) / duration - leftmost);
+            previousValue = laneSeries.Value(before - 1);
+        }
+
+        SelectObject(backDc, pens[lane]);
+        DecimateColumns(laneSeries, firstColumn * duration, duration, count, columns.data());
+        for (size_t i = 0; i < count; i++) {
+            const ChartColumn& column = columns[i];
+            if (column.empty) {
+                continue;
+            }
+            int x = left + static_cast<int>(i);
+            if (hasPrevious) {
+                MoveToEx(backDc, previousX, y(previousValue), NULL);
+                LineTo(backDc, x, y(column.first));
+            }
+            MoveToEx(backDc, x, y(column.maximum), NULL);
+            LineTo(backDc, x, y(column.minimum) + 1);
+            hasPrevious = true;
+            previousX = x;
+            previousValue = column.last;
+        }
+    }
+
+    SelectObject(backDc, previousPen);
+    SelectClipRgn(backDc, NULL);
+}
+
+// Scales of the lanes and the visible span, left of the plot
+void StripChart::drawLabels() {
+    RECT area = {0, 0, plot.left, height};
+    FillRect(backDc, &area, (HBRUSH)GetStockObject(LTGRAY_BRUSH));
+
+    char text[NUMBER_BUFFER_SIZE + 8];
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        int top = lane * height / 2;
+        int bottom = (lane + 1) * height / 2;
+        SetTextColor(backDc, LANE_COLORS[lane]);
+
+        size_t length = FormatNumber(upper[lane], text, sizeof(text));
+        TextOut(backDc, 4, top + 2, text, static_cast<int>(length));
+        TextOut(backDc, 4, (top + bottom) / 2 - 8, LANE_NAMES[lane], static_cast<int>(strlen(LANE_NAMES[lane])));
+        length = FormatNumber(lower[lane], text, sizeof(text));
+        TextOut(backDc, 4, bottom - 18, text, static_cast<int>(length));
+    }
+
+    SetTextColor(backDc, RGB(0, 0, 0));
+    double seconds = span / 1e9;
+    bool minutes = seconds >= 120.0;
+    size_t length = FormatNumber(minutes ? seconds / 60.0 : seconds, text, sizeof(text), 0);
+    memcpy(text + length, minutes ? " min" : " s", minutes ? 5 : 3);
+    TextOut(backDc, 4, height / 2 - 28, text, static_cast<int>(strlen(text)));
+}
+
+void StripChart::paint() {
+    PAINTSTRUCT paintStruct;
+    HDC dc = BeginPaint(hwnd, &paintStruct);
+    const RECT& area = paintStruct.rcPaint;
+    BitBlt(dc, area.left, area.top, area.right - area.left, area.bottom - area.top, backDc, area.left, area.top, SRCCOPY);
+    EndPaint(hwnd, &paintStruct);
+}
+
+// Each step halves (negative) or doubles the visible span
+void StripChart::zoom(int steps) {
+    int64_t zoomed = steps < 0 ? span / 2 : span * 2;
+    zoomed = std::min(std::max(zoomed, MIN_SPAN), MAX_SPAN);
+    if (zoomed != span) {
+        span = zoomed;
+        redrawAll = true;
+        Update();
+    }
+}
+
+LRESULT CALLBACK StripChart::windowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+    if (message == WM_NCCREATE) {
+        CREATESTRUCT* create = (CREATESTRUCT*)lParam;
+        SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)create->lpCreateParams);
+    }
+    StripChart* chart = (StripChart*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+    if (chart == NULL || chart->backDc == NULL) {
+        return DefWindowProc(hwnd, message, wParam, lParam);
+    }
+
+    switch (message) {
+    case WM_PAINT:
+        chart->paint();
+        return 0;
+    case WM_ERASEBKGND:
+        return 1;  // WM_PAINT covers everything from the bitmap
+    case WM_LBUTTONDOWN:
+        SetFocus(hwnd);  // For the mouse wheel
+        return 0;
+    case WM_MOUSEWHEEL:
+        chart->zoom(GET_WHEEL_DELTA_WPARAM(wParam) > 0 ? -1 : 1);
+        return 0;
+    }
+    return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef STRIP_CHART_H
+#define STRIP_CHART_H
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "acquisition.h"
+
+// Recent history of one measured quantity, for drawing it at any zoom. Samples are kept until
+// the owner drops them (16 bytes; a day at 50 samples/s is 69 MB) and summarized in a few levels
+// of minima and maxima, each entry of a level covering FANOUT entries of the level below. The
+// minimum and maximum of any range of samples are then merged from at most 2 * FANOUT entries
+// per level, so the cost of drawing does not grow with the length of the history.
+class MinMaxSeries {
+public:
+    static const size_t FANOUT = 16;
+    static const size_t LEVEL_COUNT = 6;  // The top level's entries cover 16^6 samples
+
+    // Times in nanoseconds since an origin of the caller's choice, never decreasing
+    void Add(int64_t time, double value);
+    void Clear();
+
+    // Dropping the samples before the time; the indices of the rest then start at 0 again
+    void DropBefore(int64_t time);
+
+    size_t Size() const;
+    int64_t Time(size_t index) const;
+    double Value(size_t index) const;
+
+    // Index of the first sample at or after the time, from the index given on (Size() if none)
+    size_t LowerBound(int64_t time, size_t from = 0) const;
+
+    // Minimum and maximum of the samples [begin, end), begin < end
+    void Range(size_t begin, size_t end, double& minimum, double& maximum) const;
+
+private:
+    // Entries are counted from the first sample ever added, first being the count of entries dropped
+    struct Level {
+        std::deque<double> minima;
+        std::deque<double> maxima;
+        size_t first = 0;
+    };
+
+    // Chunked, so a long history is never copied while the panel is running
+    std::deque<int64_t> times;
+    std::deque<double> values;
+    size_t dropped = 0;  // Samples dropped from the front
+    Level levels[LEVEL_COUNT];
+};
+
+// One pixel column of a chart: the extremes of the samples in its time range, and the first
+// and last of them for the lines to the neighbouring columns
+struct ChartColumn {
+    bool empty = true;
+    double minimum = 0.0;
+    double maximum = 0.0;
+    double first = 0.0;
+    double last = 0.0;
+};
+
+// Min/max decimation: columns[i] gets the samples in [start + i * duration, start + (i + 1) * duration)
+void DecimateColumns(const MinMaxSeries& series, int64_t start, int64_t duration, size_t count, ChartColumn* columns);
+
+#ifdef _WIN32
+
+// Live strip chart of the voltage (upper lane) and current (lower lane) ending at the present.
+// The plot is drawn into a bitmap: when time moves on, the bitmap is scrolled by whole columns and only
+// the columns that are new or got samples are drawn again, and WM_PAINT copies just the invalid region.
+// The mouse wheel zooms from one second to a day, older samples are dropped. Used on the UI thread.
+class StripChart {
+public:
+    static const int DEFAULT_SPAN_SECONDS = 60;
+
+    StripChart();
+    ~StripChart();
+
+    StripChart(const StripChart&) = delete;
+    StripChart& operator=(const StripChart&) = delete;
+
+    bool Create(HWND parent, int x, int y, int width, int height, int id);
+
+    // Adding the samples drained in one tick, then bringing the chart up to date with Update
+    void Add(const Sample& sample);
+    void Update();
+    void Clear();
+
+private:
+    enum { LANE_COUNT = 2 };
+
+    static LRESULT CALLBACK windowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+
+    int64_t now() const;
+    int64_t columnDuration() const;
+    void extendScale(int lane, double value);
+    void drawColumns(int64_t firstColumn, int64_t lastColumn, int64_t leftmost);
+    void drawLabels();
+    void paint();
+    void zoom(int steps);
+
+    HWND hwnd = NULL;
+    HDC backDc = NULL;
+    HBITMAP backBitmap = NULL;
+    HGDIOBJ previousBitmap = NULL;
+    HPEN pens[LANE_COUNT];
+    RECT plot = {};  // Client area right of the labels
+    int width = 0;
+    int height = 0;
+
+    std::chrono::steady_clock::time_point origin;
+    MinMaxSeries series[LANE_COUNT];
+    double lower[LANE_COUNT];
+    double upper[LANE_COUNT];
+    int64_t span;                  // Visible time, nanoseconds
+    int64_t drawnColumn = -1;      // Newest column in the bitmap, counted from the origin; -1: nothing drawn
+    int64_t changedFrom = -1;      // Oldest sample time added since the last Update; -1: none
+    bool redrawAll = true;
+    std::vector<ChartColumn> columns;
+};
+
+#endif
+
+#endif // STRIP_CHART_H
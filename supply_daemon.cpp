@@ -0,0 +1,108 @@
+/*****************************************************************************************************************
+ * Headless server of power supplies (supply_server.h): owns the ports and shares them with local clients,
+ * e.g. test executives, data loggers and the operators' tools at the same time.
+ *
+ * supply_daemon [--listen <TCP port | socket path>] [--baud <rate>] [--trace] [--simulate <count>] <port>...
+ *
+ * --listen    TCP port on 127.0.0.1 (default 5025) or, on Linux, the path of a Unix domain socket
+ * --baud      Baud rate of the ports (default 9600, as the panel)
+ * --trace     Echoing every message written to the supplies to the console
+ * --simulate  Serving simulated supplies on pseudo-terminals as well (Linux)
+ *
+ * Runs until Ctrl+C; the number of serial requests against client queries is printed on exit.
+ ***************************************************************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "serial.h"
+#include "simulator.h"
+#include "supply_server.h"
+#include "trace_sink.h"
+
+static std::atomic<bool> stopRequested{false};
+
+static void requestStop(int) {
+    stopRequested = true;
+}
+
+int main(int argc, char* argv[]) {
+    std::string address = DEFAULT_LISTEN_ADDRESS;
+    SerialSettings settings;
+    bool trace = false;
+    int simulated = 0;
+    std::vector<std::string> portNames;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            address = argv[++i];
+        } else if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc) {
+            settings.baudRate = std::strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = true;
+        } else if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc) {
+            simulated = std::atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--listen <TCP port | socket path>] [--baud <rate>] [--trace] [--simulate <count>] <port>...\n",
+                    argv[0]);
+            return 2;
+        } else {
+            portNames.push_back(argv[i]);
+        }
+    }
+
+    SupplyServer server;
+#ifndef _WIN32
+    std::vector<std::unique_ptr<PowerSupplySimulator>> simulators;
+    for (int i = 0; i < simulated; i++) {
+        simulators.emplace_back(new PowerSupplySimulator());
+        portNames.push_back(simulators.back()->StartPty());
+    }
+#else
+    if (simulated > 0) {
+        fprintf(stderr, "Simulated supplies are only available on Linux\n");
+    }
+#endif
+    if (portNames.empty()) {
+        fprintf(stderr, "No ports to serve\n");
+        return 2;
+    }
+
+    for (const std::string& name : portNames) {
+        std::unique_ptr<Transport> transport = OpenSerialTransport(name.c_str());
+        if (!transport || !transport->Configure(settings)) {
+            fprintf(stderr, "Failed to open %s\n", name.c_str());
+            return 1;
+        }
+        server.AddPort(name, std::move(transport));
+    }
+
+    if (trace) {
+        commandTrace.Start(stdout);
+    }
+    if (!server.Start(address)) {
+        fprintf(stderr, "Cannot listen on %s\n", address.c_str());
+        return 1;
+    }
+    printf("Serving %zu port(s) on %s\n", portNames.size(), address.c_str());
+    fflush(stdout);
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    while (!stopRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    server.Stop();
+    commandTrace.Stop();
+    printf("%llu serial requests for %llu client queries\n", static_cast<unsigned long long>(server.LinkRequests()),
+           static_cast<unsigned long long>(server.ClientQueries()));
+    return 0;
+}
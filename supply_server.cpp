@@ -0,0 +1,675 @@
+#include "supply_server.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "numeric.h"
+#include "scpi.h"
+#include "scpi_batch.h"
+#include "scpi_commands.h"
+#include "trace_sink.h"
+
+// After a query times out the port is left alone for a while, so the late answer is not
+// taken for the answer to the next query
+const int LINK_SETTLE_MS = 100;
+
+// Retry interval for output a client's socket has not taken
+const int CLIENT_FLUSH_MS = 10;
+
+// Socket helpers; sockets are kept as NativeHandle, as the event loop watches them
+
+#ifdef _WIN32
+
+static SOCKET toSocket(NativeHandle handle) {
+    return static_cast<SOCKET>(reinterpret_cast<uintptr_t>(handle));
+}
+
+static NativeHandle fromSocket(SOCKET socket) {
+    return reinterpret_cast<NativeHandle>(static_cast<uintptr_t>(socket));
+}
+
+static void closeSocket(NativeHandle handle) {
+    closesocket(toSocket(handle));
+}
+
+// Bytes taken by the socket, 0 if it is full, -1 on error
+static long sendSome(NativeHandle handle, const char* data, size_t length) {
+    int sent = ::send(toSocket(handle), data, static_cast<int>(std::min<size_t>(length, 1 << 30)), 0);
+    if (sent == SOCKET_ERROR) {
+        return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+    }
+    return sent;
+}
+
+#else
+
+static void closeSocket(NativeHandle handle) {
+    close(handle);
+}
+
+static long sendSome(NativeHandle handle, const char* data, size_t length) {
+    for (;;) {
+        ssize_t sent = ::send(handle, data, length, MSG_NOSIGNAL);
+        if (sent >= 0) {
+            return static_cast<long>(sent);
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+}
+
+#endif
+
+// Queries that change nothing on the supply, so one answer can serve every client that asked
+static bool isSharedQuery(const ScpiModel& model, const std::string& message) {
+    if (message.find(';') != std::string::npos) {
+        return false;
+    }
+    size_t start = message.find_first_not_of(" \t:");
+    size_t end = message.find_last_not_of(" \t");
+    if (start == std::string::npos) {
+        return false;
+    }
+    const ScpiCommandSpec* spec = FindScpiCommand(model, message.substr(start, end + 1 - start));
+    return spec != nullptr && (spec->id == SCPI_MEASURE_VOLTAGE || spec->id == SCPI_MEASURE_CURRENT ||
+                               spec->id == SCPI_IDENTIFY || spec->id == SCPI_STATUS_BYTE);
+}
+
+// The next blank-separated word of a request line
+static bool nextWord(const std::string& line, size_t& position, std::string& word) {
+    size_t start = line.find_first_not_of(' ', position);
+    if (start == std::string::npos) {
+        return false;
+    }
+    size_t end = line.find(' ', start);
+    if (end == std::string::npos) {
+        end = line.size();
+    }
+    word.assign(line, start, end - start);
+    position = end;
+    return true;
+}
+
+static bool parseIndex(const std::string& word, size_t limit, size_t& index) {
+    char* end = nullptr;
+    unsigned long value = std::strtoul(word.c_str(), &end, 10);
+    if (word.empty() || *end != '\0' || value >= limit) {
+        return false;
+    }
+    index = value;
+    return true;
+}
+
+SupplyServer::SupplyServer() {}
+
+SupplyServer::~SupplyServer() {
+    Stop();
+}
+
+size_t SupplyServer::AddPort(const std::string& name, std::unique_ptr<Transport> transport, const ScpiModel& model) {
+    std::unique_ptr<Port> port(new Port());
+    port->index = ports.size();
+    port->name = name;
+    port->transport = std::move(transport);
+    port->model = &model;
+    port->state.SetModel(model);
+    ports.push_back(std::move(port));
+    return ports.size() - 1;
+}
+
+uint64_t SupplyServer::LinkRequests() const {
+    return linkRequests;
+}
+
+uint64_t SupplyServer::ClientQueries() const {
+    return clientQueries;
+}
+
+bool SupplyServer::Start(const std::string& address) {
+    Stop();
+
+#ifdef _WIN32
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        return false;
+    }
+    SOCKET socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    local.sin_port = htons(static_cast<u_short>(std::atoi(address.c_str())));
+    if (socket == INVALID_SOCKET || bind(socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+        listen(socket, SOMAXCONN) != 0) {
+        if (socket != INVALID_SOCKET) {
+            closesocket(socket);
+        }
+        WSACleanup();
+        return false;
+    }
+    listener = fromSocket(socket);
+#else
+    int socket = -1;
+    bool isUnixSocket = !address.empty() && address[0] == '/';
+    if (isUnixSocket) {
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(local.sun_path)) {
+            return false;
+        }
+        address.copy(local.sun_path, address.size());
+        unlink(address.c_str());  // Left behind by a server that did not stop cleanly
+        socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (socket >= 0 && bind(socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == 0) {
+            unixPath = address;
+        }
+    } else {
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        local.sin_port = htons(static_cast<uint16_t>(std::atoi(address.c_str())));
+        socket = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        if (socket >= 0) {
+            setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (bind(socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+                close(socket);
+                socket = -1;
+            }
+        }
+    }
+    if (socket < 0 || (isUnixSocket && unixPath.empty()) || listen(socket, SOMAXCONN) != 0) {
+        if (socket >= 0) {
+            close(socket);
+        }
+        return false;
+    }
+    listener = socket;
+#endif
+
+    started = std::chrono::steady_clock::now();
+    worker = std::thread([this] {
+        for (auto& entry : ports) {
+            Port& port = *entry;
+            port.reader.Clear();
+            port.online = loop.Watch(port.transport->Handle(),
+                [this, &port](const char* data, size_t length) {
+                    port.reader.Feed(data, length, [this, &port](const std::string& line) { onAnswer(port, line); });
+                },
+                [this, &port] { onPortError(port); });
+        }
+        loop.Run();
+
+        for (auto& entry : ports) {
+            onPortError(*entry);
+        }
+        while (!clients.empty()) {
+            removeClient(clients.begin()->first);
+        }
+    });
+    acceptor = std::thread(&SupplyServer::acceptLoop, this);
+    return true;
+}
+
+void SupplyServer::Stop() {
+    bool listening = acceptor.joinable();
+    // The acceptor is stopped first, a client it hands over later would never be served
+    if (listening) {
+#ifdef _WIN32
+        closeSocket(listener);
+#else
+        shutdown(listener, SHUT_RDWR);
+#endif
+        acceptor.join();
+#ifndef _WIN32
+        closeSocket(listener);
+#endif
+        listener = INVALID_NATIVE_HANDLE;
+    }
+    if (worker.joinable()) {
+        loop.Stop();
+        worker.join();
+    }
+    if (!unixPath.empty()) {
+#ifndef _WIN32
+        unlink(unixPath.c_str());
+#endif
+        unixPath.clear();
+    }
+#ifdef _WIN32
+    if (listening) {
+        WSACleanup();
+    }
+#endif
+}
+
+// Accepting thread: connections are handed to the loop, which does all the rest
+void SupplyServer::acceptLoop() {
+    for (;;) {
+#ifdef _WIN32
+        SOCKET socket = accept(toSocket(listener), NULL, NULL);
+        if (socket == INVALID_SOCKET) {
+            return;  // The listener was closed
+        }
+        u_long nonBlocking = 1;
+        ioctlsocket(socket, FIONBIO, &nonBlocking);
+        BOOL noDelay = TRUE;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+        NativeHandle handle = fromSocket(socket);
+#else
+        int handle = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (handle < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;  // The listener was shut down
+        }
+        if (unixPath.empty()) {
+            int noDelay = 1;
+            setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+#endif
+        loop.Post([this, handle] { addClient(handle); });
+    }
+}
+
+void SupplyServer::addClient(NativeHandle handle) {
+    uint64_t id = nextClientId++;
+    std::unique_ptr<Client> client(new Client());
+    client->id = id;
+    client->handle = handle;
+    Client& entry = *client;
+    clients[id] = std::move(client);
+
+    bool watched = loop.WatchSocket(handle,
+        [this, &entry](const char* data, size_t length) {
+            entry.reader.Feed(data, length, [this, &entry](const std::string& line) { onRequest(entry, line); });
+        },
+        [this, id] { removeClient(id); });
+    if (!watched) {
+        removeClient(id);
+    }
+}
+
+void SupplyServer::removeClient(uint64_t id) {
+    auto it = clients.find(id);
+    if (it == clients.end()) {
+        return;
+    }
+    loop.Unwatch(it->second->handle);
+    loop.CancelTimer(it->second->flushTimer);
+    closeSocket(it->second->handle);
+    clients.erase(it);
+
+    for (auto& entry : ports) {
+        Port& port = *entry;
+        if (port.subscribers.erase(id) != 0) {
+            schedulePoll(port);
+        }
+        auto queue = port.waiting.find(id);
+        if (queue == port.waiting.end()) {
+            continue;
+        }
+        // Shared queries other clients have joined stay, in the queue of the next one of them
+        std::deque<std::shared_ptr<LinkRequest>> requests;
+        requests.swap(queue->second);
+        port.waiting.erase(queue);
+        for (auto& request : requests) {
+            request->waiters.erase(std::remove_if(request->waiters.begin(), request->waiters.end(),
+                                                  [id](const Waiter& waiter) { return waiter.client == id; }),
+                                   request->waiters.end());
+            if (!request->waiters.empty()) {
+                port.waiting[request->waiters.front().client].push_back(request);
+            } else {
+                forgetShared(port, request);
+            }
+        }
+    }
+}
+
+void SupplyServer::onRequest(Client& client, const std::string& line) {
+    size_t position = 0;
+    std::string verb;
+    if (!nextWord(line, position, verb)) {
+        return;  // Empty lines are ignored
+    }
+
+    std::string id;
+    std::string word;
+    size_t index = 0;
+    if (verb == "Q" || verb == "C") {
+        if (!nextWord(line, position, id) || !nextWord(line, position, word) || !parseIndex(word, ports.size(), index)) {
+            send(client.id, "E bad request: " + line);
+            return;
+        }
+        size_t start = line.find_first_not_of(' ', position);
+        std::string message = start == std::string::npos ? std::string() : line.substr(start);
+        bool query = verb == "Q";
+        // The answers are matched by their order, so whether one comes must be known
+        if (message.empty() || query != (message.find('?') != std::string::npos)) {
+            send(client.id, "R " + id + " ERROR " + (query ? "not a query" : "a command must not query"));
+            return;
+        }
+        submit(*ports[index], client.id, id, message, query);
+    } else if (verb == "S") {
+        std::string period;
+        if (!nextWord(line, position, word) || !parseIndex(word, ports.size(), index) || !nextWord(line, position, period)) {
+            send(client.id, "E bad request: " + line);
+            return;
+        }
+        subscribe(*ports[index], client.id, std::atoi(period.c_str()));
+    } else if (verb == "L") {
+        for (const auto& port : ports) {
+            send(client.id, "L " + std::to_string(port->index) + " " + port->name + (port->online ? " ON" : " OFF"));
+        }
+        send(client.id, "L END");
+    } else {
+        send(client.id, "E unknown request: " + line);
+    }
+}
+
+// Output to a client: what its socket does not take now is kept and sent later, a client that
+// stops reading is disconnected rather than held in memory
+void SupplyServer::send(uint64_t id, const std::string& line) {
+    auto it = clients.find(id);
+    if (it == clients.end()) {
+        return;
+    }
+    Client& client = *it->second;
+    if (!client.backlog.empty()) {
+        client.backlog += line;
+        client.backlog += '\n';
+        if (client.backlog.size() > MAX_CLIENT_BACKLOG) {
+            // Not removed right here, the caller may be going through the clients
+            loop.Post([this, id] { removeClient(id); });
+        }
+        return;
+    }
+
+    client.backlog = line;
+    client.backlog += '\n';
+    flushBacklog(client);
+}
+
+void SupplyServer::flushBacklog(Client& client) {
+    client.flushTimer = 0;
+    long sent = sendSome(client.handle, client.backlog.data(), client.backlog.size());
+    if (sent < 0) {
+        uint64_t id = client.id;
+        loop.Post([this, id] { removeClient(id); });
+        return;
+    }
+    client.backlog.erase(0, static_cast<size_t>(sent));
+    if (!client.backlog.empty()) {
+        client.flushTimer = loop.AddTimer(std::chrono::steady_clock::now() + std::chrono::milliseconds(CLIENT_FLUSH_MS),
+                                          [this, &client] { flushBacklog(client); });
+    }
+}
+
+void SupplyServer::submit(Port& port, uint64_t client, const std::string& id, const std::string& message, bool query) {
+    if (query) {
+        clientQueries++;
+    }
+    if (!port.online) {
+        send(client, "R " + id + " ERROR port offline");
+        return;
+    }
+    if (!query && !port.state.ShouldSend(message)) {
+        send(client, "R " + id + " OK");  // The supply already has that setting
+        return;
+    }
+
+    bool shared = query && isSharedQuery(*port.model, message);
+    if (shared) {
+        auto existing = port.sharedRequests.find(message);
+        if (existing != port.sharedRequests.end()) {
+            existing->second->waiters.push_back(Waiter{client, id});
+            return;
+        }
+    }
+
+    auto request = std::make_shared<LinkRequest>();
+    request->message = message;
+    request->query = query;
+    request->shared = shared;
+    request->waiters.push_back(Waiter{client, id});
+    port.waiting[client].push_back(request);
+    if (shared) {
+        port.sharedRequests[message] = request;
+    }
+    pump(port);
+}
+
+void SupplyServer::subscribe(Port& port, uint64_t client, int periodMs) {
+    if (periodMs <= 0) {
+        port.subscribers.erase(client);
+    } else {
+        Subscription& subscription = port.subscribers[client];
+        subscription.period = std::chrono::milliseconds(std::max(periodMs, MIN_SUBSCRIPTION_PERIOD_MS));
+        subscription.nextDue = std::chrono::steady_clock::now();
+    }
+    schedulePoll(port);
+}
+
+// One poll for all subscribers of the port, as often as the most demanding of them asks
+void SupplyServer::schedulePoll(Port& port) {
+    loop.CancelTimer(port.pollTimer);
+    port.pollTimer = 0;
+    if (port.subscribers.empty() || !port.online || port.pollQueued) {
+        return;
+    }
+
+    auto period = std::chrono::milliseconds::max();
+    for (const auto& subscriber : port.subscribers) {
+        period = std::min(period, subscriber.second.period);
+    }
+    port.pollPeriod = period;
+    auto now = std::chrono::steady_clock::now();
+    if (port.nextPoll > now + period) {
+        port.nextPoll = now + period;  // A faster subscriber has joined
+    }
+    if (port.nextPoll > now) {
+        port.pollTimer = loop.AddTimer(port.nextPoll, [this, &port] {
+            port.pollTimer = 0;
+            schedulePoll(port);
+        });
+        return;
+    }
+
+    auto request = std::make_shared<LinkRequest>();
+    AppendToProgramMessage(request->message, port.model->commands[SCPI_MEASURE_VOLTAGE].shortForm);
+    AppendToProgramMessage(request->message, port.model->commands[SCPI_MEASURE_CURRENT].shortForm);
+    request->poll = true;
+    port.waiting[0].push_back(request);
+    port.pollQueued = true;
+    port.nextPoll = now + period;
+    pump(port);
+}
+
+// Writing the waiting requests while the pipeline has room
+void SupplyServer::pump(Port& port) {
+    if (!port.online || std::chrono::steady_clock::now() < port.settleUntil) {
+        return;
+    }
+    std::shared_ptr<LinkRequest> request;
+    while (port.inFlight.size() < SERVER_PIPELINE_DEPTH && takeNext(port, request)) {
+        static const char terminator = '\n';
+        const OutputSegment segments[] = {{request->message.data(), request->message.size()}, {&terminator, 1}};
+        commandTrace.WriteLine(request->message.data(), request->message.size());
+        request->sent = std::chrono::steady_clock::now();
+        if (!port.transport->WriteMessage(segments, 2)) {
+            port.waiting[0].push_front(request);  // Failed together with the rest
+            onPortError(port);
+            return;
+        }
+        linkRequests++;
+
+        if (request->query) {
+            port.inFlight.push_back(request);  // Still joinable until it is answered
+            if (port.inFlight.size() == 1) {
+                armTimeout(port);
+            }
+        } else {
+            answer(*request, "OK");
+        }
+    }
+}
+
+// The clients take turns, each getting one request written per round
+bool SupplyServer::takeNext(Port& port, std::shared_ptr<LinkRequest>& request) {
+    if (port.waiting.empty()) {
+        return false;
+    }
+    auto it = port.waiting.upper_bound(port.lastServed);
+    if (it == port.waiting.end()) {
+        it = port.waiting.begin();
+    }
+    request = std::move(it->second.front());
+    it->second.pop_front();
+    port.lastServed = it->first;
+    if (it->second.empty()) {
+        port.waiting.erase(it);
+    }
+    return true;
+}
+
+void SupplyServer::armTimeout(Port& port) {
+    loop.CancelTimer(port.timeoutTimer);
+    port.timeoutTimer = 0;
+    if (port.inFlight.empty()) {
+        return;
+    }
+    auto deadline = port.inFlight.front()->sent + std::chrono::milliseconds(RESPONSE_TIMEOUT_MS);
+    port.timeoutTimer = loop.AddTimer(deadline, [this, &port] {
+        port.timeoutTimer = 0;
+        onTimeout(port);
+    });
+}
+
+void SupplyServer::onAnswer(Port& port, const std::string& line) {
+    if (port.inFlight.empty()) {
+        return;  // Late answer to a query that has timed out
+    }
+    std::shared_ptr<LinkRequest> request = std::move(port.inFlight.front());
+    port.inFlight.pop_front();
+    forgetShared(port, request);
+    armTimeout(port);
+
+    if (request->poll) {
+        port.pollQueued = false;
+        deliverSample(port, *request, line);
+        schedulePoll(port);
+    } else {
+        answer(*request, "OK " + line);
+    }
+    pump(port);
+}
+
+// The answers cannot be matched any more: the queries in flight fail and the port is given time to settle
+void SupplyServer::onTimeout(Port& port) {
+    std::deque<std::shared_ptr<LinkRequest>> failed;
+    failed.swap(port.inFlight);
+    for (auto& request : failed) {
+        forgetShared(port, request);
+        if (request->poll) {
+            port.pollQueued = false;
+        } else {
+            answer(*request, "TIMEOUT");
+        }
+    }
+
+    port.settleUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(LINK_SETTLE_MS);
+    port.timeoutTimer = loop.AddTimer(port.settleUntil, [this, &port] {
+        port.timeoutTimer = 0;
+        port.reader.Clear();
+        schedulePoll(port);
+        pump(port);
+    });
+}
+
+// The port stays offline for good: it is not reopened, and its clients get "port offline" until the
+// server is restarted
+void SupplyServer::onPortError(Port& port) {
+    if (port.online) {
+        loop.Unwatch(port.transport->Handle());
+    }
+    loop.CancelTimer(port.timeoutTimer);
+    loop.CancelTimer(port.pollTimer);
+    port.timeoutTimer = 0;
+    port.pollTimer = 0;
+    port.online = false;
+    port.pollQueued = false;
+    port.state.Invalidate();
+
+    std::deque<std::shared_ptr<LinkRequest>> failed;
+    failed.swap(port.inFlight);
+    for (auto& queue : port.waiting) {
+        failed.insert(failed.end(), queue.second.begin(), queue.second.end());
+    }
+    port.waiting.clear();
+    port.sharedRequests.clear();
+    for (auto& request : failed) {
+        answer(*request, "ERROR port failed");
+    }
+}
+
+void SupplyServer::forgetShared(Port& port, const std::shared_ptr<LinkRequest>& request) {
+    if (!request->shared) {
+        return;
+    }
+    auto shared = port.sharedRequests.find(request->message);
+    if (shared != port.sharedRequests.end() && shared->second == request) {
+        port.sharedRequests.erase(shared);
+    }
+}
+
+void SupplyServer::answer(const LinkRequest& request, const std::string& status) {
+    for (const Waiter& waiter : request.waiters) {
+        send(waiter.client, "R " + waiter.id + " " + status);
+    }
+}
+
+// The measurement goes to the subscribers whose period has passed, as the supply sent it
+void SupplyServer::deliverSample(Port& port, const LinkRequest& request, const std::string& response) {
+    SplitResponseMessage(response, responseParts);
+    double value;
+    if (responseParts.size() != 2 || !ParseScpiNumber(responseParts[0], value) ||
+        !ParseScpiNumber(responseParts[1], value)) {
+        return;
+    }
+
+    char time[NUMBER_BUFFER_SIZE];
+    size_t length = FormatNumber(std::chrono::duration<double, std::milli>(request.sent - started).count(),
+                                 time, sizeof(time), 3);
+    std::string line = "M " + std::to_string(port.index) + " " + std::string(time, length) + " " +
+                       responseParts[0] + " " + responseParts[1];
+
+    // Polls come at the fastest subscriber's period, give or take half of it
+    auto now = std::chrono::steady_clock::now();
+    for (auto& subscriber : port.subscribers) {
+        Subscription& subscription = subscriber.second;
+        if (subscription.nextDue > now + port.pollPeriod / 2) {
+            continue;
+        }
+        send(subscriber.first, line);
+        subscription.nextDue += subscription.period;
+        if (subscription.nextDue < now) {
+            subscription.nextDue = now;  // Not catching up on missed samples
+        }
+    }
+}
@@ -0,0 +1,160 @@
+#ifndef SUPPLY_SERVER_H
+#define SUPPLY_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "device_state.h"
+#include "event_loop.h"
+#include "line_reader.h"
+#include "transport.h"
+
+// Address the server listens on unless told otherwise: a TCP port on 127.0.0.1
+// (5025 is the usual port of SCPI over raw sockets), or on Linux a Unix domain socket path
+const char* const DEFAULT_LISTEN_ADDRESS = "5025";
+
+// Requests of one port that may be written before the first of them is answered
+const size_t SERVER_PIPELINE_DEPTH = 4;
+
+// Fastest measurement rate a subscriber can ask for
+const int MIN_SUBSCRIPTION_PERIOD_MS = 1;
+
+// Output a client may fall behind by before it is disconnected
+const size_t MAX_CLIENT_BACKLOG = 1 << 20;
+
+// Server that owns the ports of the supplies and shares them between any number of local
+// clients. The protocol is line based, one request per line; <port> is the index of a port.
+//
+//   Q <id> <port> <query>      Query; answered R <id> OK <response>, R <id> TIMEOUT or R <id> ERROR <reason>
+//   C <id> <port> <command>    Command; answered R <id> OK once it is written (or found redundant)
+//   S <port> <period ms>       Subscribing to voltage and current, delivered as
+//                              M <port> <ms since the server started> <voltage> <current>; period 0 ends it
+//   L                          Listing the ports: L <port> <name> ON|OFF for each, then L END
+//
+// Requests of a client are pipelined: it can send many before reading the answers, which carry its
+// <id> (any text without blanks). The clients' requests for a port are written in round-robin order.
+// Identical measurement and identification queries for the same port, waiting or in flight, are sent
+// once and the answer goes to every client that asked, and all subscriptions of a port share one poll,
+// so ten clients asking for MEAS:VOLT? cost one query on the serial line. A port that fails is offline
+// until the server is restarted; it is not reopened.
+class SupplyServer {
+public:
+    SupplyServer();
+    ~SupplyServer();
+
+    SupplyServer(const SupplyServer&) = delete;
+    SupplyServer& operator=(const SupplyServer&) = delete;
+
+    // Adding a supply; only before Start. The model's command table gives the poll queries, the
+    // queries that are shared and the settings of its state.
+    size_t AddPort(const std::string& name, std::unique_ptr<Transport> transport, const ScpiModel& model = GENERIC_SUPPLY);
+
+    // Listening and serving on a background thread; false if the address cannot be used
+    bool Start(const std::string& address = DEFAULT_LISTEN_ADDRESS);
+    void Stop();
+
+    // Serial queries and commands written, and client queries answered by them
+    uint64_t LinkRequests() const;
+    uint64_t ClientQueries() const;
+
+private:
+    struct Client;
+    struct Port;
+
+    // Request written to a port: one waiter per client (and id) that gets the answer
+    struct Waiter {
+        uint64_t client;
+        std::string id;
+    };
+    struct LinkRequest {
+        std::string message;
+        bool query = true;
+        bool shared = false;  // Other clients asking the same may join
+        bool poll = false;    // The subscriptions' measurement poll
+        std::vector<Waiter> waiters;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    struct Subscription {
+        std::chrono::milliseconds period;
+        std::chrono::steady_clock::time_point nextDue;
+    };
+
+    struct Port {
+        size_t index;
+        std::string name;
+        std::unique_ptr<Transport> transport;
+        const ScpiModel* model = &GENERIC_SUPPLY;
+        LineReader reader;
+        DeviceStateCache state;
+        bool online = false;
+
+        // Requests waiting per client (client 0: the subscriptions' poll), served round-robin
+        std::map<uint64_t, std::deque<std::shared_ptr<LinkRequest>>> waiting;
+        // Shared queries by message, from their submit until they are answered or fail: a client
+        // asking the same while one is written or in flight joins it instead of querying again
+        std::map<std::string, std::shared_ptr<LinkRequest>> sharedRequests;
+        uint64_t lastServed = 0;
+        std::deque<std::shared_ptr<LinkRequest>> inFlight;  // Queries in the order of their answers
+        EventLoop::TimerId timeoutTimer = 0;
+        std::chrono::steady_clock::time_point settleUntil;  // Quiet time after a timeout
+
+        std::map<uint64_t, Subscription> subscribers;
+        std::chrono::milliseconds pollPeriod{0};
+        EventLoop::TimerId pollTimer = 0;
+        bool pollQueued = false;
+        std::chrono::steady_clock::time_point nextPoll;
+    };
+
+    struct Client {
+        uint64_t id;
+        NativeHandle handle;
+        LineReader reader;
+        std::string backlog;  // Output the socket has not taken yet
+        EventLoop::TimerId flushTimer = 0;
+    };
+
+    void acceptLoop();
+    void addClient(NativeHandle handle);
+    void removeClient(uint64_t id);
+    void onRequest(Client& client, const std::string& line);
+    void send(uint64_t client, const std::string& line);
+    void flushBacklog(Client& client);
+
+    void submit(Port& port, uint64_t client, const std::string& id, const std::string& message, bool query);
+    void subscribe(Port& port, uint64_t client, int periodMs);
+    void schedulePoll(Port& port);
+    void pump(Port& port);
+    bool takeNext(Port& port, std::shared_ptr<LinkRequest>& request);
+    void armTimeout(Port& port);
+    void onAnswer(Port& port, const std::string& line);
+    void onTimeout(Port& port);
+    void onPortError(Port& port);
+    void forgetShared(Port& port, const std::shared_ptr<LinkRequest>& request);
+    void answer(const LinkRequest& request, const std::string& status);
+    void deliverSample(Port& port, const LinkRequest& request, const std::string& response);
+
+    EventLoop loop;
+    std::thread worker;
+    std::thread acceptor;
+    NativeHandle listener = INVALID_NATIVE_HANDLE;
+    std::string unixPath;  // Removed again by Stop
+
+    std::vector<std::unique_ptr<Port>> ports;
+    std::map<uint64_t, std::unique_ptr<Client>> clients;
+    uint64_t nextClientId = 1;
+    std::chrono::steady_clock::time_point started;
+    std::vector<std::string> responseParts;
+
+    std::atomic<uint64_t> linkRequests{0};
+    std::atomic<uint64_t> clientQueries{0};
+};
+
+#endif // SUPPLY_SERVER_H
@@ -0,0 +1,284 @@
+/*****************************************************************************************************************
+ * Tests of the communication core against the simulated power supply on a loopback transport (no port needed).
+ *
+ * Usage: tests [name...]   Running every test, or the named ones (engine, batch, resync, block)
+ *
+ * engine: samples and posted commands of the acquisition engine, and the errors it drains from the supply.
+ * batch: joining and splitting program messages, a batch split at the message length limit, and a message
+ * whose response is missing or short failing every query in it.
+ * resync: a query that timed out, whose late answer must not be taken for the next one, also in a batch.
+ * block: the block decoder fed byte by byte, malformed and oversized headers, and array fetches from the
+ * simulator, including one too long for its buffer after which the link is still in step.
+ *
+ * Exits with 1 if a check failed, so a build script can run it after the build.
+ ***************************************************************************************************************/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "acquisition.h"
+#include "scpi.h"
+#include "scpi_batch.h"
+#include "scpi_block.h"
+#include "simulator.h"
+#include "transport.h"
+
+static int failures = 0;
+
+// Like assert, but also checked in optimized builds, and the tests go on after a failure
+#define CHECK(condition)                                                                 \
+    do {                                                                                 \
+        if (!(condition)) {                                                              \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                                  \
+        }                                                                                \
+    } while (0)
+
+static bool near(double value, double expected) {
+    return std::fabs(value - expected) < 0.01;
+}
+
+static bool isIdentity(const std::string& response) {
+    return response.compare(0, 9, "SIMULATED") == 0;
+}
+
+// Taking the engine's samples until one satisfies the condition, for at most two seconds
+template <typename Condition>
+static bool waitForSample(AcquisitionEngine& engine, Condition condition) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (std::chrono::steady_clock::now() < deadline) {
+        Sample sample;
+        while (engine.PopSample(sample)) {
+            if (condition(sample)) {
+                return true;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+static void testEngine() {
+    PowerSupplySimulator simulator;
+    std::unique_ptr<Transport> transport = simulator.StartLoopback();
+    CHECK(sendCommand(*transport, "VOLT 5;:OUTP ON"));
+
+    Transport& link = *transport;
+    AcquisitionEngine engine(
+        [&link](const std::string& message, std::string& response) {
+            return SendSCPICommandAndGetResponse(link, message, response) == QUERY_ANSWERED;
+        },
+        [&link](const std::string& command) { return sendCommand(link, command); });
+    engine.Start(std::chrono::milliseconds(10));
+    CHECK(engine.IsRunning());
+
+    CHECK(waitForSample(engine, [](const Sample& sample) {
+        return sample.valid && sample.hasVoltage && sample.hasCurrent && near(sample.voltage, 5.0);
+    }));
+
+    // A posted command goes out between polls
+    CHECK(engine.PostCommand("VOLT 7"));
+    CHECK(waitForSample(engine, [](const Sample& sample) { return sample.valid && near(sample.voltage, 7.0); }));
+    CHECK(near(simulator.OutputVoltage(), 7.0));
+
+    // The status byte reports the error of an unknown command, and the engine reads it from the queue
+    CHECK(engine.PostCommand("SYST:BOGUS 1"));
+    DeviceError error;
+    bool reported = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!reported && std::chrono::steady_clock::now() < deadline) {
+        reported = engine.PopError(error);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    CHECK(reported && error.kind == DeviceError::SCPI_ERROR && error.code == -113);
+
+    engine.Stop();
+    CHECK(!engine.IsRunning());
+    CHECK(engine.Report().statusByte >= 0);
+}
+
+// Answering each query of a message with its number, counted over all messages
+struct NumberingSupply {
+    std::vector<std::string> messages;
+    int answers = 0;
+
+    bool Query(const std::string& message, std::string& response) {
+        messages.push_back(message);
+        response.clear();
+        for (char c : message) {
+            if (c == '?') {
+                if (!response.empty()) {
+                    response += ';';
+                }
+                response += std::to_string(answers++);
+            }
+        }
+        return true;
+    }
+};
+
+static void testBatch() {
+    std::string message;
+    AppendToProgramMessage(message, "MEAS:VOLT?");
+    AppendToProgramMessage(message, "MEAS:CURR?");
+    AppendToProgramMessage(message, "*STB?");
+    CHECK(message == "MEAS:VOLT?;:MEAS:CURR?;*STB?");
+
+    std::vector<std::string> parts;
+    SplitResponseMessage("1.5;\"a;b\";+3\r\n", parts);
+    CHECK(parts.size() == 3 && parts[0] == "1.5" && parts[1] == "\"a;b\"" && parts[2] == "+3");
+    SplitResponseMessage("7", parts);
+    CHECK(parts.size() == 1 && parts[0] == "7");
+
+    // Longer than the limit: sent as several messages, each answer still goes to its own query
+    const size_t limit = 40;
+    NumberingSupply supply;
+    ScpiBatch batch([](const std::string&) { return true; },
+                    [&supply](const std::string& message, std::string& response) { return supply.Query(message, response); },
+                    limit);
+    std::vector<std::string> results(8);
+    for (size_t i = 0; i < results.size(); i++) {
+        batch.Query("MEAS:VOLT?", [&results, i](bool ok, const std::string& response) {
+            results[i] = ok ? response : "failed";
+        });
+    }
+    CHECK(batch.Pending() == results.size());
+    CHECK(batch.Flush());
+    CHECK(batch.Pending() == 0);
+    CHECK(supply.messages.size() > 1);
+    for (const std::string& sent : supply.messages) {
+        CHECK(sent.size() <= limit);
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        CHECK(results[i] == std::to_string(i));
+    }
+
+    // A short response, or none at all whatever the string holds, fails every query of the message
+    for (bool answered : {true, false}) {
+        ScpiBatch failing([](const std::string&) { return true; },
+                          [answered](const std::string&, std::string& response) {
+                              response = answered ? "1" : "1;2";
+                              return answered;
+                          });
+        int failed = 0;
+        failing.Query("MEAS:VOLT?", [&failed](bool ok, const std::string&) { failed += ok ? 0 : 1; });
+        failing.Query("MEAS:CURR?", [&failed](bool ok, const std::string&) { failed += ok ? 0 : 1; });
+        CHECK(!failing.Flush());
+        CHECK(failed == 2);
+    }
+}
+
+static void testResync() {
+    PowerSupplySimulator simulator;
+    std::unique_ptr<Transport> transport = simulator.StartLoopback();
+    CHECK(sendCommand(*transport, "VOLT 5;:OUTP ON"));
+
+    // The whole message times out: both queries fail, the answer comes later
+    Transport& link = *transport;
+    ScpiBatch batch([&link](const std::string& command) { return sendCommand(link, command); },
+                    [&link](const std::string& message, std::string& response) {
+                        return SendSCPICommandAndGetResponse(link, message, response) == QUERY_ANSWERED;
+                    });
+    simulator.SetResponseLatency(RESPONSE_TIMEOUT_MS + 300);
+    int failed = 0;
+    batch.Query("MEAS:VOLT?", [&failed](bool ok, const std::string&) { failed += ok ? 0 : 1; });
+    batch.Query("MEAS:CURR?", [&failed](bool ok, const std::string&) { failed += ok ? 0 : 1; });
+    CHECK(!batch.Flush());
+    CHECK(failed == 2);
+    CHECK(transport->LateAnswerPending());
+
+    // The late "5;0.5" is read and dropped before the next query, not taken for its answer
+    simulator.SetResponseLatency(0);
+    std::string response;
+    CHECK(SendSCPICommandAndGetResponse(*transport, "*IDN?", response) == QUERY_ANSWERED);
+    CHECK(isIdentity(response));
+    CHECK(!transport->LateAnswerPending());
+
+    double voltage = 0.0;
+    CHECK(SendSCPICommandAndGetResponse(*transport, "MEAS:VOLT?", response) == QUERY_ANSWERED);
+    CHECK(ParseMeasurement(response, voltage) && near(voltage, 5.0));
+}
+
+static void testBlock() {
+    // Fed one byte at a time, as from a slow line
+    const char block[] = "#15hello\r\n";
+    char payload[16];
+    BlockDecoder decoder;
+    decoder.Reset(payload, sizeof(payload));
+    for (size_t i = 0; i + 1 < sizeof(block); i++) {
+        CHECK(decoder.Feed(block + i, 1) == 1);
+    }
+    CHECK(decoder.GetState() == BlockDecoder::COMPLETE);
+    CHECK(decoder.Length() == 5 && std::memcmp(decoder.Payload(), "hello", 5) == 0);
+
+    // The indefinite form, a missing '#' and a block longer than the destination
+    for (const char* malformed : {"#0\n", "15hello\n", "#220abcdefghijklmnopqrst\n"}) {
+        decoder.Reset(payload, sizeof(payload));
+        decoder.Feed(malformed, std::strlen(malformed));
+        CHECK(decoder.GetState() == BlockDecoder::MALFORMED);
+    }
+
+    // A reused buffer is not grown past its limit
+    BlockBuffer buffer;
+    decoder.Reset(buffer, 8);
+    decoder.Feed("#216", 4);
+    CHECK(decoder.GetState() == BlockDecoder::MALFORMED);
+
+    PowerSupplySimulator simulator;
+    std::unique_ptr<Transport> transport = simulator.StartLoopback();
+    CHECK(sendCommand(*transport, "VOLT 5;:OUTP ON;:SENS:SWE:POIN 100"));
+    CHECK(sendCommand(*transport, "FORM REAL,32"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));  // The sweep covers the output since it was on
+
+    decoder.Reset(buffer);
+    CHECK(QueryBlock(*transport, "FETC:ARR:VOLT?", decoder));
+    CHECK(decoder.Length() == 400);
+    float values[100];
+    CHECK(DecodeFloatBlock(decoder.Payload(), decoder.Length(), BLOCK_BIG_ENDIAN, values) == 100);
+    CHECK(near(values[0], 5.0) && near(values[99], 5.0));
+
+    // Too long for the destination: the rest of the block is skipped and the next answer is the right one
+    decoder.Reset(payload, sizeof(payload));
+    CHECK(!QueryBlock(*transport, "FETC:ARR:VOLT?", decoder));
+    CHECK(isIdentity(query(*transport, "*IDN?")));
+}
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+
+static const Test TESTS[] = {
+    {"engine", testEngine},
+    {"batch", testBatch},
+    {"resync", testResync},
+    {"block", testBlock},
+};
+
+int main(int argc, char* argv[]) {
+    int run = 0;
+    for (const Test& test : TESTS) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            selected = selected || std::strcmp(argv[i], test.name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        int before = failures;
+        test.run();
+        printf("%-8s %s\n", test.name, failures == before ? "ok" : "FAILED");
+        run++;
+    }
+    if (run == 0) {
+        fprintf(stderr, "Usage: %s [engine] [batch] [resync] [block]\n", argv[0]);
+        return 2;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include "timeseries.h"
+
+#include <limits>
+
+TimeSeriesStore measurementHistory;
+
+std::vector<TimeSeriesStore::Tier> TimeSeriesStore::DefaultTiers() {
+    using namespace std::chrono;
+    return {
+        {milliseconds(10), 6000},
+        {seconds(1), 3600},
+        {minutes(1), 1440},
+        {hours(1), 720},
+    };
+}
+
+TimeSeriesStore::TimeSeriesStore(size_t rawCapacity, const std::vector<Tier>& tierOptions)
+    : rawCapacity(rawCapacity > 0 ? rawCapacity : 1),
+      rawTimestamps(new std::chrono::steady_clock::time_point[this->rawCapacity]) {
+    for (auto& values : rawValues) {
+        values.reset(new double[this->rawCapacity]);
+    }
+    for (const Tier& option : tierOptions) {
+        TierBuckets tier;
+        tier.bucketDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(option.bucketDuration).count();
+        tier.bucketCount = option.bucketCount;
+        if (tier.bucketDuration <= 0 || tier.bucketCount == 0) {
+            continue;
+        }
+        tier.bucketIndex.reset(new int64_t[tier.bucketCount]);
+        for (auto& statistics : tier.statistics) {
+            statistics.reset(new RunningStatistics[tier.bucketCount]);
+        }
+        tiers.push_back(std::move(tier));
+    }
+    Clear();
+}
+
+void TimeSeriesStore::Clear() {
+    rawAdded = 0;
+    for (auto& statistics : session) {
+        statistics.Clear();
+    }
+    for (TierBuckets& tier : tiers) {
+        for (size_t i = 0; i < tier.bucketCount; i++) {
+            tier.bucketIndex[i] = -1;
+        }
+    }
+}
+
+void TimeSeriesStore::Add(const Sample& sample) {
+    if (!sample.valid) {
+        return;
+    }
+    const double values[CHANNEL_COUNT] = {sample.voltage, sample.current};
+    const bool present[CHANNEL_COUNT] = {sample.hasVoltage, sample.hasCurrent};
+
+    size_t slot = static_cast<size_t>(rawAdded % rawCapacity);
+    rawTimestamps[slot] = sample.timestamp;
+    for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+        // A quantity that was not polled for this sample is stored as NaN and left out of the statistics
+        rawValues[channel][slot] = present[channel] ? values[channel] : std::numeric_limits<double>::quiet_NaN();
+        if (present[channel]) {
+            session[channel].Add(values[channel]);
+        }
+    }
+    rawAdded++;
+
+    int64_t ticks = sample.timestamp.time_since_epoch().count();
+    for (TierBuckets& tier : tiers) {
+        int64_t bucket = ticks / tier.bucketDuration;
+        size_t bucketSlot = static_cast<size_t>(bucket % static_cast<int64_t>(tier.bucketCount));
+        if (tier.bucketIndex[bucketSlot] != bucket) {
+            // The slot held a bucket that has fallen out of the tier's span
+            tier.bucketIndex[bucketSlot] = bucket;
+            for (auto& statistics : tier.statistics) {
+                statistics[bucketSlot].Clear();
+            }
+        }
+        for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+            if (present[channel]) {
+                tier.statistics[channel][bucketSlot].Add(values[channel]);
+            }
+        }
+    }
+}
+
+const RunningStatistics& TimeSeriesStore::Session(Channel channel) const {
+    return session[channel];
+}
+
+RunningStatistics TimeSeriesStore::Window(Channel channel, std::chrono::nanoseconds window,
+                                          std::chrono::steady_clock::time_point now) const {
+    RunningStatistics result;
+    if (tiers.empty() || window.count() <= 0) {
+        return result;
+    }
+    int64_t windowTicks = std::chrono::duration_cast<std::chrono::steady_clock::duration>(window).count();
+
+    // The finest tier that spans the window with a bounded number of buckets
+    const TierBuckets* tier = &tiers.back();
+    for (const TierBuckets& candidate : tiers) {
+        int64_t buckets = (windowTicks + candidate.bucketDuration - 1) / candidate.bucketDuration;
+        if (static_cast<size_t>(buckets) <= candidate.bucketCount && static_cast<size_t>(buckets) <= MAX_QUERY_BUCKETS) {
+            tier = &candidate;
+            break;
+        }
+    }
+
+    int64_t lastBucket = now.time_since_epoch().count() / tier->bucketDuration;
+    int64_t buckets = (windowTicks + tier->bucketDuration - 1) / tier->bucketDuration;
+    if (buckets > static_cast<int64_t>(tier->bucketCount)) {
+        buckets = static_cast<int64_t>(tier->bucketCount);
+    }
+    for (int64_t bucket = lastBucket - buckets + 1; bucket <= lastBucket; bucket++) {
+        size_t slot = static_cast<size_t>(bucket % static_cast<int64_t>(tier->bucketCount));
+        if (bucket >= 0 && tier->bucketIndex[slot] == bucket) {
+            result.Merge(tier->statistics[channel][slot]);
+        }
+    }
+    return result;
+}
+
+size_t TimeSeriesStore::RawSize() const {
+    return rawAdded < rawCapacity ? static_cast<size_t>(rawAdded) : rawCapacity;
+}
+
+size_t TimeSeriesStore::rawSlot(size_t index) const {
+    uint64_t oldest = rawAdded - RawSize();
+    return static_cast<size_t>((oldest + index) % rawCapacity);
+}
+
+std::chrono::steady_clock::time_point TimeSeriesStore::RawTimestamp(size_t index) const {
+    return rawTimestamps[rawSlot(index)];
+}
+
+double TimeSeriesStore::RawValue(Channel channel, size_t index) const {
+    return rawValues[channel][rawSlot(index)];
+}
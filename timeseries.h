@@ -0,0 +1,75 @@
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "acquisition.h"
+#include "statistics.h"
+
+// Time-series store of the measured voltage and current.
+// The latest raw samples are kept in a fixed-capacity ring in structure-of-arrays layout; every
+// sample is also added to the statistics of the whole session and of fixed-duration buckets in a
+// few downsampled tiers (10 ms, 1 s, 1 min, 1 h by default). Memory use does not grow with the
+// length of the session, and window queries merge bucket statistics instead of rescanning samples.
+// Not thread-safe: it is filled and queried on the UI thread.
+class TimeSeriesStore {
+public:
+    enum Channel { VOLTAGE, CURRENT, CHANNEL_COUNT };
+
+    struct Tier {
+        std::chrono::nanoseconds bucketDuration;
+        size_t bucketCount;
+    };
+
+    static const size_t DEFAULT_RAW_CAPACITY = 65536;
+    // A window query merges at most this many buckets, it uses a coarser tier otherwise
+    static const size_t MAX_QUERY_BUCKETS = 600;
+
+    // 10 ms buckets for 1 min, 1 s for 1 h, 1 min for 1 day, 1 h for 30 days
+    static std::vector<Tier> DefaultTiers();
+
+    explicit TimeSeriesStore(size_t rawCapacity = DEFAULT_RAW_CAPACITY, const std::vector<Tier>& tiers = DefaultTiers());
+
+    // Invalid samples are ignored
+    void Add(const Sample& sample);
+    void Clear();
+
+    const RunningStatistics& Session(Channel channel) const;
+
+    // Statistics of the samples taken in the last window before now, to the resolution of the
+    // buckets of the tier used; windows longer than the coarsest tier are cut to its span
+    RunningStatistics Window(Channel channel, std::chrono::nanoseconds window,
+                             std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const;
+
+    // Raw samples still in the ring, index 0 is the oldest; NaN for a quantity the sample does not have
+    size_t RawSize() const;
+    std::chrono::steady_clock::time_point RawTimestamp(size_t index) const;
+    double RawValue(Channel channel, size_t index) const;
+
+private:
+    struct TierBuckets {
+        int64_t bucketDuration;  // In clock ticks
+        size_t bucketCount;
+        std::unique_ptr<int64_t[]> bucketIndex;  // Bucket number stored in each slot, -1 if none
+        std::unique_ptr<RunningStatistics[]> statistics[CHANNEL_COUNT];
+    };
+
+    size_t rawSlot(size_t index) const;
+
+    size_t rawCapacity;
+    uint64_t rawAdded = 0;
+    std::unique_ptr<std::chrono::steady_clock::time_point[]> rawTimestamps;
+    std::unique_ptr<double[]> rawValues[CHANNEL_COUNT];
+
+    std::vector<TierBuckets> tiers;
+    RunningStatistics session[CHANNEL_COUNT];
+};
+
+// History of the connected power supply's measurements, filled from the acquisition samples
+extern TimeSeriesStore measurementHistory;
+
+#endif // TIMESERIES_H
@@ -0,0 +1,102 @@
+#include "trace_sink.h"
+
+#include <algorithm>
+#include <cstring>
+
+TraceSink commandTrace;
+
+TraceSink::~TraceSink() {
+    Stop();
+}
+
+void TraceSink::Start(FILE* file, size_t capacity) {
+    Stop();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->file = file;
+        this->capacity = std::max<size_t>(capacity, 1);
+        ring.reset(new char[this->capacity]);
+        head = tail = 0;
+        stopping = false;
+    }
+    writer = std::thread(&TraceSink::writerLoop, this);
+    enabled = true;
+}
+
+void TraceSink::Stop() {
+    enabled = false;
+    if (!writer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    std::fflush(file);
+}
+
+bool TraceSink::IsEnabled() const {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t TraceSink::DroppedBytes() const {
+    return droppedBytes;
+}
+
+void TraceSink::Write(const char* data, size_t length) {
+    write(data, length, false);
+}
+
+void TraceSink::WriteLine(const char* data, size_t length) {
+    write(data, length, true);
+}
+
+void TraceSink::write(const char* data, size_t length, bool terminate) {
+    if (!IsEnabled()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = length + (terminate ? 1 : 0);
+        if (ring == nullptr || capacity - (tail - head) < total) {
+            droppedBytes += total;
+            return;
+        }
+        while (length > 0) {
+            size_t offset = tail % capacity;
+            size_t count = std::min(length, capacity - offset);
+            std::memcpy(ring.get() + offset, data, count);
+            tail += count;
+            data += count;
+            length -= count;
+        }
+        if (terminate) {
+            ring[tail % capacity] = '\n';
+            tail++;
+        }
+    }
+    wake.notify_one();
+}
+
+void TraceSink::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return stopping || head != tail; });
+        if (head == tail) {
+            return;  // Stopping with nothing left to write
+        }
+
+        // The writers only fill [tail, head + capacity), so the buffered part is written unlocked
+        size_t offset = head % capacity;
+        size_t count = std::min(tail - head, capacity - offset);
+        lock.unlock();
+        std::fwrite(ring.get() + offset, 1, count, file);
+        lock.lock();
+        head += count;
+        if (head == tail) {
+            std::fflush(file);
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef TRACE_SINK_H
+#define TRACE_SINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Asynchronous echo of the I/O (formerly printed to the console by sendCommand). Writers only
+// copy the text into a ring buffer; a background thread writes it to the file, so a slow console
+// never delays a command. Disabled until Start, then a disabled check is the only cost.
+class TraceSink {
+public:
+    static const size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    ~TraceSink();
+
+    // Echoing to an open file (e.g. stdout); the file is not closed by the sink
+    void Start(FILE* file, size_t capacity = DEFAULT_CAPACITY);
+    // Writing what is still buffered and stopping the background thread
+    void Stop();
+    bool IsEnabled() const;
+
+    // Called from any thread; text that does not fit into the ring is dropped and counted
+    void Write(const char* data, size_t length);
+    // The text and a line terminator, kept together
+    void WriteLine(const char* data, size_t length);
+    uint64_t DroppedBytes() const;
+
+private:
+    void write(const char* data, size_t length, bool terminate);
+    void writerLoop();
+
+    FILE* file = nullptr;
+    std::unique_ptr<char[]> ring;
+    size_t capacity = 0;
+    size_t head = 0;  // Monotonic read position
+    size_t tail = 0;  // Monotonic write position
+
+    std::atomic<bool> enabled{false};
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread writer;
+    std::atomic<uint64_t> droppedBytes{0};
+};
+
+// Echo of the commands sent by sendCommand and query
+extern TraceSink commandTrace;
+
+#endif // TRACE_SINK_H
@@ -0,0 +1,155 @@
+/*****************************************************************************************************************
+ * Reader and player of traffic traces recorded by RecordingTransport (traffic_trace.h), e.g. with the panel's
+ * "Record traffic" box. Needs no instrument, so field captures can be examined and replayed on Linux.
+ *
+ * trace_tool dump <trace>                          Every record: time, direction, length and the bytes
+ * trace_tool replay [--fast] [--print] <trace>     Replaying the recorded messages through the SCPI stack
+ *
+ * replay writes each recorded message with the same functions the panel uses (queries through
+ * SendSCPICommandAndGetResponse, commands through sendCommand) to a ReplayTransport that answers with the
+ * recorded responses, at their original timing or with --fast as soon as possible, and parses every field of
+ * the responses as a number. --print lists the responses, so a replay can be compared with an expected output.
+ * The exit code is 1 if the replay diverged from the trace.
+ ***************************************************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "numeric.h"
+#include "scpi.h"
+#include "traffic_trace.h"
+
+static void printBytes(const std::string& bytes, size_t offset, size_t length) {
+    for (size_t i = offset; i < offset + length; i++) {
+        unsigned char c = static_cast<unsigned char>(bytes[i]);
+        if (c == '\n') {
+            printf("\\n");
+        } else if (c == '\r') {
+            printf("\\r");
+        } else if (c < 0x20 || c >= 0x7F || c == '\\') {
+            printf("\\x%02X", c);
+        } else {
+            putchar(c);
+        }
+    }
+}
+
+static int dump(const TrafficTrace& trace) {
+    for (const TrafficRecord& record : trace.records) {
+        printf("%12.6f %s %5zu ", record.time / 1e9, record.direction == TRAFFIC_SENT ? ">" : "<", record.length);
+        printBytes(trace.bytes, record.offset, record.length);
+        putchar('\n');
+    }
+    return 0;
+}
+
+static int replay(std::shared_ptr<const TrafficTrace> trace, ReplayTiming timing, bool print) {
+    ReplayTransport transport(trace, timing);
+
+    // The messages the client wrote, one per line, in the order they were sent
+    std::string sent;
+    for (const TrafficRecord& record : trace->records) {
+        if (record.direction == TRAFFIC_SENT) {
+            sent.append(trace->bytes, record.offset, record.length);
+        }
+    }
+
+    size_t queries = 0, commands = 0, answered = 0, numbers = 0, texts = 0, responseBytes = 0;
+    std::string response;
+    auto start = std::chrono::steady_clock::now();
+    size_t begin = 0;
+    while (begin < sent.size()) {
+        size_t end = sent.find('\n', begin);
+        if (end == std::string::npos) {
+            end = sent.size();
+        }
+        std::string message = sent.substr(begin, end - begin);
+        begin = end + 1;
+        if (message.empty()) {
+            continue;
+        }
+
+        if (message.find('?') == std::string::npos) {
+            commands++;
+            try {
+                sendCommand(transport, message);
+            } catch (const std::runtime_error&) {
+                break;  // The end of the trace
+            }
+            continue;
+        }
+
+        queries++;
+        QueryStatus status = SendSCPICommandAndGetResponse(transport, message, response);
+        if (print) {
+            printf("%s -> %s\n", message.c_str(), response.c_str());
+        }
+        if (status != QUERY_ANSWERED) {
+            continue;
+        }
+        answered++;
+        responseBytes += response.size() + 1;
+
+        // A batched message is answered with its responses separated by ';'
+        size_t field = 0;
+        while (field <= response.size()) {
+            size_t separator = response.find(';', field);
+            if (separator == std::string::npos) {
+                separator = response.size();
+            }
+            double value;
+            if (ParseScpiNumber(response.data() + field, response.data() + separator, value)) {
+                numbers++;
+            } else {
+                texts++;
+            }
+            field = separator + 1;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double recorded = trace->records.empty() ? 0.0 : trace->records.back().time / 1e9;
+
+    printf("%zu queries (%zu answered), %zu commands\n", queries, answered, commands);
+    printf("%zu numeric and %zu other response fields\n", numbers, texts);
+    printf("%.3f s replayed (%.3f s recorded): %.0f messages/s, %.2f MB/s of responses\n", elapsed.count(), recorded,
+           (queries + commands) / elapsed.count(), responseBytes / elapsed.count() / 1e6);
+    bool diverged = transport.Mismatches() != 0 || !transport.Finished();
+    printf("%llu mismatched bytes, %s\n", static_cast<unsigned long long>(transport.Mismatches()),
+           transport.Finished() ? "trace finished" : "trace not finished");
+    return diverged ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    bool fast = false;
+    bool print = false;
+    const char* command = argc > 1 ? argv[1] : "";
+    const char* path = nullptr;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--fast") == 0) {
+            fast = true;
+        } else if (strcmp(argv[i], "--print") == 0) {
+            print = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == nullptr || (strcmp(command, "dump") != 0 && strcmp(command, "replay") != 0)) {
+        fprintf(stderr, "Usage: %s dump <trace>\n       %s replay [--fast] [--print] <trace>\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    auto trace = std::make_shared<TrafficTrace>();
+    std::string error;
+    if (!trace->Load(path, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+    if (strcmp(command, "dump") == 0) {
+        return dump(*trace);
+    }
+    return replay(trace, fast ? REPLAY_FAST : REPLAY_ORIGINAL, print);
+}
@@ -0,0 +1,312 @@
+#include "traffic_trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+static const size_t NO_RECORD = static_cast<size_t>(-1);
+
+// Unsigned LEB128: 7 bits per byte, the high bit set on all but the last
+static size_t encodeVarint(uint64_t value, unsigned char* out) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = static_cast<unsigned char>(value);
+    return length;
+}
+
+static bool decodeVarint(const std::string& data, size_t& position, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && position < data.size(); shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(data[position++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TrafficTrace::Load(const std::string& path, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    std::ostringstream content;
+    content << file.rdbuf();
+    std::string data = content.str();
+
+    TrafficHeader header;
+    if (data.size() < sizeof(header)) {
+        error = path + " is not a traffic trace";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, TRAFFIC_MAGIC, sizeof(TRAFFIC_MAGIC)) != 0 || header.version != TRAFFIC_VERSION) {
+        error = path + " is not a traffic trace of this version";
+        return false;
+    }
+
+    startSystemTime = header.startSystemTime;
+    records.clear();
+    bytes.clear();
+    int64_t time = 0;
+    size_t position = sizeof(header);
+    while (position < data.size()) {
+        uint64_t kind, delta;
+        if (!decodeVarint(data, position, kind) || !decodeVarint(data, position, delta)) {
+            break;
+        }
+        uint64_t length = kind >> 1;
+        if (length > data.size() - position) {
+            break;
+        }
+        time += static_cast<int64_t>(delta);
+        records.push_back({(kind & 1) != 0 ? TRAFFIC_RECEIVED : TRAFFIC_SENT, time, bytes.size(), static_cast<size_t>(length)});
+        bytes.append(data, position, static_cast<size_t>(length));
+        position += static_cast<size_t>(length);
+    }
+    return true;
+}
+
+RecordingTransport::RecordingTransport(std::unique_ptr<Transport> inner) : inner(std::move(inner)) {
+}
+
+RecordingTransport::~RecordingTransport() {
+    Stop();
+}
+
+bool RecordingTransport::Start(const std::string& path) {
+    Stop();
+    FILE* opened = fopen(path.c_str(), "wb");
+    if (opened == nullptr) {
+        return false;
+    }
+    // The records are small; they reach the disk in large writes
+    setvbuf(opened, nullptr, _IOFBF, 64 * 1024);
+
+    TrafficHeader header = {};
+    memcpy(header.magic, TRAFFIC_MAGIC, sizeof(TRAFFIC_MAGIC));
+    header.version = TRAFFIC_VERSION;
+    header.startSystemTime =
+        std::chrono::duration_cast<nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    fwrite(&header, sizeof(header), 1, opened);
+
+    std::lock_guard<std::mutex> lock(fileMutex);
+    file = opened;
+    previous = steady_clock::now();
+    recordedBytes = sizeof(header);
+    recording = true;
+    return true;
+}
+
+void RecordingTransport::Stop() {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    recording = false;
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool RecordingTransport::IsRecording() const {
+    return recording;
+}
+
+uint64_t RecordingTransport::RecordedBytes() const {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    return recordedBytes;
+}
+
+// Records are written in the order of their times, which the lock keeps when the engine reads
+// while the sequencer writes
+void RecordingTransport::record(TrafficDirection direction, steady_clock::time_point time, const OutputSegment* segments,
+                                size_t count) {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (file == nullptr) {
+        return;
+    }
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        length += segments[i].length;
+    }
+    time = std::max(time, previous);
+
+    unsigned char prefix[20];
+    size_t prefixLength = encodeVarint((static_cast<uint64_t>(length) << 1) | (direction == TRAFFIC_RECEIVED ? 1 : 0), prefix);
+    prefixLength += encodeVarint(static_cast<uint64_t>(std::chrono::duration_cast<nanoseconds>(time - previous).count()),
+                                 prefix + prefixLength);
+    previous = time;
+
+    fwrite(prefix, 1, prefixLength, file);
+    for (size_t i = 0; i < count; i++) {
+        fwrite(segments[i].data, 1, segments[i].length, file);
+    }
+    recordedBytes += prefixLength + length;
+}
+
+bool RecordingTransport::IsOpen() const {
+    return inner->IsOpen();
+}
+
+void RecordingTransport::Close() {
+    inner->Close();
+}
+
+bool RecordingTransport::Configure(const SerialSettings& settings) {
+    return inner->Configure(settings);
+}
+
+bool RecordingTransport::Write(const char* data, size_t length) {
+    const OutputSegment segment = {data, length};
+    return WriteGather(&segment, 1);
+}
+
+bool RecordingTransport::WriteGather(const OutputSegment* segments, size_t count) {
+    steady_clock::time_point time = steady_clock::now();
+    bool written = inner->WriteGather(segments, count);
+    if (written && recording) {
+        record(TRAFFIC_SENT, time, segments, count);
+    }
+    return written;
+}
+
+long RecordingTransport::Read(char* buffer, size_t size, int timeoutMs) {
+    long count = inner->Read(buffer, size, timeoutMs);
+    if (count > 0 && recording) {
+        const OutputSegment segment = {buffer, static_cast<size_t>(count)};
+        record(TRAFFIC_RECEIVED, steady_clock::now(), &segment, 1);
+    }
+    return count;
+}
+
+ReplayTransport::ReplayTransport(std::shared_ptr<const TrafficTrace> trace, ReplayTiming timing)
+    : trace(std::move(trace)), timing(timing), started(steady_clock::now()) {
+    const std::vector<TrafficRecord>& records = this->trace->records;
+    previousSent.resize(records.size());
+    size_t lastSent = NO_RECORD;
+    for (size_t i = 0; i < records.size(); i++) {
+        previousSent[i] = lastSent;
+        if (records[i].direction == TRAFFIC_SENT) {
+            lastSent = i;
+        }
+    }
+    writtenAt.resize(records.size());
+    sentCursor = nextOf(TRAFFIC_SENT, 0);
+    receivedCursor = nextOf(TRAFFIC_RECEIVED, 0);
+}
+
+ReplayTransport::~ReplayTransport() {
+    Close();
+}
+
+size_t ReplayTransport::nextOf(TrafficDirection direction, size_t from) const {
+    const std::vector<TrafficRecord>& records = trace->records;
+    while (from < records.size() && records[from].direction != direction) {
+        from++;
+    }
+    return from;
+}
+
+bool ReplayTransport::IsOpen() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return open;
+}
+
+void ReplayTransport::Close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        open = false;
+    }
+    progress.notify_all();
+}
+
+bool ReplayTransport::Configure(const SerialSettings&) {
+    return IsOpen();
+}
+
+bool ReplayTransport::Write(const char* data, size_t length) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!open) {
+            return false;
+        }
+        const std::vector<TrafficRecord>& records = trace->records;
+        for (size_t i = 0; i < length; i++) {
+            if (sentCursor == records.size()) {
+                mismatches += length - i;
+                break;
+            }
+            const TrafficRecord& record = records[sentCursor];
+            if (trace->bytes[record.offset + sentPosition] != data[i]) {
+                mismatches++;
+            }
+            if (++sentPosition == record.length) {
+                writtenAt[sentCursor] = steady_clock::now();
+                sentCursor = nextOf(TRAFFIC_SENT, sentCursor + 1);
+                sentPosition = 0;
+            }
+        }
+    }
+    progress.notify_all();
+    return true;
+}
+
+long ReplayTransport::Read(char* buffer, size_t size, int timeoutMs) {
+    steady_clock::time_point deadline = steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::unique_lock<std::mutex> lock(mutex);
+    const std::vector<TrafficRecord>& records = trace->records;
+
+    // The response is due once the client has written what came before it in the trace
+    if (!progress.wait_until(lock, deadline, [&] { return !open || receivedCursor == records.size() || sentCursor > receivedCursor; })) {
+        return 0;
+    }
+    if (!open || receivedCursor == records.size()) {
+        return -1;
+    }
+
+    const TrafficRecord& record = records[receivedCursor];
+    if (timing == REPLAY_ORIGINAL) {
+        size_t request = previousSent[receivedCursor];
+        steady_clock::time_point due = request == NO_RECORD ? started + nanoseconds(record.time)
+                                                            : writtenAt[request] + nanoseconds(record.time - records[request].time);
+        if (due > deadline) {
+            lock.unlock();
+            std::this_thread::sleep_until(deadline);
+            return 0;
+        }
+        if (due > steady_clock::now()) {
+            // Only this reader moves the received cursor, so the record stays the same
+            lock.unlock();
+            std::this_thread::sleep_until(due);
+            lock.lock();
+        }
+    }
+
+    size_t count = std::min(size, record.length - receivedPosition);
+    memcpy(buffer, trace->bytes.data() + record.offset + receivedPosition, count);
+    receivedPosition += count;
+    if (receivedPosition == record.length) {
+        receivedCursor = nextOf(TRAFFIC_RECEIVED, receivedCursor + 1);
+        receivedPosition = 0;
+    }
+    return static_cast<long>(count);
+}
+
+bool ReplayTransport::Finished() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sentCursor == trace->records.size() && receivedCursor == trace->records.size();
+}
+
+uint64_t ReplayTransport::Mismatches() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return mismatches;
+}
@@ -0,0 +1,131 @@
+#ifndef TRAFFIC_TRACE_H
+#define TRAFFIC_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "transport.h"
+
+// Traffic trace file: a 32-byte header followed by one record per write to the instrument and per
+// read from it. A record is two LEB128 varints, (length << 1 | direction) and the nanoseconds since
+// the previous record, then the bytes, so a poll of a few dozen bytes costs two or three more.
+
+const char TRAFFIC_MAGIC[8] = {'P', 'S', 'U', 'T', 'R', 'A', 'C', '1'};
+const uint32_t TRAFFIC_VERSION = 1;
+
+struct TrafficHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved0;
+    int64_t startSystemTime;  // Nanoseconds since the Unix epoch when the recording started
+    uint8_t reserved[8];
+};
+
+static_assert(sizeof(TrafficHeader) == 32, "The traffic header is part of the file format");
+
+enum TrafficDirection { TRAFFIC_SENT, TRAFFIC_RECEIVED };
+
+struct TrafficRecord {
+    TrafficDirection direction;
+    int64_t time;  // Nanoseconds since the recording started
+    size_t offset; // Of the bytes in TrafficTrace::bytes
+    size_t length;
+};
+
+// A trace read back into memory
+struct TrafficTrace {
+    int64_t startSystemTime = 0;
+    std::vector<TrafficRecord> records;
+    std::string bytes;  // Bytes of all records, back to back
+
+    // A trace cut short by a crash is read up to its last complete record
+    bool Load(const std::string& path, std::string& error);
+};
+
+// Recording tap: passes everything through to the transport it wraps and, while recording,
+// writes every byte sent and received with its time to a trace file. Recording can be started
+// and stopped while the transport is in use. Meant for the blocking I/O of the panel: the event
+// loop reads the OS handle itself, so the tap reports none.
+class RecordingTransport : public Transport {
+public:
+    explicit RecordingTransport(std::unique_ptr<Transport> inner);
+    ~RecordingTransport() override;
+
+    // Recording into a new file; false if it cannot be created
+    bool Start(const std::string& path);
+    void Stop();
+    bool IsRecording() const;
+    uint64_t RecordedBytes() const;  // Of the file, headers included
+
+    bool IsOpen() const override;
+    void Close() override;
+    bool Configure(const SerialSettings& settings) override;
+    bool Write(const char* data, size_t length) override;
+    bool WriteGather(const OutputSegment* segments, size_t count) override;
+    long Read(char* buffer, size_t size, int timeoutMs) override;
+
+private:
+    void record(TrafficDirection direction, std::chrono::steady_clock::time_point time, const OutputSegment* segments,
+                size_t count);
+
+    std::unique_ptr<Transport> inner;
+
+    std::atomic<bool> recording{false};
+    mutable std::mutex fileMutex;
+    FILE* file = nullptr;
+    std::chrono::steady_clock::time_point previous;  // Time of the last record
+    uint64_t recordedBytes = 0;
+};
+
+enum ReplayTiming {
+    REPLAY_ORIGINAL,  // Each response comes as long after the client's request as it did in the trace
+    REPLAY_FAST       // Each response as soon as the client has written the request before it
+};
+
+// Replay backend: plays the instrument's side of a trace. The recorded responses are read in the
+// pieces they arrived in, each once the client has written everything that was written before it
+// in the trace. The client's bytes are compared with the recorded ones and differences counted,
+// so a run that diverges from the trace shows up. The end of the trace reads as a closed port.
+class ReplayTransport : public Transport {
+public:
+    ReplayTransport(std::shared_ptr<const TrafficTrace> trace, ReplayTiming timing);
+    ~ReplayTransport() override;
+
+    bool IsOpen() const override;
+    void Close() override;
+    bool Configure(const SerialSettings& settings) override;
+    bool Write(const char* data, size_t length) override;
+    long Read(char* buffer, size_t size, int timeoutMs) override;
+
+    // Every record was written or read
+    bool Finished() const;
+    // Bytes written that differ from the trace or go beyond it
+    uint64_t Mismatches() const;
+
+private:
+    size_t nextOf(TrafficDirection direction, size_t from) const;
+
+    std::shared_ptr<const TrafficTrace> trace;
+    ReplayTiming timing;
+    std::vector<size_t> previousSent;  // Per record: index of the last sent record before it, or SIZE_MAX
+
+    mutable std::mutex mutex;
+    std::condition_variable progress;
+    bool open = true;
+    size_t sentCursor;      // Next sent record to be written, and how much of it is
+    size_t sentPosition = 0;
+    size_t receivedCursor;  // Next received record to be read, and how much of it is
+    size_t receivedPosition = 0;
+    std::chrono::steady_clock::time_point started;
+    std::vector<std::chrono::steady_clock::time_point> writtenAt;  // When each sent record was completed
+    uint64_t mismatches = 0;
+};
+
+#endif // TRAFFIC_TRACE_H
@@ -0,0 +1,150 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#ifdef _WIN32
+const NativeHandle INVALID_NATIVE_HANDLE = reinterpret_cast<void*>(static_cast<intptr_t>(-1));
+#else
+const NativeHandle INVALID_NATIVE_HANDLE = -1;
+#endif
+
+double SerialSettings::BitsPerCharacter() const {
+    double bits = 1.0 + byteSize + (parity == 'N' ? 0.0 : 1.0);
+    switch (stopBits) {
+    case ONE:
+        return bits + 1.0;
+    case ONE_AND_HALF:
+        return bits + 1.5;
+    default:
+        return bits + 2.0;
+    }
+}
+
+NativeHandle Transport::Handle() const {
+    return INVALID_NATIVE_HANDLE;
+}
+
+LineReader::Status Transport::ReadLine(std::string& line, std::chrono::steady_clock::time_point deadline,
+                                       LineTiming* timing) {
+    return lineReader.ReadLine(*this, line, deadline, '\n', timing);
+}
+
+LineReader::Status Transport::ReadBlock(BlockDecoder& block, std::chrono::milliseconds idleTimeout, LineTiming* timing) {
+    return lineReader.ReadBlock(*this, block, idleTimeout, timing);
+}
+
+void Transport::DiscardInput() {
+    lineReader.Clear();
+}
+
+void Transport::SetLateAnswerPending(bool pending) {
+    lateAnswerPending = pending;
+}
+
+bool Transport::LateAnswerPending() const {
+    return lateAnswerPending;
+}
+
+bool Transport::WriteGather(const OutputSegment* segments, size_t count) {
+    if (count == 1) {
+        return Write(segments[0].data, segments[0].length);
+    }
+    // Keeps its capacity, so steady traffic does not allocate
+    static thread_local std::string joined;
+    joined.clear();
+    for (size_t i = 0; i < count; i++) {
+        joined.append(segments[i].data, segments[i].length);
+    }
+    return Write(joined.data(), joined.size());
+}
+
+bool Transport::WriteMessage(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return Write(data, length);
+}
+
+bool Transport::WriteMessage(const OutputSegment* segments, size_t count) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return WriteGather(segments, count);
+}
+
+void LoopbackTransport::CreatePair(std::unique_ptr<LoopbackTransport>& first, std::unique_ptr<LoopbackTransport>& second) {
+    auto forward = std::make_shared<Channel>();
+    auto backward = std::make_shared<Channel>();
+    first.reset(new LoopbackTransport(backward, forward));
+    second.reset(new LoopbackTransport(forward, backward));
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Channel> incoming, std::shared_ptr<Channel> outgoing)
+    : incoming(std::move(incoming)), outgoing(std::move(outgoing)) {
+}
+
+LoopbackTransport::~LoopbackTransport() {
+    Close();
+}
+
+bool LoopbackTransport::IsOpen() const {
+    return open;
+}
+
+// Closing one end makes reads on the other end fail once the buffered bytes are consumed
+void LoopbackTransport::Close() {
+    if (!open) {
+        return;
+    }
+    open = false;
+    for (Channel* channel : {incoming.get(), outgoing.get()}) {
+        {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            channel->closed = true;
+        }
+        channel->dataAvailable.notify_all();
+    }
+}
+
+bool LoopbackTransport::Configure(const SerialSettings& settings) {
+    {
+        std::lock_guard<std::mutex> lock(outgoing->mutex);
+        outgoing->writerBaudRate = settings.baudRate;
+    }
+    {
+        std::lock_guard<std::mutex> lock(incoming->mutex);
+        incoming->readerBaudRate = settings.baudRate;
+    }
+    return open;
+}
+
+bool LoopbackTransport::Write(const char* data, size_t length) {
+    {
+        std::lock_guard<std::mutex> lock(outgoing->mutex);
+        if (!open || outgoing->closed) {
+            return false;
+        }
+        if (outgoing->writerBaudRate != 0 && outgoing->readerBaudRate != 0 &&
+            outgoing->writerBaudRate != outgoing->readerBaudRate) {
+            // Sampled at the wrong rate: framing errors, and no byte reads as a line terminator
+            for (size_t i = 0; i < length; i++) {
+                outgoing->bytes += static_cast<char>(0x80 | (static_cast<unsigned char>(data[i]) * 7));
+            }
+        } else {
+            outgoing->bytes.append(data, length);
+        }
+    }
+    outgoing->dataAvailable.notify_one();
+    return true;
+}
+
+long LoopbackTransport::Read(char* buffer, size_t size, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(incoming->mutex);
+    incoming->dataAvailable.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                     [this] { return !incoming->bytes.empty() || incoming->closed; });
+    if (incoming->bytes.empty()) {
+        return incoming->closed ? -1 : 0;
+    }
+    size_t count = std::min(size, incoming->bytes.size());
+    incoming->bytes.copy(buffer, count);
+    incoming->bytes.erase(0, count);
+    return static_cast<long>(count);
+}
@@ -0,0 +1,122 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "line_reader.h"
+
+// OS handle of a transport, used to register it with the event loop
+#ifdef _WIN32
+typedef void* NativeHandle;  // HANDLE
+#else
+typedef int NativeHandle;    // File descriptor
+#endif
+
+extern const NativeHandle INVALID_NATIVE_HANDLE;
+
+// Serial line settings, independent of the platform
+struct SerialSettings {
+    enum StopBits { ONE, ONE_AND_HALF, TWO };
+
+    unsigned long baudRate = 9600;
+    int byteSize = 8;
+    char parity = 'N';  // 'N'one, 'O'dd, 'E'ven, 'M'ark, 'S'pace
+    StopBits stopBits = ONE;
+
+    // Number of bits on the wire per character (start + data + parity + stop)
+    double BitsPerCharacter() const;
+};
+
+// One piece of an outgoing message
+struct OutputSegment {
+    const char* data;
+    size_t length;
+};
+
+// Byte stream to the instrument. All SCPI I/O is written against this interface.
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    virtual bool IsOpen() const = 0;
+    virtual void Close() = 0;
+    virtual bool Configure(const SerialSettings& settings) = 0;
+
+    // Writing all bytes; returns false on error
+    virtual bool Write(const char* data, size_t length) = 0;
+
+    // Writing the segments in order as one piece of data. The default joins them in a reused
+    // per-thread buffer and makes one Write; backends that can gather (writev) override it.
+    virtual bool WriteGather(const OutputSegment* segments, size_t count);
+
+    // Waiting up to timeoutMs for data and returning as soon as at least one byte is available.
+    // Returns the number of bytes read, 0 on timeout and -1 on error.
+    virtual long Read(char* buffer, size_t size, int timeoutMs) = 0;
+
+    // OS handle for the event loop; INVALID_NATIVE_HANDLE for in-process transports
+    virtual NativeHandle Handle() const;
+
+    // Reading one terminated response line (without the terminator) until the deadline
+    LineReader::Status ReadLine(std::string& line, std::chrono::steady_clock::time_point deadline,
+                                LineTiming* timing = nullptr);
+
+    // Reading one definite-length block response (LineReader::ReadBlock)
+    LineReader::Status ReadBlock(BlockDecoder& block, std::chrono::milliseconds idleTimeout, LineTiming* timing = nullptr);
+
+    // Dropping received bytes that have not been consumed yet, e.g. the rest of a late response
+    void DiscardInput();
+
+    // Set when a query timed out: its answer may still arrive, so the next query resynchronizes first (scpi.cpp)
+    void SetLateAnswerPending(bool pending);
+    bool LateAnswerPending() const;
+
+    // Writing one complete message; messages written from different threads (the acquisition
+    // engine and the sequencer) are never interleaved
+    bool WriteMessage(const char* data, size_t length);
+    bool WriteMessage(const OutputSegment* segments, size_t count);
+
+private:
+    LineReader lineReader;
+    std::mutex writeMutex;
+    std::atomic<bool> lateAnswerPending{false};
+};
+
+// In-process transport: bytes written to one end are read from the other end. Once both ends are
+// configured, it behaves like a serial line in one respect: bytes written at one baud rate and read
+// at another arrive garbled, so a baud rate change can be tried against the simulator.
+class LoopbackTransport : public Transport {
+public:
+    static void CreatePair(std::unique_ptr<LoopbackTransport>& first, std::unique_ptr<LoopbackTransport>& second);
+
+    ~LoopbackTransport() override;
+
+    bool IsOpen() const override;
+    void Close() override;
+    bool Configure(const SerialSettings& settings) override;
+    bool Write(const char* data, size_t length) override;
+    long Read(char* buffer, size_t size, int timeoutMs) override;
+
+private:
+    struct Channel {
+        std::mutex mutex;
+        std::condition_variable dataAvailable;
+        std::string bytes;
+        bool closed = false;
+        unsigned long writerBaudRate = 0;  // 0 until that end is configured
+        unsigned long readerBaudRate = 0;
+    };
+
+    LoopbackTransport(std::shared_ptr<Channel> incoming, std::shared_ptr<Channel> outgoing);
+
+    std::shared_ptr<Channel> incoming;
+    std::shared_ptr<Channel> outgoing;
+    bool open = true;
+};
+
+#endif // TRANSPORT_H
@@ -0,0 +1,398 @@
+#include "trigger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "numeric.h"
+
+// Longest record the file may ask for, before and after the trigger
+const size_t MAX_TRIGGER_SAMPLES = 100000;
+
+static std::string toLower(std::string text) {
+    for (char& c : text) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return text;
+}
+
+static bool parseSlope(const std::string& word, bool level, TriggerSlope& slope) {
+    if (word == (level ? "above" : "rising")) {
+        slope = TRIGGER_RISING;
+    } else if (word == (level ? "below" : "falling")) {
+        slope = TRIGGER_FALLING;
+    } else if (word == "either" && !level) {
+        slope = TRIGGER_EITHER;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parseCount(const std::string& word, size_t& count) {
+    double value;
+    if (!ParseScpiNumber(word, value) || value < 0.0 || value > MAX_TRIGGER_SAMPLES || value != std::floor(value)) {
+        return false;
+    }
+    count = static_cast<size_t>(value);
+    return true;
+}
+
+bool TriggerSettings::Load(const std::string& path, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return Parse(text.str(), error);
+}
+
+bool TriggerSettings::Parse(const std::string& text, std::string& error) {
+    TriggerSettings parsed;
+
+    std::istringstream input(text);
+    std::string line;
+    for (int number = 1; std::getline(input, line); number++) {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::vector<std::string> words;
+        for (std::string word; fields >> word;) {
+            words.push_back(toLower(word));
+        }
+        if (words.empty()) {
+            continue;
+        }
+        auto fail = [&](const std::string& message) {
+            error = "Line " + std::to_string(number) + ": " + message;
+            return false;
+        };
+
+        const std::string& keyword = words[0];
+        if (keyword == "pre" || keyword == "post") {
+            if (words.size() != 2 || !parseCount(words[1], keyword == "pre" ? parsed.preSamples : parsed.postSamples)) {
+                return fail("expected " + keyword + " <samples> (0 to " + std::to_string(MAX_TRIGGER_SAMPLES) + ")");
+            }
+            continue;
+        }
+        if (keyword == "holdoff") {
+            double seconds;
+            if (words.size() != 2 || !ParseScpiNumber(words[1], seconds) || seconds < 0.0 || seconds > 86400.0) {
+                return fail("expected holdoff <seconds>");
+            }
+            parsed.holdoff = std::chrono::milliseconds(static_cast<int64_t>(std::lround(seconds * 1000.0)));
+            continue;
+        }
+        if (keyword == "fast") {
+            if (words.size() != 2 || (words[1] != "on" && words[1] != "off")) {
+                return fail("expected fast <on|off>");
+            }
+            parsed.fastPolling = words[1] == "on";
+            continue;
+        }
+
+        TriggerCondition condition;
+        if (keyword == "voltage") {
+            condition.quantity = POLL_VOLTAGE;
+        } else if (keyword == "current") {
+            condition.quantity = POLL_CURRENT;
+        } else {
+            return fail("unknown item " + words[0]);
+        }
+        if (words.size() < 4) {
+            return fail("expected " + keyword + " <level|edge|window|slew> ...");
+        }
+
+        const std::string& kind = words[1];
+        size_t options = 4;
+        if (kind == "level" || kind == "edge") {
+            condition.kind = kind == "level" ? TRIGGER_LEVEL : TRIGGER_EDGE;
+            if (!parseSlope(words[2], kind == "level", condition.slope) || !ParseScpiNumber(words[3], condition.level)) {
+                return fail(kind == "level" ? "expected level <above|below> <level>" : "expected edge <rising|falling|either> <level>");
+            }
+        } else if (kind == "window") {
+            condition.kind = TRIGGER_WINDOW;
+            if (!ParseScpiNumber(words[2], condition.low) || !ParseScpiNumber(words[3], condition.high) ||
+                condition.low >= condition.high) {
+                return fail("expected window <low> <high>, low below high");
+            }
+        } else if (kind == "slew") {
+            condition.kind = TRIGGER_SLEW;
+            if (!parseSlope(words[2], false, condition.slope) || !ParseScpiNumber(words[3], condition.level) ||
+                condition.level <= 0.0) {
+                return fail("expected slew <rising|falling|either> <units per second>");
+            }
+        } else {
+            return fail("unknown trigger " + words[1] + " (level, edge, window or slew)");
+        }
+
+        for (; options < words.size(); options += 2) {
+            double value;
+            bool known = words[options] == "hysteresis" || words[options] == "near";
+            if (!known || condition.kind == TRIGGER_SLEW || options + 1 >= words.size() ||
+                !ParseScpiNumber(words[options + 1], value) || value < 0.0) {
+                return fail("expected [hysteresis <h>] [near <distance>] after the level");
+            }
+            (words[options] == "near" ? condition.approach : condition.hysteresis) = value;
+        }
+        parsed.conditions.push_back(condition);
+    }
+
+    if (parsed.conditions.empty()) {
+        error = "The file has no trigger conditions";
+        return false;
+    }
+    *this = parsed;
+    return true;
+}
+
+std::string DescribeTrigger(const TriggerCondition& condition) {
+    static const char* const kinds[] = {"level", "edge", "window", "slew"};
+    static const char* const slopes[] = {"rising", "falling", "either"};
+
+    char text[128];
+    const char* quantity = condition.quantity == POLL_VOLTAGE ? "voltage" : "current";
+    if (condition.kind == TRIGGER_WINDOW) {
+        snprintf(text, sizeof(text), "%s window %g %g", quantity, condition.low, condition.high);
+    } else {
+        const char* slope = condition.kind == TRIGGER_LEVEL ? (condition.slope == TRIGGER_RISING ? "above" : "below")
+                                                            : slopes[condition.slope];
+        snprintf(text, sizeof(text), "%s %s %s %g%s", quantity, kinds[condition.kind], slope, condition.level,
+                 condition.kind == TRIGGER_SLEW ? "/s" : "");
+    }
+    return text;
+}
+
+bool AppendTriggerCapture(const std::string& path, const TriggerCapture& capture, const std::string& description) {
+    FILE* file = std::fopen(path.c_str(), "a");
+    if (file == nullptr) {
+        return false;
+    }
+    std::fseek(file, 0, SEEK_END);
+    if (std::ftell(file) == 0) {
+        std::fprintf(file, "trigger,condition,time_ms,voltage,current\n");
+    }
+
+    const Sample& trigger = capture.samples[capture.triggerIndex];
+    for (const Sample& sample : capture.samples) {
+        double offset = std::chrono::duration<double, std::milli>(sample.timestamp - trigger.timestamp).count();
+        std::fprintf(file, "%llu,%s,%.3f,", static_cast<unsigned long long>(capture.sequence), description.c_str(), offset);
+        if (sample.valid && sample.hasVoltage) {
+            std::fprintf(file, "%.9g", sample.voltage);
+        }
+        std::fputc(',', file);
+        if (sample.valid && sample.hasCurrent) {
+            std::fprintf(file, "%.9g", sample.current);
+        }
+        std::fputc('\n', file);
+    }
+    return std::fclose(file) == 0;
+}
+
+TriggerEngine::TriggerEngine() : slots(CAPTURE_SLOTS) {
+    for (size_t slot = 0; slot < CAPTURE_SLOTS; slot++) {
+        freeSlots.Push(slot);
+    }
+}
+
+void TriggerEngine::Configure(const TriggerSettings& newSettings) {
+    settings = newSettings;
+    states.assign(settings.conditions.size(), ConditionState());
+    for (size_t i = 0; i < states.size(); i++) {
+        // An edge needs to see the value on the other side of the level first
+        states[i].armed = settings.conditions[i].kind != TRIGGER_EDGE;
+    }
+
+    history.assign(settings.preSamples, Sample());
+    historyNext = 0;
+    historyCount = 0;
+    sequence = 0;
+    triggered = false;
+
+    // The engine thread is not running, so this thread may take back the slot it was filling
+    size_t slot;
+    while (readySlots.Pop(slot)) {
+        freeSlots.Push(slot);
+    }
+    if (filling != NO_SLOT) {
+        freeSlots.Push(filling);
+        filling = NO_SLOT;
+    }
+    for (TriggerCapture& capture : slots) {
+        capture.samples.clear();
+        capture.samples.reserve(settings.preSamples + 1 + settings.postSamples);
+    }
+    fired = 0;
+    missed = 0;
+}
+
+// Whether the condition fires on this value, keeping its arming and previous value
+bool TriggerEngine::evaluate(size_t index, double value, std::chrono::steady_clock::time_point time) {
+    const TriggerCondition& condition = settings.conditions[index];
+    ConditionState& state = states[index];
+    bool fire = false;
+
+    switch (condition.kind) {
+    case TRIGGER_LEVEL:
+    case TRIGGER_EDGE:
+        if (condition.slope == TRIGGER_EITHER) {
+            int side = value > condition.level + condition.hysteresis   ? 1
+                       : value < condition.level - condition.hysteresis ? -1
+                                                                        : state.side;
+            fire = state.side != 0 && side != state.side;
+            state.side = side;
+        } else {
+            bool rising = condition.slope == TRIGGER_RISING;
+            bool beyond = rising ? value > condition.level : value < condition.level;
+            bool back = rising ? value <= condition.level - condition.hysteresis : value >= condition.level + condition.hysteresis;
+            fire = beyond && state.armed;
+            if (fire) {
+                state.armed = false;
+            } else if (back) {
+                state.armed = true;
+            }
+        }
+        break;
+    case TRIGGER_WINDOW: {
+        bool outside = value < condition.low || value > condition.high;
+        bool inside = value >= condition.low + condition.hysteresis && value <= condition.high - condition.hysteresis;
+        fire = outside && state.armed;
+        if (fire) {
+            state.armed = false;
+        } else if (inside) {
+            state.armed = true;
+        }
+        break;
+    }
+    case TRIGGER_SLEW:
+        if (state.havePrevious && time > state.previousTime) {
+            double rate = (value - state.previous) / std::chrono::duration<double>(time - state.previousTime).count();
+            bool fast = condition.slope == TRIGGER_RISING    ? rate > condition.level
+                        : condition.slope == TRIGGER_FALLING ? rate < -condition.level
+                                                             : std::fabs(rate) > condition.level;
+            fire = fast && state.armed;
+            state.armed = !fast;
+        }
+        break;
+    }
+
+    state.havePrevious = true;
+    state.previous = value;
+    state.previousTime = time;
+    return fire;
+}
+
+bool TriggerEngine::near(const TriggerCondition& condition, double value) const {
+    if (condition.approach <= 0.0) {
+        return false;
+    }
+    switch (condition.kind) {
+    case TRIGGER_LEVEL:
+    case TRIGGER_EDGE:
+        if (condition.slope == TRIGGER_EITHER) {
+            return std::fabs(value - condition.level) < condition.approach;
+        }
+        return condition.slope == TRIGGER_RISING ? value > condition.level - condition.approach
+                                                 : value < condition.level + condition.approach;
+    case TRIGGER_WINDOW:
+        return value < condition.low + condition.approach || value > condition.high - condition.approach;
+    default:
+        return false;
+    }
+}
+
+void TriggerEngine::complete() {
+    readySlots.Push(filling);  // Never full, it has room for every slot
+    filling = NO_SLOT;
+}
+
+bool TriggerEngine::Process(const Sample& sample) {
+    if (settings.conditions.empty()) {
+        return false;
+    }
+
+    // Every condition sees every sample, so the arming and slew rates stay current during a record
+    bool fast = false;
+    size_t firedCondition = NO_SLOT;
+    if (sample.valid) {
+        for (size_t i = 0; i < settings.conditions.size(); i++) {
+            const TriggerCondition& condition = settings.conditions[i];
+            bool voltage = condition.quantity == POLL_VOLTAGE;
+            if (!(voltage ? sample.hasVoltage : sample.hasCurrent)) {
+                continue;
+            }
+            double value = voltage ? sample.voltage : sample.current;
+            if (evaluate(i, value, sample.timestamp) && firedCondition == NO_SLOT) {
+                firedCondition = i;
+            }
+            fast = fast || near(condition, value);
+        }
+    }
+
+    // A trigger while a record is filled is part of that record
+    if (filling != NO_SLOT) {
+        TriggerCapture& capture = slots[filling];
+        capture.samples.push_back(sample);
+        if (capture.samples.size() > capture.triggerIndex + settings.postSamples) {
+            complete();
+        } else {
+            fast = true;
+        }
+    } else if (firedCondition != NO_SLOT && (!triggered || sample.timestamp - lastTrigger >= settings.holdoff)) {
+        triggered = true;
+        lastTrigger = sample.timestamp;
+        sequence++;
+        fired++;
+
+        size_t slot;
+        if (!freeSlots.Pop(slot)) {
+            missed++;
+        } else {
+            TriggerCapture& capture = slots[slot];
+            capture.sequence = sequence;
+            capture.condition = firedCondition;
+            capture.samples.clear();
+            size_t oldest = historyCount == 0 ? 0 : (historyNext + history.size() - historyCount) % history.size();
+            for (size_t i = 0; i < historyCount; i++) {
+                capture.samples.push_back(history[(oldest + i) % history.size()]);
+            }
+            capture.triggerIndex = capture.samples.size();
+            capture.samples.push_back(sample);
+
+            filling = slot;
+            if (settings.postSamples == 0) {
+                complete();
+            } else {
+                fast = true;
+            }
+        }
+    }
+
+    if (!history.empty()) {
+        history[historyNext] = sample;
+        historyNext = (historyNext + 1) % history.size();
+        historyCount = std::min(historyCount + 1, history.size());
+    }
+    return fast && settings.fastPolling;
+}
+
+bool TriggerEngine::PopCapture(TriggerCapture& capture) {
+    size_t slot;
+    if (!readySlots.Pop(slot)) {
+        return false;
+    }
+    capture = slots[slot];
+    freeSlots.Push(slot);
+    return true;
+}
+
+uint64_t TriggerEngine::Fired() const {
+    return fired;
+}
+
+uint64_t TriggerEngine::Missed() const {
+    return missed;
+}
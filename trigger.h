@@ -0,0 +1,131 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "acquisition.h"
+#include "poll_scheduler.h"
+#include "spsc_queue.h"
+
+enum TriggerKind {
+    TRIGGER_LEVEL,   // The value is beyond the level (fires at once if it already is)
+    TRIGGER_EDGE,    // The value crosses the level
+    TRIGGER_WINDOW,  // The value leaves [low, high]
+    TRIGGER_SLEW     // The value changes faster than the level, in units per second
+};
+
+enum TriggerSlope { TRIGGER_RISING, TRIGGER_FALLING, TRIGGER_EITHER };
+
+// One condition on voltage or current, evaluated on every sample. After firing it is armed
+// again only once the value is back by the hysteresis (window: inside it by the hysteresis).
+struct TriggerCondition {
+    PollQuantity quantity = POLL_CURRENT;
+    TriggerKind kind = TRIGGER_LEVEL;
+    TriggerSlope slope = TRIGGER_RISING;  // Level: rising is above, falling below; unused by windows
+    double level = 0.0;
+    double low = 0.0;  // Window
+    double high = 0.0;
+    double hysteresis = 0.0;
+    double approach = 0.0;  // Polling at full rate while the value is this close to firing (0: off)
+};
+
+// Triggers of the panel, and the file their records are appended to
+const char* const TRIGGER_FILE = "triggers.txt";
+const char* const TRIGGER_CAPTURE_FILE = "trigger_captures.csv";
+
+// Trigger configuration. Any condition fires; a record holds up to preSamples samples before the
+// trigger, the triggering sample and postSamples after it.
+//
+// File syntax, one item per line ('#' starts a comment):
+//   <voltage|current> level <above|below> <level> [hysteresis <h>] [near <distance>]
+//   <voltage|current> edge <rising|falling|either> <level> [hysteresis <h>] [near <distance>]
+//   <voltage|current> window <low> <high> [hysteresis <h>] [near <distance>]
+//   <voltage|current> slew <rising|falling|either> <units per second>
+//   pre <samples> / post <samples> / holdoff <seconds> / fast <on|off>
+struct TriggerSettings {
+    std::vector<TriggerCondition> conditions;
+    size_t preSamples = 200;
+    size_t postSamples = 200;
+    std::chrono::milliseconds holdoff{0};  // Shortest time from one trigger to the next
+    bool fastPolling = true;               // Full poll rate while a record is filled or a value is near a trigger
+
+    bool Load(const std::string& path, std::string& error);
+    bool Parse(const std::string& text, std::string& error);
+};
+
+// E.g. "current level above 2.5"
+std::string DescribeTrigger(const TriggerCondition& condition);
+
+// Samples frozen around one trigger
+struct TriggerCapture {
+    uint64_t sequence = 0;    // Number of the trigger, missed ones included
+    size_t condition = 0;     // Index of the condition that fired
+    size_t triggerIndex = 0;  // samples[triggerIndex] fired it
+    std::vector<Sample> samples;
+};
+
+// Appending a record as CSV (trigger, condition, ms from the trigger, voltage, current); the header
+// is written into a new file
+bool AppendTriggerCapture(const std::string& path, const TriggerCapture& capture, const std::string& description);
+
+// Trigger engine of the acquisition path. Process runs on the engine thread for every sample and
+// neither locks nor allocates: the pre-trigger ring belongs to that thread, and the records are
+// preallocated slots passed to the UI thread and back through two lock-free queues. A trigger that
+// finds no free slot (the UI is not collecting the records) is counted as missed.
+class TriggerEngine {
+public:
+    static const size_t CAPTURE_SLOTS = 4;
+
+    TriggerEngine();
+
+    // Only while Process is not running (the acquisition engine is stopped); no conditions: off
+    void Configure(const TriggerSettings& settings);
+
+    // Engine thread. True while polling should be at full rate
+    bool Process(const Sample& sample);
+
+    // UI thread
+    bool PopCapture(TriggerCapture& capture);
+    uint64_t Fired() const;
+    uint64_t Missed() const;
+
+private:
+    static const size_t NO_SLOT = static_cast<size_t>(-1);
+
+    struct ConditionState {
+        bool armed = false;
+        int side = 0;  // Edge in either direction: last side of the level (-1, 1; 0 unknown)
+        bool havePrevious = false;
+        double previous = 0.0;
+        std::chrono::steady_clock::time_point previousTime;
+    };
+
+    bool evaluate(size_t index, double value, std::chrono::steady_clock::time_point time);
+    bool near(const TriggerCondition& condition, double value) const;
+    void complete();
+
+    TriggerSettings settings;
+    std::vector<ConditionState> states;
+
+    // Engine thread only
+    std::vector<Sample> history;  // Ring of the last preSamples samples
+    size_t historyNext = 0;
+    size_t historyCount = 0;
+    size_t filling = NO_SLOT;
+    uint64_t sequence = 0;
+    bool triggered = false;
+    std::chrono::steady_clock::time_point lastTrigger;
+
+    std::vector<TriggerCapture> slots;
+    SpscQueue<size_t, 8> freeSlots;   // UI -> engine
+    SpscQueue<size_t, 8> readySlots;  // engine -> UI
+    std::atomic<uint64_t> fired{0};
+    std::atomic<uint64_t> missed{0};
+};
+
+#endif // TRIGGER_H